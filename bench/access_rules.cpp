@@ -0,0 +1,179 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Measure the time to check a request against a
+// large rules file.
+//
+// The rules mix target prefixes, domain suffixes,
+// client prefixes, users and port ranges, in the
+// proportions of a site blocklist with a few
+// exceptions. Requests to addresses and to names
+// are checked separately, and each size is
+// written as one JSON object per line.
+
+#include "access_rules.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+std::string
+random_v4(std::mt19937& rng)
+{
+    std::uint32_t a = static_cast<std::uint32_t>(rng());
+    return
+        std::to_string(a >> 24) + "." +
+        std::to_string((a >> 16) & 0xff) + "." +
+        std::to_string((a >> 8) & 0xff) + "." +
+        std::to_string(a & 0xff);
+}
+
+std::string
+random_name(std::mt19937& rng, std::size_t domains)
+{
+    static char const* const tlds[] = {
+        "com", "net", "org", "io", "de" };
+    return
+        "site" + std::to_string(rng() % domains) + "." +
+        tlds[rng() % 5];
+}
+
+std::string
+make_rules(std::size_t n, std::mt19937& rng)
+{
+    std::string text;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        switch (rng() % 10)
+        {
+        case 0:
+        case 1:
+        case 2:
+            text += "deny to " + random_v4(rng) + "/" +
+                std::to_string(16 + rng() % 17);
+            break;
+        case 3:
+        case 4:
+        case 5:
+        case 6:
+            text += "deny to " + random_name(rng, n);
+            break;
+        case 7:
+            text += "allow from " + random_v4(rng) + "/" +
+                std::to_string(24 + rng() % 9) +
+                " to " + random_name(rng, n);
+            break;
+        case 8:
+            text += "deny from " + random_v4(rng) + "/" +
+                std::to_string(16 + rng() % 17) +
+                " port " + std::to_string(1 + rng() % 1024);
+            break;
+        default:
+            text += "allow user user" + std::to_string(rng() % n) +
+                " to " + random_v4(rng) + "/24 port 8000-9000";
+            break;
+        }
+        text += "\n";
+    }
+    text += "allow\n";
+    return text;
+}
+
+void
+run(std::size_t n, std::size_t checks)
+{
+    std::mt19937 rng(42);
+    std::string text = make_rules(n, rng);
+    std::string error;
+    auto t0 = clock_type::now();
+    auto rules = rule_set::parse(text, error);
+    auto t1 = clock_type::now();
+    if (!rules)
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> hosts;
+    std::vector<ip::address> targets;
+    std::vector<ip::address> clients;
+    for (std::size_t i = 0; i < 4096; ++i)
+    {
+        hosts.push_back("www." + random_name(rng, n));
+        targets.push_back(ip::make_address(random_v4(rng)));
+        clients.push_back(ip::make_address(random_v4(rng)));
+    }
+
+    // Counting the decisions keeps
+    // the checks from being elided
+    std::size_t allowed = 0;
+    access_request req;
+    req.user = "user1";
+    req.port = 443;
+    auto t2 = clock_type::now();
+    for (std::size_t i = 0; i < checks; ++i)
+    {
+        req.client = clients[i % clients.size()];
+        req.target = targets[(i * 7) % targets.size()];
+        allowed += rules->allows(req);
+    }
+    auto t3 = clock_type::now();
+    for (std::size_t i = 0; i < checks; ++i)
+    {
+        req.client = clients[i % clients.size()];
+        req.host = hosts[(i * 7) % hosts.size()];
+        allowed += rules->allows(req);
+    }
+    auto t4 = clock_type::now();
+
+    auto ns = [checks](clock_type::duration d)
+    {
+        return static_cast<double>(
+            std::chrono::duration_cast<
+                std::chrono::nanoseconds>(d).count()) /
+            static_cast<double>(checks);
+    };
+    std::printf(
+        "{\"rules\":%zu,\"parse_ms\":%.1f,"
+        "\"address_ns\":%.1f,\"domain_ns\":%.1f,"
+        "\"allowed\":%zu}\n",
+        n,
+        std::chrono::duration<double, std::milli>(t1 - t0).count(),
+        ns(t3 - t2),
+        ns(t4 - t3),
+        allowed);
+}
+
+int
+main(int argc, char** argv)
+{
+    std::size_t checks = 1000000;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--checks=", 9) != 0)
+        {
+            std::fprintf(stderr,
+                "Usage: access_rules [options]\n\n"
+                "Options:\n"
+                "  --checks=N  Requests checked per run (1000000)\n");
+            return EXIT_FAILURE;
+        }
+        checks = static_cast<std::size_t>(
+            std::strtoull(argv[i] + 9, nullptr, 10));
+    }
+    for (std::size_t n : {1000, 10000, 100000})
+        run(n, checks);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,317 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Measure the handshake latency of clients whose
+// credentials are cached while other clients make
+// the server derive keys, as when users log in for
+// the first time or a password is brute forced.
+//
+// Hot clients log in with the same credentials,
+// which are found in the cache after the first
+// time. Cold clients send wrong passwords, so
+// each of their handshakes costs a derivation.
+// The run is repeated with keys derived on the
+// io thread and in the verify pool, and each run
+// is written as one JSON object per line.
+
+#include "socks_server.hpp"
+
+#include <boost/socks/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace socks = boost::socks;
+using clock_type = std::chrono::steady_clock;
+
+struct bench_options
+{
+    // Clients logging in with cached credentials
+    std::size_t hot{8};
+
+    // Clients sending wrong passwords
+    std::size_t cold{8};
+
+    // Iterations of the password records
+    std::size_t iterations{default_password_iterations};
+
+    // Threads of the verify pool
+    std::size_t verify_threads{2};
+
+    // Checks queued before they are rejected
+    std::size_t verify_queue{256};
+
+    // Time each run takes
+    std::chrono::milliseconds duration{std::chrono::seconds(3)};
+};
+
+// Accepts target connections and closes them
+class sink_server
+{
+public:
+    explicit
+    sink_server(asio::io_context& ioc)
+        : acceptor_(ioc, endpoint(
+            asio::ip::make_address("127.0.0.1"), 0))
+    {
+        do_accept();
+    }
+
+    endpoint
+    local_endpoint() const
+    {
+        return acceptor_.local_endpoint();
+    }
+
+private:
+    void
+    do_accept()
+    {
+        acceptor_.async_accept(
+            [this](error_code ec, tcp::socket)
+            {
+                if (ec != asio::error::operation_aborted)
+                    do_accept();
+            });
+    }
+
+    tcp::acceptor acceptor_;
+};
+
+struct client_stats
+{
+    std::vector<std::uint64_t> handshake_us;
+    std::size_t failures{0};
+};
+
+// Logs in until the deadline
+class client
+    : public std::enable_shared_from_this<client>
+{
+public:
+    client(
+        asio::io_context& ioc,
+        endpoint proxy,
+        endpoint target,
+        std::string user,
+        std::string pass,
+        client_stats& stats,
+        clock_type::time_point deadline)
+        : s_(ioc)
+        , proxy_(proxy)
+        , target_(target)
+        , user_(std::move(user))
+        , pass_(std::move(pass))
+        , stats_(stats)
+        , deadline_(deadline)
+    {
+    }
+
+    void
+    run()
+    {
+        if (clock_type::now() >= deadline_)
+            return;
+        error_code ec;
+        s_.close(ec);
+        auto self = shared_from_this();
+        s_.async_connect(
+            proxy_,
+            [self](error_code ec)
+            {
+                if (ec.failed())
+                {
+                    ++self->stats_.failures;
+                    return self->run();
+                }
+                self->do_handshake();
+            });
+    }
+
+private:
+    void
+    do_handshake()
+    {
+        start_ = clock_type::now();
+        auto self = shared_from_this();
+        socks::async_connect(
+            s_,
+            target_,
+            socks::auth_options::userpass{user_, pass_},
+            [self](error_code ec, endpoint)
+            {
+                if (ec.failed())
+                    ++self->stats_.failures;
+                else
+                    self->stats_.handshake_us.push_back(
+                        static_cast<std::uint64_t>(
+                            std::chrono::duration_cast<
+                                std::chrono::microseconds>(
+                                    clock_type::now() -
+                                        self->start_).count()));
+                self->run();
+            });
+    }
+
+    tcp::socket s_;
+    endpoint proxy_;
+    endpoint target_;
+    std::string user_;
+    std::string pass_;
+    client_stats& stats_;
+    clock_type::time_point deadline_;
+    clock_type::time_point start_;
+};
+
+std::uint64_t
+percentile(
+    std::vector<std::uint64_t> const& sorted,
+    double q)
+{
+    if (sorted.empty())
+        return 0;
+    return sorted[static_cast<std::size_t>(
+        q * static_cast<double>(sorted.size() - 1) + 0.5)];
+}
+
+void
+run(
+    bench_options const& opt,
+    std::shared_ptr<credential_table const> const& table,
+    std::size_t verify_threads)
+{
+    asio::io_context ioc;
+    sink_server target(ioc);
+
+    server_options so;
+    so.logging.access = false;
+    so.logging.error_rate = 1;
+    socks_server server(
+        ioc,
+        tcp::acceptor(ioc, endpoint(
+            asio::ip::make_address("127.0.0.1"), 0)),
+        so);
+    auto auth = std::make_shared<table_authenticator>(so.auth, table);
+    std::shared_ptr<verify_pool> pool;
+    if (verify_threads != 0)
+    {
+        pool = std::make_shared<verify_pool>(
+            verify_threads, opt.verify_queue);
+        auth->set_pool(pool);
+    }
+    server.set_authenticator(auth);
+    std::thread proxy_thread([&ioc]{ ioc.run(); });
+
+    // The clients run on their own thread, so
+    // their latency is the latency of the proxy
+    asio::io_context client_ioc;
+    client_stats hot;
+    client_stats cold;
+    auto deadline = clock_type::now() + opt.duration;
+    endpoint proxy = server.acceptor().local_endpoint();
+    for (std::size_t i = 0; i < opt.hot; ++i)
+        std::make_shared<client>(
+            client_ioc, proxy, target.local_endpoint(),
+            "hot", "password", hot, deadline)->run();
+    for (std::size_t i = 0; i < opt.cold; ++i)
+        std::make_shared<client>(
+            client_ioc, proxy, target.local_endpoint(),
+            "cold", "wrong" + std::to_string(i), cold, deadline)->run();
+    client_ioc.run();
+
+    ioc.stop();
+    proxy_thread.join();
+
+    auto& us = hot.handshake_us;
+    std::sort(us.begin(), us.end());
+    double s = std::chrono::duration<double>(opt.duration).count();
+    std::printf(
+        "{\"verify_threads\":%zu,\"verify_queue\":%zu,"
+        "\"iterations\":%zu,\"hot_clients\":%zu,\"cold_clients\":%zu,"
+        "\"hot_handshakes_per_sec\":%.0f,"
+        "\"hot_p50_us\":%llu,\"hot_p99_us\":%llu,\"hot_p999_us\":%llu,"
+        "\"hot_failures\":%zu,\"cold_attempts_per_sec\":%.0f,"
+        "\"overloaded\":%zu}\n",
+        verify_threads, opt.verify_queue, opt.iterations,
+        opt.hot, opt.cold,
+        static_cast<double>(us.size()) / s,
+        static_cast<unsigned long long>(percentile(us, 0.5)),
+        static_cast<unsigned long long>(percentile(us, 0.99)),
+        static_cast<unsigned long long>(percentile(us, 0.999)),
+        hot.failures,
+        static_cast<double>(cold.failures) / s,
+        pool ? pool->rejected() : std::size_t(0));
+}
+
+bool
+parse_option(
+    char const* arg,
+    char const* name,
+    std::size_t& v)
+{
+    std::size_t n = std::strlen(name);
+    if (std::strncmp(arg, name, n) != 0 || arg[n] != '=')
+        return false;
+    v = static_cast<std::size_t>(
+        std::strtoull(arg + n + 1, nullptr, 10));
+    return true;
+}
+
+int
+main(int argc, char** argv)
+{
+    bench_options opt;
+    std::size_t seconds = 3;
+    for (int i = 1; i < argc; ++i)
+    {
+        char const* arg = argv[i];
+        if (!parse_option(arg, "--hot", opt.hot) &&
+            !parse_option(arg, "--cold", opt.cold) &&
+            !parse_option(arg, "--iterations", opt.iterations) &&
+            !parse_option(arg, "--verify-threads", opt.verify_threads) &&
+            !parse_option(arg, "--verify-queue", opt.verify_queue) &&
+            !parse_option(arg, "--duration", seconds))
+        {
+            std::fprintf(stderr,
+                "Usage: auth [options]\n\n"
+                "Options:\n"
+                "  --hot=N             Clients with cached credentials (8)\n"
+                "  --cold=N            Clients with wrong passwords (8)\n"
+                "  --iterations=N      Iterations of the password records (20000)\n"
+                "  --verify-threads=N  Threads of the verify pool (2)\n"
+                "  --verify-queue=N    Checks queued before rejecting (256)\n"
+                "  --duration=N        Seconds of each run (3)\n");
+            return EXIT_FAILURE;
+        }
+    }
+    opt.duration = std::chrono::seconds(seconds);
+    if (opt.iterations == 0 || opt.verify_threads == 0)
+    {
+        std::fprintf(stderr, "Iterations and verify threads must not be 0\n");
+        return EXIT_FAILURE;
+    }
+
+    auto table = std::make_shared<credential_table>();
+    table->add("hot", hash_password("password", opt.iterations));
+    table->add("cold", hash_password("password", opt.iterations));
+
+    // Keys derived on the io thread, then in the pool
+    run(opt, table, 0);
+    run(opt, table, opt.verify_threads);
+    return EXIT_SUCCESS;
+}
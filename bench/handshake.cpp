@@ -0,0 +1,312 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Measure the client handshakes per second and
+// the allocations per handshake of the connect
+// functions against the in-memory stream of the
+// unit tests, so the cost of the protocol is not
+// hidden by the cost of the network.
+//
+// Each case is written as one JSON object per
+// line, for regression tracking:
+//
+// {"op":"async_connect","target":"ipv4","auth":"userpass",
+//  "handshakes":100000,"handshakes_per_sec":...,
+//  "ns_per_handshake":...,"allocs_per_handshake":...}
+
+#include <boost/socks/connect.hpp>
+#include <boost/socks/connect_v4.hpp>
+#include <boost/socks/handshake_template.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/config.hpp>
+
+#include "stream.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace socks = boost::socks;
+using socks::endpoint;
+using socks::error_code;
+using clock_type = std::chrono::steady_clock;
+using bytes = std::vector<unsigned char>;
+
+//------------------------------------------------
+//
+// Count the allocations of the whole program
+//
+//------------------------------------------------
+
+static std::atomic<std::size_t> allocations{0};
+
+// Not inlined, so the compiler does not pair
+// the malloc and free across the operators
+BOOST_NOINLINE
+void*
+operator new(std::size_t n)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+BOOST_NOINLINE
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+BOOST_NOINLINE
+void
+operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+//------------------------------------------------
+
+// What the SOCKS server sends back
+// in a successful handshake
+struct peer
+{
+    char const* target;
+    char const* auth;
+    endpoint ep;
+    socks::string_view domain;
+    socks::string_view ident;
+    socks::auth_options opt;
+    bytes replies;
+};
+
+bytes
+operator+(bytes a, bytes const& b)
+{
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+bytes
+greet_reply(socks::auth_options const& opt)
+{
+    if (opt.is_userpass)
+        return {0x05, 0x02, 0x01, 0x00};
+    return {0x05, 0x00};
+}
+
+bytes
+connect_reply(bool ipv6)
+{
+    if (ipv6)
+        return {
+            0x05, 0x00, 0x00, 0x04,
+            0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+            0x04, 0x38};
+    return {0x05, 0x00, 0x00, 0x01, 10, 0, 0, 1, 0x04, 0x38};
+}
+
+std::vector<peer>
+make_v5_peers()
+{
+    endpoint v4(asio::ip::make_address("93.184.216.34"), 80);
+    endpoint v6(asio::ip::make_address("2606:2800:220:1::248"), 80);
+    socks::auth_options none{socks::auth_options::none{}};
+    socks::auth_options userpass{
+        socks::auth_options::userpass{"username", "password"}};
+    socks::auth_options credentials{
+        std::make_shared<socks::userpass_credentials const>(
+            "username", "password")};
+    std::vector<peer> v;
+    for (auto const& opt : {none, userpass, credentials})
+    {
+        char const* auth =
+            opt.credentials() ? "credentials" :
+            opt.is_userpass ? "userpass" : "none";
+        bytes greet = greet_reply(opt);
+        v.push_back({"ipv4", auth, v4, {}, {}, opt,
+            greet + connect_reply(false)});
+        v.push_back({"ipv6", auth, v6, {}, {}, opt,
+            greet + connect_reply(true)});
+        v.push_back({"domain", auth, {}, "www.example.com", {}, opt,
+            greet + connect_reply(false)});
+    }
+    return v;
+}
+
+std::vector<peer>
+make_v4_peers()
+{
+    // SOCKS4 has no authentication, so the
+    // second case sends an ident user id
+    endpoint v4(asio::ip::make_address("93.184.216.34"), 80);
+    bytes reply{0x00, 0x5a, 0x04, 0x38, 10, 0, 0, 1};
+    socks::auth_options none{socks::auth_options::none{}};
+    return {
+        {"ipv4", "none", v4, {}, {}, none, reply},
+        {"ipv4", "ident", v4, {}, "username", none, reply}};
+}
+
+//------------------------------------------------
+
+struct result
+{
+    double handshakes_per_sec;
+    double ns_per_handshake;
+    double allocs_per_handshake;
+};
+
+// Handshakes are run back to back on the same
+// stream and io_context, so their buffers and
+// the recycled handler memory are reused as they
+// would be by a client on a long-lived thread
+template <class Handshake>
+result
+run(
+    std::size_t n,
+    peer const& p,
+    Handshake const& f)
+{
+    asio::io_context ioc;
+    socks::test::stream s(ioc);
+    error_code ec;
+
+    auto once = [&]
+    {
+        s.reset_read(p.replies.data(), p.replies.size());
+        s.reset_write();
+        f(s, ioc, ec);
+        ioc.run();
+        ioc.restart();
+    };
+
+    // Warm up the buffers
+    for (std::size_t i = 0; i < 100; ++i)
+        once();
+    if (ec.failed())
+    {
+        std::fprintf(stderr, "%s/%s: %s\n",
+            p.target, p.auth, ec.message().c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::size_t a0 = allocations.load();
+    auto t0 = clock_type::now();
+    for (std::size_t i = 0; i < n; ++i)
+        once();
+    auto t1 = clock_type::now();
+    std::size_t a1 = allocations.load();
+
+    double ns = std::chrono::duration<double, std::nano>(
+        t1 - t0).count();
+    result r;
+    r.ns_per_handshake = ns / static_cast<double>(n);
+    r.handshakes_per_sec = 1e9 / r.ns_per_handshake;
+    r.allocs_per_handshake =
+        static_cast<double>(a1 - a0) / static_cast<double>(n);
+    return r;
+}
+
+void
+print(
+    char const* op,
+    std::size_t n,
+    peer const& p,
+    result const& r)
+{
+    std::printf(
+        "{\"op\":\"%s\",\"target\":\"%s\",\"auth\":\"%s\","
+        "\"handshakes\":%zu,\"handshakes_per_sec\":%.0f,"
+        "\"ns_per_handshake\":%.1f,\"allocs_per_handshake\":%.2f}\n",
+        op, p.target, p.auth, n,
+        r.handshakes_per_sec,
+        r.ns_per_handshake,
+        r.allocs_per_handshake);
+}
+
+int
+main(int argc, char** argv)
+{
+    std::size_t n = 100000;
+    if (argc > 1)
+        n = static_cast<std::size_t>(
+            std::strtoull(argv[1], nullptr, 10));
+
+    for (auto const& p : make_v5_peers())
+    {
+        print("connect", n, p, run(n, p,
+            [&p](socks::test::stream& s, asio::io_context&, error_code& ec)
+            {
+                if (p.domain.empty())
+                    socks::connect(s, p.ep, p.opt, ec);
+                else
+                    socks::connect(s, p.domain, 80, p.opt, ec);
+            }));
+        print("async_connect", n, p, run(n, p,
+            [&p](socks::test::stream& s, asio::io_context&, error_code& ec)
+            {
+                auto h = [&ec](error_code e, endpoint)
+                {
+                    ec = e;
+                };
+                if (p.domain.empty())
+                    socks::async_connect(s, p.ep, p.opt, h);
+                else
+                    socks::async_connect(s, p.domain, 80, p.opt, h);
+            }));
+
+        // The messages are encoded once
+        for (bool pipeline : {false, true})
+        {
+            socks::handshake_template t =
+                p.domain.empty() ?
+                    socks::handshake_template(p.ep, p.opt, pipeline) :
+                    socks::handshake_template(p.domain, 80, p.opt, pipeline);
+            print(
+                pipeline ?
+                    "async_connect_template_pipelined" :
+                    "async_connect_template",
+                n, p, run(n, p,
+                [&t](socks::test::stream& s, asio::io_context&, error_code& ec)
+                {
+                    socks::async_connect(s, t,
+                        [&ec](error_code e, endpoint)
+                        {
+                            ec = e;
+                        });
+                }));
+        }
+    }
+
+    for (auto const& p : make_v4_peers())
+    {
+        print("connect_v4", n, p, run(n, p,
+            [&p](socks::test::stream& s, asio::io_context&, error_code& ec)
+            {
+                socks::connect_v4(s, p.ep, p.ident, ec);
+            }));
+        print("async_connect_v4", n, p, run(n, p,
+            [&p](socks::test::stream& s, asio::io_context&, error_code& ec)
+            {
+                socks::async_connect_v4(s, p.ep, p.ident,
+                    [&ec](error_code e, endpoint)
+                    {
+                        ec = e;
+                    });
+            }));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,545 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Measure what the whole stack sustains: client
+// threads use async_connect through the example
+// server to an echo target, all on the loopback
+// interface.
+//
+// The connect phase opens and closes tunnels as
+// fast as it can and reports the new connections
+// per second and the handshake latency, from the
+// greeting until the reply, which includes the
+// proxy connecting to the target.
+//
+// The bulk phase keeps one tunnel per client and
+// echoes messages through it, reporting the
+// payload throughput of each tunnel and of all
+// of them. Each byte is relayed in both
+// directions.
+//
+// Each phase is written as one JSON object per
+// line, for regression tracking.
+
+#include "socks_server.hpp"
+
+#include <boost/socks/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace socks = boost::socks;
+using clock_type = std::chrono::steady_clock;
+
+struct bench_options
+{
+    // Client threads, each with its own io_context
+    std::size_t threads{1};
+
+    // Tunnels open at once on each thread
+    std::size_t concurrency{8};
+
+    // Tunnels opened by the connect phase
+    std::size_t connections{10000};
+
+    // Bytes echoed at once in the bulk phase
+    std::size_t message_size{16384};
+
+    // Time the bulk phase runs for
+    std::chrono::milliseconds duration{std::chrono::seconds(5)};
+
+    // An external proxy to use instead
+    // of the example server
+    std::string proxy;
+};
+
+//------------------------------------------------
+//
+// Echo target
+//
+//------------------------------------------------
+
+class echo_session
+    : public std::enable_shared_from_this<echo_session>
+{
+public:
+    explicit
+    echo_session(tcp::socket s)
+        : s_(std::move(s))
+        , buf_(65536)
+    {
+    }
+
+    void
+    do_read()
+    {
+        auto self = shared_from_this();
+        s_.async_read_some(
+            asio::buffer(buf_),
+            [self](error_code ec, std::size_t n)
+            {
+                if (!ec.failed())
+                    self->do_write(n);
+            });
+    }
+
+private:
+    void
+    do_write(std::size_t n)
+    {
+        auto self = shared_from_this();
+        asio::async_write(
+            s_,
+            asio::buffer(buf_.data(), n),
+            [self](error_code ec, std::size_t)
+            {
+                if (!ec.failed())
+                    self->do_read();
+            });
+    }
+
+    tcp::socket s_;
+    std::vector<char> buf_;
+};
+
+class echo_server
+{
+public:
+    explicit
+    echo_server(asio::io_context& ioc)
+        : acceptor_(ioc, endpoint(
+            asio::ip::make_address("127.0.0.1"), 0))
+    {
+        do_accept();
+    }
+
+    endpoint
+    local_endpoint() const
+    {
+        return acceptor_.local_endpoint();
+    }
+
+private:
+    void
+    do_accept()
+    {
+        acceptor_.async_accept(
+            [this](error_code ec, tcp::socket s)
+            {
+                if (ec == asio::error::operation_aborted)
+                    return;
+                if (!ec.failed())
+                {
+                    s.set_option(tcp::no_delay(true), ec);
+                    std::make_shared<echo_session>(
+                        std::move(s))->do_read();
+                }
+                do_accept();
+            });
+    }
+
+    tcp::acceptor acceptor_;
+};
+
+//------------------------------------------------
+//
+// Clients
+//
+//------------------------------------------------
+
+// What the clients of one thread measured
+struct client_stats
+{
+    std::vector<std::uint64_t> handshake_us;
+    std::vector<double> tunnel_bytes_per_sec;
+    std::uint64_t bytes{0};
+    std::size_t errors{0};
+};
+
+// Opens tunnels until the shared budget is spent,
+// then, in the bulk phase, echoes messages through
+// the last one until the deadline
+class client
+    : public std::enable_shared_from_this<client>
+{
+public:
+    client(
+        asio::io_context& ioc,
+        endpoint proxy,
+        endpoint target,
+        std::atomic<std::ptrdiff_t>& budget,
+        client_stats& stats,
+        std::size_t message_size,
+        clock_type::time_point deadline)
+        : s_(ioc)
+        , proxy_(proxy)
+        , target_(target)
+        , budget_(budget)
+        , stats_(stats)
+        , out_(message_size, 'x')
+        , in_(message_size)
+        , deadline_(deadline)
+    {
+    }
+
+    void
+    run()
+    {
+        if (budget_.fetch_sub(1) <= 0)
+            return;
+        error_code ec;
+        s_.close(ec);
+        auto self = shared_from_this();
+        s_.async_connect(
+            proxy_,
+            [self](error_code ec)
+            {
+                if (ec.failed())
+                    return self->fail();
+                error_code ignored;
+                self->s_.set_option(tcp::no_delay(true), ignored);
+                self->do_handshake();
+            });
+    }
+
+private:
+    void
+    do_handshake()
+    {
+        start_ = clock_type::now();
+        auto self = shared_from_this();
+        socks::async_connect(
+            s_,
+            target_,
+            socks::auth_options::none{},
+            [self](error_code ec, endpoint)
+            {
+                if (ec.failed())
+                    return self->fail();
+                self->stats_.handshake_us.push_back(
+                    static_cast<std::uint64_t>(
+                        std::chrono::duration_cast<
+                            std::chrono::microseconds>(
+                                clock_type::now() -
+                                    self->start_).count()));
+                if (self->out_.empty())
+                    return self->run();
+                self->start_ = clock_type::now();
+                self->do_echo();
+            });
+    }
+
+    void
+    do_echo()
+    {
+        if (clock_type::now() >= deadline_)
+        {
+            double s = std::chrono::duration<double>(
+                clock_type::now() - start_).count();
+            stats_.tunnel_bytes_per_sec.push_back(
+                static_cast<double>(bytes_) / s);
+            stats_.bytes += bytes_;
+            return;
+        }
+        auto self = shared_from_this();
+        asio::async_write(
+            s_,
+            asio::buffer(out_),
+            [self](error_code ec, std::size_t)
+            {
+                if (ec.failed())
+                    return self->fail();
+                asio::async_read(
+                    self->s_,
+                    asio::buffer(self->in_),
+                    [self](error_code ec, std::size_t n)
+                    {
+                        if (ec.failed())
+                            return self->fail();
+                        self->bytes_ += n;
+                        self->do_echo();
+                    });
+            });
+    }
+
+    void
+    fail()
+    {
+        ++stats_.errors;
+        run();
+    }
+
+    tcp::socket s_;
+    endpoint proxy_;
+    endpoint target_;
+    std::atomic<std::ptrdiff_t>& budget_;
+    client_stats& stats_;
+    std::vector<char> out_;
+    std::vector<char> in_;
+    clock_type::time_point deadline_;
+    clock_type::time_point start_;
+    std::uint64_t bytes_{0};
+};
+
+// Run the clients of every thread and return
+// what each thread measured
+std::vector<client_stats>
+run_clients(
+    bench_options const& opt,
+    endpoint proxy,
+    endpoint target,
+    std::size_t tunnels,
+    std::size_t message_size,
+    clock_type::time_point deadline)
+{
+    std::atomic<std::ptrdiff_t> budget(
+        static_cast<std::ptrdiff_t>(tunnels));
+    std::vector<client_stats> stats(opt.threads);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < opt.threads; ++t)
+    {
+        threads.emplace_back(
+            [&, t]
+            {
+                asio::io_context ioc;
+                for (std::size_t i = 0; i < opt.concurrency; ++i)
+                    std::make_shared<client>(
+                        ioc, proxy, target, budget, stats[t],
+                        message_size, deadline)->run();
+                ioc.run();
+            });
+    }
+    for (auto& t : threads)
+        t.join();
+    return stats;
+}
+
+//------------------------------------------------
+
+template <class T>
+T
+percentile(std::vector<T> const& sorted, double q)
+{
+    if (sorted.empty())
+        return T();
+    std::size_t i = static_cast<std::size_t>(
+        q * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+void
+connect_phase(
+    bench_options const& opt,
+    endpoint proxy,
+    endpoint target)
+{
+    auto t0 = clock_type::now();
+    auto stats = run_clients(
+        opt, proxy, target, opt.connections, 0, t0);
+    double s = std::chrono::duration<double>(
+        clock_type::now() - t0).count();
+
+    std::vector<std::uint64_t> us;
+    std::size_t errors = 0;
+    for (auto const& st : stats)
+    {
+        us.insert(us.end(),
+            st.handshake_us.begin(), st.handshake_us.end());
+        errors += st.errors;
+    }
+    std::sort(us.begin(), us.end());
+    std::printf(
+        "{\"phase\":\"connect\",\"threads\":%zu,\"concurrency\":%zu,"
+        "\"connections\":%zu,\"errors\":%zu,"
+        "\"connections_per_sec\":%.0f,"
+        "\"handshake_p50_us\":%llu,\"handshake_p99_us\":%llu,"
+        "\"handshake_p999_us\":%llu}\n",
+        opt.threads, opt.concurrency, us.size(), errors,
+        static_cast<double>(us.size()) / s,
+        static_cast<unsigned long long>(percentile(us, 0.5)),
+        static_cast<unsigned long long>(percentile(us, 0.99)),
+        static_cast<unsigned long long>(percentile(us, 0.999)));
+}
+
+void
+bulk_phase(
+    bench_options const& opt,
+    endpoint proxy,
+    endpoint target)
+{
+    auto t0 = clock_type::now();
+    auto stats = run_clients(
+        opt, proxy, target,
+        opt.threads * opt.concurrency,
+        opt.message_size,
+        t0 + opt.duration);
+    double s = std::chrono::duration<double>(
+        clock_type::now() - t0).count();
+
+    std::vector<double> rates;
+    std::uint64_t bytes = 0;
+    std::size_t errors = 0;
+    for (auto const& st : stats)
+    {
+        rates.insert(rates.end(),
+            st.tunnel_bytes_per_sec.begin(),
+            st.tunnel_bytes_per_sec.end());
+        bytes += st.bytes;
+        errors += st.errors;
+    }
+    std::sort(rates.begin(), rates.end());
+    double const mib = 1024 * 1024;
+    std::printf(
+        "{\"phase\":\"bulk\",\"threads\":%zu,\"concurrency\":%zu,"
+        "\"message_size\":%zu,\"tunnels\":%zu,\"errors\":%zu,"
+        "\"seconds\":%.2f,\"aggregate_mib_per_sec\":%.1f,"
+        "\"tunnel_min_mib_per_sec\":%.1f,"
+        "\"tunnel_p50_mib_per_sec\":%.1f,"
+        "\"tunnel_max_mib_per_sec\":%.1f}\n",
+        opt.threads, opt.concurrency, opt.message_size,
+        rates.size(), errors, s,
+        static_cast<double>(bytes) / s / mib,
+        rates.empty() ? 0 : rates.front() / mib,
+        percentile(rates, 0.5) / mib,
+        rates.empty() ? 0 : rates.back() / mib);
+}
+
+//------------------------------------------------
+
+bool
+parse_option(
+    char const* arg,
+    char const* name,
+    std::size_t& v)
+{
+    std::size_t n = std::strlen(name);
+    if (std::strncmp(arg, name, n) != 0 || arg[n] != '=')
+        return false;
+    v = static_cast<std::size_t>(
+        std::strtoull(arg + n + 1, nullptr, 10));
+    return true;
+}
+
+bool
+parse_option(
+    char const* arg,
+    char const* name,
+    std::string& v)
+{
+    std::size_t n = std::strlen(name);
+    if (std::strncmp(arg, name, n) != 0 || arg[n] != '=')
+        return false;
+    v = arg + n + 1;
+    return true;
+}
+
+endpoint
+parse_endpoint(std::string const& s)
+{
+    std::size_t i = s.rfind(':');
+    if (i == std::string::npos)
+        return {};
+    error_code ec;
+    auto a = asio::ip::make_address(
+        s.substr(0, i) == "localhost" ?
+            "127.0.0.1" : s.substr(0, i), ec);
+    if (ec.failed())
+        return {};
+    return endpoint(a, static_cast<unsigned short>(
+        std::strtoul(s.c_str() + i + 1, nullptr, 10)));
+}
+
+int
+main(int argc, char** argv)
+{
+    bench_options opt;
+    std::size_t seconds = 5;
+    for (int i = 1; i < argc; ++i)
+    {
+        char const* arg = argv[i];
+        if (!parse_option(arg, "--threads", opt.threads) &&
+            !parse_option(arg, "--concurrency", opt.concurrency) &&
+            !parse_option(arg, "--connections", opt.connections) &&
+            !parse_option(arg, "--message-size", opt.message_size) &&
+            !parse_option(arg, "--duration", seconds) &&
+            !parse_option(arg, "--proxy", opt.proxy))
+        {
+            std::fprintf(stderr,
+                "Usage: proxy [options]\n\n"
+                "Options:\n"
+                "  --threads=N        Client threads (1)\n"
+                "  --concurrency=N    Tunnels open at once per thread (8)\n"
+                "  --connections=N    Tunnels opened by the connect phase (10000)\n"
+                "  --message-size=N   Bytes echoed at once by the bulk phase (16384)\n"
+                "  --duration=N       Seconds the bulk phase runs for (5)\n"
+                "  --proxy=ADDR:PORT  Use this SOCKS5 server instead of the example server\n");
+            return EXIT_FAILURE;
+        }
+    }
+    opt.duration = std::chrono::seconds(seconds);
+    if (opt.threads == 0 || opt.concurrency == 0 || opt.message_size == 0)
+    {
+        std::fprintf(stderr, "Threads, concurrency and message size must not be 0\n");
+        return EXIT_FAILURE;
+    }
+
+    // The target and the proxy run on their own
+    // threads, so the clients measure the proxy
+    // as a remote client would
+    asio::io_context target_ioc;
+    echo_server target(target_ioc);
+    std::thread target_thread([&target_ioc]{ target_ioc.run(); });
+
+    asio::io_context proxy_ioc;
+    std::unique_ptr<socks_server> server;
+    std::thread proxy_thread;
+    endpoint proxy;
+    if (opt.proxy.empty())
+    {
+        server_options so;
+        so.logging.access = false;
+        server.reset(new socks_server(
+            proxy_ioc,
+            tcp::acceptor(proxy_ioc, endpoint(
+                asio::ip::make_address("127.0.0.1"), 0)),
+            so));
+        proxy = server->acceptor().local_endpoint();
+        proxy_thread = std::thread([&proxy_ioc]{ proxy_ioc.run(); });
+    }
+    else
+    {
+        proxy = parse_endpoint(opt.proxy);
+        if (proxy.port() == 0)
+        {
+            std::fprintf(stderr, "Invalid proxy: %s\n", opt.proxy.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    connect_phase(opt, proxy, target.local_endpoint());
+    bulk_phase(opt, proxy, target.local_endpoint());
+
+    proxy_ioc.stop();
+    if (proxy_thread.joinable())
+        proxy_thread.join();
+    target_ioc.stop();
+    target_thread.join();
+    return EXIT_SUCCESS;
+}
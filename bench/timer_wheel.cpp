@@ -0,0 +1,148 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Compare the cost of scheduling and cancelling
+// a deadline in the timer_wheel with the cost of
+// the same operations on an asio::steady_timer,
+// with many timers outstanding.
+
+#include <boost/socks/timer_wheel.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace socks = boost::socks;
+using clock_type = std::chrono::steady_clock;
+
+struct result
+{
+    double schedule_ns;
+    double cancel_ns;
+};
+
+// Timeouts spread over a few minutes, as the
+// handshake and idle timeouts of a server are
+std::vector<std::chrono::milliseconds>
+make_timeouts(std::size_t n)
+{
+    std::mt19937 g(42);
+    std::uniform_int_distribution<int> d(1000, 300000);
+    std::vector<std::chrono::milliseconds> v;
+    v.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        v.emplace_back(d(g));
+    return v;
+}
+
+double
+ns_per_op(
+    clock_type::time_point t0,
+    clock_type::time_point t1,
+    std::size_t n)
+{
+    return std::chrono::duration<double, std::nano>(
+        t1 - t0).count() / static_cast<double>(n);
+}
+
+void
+on_expire(void*)
+{
+}
+
+result
+bench_wheel(
+    std::vector<std::chrono::milliseconds> const& timeouts)
+{
+    asio::io_context ioc;
+    std::size_t const n = timeouts.size();
+    std::vector<std::unique_ptr<socks::deadline>> ds;
+    ds.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        ds.emplace_back(new socks::deadline(ioc.get_executor()));
+        ds[i]->on_expire(&on_expire, nullptr);
+    }
+
+    result r{};
+    auto t0 = clock_type::now();
+    for (std::size_t i = 0; i < n; ++i)
+        ds[i]->expires_after(timeouts[i]);
+    auto t1 = clock_type::now();
+    r.schedule_ns = ns_per_op(t0, t1, n);
+
+    // Cancel in a different order than scheduled
+    t0 = clock_type::now();
+    for (std::size_t i = n; i-- > 0;)
+        ds[i]->cancel();
+    t1 = clock_type::now();
+    r.cancel_ns = ns_per_op(t0, t1, n);
+
+    ioc.run();
+    return r;
+}
+
+result
+bench_steady_timer(
+    std::vector<std::chrono::milliseconds> const& timeouts)
+{
+    asio::io_context ioc;
+    std::size_t const n = timeouts.size();
+    std::vector<std::unique_ptr<asio::steady_timer>> ts;
+    ts.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        ts.emplace_back(new asio::steady_timer(ioc));
+
+    result r{};
+    auto t0 = clock_type::now();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        ts[i]->expires_after(timeouts[i]);
+        ts[i]->async_wait([](boost::system::error_code){});
+    }
+    auto t1 = clock_type::now();
+    r.schedule_ns = ns_per_op(t0, t1, n);
+
+    t0 = clock_type::now();
+    for (std::size_t i = n; i-- > 0;)
+        ts[i]->cancel();
+    t1 = clock_type::now();
+    r.cancel_ns = ns_per_op(t0, t1, n);
+
+    // Run the cancelled handlers
+    ioc.run();
+    return r;
+}
+
+int
+main(int argc, char** argv)
+{
+    std::size_t n = 1000000;
+    if (argc > 1)
+        n = static_cast<std::size_t>(
+            std::strtoull(argv[1], nullptr, 10));
+    auto timeouts = make_timeouts(n);
+
+    result w = bench_wheel(timeouts);
+    result t = bench_steady_timer(timeouts);
+
+    std::cout <<
+        "Outstanding timers: " << n << "\n"
+        "timer_wheel    schedule: " << w.schedule_ns << " ns/op, "
+            "cancel: " << w.cancel_ns << " ns/op\n"
+        "steady_timer   schedule: " << t.schedule_ns << " ns/op, "
+            "cancel: " << t.cancel_ns << " ns/op\n";
+    return EXIT_SUCCESS;
+}
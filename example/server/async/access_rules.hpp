@@ -0,0 +1,954 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_ACCESS_RULES_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_ACCESS_RULES_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// An address as 128 bits
+//
+// IPv4 addresses are mapped into ::ffff:0:0/96,
+// so both families share one trie, and clients
+// of a dual-stack socket match IPv4 rules.
+struct address_key
+{
+    std::uint64_t hi{0};
+    std::uint64_t lo{0};
+
+    static
+    address_key
+    from(ip::address const& a) noexcept
+    {
+        std::array<unsigned char, 16> b{};
+        if (a.is_v4())
+        {
+            auto v4 = a.to_v4().to_bytes();
+            b[10] = 0xff;
+            b[11] = 0xff;
+            std::copy(v4.begin(), v4.end(), b.begin() + 12);
+        }
+        else
+        {
+            b = a.to_v6().to_bytes();
+        }
+        address_key k;
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            k.hi = (k.hi << 8) | b[i];
+            k.lo = (k.lo << 8) | b[i + 8];
+        }
+        return k;
+    }
+
+    bool
+    bit(std::size_t i) const noexcept
+    {
+        return i < 64 ?
+            (hi >> (63 - i)) & 1 :
+            (lo >> (127 - i)) & 1;
+    }
+
+    // Number of leading bits, up to `n`,
+    // this key has in common with `other`
+    std::size_t
+    common_prefix(
+        address_key const& other,
+        std::size_t n) const noexcept
+    {
+        std::size_t r = 128;
+        if (hi != other.hi)
+            r = leading_zeros(hi ^ other.hi);
+        else if (lo != other.lo)
+            r = 64 + leading_zeros(lo ^ other.lo);
+        return r < n ? r : n;
+    }
+
+    // Return true if the first `n` bits
+    // of this key and `other` are equal
+    bool
+    same_prefix(
+        address_key const& other,
+        std::size_t n) const noexcept
+    {
+        std::uint64_t x = hi ^ other.hi;
+        if (n < 64)
+            return n == 0 || (x >> (64 - n)) == 0;
+        std::uint64_t y = lo ^ other.lo;
+        return x == 0 &&
+            (n == 64 || (y >> (128 - n)) == 0);
+    }
+
+private:
+    // `x` is not 0
+    static
+    std::size_t
+    leading_zeros(std::uint64_t x) noexcept
+    {
+        std::size_t n = 0;
+        for (std::size_t s = 32; s != 0; s /= 2)
+        {
+            if ((x >> (64 - s)) == 0)
+            {
+                n += s;
+                x <<= s;
+            }
+        }
+        return n;
+    }
+};
+
+// Parse an address, or an address and a prefix
+// length such as 10.0.0.0/8 or 2001:db8::/32
+inline
+bool
+parse_cidr(
+    boost::core::string_view s,
+    address_key& key,
+    std::size_t& len)
+{
+    std::size_t slash = s.find('/');
+    error_code ec;
+    ip::address a = ip::make_address(
+        std::string(s.substr(0, slash)), ec);
+    if (ec.failed())
+        return false;
+    std::size_t bits = a.is_v4() ? 32 : 128;
+    len = bits;
+    if (slash != boost::core::string_view::npos)
+    {
+        std::string n(s.substr(slash + 1));
+        char* end = nullptr;
+        unsigned long v = std::strtoul(n.c_str(), &end, 10);
+        if (n.empty() || *end != '\0' || v > bits)
+            return false;
+        len = v;
+    }
+    key = address_key::from(a);
+    if (a.is_v4())
+        len += 96;
+    return true;
+}
+
+// A Patricia trie of address prefixes
+//
+// Each node holds the prefix shared by its
+// subtree, so chains of nodes with one child
+// are collapsed and a lookup visits at most
+// one node per distinct prefix length on the
+// path of the address. Nodes are small and the
+// rules of all nodes share one array, so the
+// levels visited by most lookups stay cached.
+class prefix_trie
+{
+public:
+    prefix_trie()
+        : nodes_(1)
+        , rules_(1)
+    {
+    }
+
+    // Associate a rule with a prefix
+    //
+    // Rules are inserted in increasing order,
+    // so the rules of each node stay sorted.
+    void
+    insert(
+        address_key const& key,
+        std::size_t len,
+        std::uint32_t rule)
+    {
+        std::uint32_t i = 0;
+        for (;;)
+        {
+            std::size_t at = nodes_[i].len;
+            if (at == len)
+                return rules_[i].push_back(rule);
+            bool b = key.bit(at);
+            std::uint32_t c = nodes_[i].child[b];
+            if (c == 0)
+            {
+                c = add_node(key, len);
+                nodes_[i].child[b] = c;
+                return rules_[c].push_back(rule);
+            }
+            std::size_t cl = nodes_[c].len;
+            std::size_t n = key.common_prefix(
+                nodes_[c].key, len < cl ? len : cl);
+            if (n == cl)
+            {
+                i = c;
+                continue;
+            }
+            // Split the edge at the first
+            // bit the prefixes differ in
+            std::uint32_t s = add_node(key, n);
+            nodes_[s].child[nodes_[c].key.bit(n)] = c;
+            nodes_[i].child[b] = s;
+            if (n == len)
+                return rules_[s].push_back(rule);
+            std::uint32_t leaf = add_node(key, len);
+            nodes_[s].child[key.bit(n)] = leaf;
+            return rules_[leaf].push_back(rule);
+        }
+    }
+
+    // Move the rules of the nodes into
+    // one array, once all are inserted
+    void
+    finish()
+    {
+        ids_.clear();
+        for (std::size_t i = 0; i < nodes_.size(); ++i)
+        {
+            nodes_[i].first = static_cast<std::uint32_t>(
+                ids_.size());
+            ids_.insert(ids_.end(),
+                rules_[i].begin(), rules_[i].end());
+            nodes_[i].last = static_cast<std::uint32_t>(
+                ids_.size());
+        }
+        rules_.clear();
+    }
+
+    // Call `f(first, last)` with the rules of
+    // each prefix containing `key`, shortest first
+    template<class F>
+    void
+    match(
+        address_key const& key,
+        F&& f) const
+    {
+        std::uint32_t i = 0;
+        for (;;)
+        {
+            node const& n = nodes_[i];
+            if (!key.same_prefix(n.key, n.len))
+                return;
+            if (n.first != n.last)
+                f(ids_.data() + n.first, ids_.data() + n.last);
+            if (n.len == 128)
+                return;
+            i = n.child[key.bit(n.len)];
+            if (i == 0)
+                return;
+        }
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return nodes_.size();
+    }
+
+private:
+    struct node
+    {
+        address_key key;
+        // 0 is the root, which is
+        // never a child
+        std::uint32_t child[2]{0, 0};
+        std::uint32_t first{0};
+        std::uint32_t last{0};
+        std::size_t len{0};
+    };
+
+    std::uint32_t
+    add_node(
+        address_key const& key,
+        std::size_t len)
+    {
+        nodes_.emplace_back();
+        nodes_.back().key = key;
+        nodes_.back().len = len;
+        rules_.emplace_back();
+        return static_cast<std::uint32_t>(
+            nodes_.size() - 1);
+    }
+
+    std::vector<node> nodes_;
+    std::vector<std::uint32_t> ids_;
+
+    // Rules of each node while
+    // the trie is built
+    std::vector<std::vector<std::uint32_t>> rules_;
+};
+
+// A trie of domain names keyed on their labels
+// from right to left
+//
+// A rule for example.com matches example.com and
+// its subdomains, such as www.example.com, but not
+// badexample.com. The edges of all nodes live in
+// one open addressing table keyed on the parent
+// and a hash of the label, so finding a child
+// costs about one probe however many siblings it
+// has, and lookups do not allocate.
+class suffix_trie
+{
+public:
+    suffix_trie()
+        : nodes_(1)
+    {
+    }
+
+    // `domain` is lowercase without a trailing dot
+    void
+    insert(
+        boost::core::string_view domain,
+        std::uint32_t rule)
+    {
+        std::uint32_t i = 0;
+        std::size_t end = domain.size();
+        for (;;)
+        {
+            std::size_t dot = domain.rfind('.', end - 1);
+            std::size_t begin =
+                dot == boost::core::string_view::npos ?
+                    0 : dot + 1;
+            boost::core::string_view label =
+                domain.substr(begin, end - begin);
+            std::string k = std::to_string(i);
+            k.push_back('/');
+            k.append(label.data(), label.size());
+            auto r = index_.emplace(std::move(k), 0);
+            if (r.second)
+            {
+                nodes_.emplace_back();
+                nodes_.back().parent = i;
+                nodes_.back().label.assign(
+                    label.data(), label.size());
+                r.first->second = static_cast<std::uint32_t>(
+                    nodes_.size() - 1);
+            }
+            i = r.first->second;
+            if (begin == 0)
+                return nodes_[i].rules.push_back(rule);
+            end = dot;
+        }
+    }
+
+    // Build the table of edges for lookups
+    void
+    finish()
+    {
+        std::size_t n = 16;
+        while (n < 2 * nodes_.size())
+            n *= 2;
+        slots_.assign(n, slot{});
+        for (std::uint32_t i = 1; i < nodes_.size(); ++i)
+        {
+            std::uint64_t h = hash(nodes_[i].parent, nodes_[i].label);
+            std::size_t j = h & (n - 1);
+            while (slots_[j].child != 0)
+                j = (j + 1) & (n - 1);
+            slots_[j].hash = h;
+            slots_[j].child = i;
+        }
+        index_.clear();
+    }
+
+    // Call `f(first, last)` with the rules of
+    // each suffix of `host`, shortest first
+    template<class F>
+    void
+    match(
+        boost::core::string_view host,
+        F&& f) const
+    {
+        if (!host.empty() && host.back() == '.')
+            host.remove_suffix(1);
+        char buf[255];
+        if (slots_.empty() ||
+            host.empty() ||
+            host.size() > sizeof(buf))
+            return;
+        for (std::size_t j = 0; j < host.size(); ++j)
+        {
+            char c = host[j];
+            buf[j] = c >= 'A' && c <= 'Z' ?
+                static_cast<char>(c - 'A' + 'a') : c;
+        }
+        boost::core::string_view s(buf, host.size());
+        std::size_t mask = slots_.size() - 1;
+        std::uint32_t i = 0;
+        std::size_t end = s.size();
+        for (;;)
+        {
+            std::size_t dot = s.rfind('.', end - 1);
+            std::size_t begin =
+                dot == boost::core::string_view::npos ?
+                    0 : dot + 1;
+            boost::core::string_view label =
+                s.substr(begin, end - begin);
+            std::uint64_t h = hash(i, label);
+            std::size_t j = h & mask;
+            std::uint32_t c = 0;
+            for (; slots_[j].child != 0; j = (j + 1) & mask)
+            {
+                node const& n = nodes_[slots_[j].child];
+                if (slots_[j].hash == h &&
+                    n.parent == i &&
+                    boost::core::string_view(n.label) == label)
+                {
+                    c = slots_[j].child;
+                    break;
+                }
+            }
+            if (c == 0)
+                return;
+            i = c;
+            auto const& r = nodes_[i].rules;
+            if (!r.empty())
+                f(r.data(), r.data() + r.size());
+            if (begin == 0 || dot == 0)
+                return;
+            end = dot;
+        }
+    }
+
+private:
+    struct node
+    {
+        std::uint32_t parent{0};
+        std::string label;
+        std::vector<std::uint32_t> rules;
+    };
+
+    struct slot
+    {
+        std::uint64_t hash{0};
+        // 0 is the root, which is
+        // never a child
+        std::uint32_t child{0};
+    };
+
+    // FNV-1a of the label, mixed with the parent
+    static
+    std::uint64_t
+    hash(
+        std::uint32_t parent,
+        boost::core::string_view label) noexcept
+    {
+        std::uint64_t h = 14695981039346656037ULL;
+        for (char c : label)
+        {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ULL;
+        }
+        h ^= (parent + 1) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+        return h;
+    }
+
+    std::vector<node> nodes_;
+    std::vector<slot> slots_;
+
+    // Children by parent and label while
+    // the trie is built
+    std::unordered_map<std::string, std::uint32_t> index_;
+};
+
+// One line of the rules file
+//
+// A condition left out matches any request.
+struct access_rule
+{
+    enum class target_kind
+    {
+        any,
+        address,
+        domain
+    };
+
+    bool allow{false};
+    bool any_client{true};
+    address_key client;
+    std::size_t client_len{0};
+    std::string user;
+    target_kind target{target_kind::any};
+    address_key target_address;
+    std::size_t target_len{0};
+    std::string domain;
+    std::uint16_t port_min{0};
+    std::uint16_t port_max{65535};
+
+    // The parent proxy allowed requests are
+    // forwarded to. Empty connects directly.
+    std::string via;
+
+    // The network interface the connections of
+    // allowed requests leave from. Empty lets
+    // the routing table decide.
+    std::string egress;
+
+    std::size_t line{0};
+};
+
+// What a client asks to connect to
+struct access_request
+{
+    ip::address client;
+
+    // Empty unless the client
+    // authenticated with a username
+    boost::core::string_view user;
+
+    // The target address, used when
+    // `host` is empty
+    ip::address target;
+
+    // The target domain name
+    boost::core::string_view host;
+
+    std::uint16_t port{0};
+};
+
+// An ordered list of allow and deny rules
+//
+// The first rule matching a request decides it,
+// and requests no rule matches are denied. Each
+// rule is indexed by one condition: the target
+// prefix or domain when it has one, else the
+// client prefix. A check only visits the rules
+// whose indexed condition matches, so its cost
+// depends on the rules relevant to the request
+// rather than on the size of the list.
+//
+// Sets are immutable once built, and a reload
+// replaces the whole set, so checks in flight
+// keep the set they started with.
+//
+// Domain rules match the name the client asked
+// for. The addresses a name resolves to are
+// checked again with allows_resolved(), so a
+// name cannot reach a prefix the rules deny.
+class rule_set
+{
+public:
+    void
+    add(access_rule r)
+    {
+        std::uint32_t id = static_cast<std::uint32_t>(
+            rules_.size());
+        switch (r.target)
+        {
+        case access_rule::target_kind::address:
+            targets_.insert(r.target_address, r.target_len, id);
+            break;
+        case access_rule::target_kind::domain:
+            domains_.insert(r.domain, id);
+            break;
+        case access_rule::target_kind::any:
+            if (!r.any_client)
+                clients_.insert(r.client, r.client_len, id);
+            else
+                any_.push_back(id);
+            break;
+        }
+        rules_.push_back(std::move(r));
+    }
+
+    // Prepare the set for checks, once
+    // all the rules were added
+    void
+    finish()
+    {
+        targets_.finish();
+        domains_.finish();
+        clients_.finish();
+    }
+
+    // Return the rule deciding the request, or
+    // nullptr if no rule matches it
+    access_rule const*
+    find(access_request const& req) const
+    {
+        address_key client = address_key::from(req.client);
+        std::uint32_t best = static_cast<std::uint32_t>(-1);
+        auto scan = [&](
+            std::uint32_t const* first,
+            std::uint32_t const* last)
+        {
+            for (; first != last; ++first)
+            {
+                std::uint32_t id = *first;
+                if (id >= best)
+                    return;
+                // The indexed condition matched
+                // already, so check the others
+                access_rule const& r = rules_[id];
+                if (req.port < r.port_min ||
+                    req.port > r.port_max ||
+                    (!r.user.empty() && r.user != req.user) ||
+                    (!r.any_client &&
+                        !client.same_prefix(
+                            r.client, r.client_len)))
+                    continue;
+                best = id;
+                return;
+            }
+        };
+        if (req.host.empty())
+            targets_.match(address_key::from(req.target), scan);
+        else
+            domains_.match(req.host, scan);
+        clients_.match(client, scan);
+        scan(any_.data(), any_.data() + any_.size());
+        if (best == static_cast<std::uint32_t>(-1))
+            return nullptr;
+        return &rules_[best];
+    }
+
+    bool
+    allows(access_request const& req) const
+    {
+        access_rule const* r = find(req);
+        return r && r->allow;
+    }
+
+    // Return false if a deny rule on target
+    // addresses decides `req`, for an address
+    // a name the rules allowed resolved to.
+    //
+    // Other rules do not apply, as the rule
+    // allowing the name decided them already.
+    bool
+    allows_resolved(access_request const& req) const
+    {
+        BOOST_ASSERT(req.host.empty());
+        access_rule const* r = find(req);
+        return
+            !r ||
+            r->allow ||
+            r->target != access_rule::target_kind::address;
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return rules_.size();
+    }
+
+    // Parse one rule per line, in the form
+    //
+    //   allow|deny [from <cidr>] [user <name>]
+    //       [to <cidr>|<domain>] [port <n>[-<m>]]
+    //       [via <upstream>|egress <interface>]
+    //
+    // where `via` and `egress` only apply
+    // to allow rules.
+    // Empty lines and lines starting with '#' are
+    // ignored. On error, `error` describes the
+    // first invalid line.
+    static
+    std::shared_ptr<rule_set const>
+    parse(
+        std::string const& text,
+        std::string& error)
+    {
+        auto s = std::make_shared<rule_set>();
+        std::istringstream in(text);
+        std::string line;
+        std::size_t n = 0;
+        while (std::getline(in, line))
+        {
+            ++n;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            std::istringstream words(line);
+            std::string action;
+            if (!(words >> action) || action[0] == '#')
+                continue;
+            access_rule r;
+            r.line = n;
+            if (!parse_rule(action, words, r))
+            {
+                error = "Invalid rule at line " + std::to_string(n);
+                return nullptr;
+            }
+            s->add(std::move(r));
+        }
+        s->finish();
+        return s;
+    }
+
+private:
+    static
+    bool
+    parse_rule(
+        std::string const& action,
+        std::istream& words,
+        access_rule& r)
+    {
+        if (action == "allow")
+            r.allow = true;
+        else if (action != "deny")
+            return false;
+        std::string key;
+        std::string value;
+        while (words >> key)
+        {
+            if (!(words >> value))
+                return false;
+            if (key == "from")
+            {
+                if (!parse_cidr(value, r.client, r.client_len))
+                    return false;
+                r.any_client = false;
+            }
+            else if (key == "user")
+            {
+                if (value.size() > 255)
+                    return false;
+                r.user = value;
+            }
+            else if (key == "to")
+            {
+                if (parse_cidr(value, r.target_address, r.target_len))
+                {
+                    r.target = access_rule::target_kind::address;
+                    continue;
+                }
+                if (!parse_domain(value, r.domain))
+                    return false;
+                r.target = access_rule::target_kind::domain;
+            }
+            else if (key == "port")
+            {
+                if (!parse_ports(value, r.port_min, r.port_max))
+                    return false;
+            }
+            else if (key == "via")
+            {
+                if (!r.allow)
+                    return false;
+                r.via = value;
+            }
+            else if (key == "egress")
+            {
+                // Interface names are shorter
+                // than IFNAMSIZ on Linux
+                if (!r.allow || value.size() > 15)
+                    return false;
+                r.egress = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        // Connections to a parent proxy are pooled
+        // for all the rules that use it
+        return r.via.empty() || r.egress.empty();
+    }
+
+    // Accept example.com, .example.com and
+    // *.example.com as the same suffix
+    static
+    bool
+    parse_domain(
+        std::string const& value,
+        std::string& domain)
+    {
+        boost::core::string_view s(value);
+        if (s.starts_with("*."))
+            s.remove_prefix(2);
+        else if (s.starts_with("."))
+            s.remove_prefix(1);
+        if (s.ends_with("."))
+            s.remove_suffix(1);
+        if (s.empty() || s.size() > 255)
+            return false;
+        domain.clear();
+        for (char c : s)
+        {
+            if (c == '.' && (domain.empty() || domain.back() == '.'))
+                return false;
+            domain.push_back(c >= 'A' && c <= 'Z' ?
+                static_cast<char>(c - 'A' + 'a') : c);
+        }
+        return true;
+    }
+
+    static
+    bool
+    parse_ports(
+        std::string const& value,
+        std::uint16_t& lo,
+        std::uint16_t& hi)
+    {
+        char const* p = value.c_str();
+        char* end = nullptr;
+        unsigned long a = std::strtoul(p, &end, 10);
+        if (end == p || a > 65535)
+            return false;
+        unsigned long b = a;
+        if (*end == '-')
+        {
+            p = end + 1;
+            b = std::strtoul(p, &end, 10);
+            if (end == p || b > 65535 || b < a)
+                return false;
+        }
+        if (*end != '\0')
+            return false;
+        lo = static_cast<std::uint16_t>(a);
+        hi = static_cast<std::uint16_t>(b);
+        return true;
+    }
+
+    std::vector<access_rule> rules_;
+    prefix_trie targets_;
+    suffix_trie domains_;
+    prefix_trie clients_;
+    std::vector<std::uint32_t> any_;
+};
+
+// The rules connections are checked against
+//
+// The set is replaced as a whole, so a reload
+// never exposes a partial set to a check.
+class access_rules
+{
+public:
+    explicit
+    access_rules(
+        std::shared_ptr<rule_set const> rules =
+            std::make_shared<rule_set const>())
+        : rules_(std::move(rules))
+    {
+    }
+
+    virtual ~access_rules() = default;
+
+    std::shared_ptr<rule_set const>
+    rules() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return rules_;
+    }
+
+    void
+    set_rules(std::shared_ptr<rule_set const> r)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        rules_ = std::move(r);
+    }
+
+    bool
+    allows(access_request const& req) const
+    {
+        return rules()->allows(req);
+    }
+
+private:
+    mutable std::mutex m_;
+    std::shared_ptr<rule_set const> rules_;
+};
+
+// Access rules loaded from a file
+//
+// The file is read again periodically, and the
+// rules are replaced when its contents changed.
+// A file that became invalid is reported and the
+// previous rules are kept.
+class file_access_rules
+    : public access_rules
+{
+public:
+    file_access_rules(
+        asio::io_context& ioc,
+        access_options const& opt)
+        : path_(opt.rules_file)
+        , interval_(opt.reload_interval)
+        , timer_(ioc)
+    {
+    }
+
+    // Read the file, returning false with
+    // `error` set if it cannot be used
+    bool
+    reload(std::string& error)
+    {
+        std::ifstream f(path_, std::ios::binary);
+        if (!f)
+        {
+            error = "Cannot open " + path_;
+            return false;
+        }
+        std::ostringstream ss;
+        ss << f.rdbuf();
+        std::string text = ss.str();
+        if (loaded_ && text == contents_)
+            return true;
+        auto r = rule_set::parse(text, error);
+        if (!r)
+        {
+            error = path_ + ": " + error;
+            return false;
+        }
+        set_rules(std::move(r));
+        contents_ = std::move(text);
+        loaded_ = true;
+        return true;
+    }
+
+    // Check the file for changes periodically
+    void
+    start()
+    {
+        if (interval_.count() == 0)
+            return;
+        timer_.expires_after(interval_);
+        timer_.async_wait(
+            [this](error_code ec)
+            {
+                if (ec.failed())
+                    return;
+                std::string error;
+                if (!reload(error))
+                    std::cerr << error << "\n";
+                start();
+            });
+    }
+
+    void
+    stop()
+    {
+        timer_.cancel();
+    }
+
+private:
+    std::string path_;
+    std::chrono::milliseconds interval_;
+    asio::steady_timer timer_;
+    std::string contents_;
+    bool loaded_{false};
+};
+
+#endif
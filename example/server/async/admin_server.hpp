@@ -0,0 +1,173 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_ADMIN_SERVER_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_ADMIN_SERVER_HPP
+
+#include "common.hpp"
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+// Serves metrics over HTTP
+//
+// GET /metrics returns the snapshot written
+// by the render function, in the Prometheus
+// text format. The endpoint has no access
+// control, so it should only listen on a
+// local address. Each connection serves one
+// request, so scrapers do not keep the server
+// running once it stops.
+class admin_server
+{
+public:
+    using render_function =
+        std::function<void(std::string&)>;
+
+    admin_server(
+        asio::io_context& ioc,
+        endpoint const& ep,
+        render_function render)
+        : ioc_(ioc)
+        , acceptor_(ioc, ep)
+        , render_(std::make_shared<render_function>(
+            std::move(render)))
+    {
+        std::cout << "Metrics on http://" <<
+            acceptor_.local_endpoint() << "/metrics\n";
+        do_accept();
+    }
+
+    endpoint
+    local_endpoint() const
+    {
+        return acceptor_.local_endpoint();
+    }
+
+    void
+    close()
+    {
+        error_code ec;
+        acceptor_.close(ec);
+    }
+
+private:
+    class session
+        : public std::enable_shared_from_this<session>
+    {
+    public:
+        session(
+            tcp::socket s,
+            std::shared_ptr<render_function> render)
+            : stream_(std::move(s))
+            , render_(std::move(render))
+        {
+        }
+
+        void
+        do_read()
+        {
+            namespace http = boost::beast::http;
+            stream_.expires_after(std::chrono::seconds(30));
+            auto self(shared_from_this());
+            http::async_read(
+                stream_, buffer_, req_,
+                [this, self](error_code ec, std::size_t)
+                {
+                    if (ec.failed())
+                        return close();
+                    do_write();
+                });
+        }
+
+    private:
+        void
+        do_write()
+        {
+            namespace http = boost::beast::http;
+            res_.version(req_.version());
+            res_.keep_alive(false);
+            if (req_.method() != http::verb::get)
+            {
+                res_.result(http::status::method_not_allowed);
+                res_.set(http::field::allow, "GET");
+            }
+            else if (req_.target() != "/metrics")
+            {
+                res_.result(http::status::not_found);
+            }
+            else
+            {
+                res_.result(http::status::ok);
+                res_.set(
+                    http::field::content_type,
+                    "text/plain; version=0.0.4");
+                (*render_)(res_.body());
+            }
+            res_.prepare_payload();
+            auto self(shared_from_this());
+            http::async_write(
+                stream_, res_,
+                [this, self](error_code, std::size_t)
+                {
+                    close();
+                });
+        }
+
+        void
+        close()
+        {
+            error_code ec;
+            stream_.socket().shutdown(
+                tcp::socket::shutdown_send, ec);
+        }
+
+        boost::beast::tcp_stream stream_;
+        boost::beast::flat_buffer buffer_;
+        boost::beast::http::request<
+            boost::beast::http::string_body> req_;
+        boost::beast::http::response<
+            boost::beast::http::string_body> res_;
+        std::shared_ptr<render_function> render_;
+    };
+
+    void
+    do_accept()
+    {
+        acceptor_.async_accept(
+            ioc_,
+            [this](error_code ec, tcp::socket s)
+            {
+                if (ec == asio::error::operation_aborted ||
+                    !acceptor_.is_open())
+                    return;
+                if (!ec.failed())
+                    std::make_shared<session>(
+                        std::move(s), render_)->do_read();
+                do_accept();
+            });
+    }
+
+    asio::io_context& ioc_;
+    tcp::acceptor acceptor_;
+    std::shared_ptr<render_function> render_;
+};
+
+#endif
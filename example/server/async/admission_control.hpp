@@ -0,0 +1,312 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_ADMISSION_CONTROL_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_ADMISSION_CONTROL_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+// Counters exported by the admission control
+//
+// These are only written by the thread running
+// the server but can be read from anywhere.
+struct admission_counters
+{
+    // Connections accepted from the listen socket
+    std::atomic<std::uint64_t> accepted{0};
+
+    // Connections closed right after accept because
+    // their source address reached its limit
+    std::atomic<std::uint64_t> rejected_per_ip{0};
+
+    // Errors returned by async_accept
+    std::atomic<std::uint64_t> accept_errors{0};
+
+    // Number of times accepting was paused
+    std::atomic<std::uint64_t> accept_pauses{0};
+
+    // Connections currently open
+    std::atomic<std::uint64_t> active_connections{0};
+
+    // Connections currently in the SOCKS handshake
+    std::atomic<std::uint64_t> active_handshakes{0};
+};
+
+class admission_control;
+
+// A slot reserved for a client connection
+//
+// The slot, and the handshake slot if the
+// handshake did not finish, are given back
+// when the ticket is destroyed.
+class admission_ticket
+{
+public:
+    admission_ticket() = default;
+
+    admission_ticket(admission_ticket&& other) noexcept
+        : ctl_(std::move(other.ctl_))
+        , key_(other.key_)
+        , in_handshake_(other.in_handshake_)
+    {
+        other.in_handshake_ = false;
+    }
+
+    admission_ticket&
+    operator=(admission_ticket&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            ctl_ = std::move(other.ctl_);
+            key_ = other.key_;
+            in_handshake_ = other.in_handshake_;
+            other.in_handshake_ = false;
+        }
+        return *this;
+    }
+
+    ~admission_ticket()
+    {
+        release();
+    }
+
+    explicit
+    operator bool() const noexcept
+    {
+        return ctl_ != nullptr;
+    }
+
+    // Give back the handshake slot
+    //
+    // Called once the connection starts
+    // relaying data.
+    inline
+    void
+    handshake_done();
+
+private:
+    friend class admission_control;
+
+    using key_type = ip::address_v6::bytes_type;
+
+    inline
+    void
+    release();
+
+    std::shared_ptr<admission_control> ctl_;
+    key_type key_{};
+    bool in_handshake_{false};
+};
+
+// Decides whether the server can take more clients
+//
+// The server stops calling async_accept while
+// the control is saturated, leaving new clients
+// in the kernel listen backlog, and resumes
+// once enough connections are closed.
+class admission_control
+    : public std::enable_shared_from_this<admission_control>
+{
+public:
+    explicit
+    admission_control(admission_options const& opt)
+        : opt_(opt)
+    {
+    }
+
+    admission_options const&
+    options() const noexcept
+    {
+        return opt_;
+    }
+
+    admission_counters&
+    counters() noexcept
+    {
+        return counters_;
+    }
+
+    admission_counters const&
+    counters() const noexcept
+    {
+        return counters_;
+    }
+
+    // Return true if no more connections should be accepted
+    bool
+    saturated() const noexcept
+    {
+        return
+            (opt_.max_connections != 0 &&
+             connections_ >= opt_.max_connections) ||
+            (opt_.max_handshakes != 0 &&
+             handshakes_ >= opt_.max_handshakes);
+    }
+
+    // Set the function called when the control
+    // stops being saturated
+    void
+    on_resume(std::function<void()> f)
+    {
+        resume_ = std::move(f);
+    }
+
+    // Reserve a slot for a connection from `addr`
+    //
+    // An empty ticket is returned when the
+    // address already reached its limit.
+    admission_ticket
+    admit(ip::address const& addr)
+    {
+        ++counters_.accepted;
+        admission_ticket t;
+        t.key_ = to_key(addr);
+        if (opt_.max_connections_per_ip != 0)
+        {
+            std::size_t& n = per_ip_[t.key_];
+            if (n >= opt_.max_connections_per_ip)
+            {
+                ++counters_.rejected_per_ip;
+                return t;
+            }
+            ++n;
+        }
+        ++connections_;
+        ++handshakes_;
+        counters_.active_connections = connections_;
+        counters_.active_handshakes = handshakes_;
+        t.ctl_ = shared_from_this();
+        t.in_handshake_ = true;
+        return t;
+    }
+
+    // Record a failed call to async_accept
+    void
+    accept_failed() noexcept
+    {
+        ++counters_.accept_errors;
+    }
+
+    // Record that accepting was paused
+    void
+    accept_paused() noexcept
+    {
+        ++counters_.accept_pauses;
+    }
+
+private:
+    friend class admission_ticket;
+
+    using key_type = admission_ticket::key_type;
+
+    struct key_hash
+    {
+        std::size_t
+        operator()(key_type const& k) const noexcept
+        {
+            // FNV-1a
+            std::uint64_t h = 14695981039346656037ull;
+            for (unsigned char c : k)
+            {
+                h ^= c;
+                h *= 1099511628211ull;
+            }
+            return static_cast<std::size_t>(h);
+        }
+    };
+
+    static
+    key_type
+    to_key(ip::address const& addr)
+    {
+        if (addr.is_v4())
+            return ip::make_address_v6(
+                ip::v4_mapped, addr.to_v4()).to_bytes();
+        return addr.to_v6().to_bytes();
+    }
+
+    void
+    release_handshake() noexcept
+    {
+        bool was_saturated = saturated();
+        --handshakes_;
+        counters_.active_handshakes = handshakes_;
+        maybe_resume(was_saturated);
+    }
+
+    void
+    release(key_type const& key, bool in_handshake) noexcept
+    {
+        bool was_saturated = saturated();
+        if (opt_.max_connections_per_ip != 0)
+        {
+            auto it = per_ip_.find(key);
+            BOOST_ASSERT(it != per_ip_.end());
+            if (--it->second == 0)
+                per_ip_.erase(it);
+        }
+        --connections_;
+        if (in_handshake)
+            --handshakes_;
+        counters_.active_connections = connections_;
+        counters_.active_handshakes = handshakes_;
+        maybe_resume(was_saturated);
+    }
+
+    void
+    maybe_resume(bool was_saturated)
+    {
+        if (was_saturated &&
+            !saturated() &&
+            resume_)
+            resume_();
+    }
+
+    admission_options opt_;
+    admission_counters counters_;
+    std::size_t connections_{0};
+    std::size_t handshakes_{0};
+    std::unordered_map<
+        key_type, std::size_t, key_hash> per_ip_;
+    std::function<void()> resume_;
+};
+
+void
+admission_ticket::
+handshake_done()
+{
+    if (ctl_ && in_handshake_)
+    {
+        in_handshake_ = false;
+        ctl_->release_handshake();
+    }
+}
+
+void
+admission_ticket::
+release()
+{
+    if (ctl_)
+    {
+        ctl_->release(key_, in_handshake_);
+        ctl_.reset();
+        in_handshake_ = false;
+    }
+}
+
+#endif
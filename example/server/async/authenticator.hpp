@@ -0,0 +1,555 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_AUTHENTICATOR_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_AUTHENTICATOR_HPP
+
+#include "common.hpp"
+#include "password_hash.hpp"
+#include "server_options.hpp"
+#include "verify_pool.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Checks the credentials of the userpass
+// sub-negotiation
+//
+// Implementations might call the handler before
+// async_verify returns, or later from any thread,
+// so connections post it to their own executor.
+class authenticator
+{
+public:
+    using handler = std::function<void(bool)>;
+
+    virtual ~authenticator() = default;
+
+    virtual
+    void
+    async_verify(
+        std::string user,
+        std::string pass,
+        handler h) = 0;
+};
+
+// Remembers the credentials verified recently
+//
+// An entry is keyed on the user and the record
+// the password was verified against, so changing
+// the record of a user forgets their entry. The
+// cache keeps a keyed SHA-1 of the password, not
+// the password, and the key is a secret of the
+// process, so the cache does not make passwords
+// cheaper to brute force than the records.
+class verified_cache
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    explicit
+    verified_cache(
+        std::size_t capacity,
+        std::chrono::milliseconds ttl)
+        : capacity_(capacity)
+        , ttl_(ttl)
+    {
+        std::random_device rd;
+        for (auto& c : secret_)
+            c = static_cast<char>(rd());
+    }
+
+    // Return true if this password was verified
+    // against the record, and did not expire
+    bool
+    contains(
+        boost::core::string_view user,
+        boost::core::string_view record,
+        boost::core::string_view pass)
+    {
+        if (capacity_ == 0)
+            return false;
+        std::string k = key(user, record);
+        sha1_digest d = digest(pass);
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = map_.find(k);
+        if (it == map_.end())
+        {
+            ++misses_;
+            return false;
+        }
+        auto e = it->second;
+        if (ttl_.count() > 0 &&
+            clock_type::now() >= e->expires)
+        {
+            map_.erase(it);
+            lru_.erase(e);
+            ++misses_;
+            return false;
+        }
+        if (!constant_time_equal(
+                d.data(), e->digest.data(), d.size()))
+        {
+            ++misses_;
+            return false;
+        }
+        lru_.splice(lru_.begin(), lru_, e);
+        ++hits_;
+        return true;
+    }
+
+    void
+    insert(
+        boost::core::string_view user,
+        boost::core::string_view record,
+        boost::core::string_view pass)
+    {
+        if (capacity_ == 0)
+            return;
+        std::string k = key(user, record);
+        sha1_digest d = digest(pass);
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = map_.find(k);
+        if (it != map_.end())
+        {
+            lru_.erase(it->second);
+            map_.erase(it);
+        }
+        else if (map_.size() == capacity_)
+        {
+            map_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+        lru_.push_front({k, d, clock_type::now() + ttl_});
+        map_.emplace(std::move(k), lru_.begin());
+    }
+
+    void
+    clear()
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        map_.clear();
+        lru_.clear();
+    }
+
+    std::size_t
+    size() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return map_.size();
+    }
+
+    std::size_t
+    hits() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return hits_;
+    }
+
+    std::size_t
+    misses() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return misses_;
+    }
+
+private:
+    struct entry
+    {
+        std::string key;
+        sha1_digest digest;
+        clock_type::time_point expires;
+    };
+
+    static
+    std::string
+    key(
+        boost::core::string_view user,
+        boost::core::string_view record)
+    {
+        std::string k(user.data(), user.size());
+        k.push_back('\0');
+        k.append(record.data(), record.size());
+        return k;
+    }
+
+    sha1_digest
+    digest(boost::core::string_view pass) const
+    {
+        return sha1(
+            boost::core::string_view(secret_, sizeof(secret_)),
+            pass);
+    }
+
+    std::size_t capacity_;
+    std::chrono::milliseconds ttl_;
+    char secret_[16];
+    mutable std::mutex m_;
+    std::list<entry> lru_;
+    std::unordered_map<
+        std::string,
+        std::list<entry>::iterator> map_;
+    std::size_t hits_{0};
+    std::size_t misses_{0};
+};
+
+// The password records of the users
+//
+// Tables are immutable once built, and a reload
+// replaces the whole table, so checks in flight
+// keep the table they started with.
+class credential_table
+{
+public:
+    struct user_entry
+    {
+        std::string record;
+        password_record parsed;
+    };
+
+    // Add a user, returning false if
+    // the record is invalid
+    bool
+    add(
+        std::string user,
+        std::string record)
+    {
+        user_entry e;
+        if (!parse_password_record(record, e.parsed))
+            return false;
+        e.record = std::move(record);
+        users_[std::move(user)] = std::move(e);
+        return true;
+    }
+
+    user_entry const*
+    find(std::string const& user) const
+    {
+        auto it = users_.find(user);
+        if (it == users_.end())
+            return nullptr;
+        return &it->second;
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return users_.size();
+    }
+
+    // Parse lines of the form user:record
+    //
+    // Empty lines and lines starting with '#' are
+    // ignored. On error, `error` describes the
+    // first invalid line.
+    static
+    std::shared_ptr<credential_table const>
+    parse(
+        std::string const& text,
+        std::string& error)
+    {
+        auto t = std::make_shared<credential_table>();
+        std::istringstream in(text);
+        std::string line;
+        std::size_t n = 0;
+        while (std::getline(in, line))
+        {
+            ++n;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::size_t i = line.rfind(':');
+            if (i == 0 || i == std::string::npos ||
+                i > 255 ||
+                !t->add(line.substr(0, i), line.substr(i + 1)))
+            {
+                error = "Invalid user at line " + std::to_string(n);
+                return nullptr;
+            }
+        }
+        return t;
+    }
+
+private:
+    std::unordered_map<std::string, user_entry> users_;
+};
+
+// Verifies passwords against a credential table
+//
+// Passwords that were verified recently are found
+// in the cache, so a user opening many connections
+// does not pay for the key derivation every time.
+// Other passwords are derived in the verify pool,
+// when there is one, and rejected when its queue
+// is full.
+//
+// Unknown users are checked against a record
+// nobody knows the password of, through the same
+// path, so the time taken to reject them does not
+// tell which users exist.
+class table_authenticator
+    : public authenticator
+{
+public:
+    explicit
+    table_authenticator(
+        authentication_options const& opt,
+        std::shared_ptr<credential_table const> table =
+            std::make_shared<credential_table const>())
+        : table_(std::move(table))
+        , cache_(std::make_shared<verified_cache>(
+            opt.cache_size, opt.cache_ttl))
+        , unknown_(std::make_shared<
+            credential_table::user_entry>())
+    {
+        // A random password with the
+        // default iterations
+        std::random_device rd;
+        unsigned char pass[16];
+        for (auto& c : pass)
+            c = static_cast<unsigned char>(rd());
+        unknown_->record = hash_password(
+            to_hex(pass, sizeof(pass)));
+        parse_password_record(
+            unknown_->record, unknown_->parsed);
+    }
+
+    // Derive keys in this pool
+    //
+    // This is set before the first check.
+    // Without a pool, keys are derived in
+    // async_verify.
+    void
+    set_pool(std::shared_ptr<verify_pool> p) noexcept
+    {
+        pool_ = std::move(p);
+    }
+
+    std::shared_ptr<credential_table const>
+    table() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return table_;
+    }
+
+    void
+    set_table(std::shared_ptr<credential_table const> t)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        table_ = std::move(t);
+    }
+
+    verified_cache const&
+    cache() const noexcept
+    {
+        return *cache_;
+    }
+
+    void
+    async_verify(
+        std::string user,
+        std::string pass,
+        handler h) override
+    {
+        // The entry lives as long as the table
+        auto t = table();
+        credential_table::user_entry const* e = t->find(user);
+        bool known = e != nullptr;
+        if (!known)
+            e = unknown_.get();
+        if (cache_->contains(user, e->record, pass))
+            return h(known);
+        if (!pool_)
+            return derive(*cache_, *e, known, user, pass, h);
+        // The task might outlive this
+        auto cache = cache_;
+        auto unknown = unknown_;
+        if (!pool_->try_post(
+                [cache, t, unknown, e, known, user, pass, h]
+                {
+                    derive(*cache, *e, known, user, pass, h);
+                }))
+            h(false);
+    }
+
+private:
+    static
+    void
+    derive(
+        verified_cache& cache,
+        credential_table::user_entry const& e,
+        bool known,
+        std::string const& user,
+        std::string const& pass,
+        handler const& h)
+    {
+        bool ok = verify_password(e.parsed, pass) && known;
+        if (ok)
+            cache.insert(user, e.record, pass);
+        h(ok);
+    }
+
+    mutable std::mutex m_;
+    std::shared_ptr<credential_table const> table_;
+    std::shared_ptr<verified_cache> cache_;
+    std::shared_ptr<verify_pool> pool_;
+    std::shared_ptr<credential_table::user_entry> unknown_;
+};
+
+// A credential table loaded from a file
+//
+// The file is read again periodically, and the
+// table is replaced when its contents changed.
+// A file that became invalid is reported and the
+// previous table is kept.
+class file_authenticator
+    : public table_authenticator
+{
+public:
+    file_authenticator(
+        asio::io_context& ioc,
+        authentication_options const& opt)
+        : table_authenticator(opt)
+        , path_(opt.users_file)
+        , interval_(opt.reload_interval)
+        , timer_(ioc)
+    {
+    }
+
+    // Read the file, returning false with
+    // `error` set if it cannot be used
+    bool
+    reload(std::string& error)
+    {
+        std::ifstream f(path_, std::ios::binary);
+        if (!f)
+        {
+            error = "Cannot open " + path_;
+            return false;
+        }
+        std::ostringstream ss;
+        ss << f.rdbuf();
+        std::string text = ss.str();
+        if (loaded_ && text == contents_)
+            return true;
+        auto t = credential_table::parse(text, error);
+        if (!t)
+        {
+            error = path_ + ": " + error;
+            return false;
+        }
+        set_table(std::move(t));
+        contents_ = std::move(text);
+        loaded_ = true;
+        return true;
+    }
+
+    // Check the file for changes periodically
+    void
+    start()
+    {
+        if (interval_.count() == 0)
+            return;
+        timer_.expires_after(interval_);
+        timer_.async_wait(
+            [this](error_code ec)
+            {
+                if (ec.failed())
+                    return;
+                std::string error;
+                if (!reload(error))
+                    std::cerr << error << "\n";
+                start();
+            });
+    }
+
+    void
+    stop()
+    {
+        timer_.cancel();
+    }
+
+private:
+    std::string path_;
+    std::chrono::milliseconds interval_;
+    asio::steady_timer timer_;
+    std::string contents_;
+    bool loaded_{false};
+};
+
+// Delegates the checks to an external service
+//
+// The verifier sends the credentials to the
+// service, such as a RADIUS or HTTP server, and
+// calls its callback with the answer. Accepted
+// credentials are cached for the TTL, so the
+// service sees a user once per TTL.
+class external_authenticator
+    : public authenticator
+{
+public:
+    using verifier = std::function<void(
+        std::string const& user,
+        std::string const& pass,
+        handler h)>;
+
+    external_authenticator(
+        verifier v,
+        authentication_options const& opt)
+        : verify_(std::move(v))
+        , cache_(std::make_shared<verified_cache>(
+            opt.cache_size, opt.cache_ttl))
+    {
+    }
+
+    verified_cache const&
+    cache() const noexcept
+    {
+        return *cache_;
+    }
+
+    void
+    async_verify(
+        std::string user,
+        std::string pass,
+        handler h) override
+    {
+        if (cache_->contains(user, {}, pass))
+            return h(true);
+        // The callback might outlive this
+        auto cache = cache_;
+        verify_(user, pass,
+            [cache, user, pass, h](bool ok)
+            {
+                if (ok)
+                    cache->insert(user, {}, pass);
+                h(ok);
+            });
+    }
+
+private:
+    verifier verify_;
+    std::shared_ptr<verified_cache> cache_;
+};
+
+#endif
@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_COMMON_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_COMMON_HPP
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/assert.hpp>
+#include <boost/core/ignore_unused.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace asio = boost::asio;
+namespace ip = boost::asio::ip;
+using tcp = boost::asio::ip::tcp;
+using endpoint = boost::asio::ip::tcp::endpoint;
+using error_code = boost::system::error_code;
+
+//------------------------------------------------------------------------------
+
+// A small version of std::to_string to avoid a
+// common bug on MinGw.
+inline
+std::string
+to_string(std::uint16_t v)
+{
+#if (defined(__MINGW32__) || defined(MINGW32) || defined(BOOST_MINGW32))
+    constexpr int bn = 4 * sizeof(std::uint16_t);
+    char str[bn];
+    int n = std::snprintf(str, bn, "%d", v);
+    BOOST_ASSERT(n <= bn);
+    boost::ignore_unused(n);
+    return std::string(str);
+#else
+    return std::to_string(v);
+#endif
+}
+
+// Parse an address in the form <host>:<port>,
+// where IPv6 hosts are in brackets
+inline
+bool
+parse_host_port(
+    boost::core::string_view s,
+    std::string& host,
+    std::string& port)
+{
+    std::size_t colon = s.rfind(':');
+    if (colon == boost::core::string_view::npos ||
+        colon == 0 ||
+        colon + 1 == s.size())
+        return false;
+    boost::core::string_view h = s.substr(0, colon);
+    if (h.starts_with("[") && h.ends_with("]"))
+        h = h.substr(1, h.size() - 2);
+    if (h.empty())
+        return false;
+    host = std::string(h);
+    port = std::string(s.substr(colon + 1));
+    char* end = nullptr;
+    unsigned long n = std::strtoul(port.c_str(), &end, 10);
+    return *end == '\0' && n != 0 && n <= 65535;
+}
+
+#endif
@@ -0,0 +1,186 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_DRAIN_CONTROL_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_DRAIN_CONTROL_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+// Tracks the connections of a server so
+// they can be drained before it exits
+//
+// Connections link themselves into the
+// control while they are alive. When draining
+// starts, each of them is notified and
+// shortens its own deadlines, and the control
+// reports when the last one is gone.
+class drain_control
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    // A connection tracked by the control
+    class hook
+    {
+    public:
+        hook(hook const&) = delete;
+        hook& operator=(hook const&) = delete;
+
+        // Called once when draining starts
+        virtual
+        void
+        on_drain() = 0;
+
+    protected:
+        hook() = default;
+
+        ~hook() = default;
+
+    private:
+        friend class drain_control;
+
+        hook* prev_{nullptr};
+        hook* next_{nullptr};
+    };
+
+    explicit
+    drain_control(asio::io_context& ioc)
+        : ioc_(ioc)
+    {
+    }
+
+    void
+    add(hook& h) noexcept
+    {
+        h.prev_ = nullptr;
+        h.next_ = head_;
+        if (head_)
+            head_->prev_ = &h;
+        head_ = &h;
+        ++size_;
+    }
+
+    void
+    remove(hook& h)
+    {
+        if (h.prev_)
+            h.prev_->next_ = h.next_;
+        else
+            head_ = h.next_;
+        if (h.next_)
+            h.next_->prev_ = h.prev_;
+        h.prev_ = nullptr;
+        h.next_ = nullptr;
+        --size_;
+        if (size_ == 0 && draining_)
+            notify_done();
+    }
+
+    // Number of connections alive
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+    bool
+    draining() const noexcept
+    {
+        return draining_;
+    }
+
+    drain_options const&
+    options() const noexcept
+    {
+        return opt_;
+    }
+
+    // Return the time left until the hard cutoff
+    //
+    // The result is zero when there is no cutoff.
+    std::chrono::milliseconds
+    remaining() const noexcept
+    {
+        if (opt_.cutoff.count() == 0)
+            return std::chrono::milliseconds(0);
+        auto left = std::chrono::duration_cast<
+            std::chrono::milliseconds>(
+                cutoff_ - clock_type::now());
+        // Connections past the cutoff close
+        // on the next tick of their deadline
+        if (left.count() <= 0)
+            return std::chrono::milliseconds(1);
+        return left;
+    }
+
+    // Return true if the hard cutoff passed
+    bool
+    past_cutoff() const noexcept
+    {
+        return
+            draining_ &&
+            opt_.cutoff.count() != 0 &&
+            clock_type::now() >= cutoff_;
+    }
+
+    // Start draining the connections
+    //
+    // `on_done` is called from the io_context
+    // once no connection is left.
+    void
+    start(
+        drain_options const& opt,
+        std::function<void()> on_done)
+    {
+        if (draining_)
+            return;
+        draining_ = true;
+        opt_ = opt;
+        cutoff_ = clock_type::now() + opt.cutoff;
+        on_done_ = std::move(on_done);
+        // Connections might unlink
+        // themselves while notified
+        hook* h = head_;
+        while (h)
+        {
+            hook* next = h->next_;
+            h->on_drain();
+            h = next;
+        }
+        if (size_ == 0)
+            notify_done();
+    }
+
+private:
+    void
+    notify_done()
+    {
+        if (!on_done_)
+            return;
+        asio::post(ioc_, std::move(on_done_));
+        on_done_ = nullptr;
+    }
+
+    asio::io_context& ioc_;
+    hook* head_{nullptr};
+    std::size_t size_{0};
+    bool draining_{false};
+    drain_options opt_;
+    clock_type::time_point cutoff_;
+    std::function<void()> on_done_;
+};
+
+#endif
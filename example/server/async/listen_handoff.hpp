@@ -0,0 +1,351 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_LISTEN_HANDOFF_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_LISTEN_HANDOFF_HPP
+
+#include "common.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Functions to start serving from listen sockets
+// opened by another process, so the server can
+// be replaced without closing the listen socket
+// and dropping the clients in its backlog.
+//
+// - systemd socket activation passes the sockets
+//   as inherited file descriptors.
+// - A running server can hand its socket to the
+//   process replacing it over a UNIX socket,
+//   as SCM_RIGHTS ancillary data.
+
+// Return the listen sockets passed by
+// systemd socket activation
+//
+// The environment variables are cleared, so
+// child processes do not adopt the sockets.
+inline
+std::vector<int>
+systemd_listen_fds()
+{
+    // SD_LISTEN_FDS_START
+    constexpr int first_fd = 3;
+    std::vector<int> r;
+    char const* pid = std::getenv("LISTEN_PID");
+    char const* fds = std::getenv("LISTEN_FDS");
+    if (!pid || !fds ||
+        std::strtol(pid, nullptr, 10) != ::getpid())
+        return r;
+    long n = std::strtol(fds, nullptr, 10);
+    for (long i = 0; i < n; ++i)
+    {
+        int fd = first_fd + static_cast<int>(i);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        r.push_back(fd);
+    }
+    ::unsetenv("LISTEN_PID");
+    ::unsetenv("LISTEN_FDS");
+    ::unsetenv("LISTEN_FDNAMES");
+    return r;
+}
+
+// Create an acceptor for a listening socket
+//
+// The socket is closed on failure.
+inline
+tcp::acceptor
+adopt_listen_fd(
+    asio::io_context& ioc,
+    int fd,
+    error_code& ec)
+{
+    tcp::acceptor a(ioc);
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    sockaddr_storage addr{};
+    socklen_t addr_len = sizeof(addr);
+    if (::getsockopt(
+            fd, SOL_SOCKET, SO_ACCEPTCONN,
+            &listening, &len) != 0 ||
+        ::getsockname(
+            fd, reinterpret_cast<sockaddr*>(&addr),
+            &addr_len) != 0)
+    {
+        ec.assign(errno, boost::system::system_category());
+        ::close(fd);
+        return a;
+    }
+    if (!listening ||
+        (addr.ss_family != AF_INET &&
+         addr.ss_family != AF_INET6))
+    {
+        ec = asio::error::not_socket;
+        ::close(fd);
+        return a;
+    }
+    a.assign(
+        addr.ss_family == AF_INET6 ? tcp::v6() : tcp::v4(),
+        fd,
+        ec);
+    if (ec.failed())
+        ::close(fd);
+    return a;
+}
+
+// Receive a listen socket from the server
+// handing it over at `path`
+//
+// Return -1 on failure.
+inline
+int
+receive_listen_fd(
+    std::string const& path,
+    error_code& ec)
+{
+    using local = asio::local::stream_protocol;
+    asio::io_context ioc;
+    local::socket s(ioc);
+    s.connect(local::endpoint(path), ec);
+    if (ec.failed())
+        return -1;
+
+    char byte = 0;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do
+    {
+        n = ::recvmsg(
+            s.native_handle(), &msg, MSG_CMSG_CLOEXEC);
+    }
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+    {
+        ec.assign(errno, boost::system::system_category());
+        return -1;
+    }
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    if (n == 0 ||
+        !c ||
+        c->cmsg_level != SOL_SOCKET ||
+        c->cmsg_type != SCM_RIGHTS)
+    {
+        ec = asio::error::eof;
+        return -1;
+    }
+    int fd = -1;
+    std::memcpy(&fd, CMSG_DATA(c), sizeof(int));
+    return fd;
+}
+
+// Hands a listen socket to the process
+// replacing this one
+//
+// The new process connects to `path` with
+// receive_listen_fd, gets a duplicate of the
+// listen socket, and this process is notified
+// so it can drain its connections.
+//
+// Only processes of the same user get the
+// socket, as any other would also make this
+// process drain. The path is only accessible
+// to the user too.
+class listen_handoff
+{
+public:
+    listen_handoff(
+        asio::io_context& ioc,
+        std::string path)
+        : path_(std::move(path))
+        , acceptor_(ioc)
+    {
+    }
+
+    ~listen_handoff()
+    {
+        close();
+    }
+
+    // Start waiting for the new process
+    //
+    // `on_handoff` is called once the socket
+    // was sent. A stale UNIX socket at the
+    // path is replaced, and the new one gets
+    // mode 0600.
+    void
+    start(
+        int listen_fd,
+        std::function<void()> on_handoff,
+        error_code& ec)
+    {
+        using local = asio::local::stream_protocol;
+        listen_fd_ = listen_fd;
+        on_handoff_ = std::move(on_handoff);
+        ::unlink(path_.c_str());
+        acceptor_.open(local(), ec);
+        if (!ec.failed())
+            acceptor_.bind(local::endpoint(path_), ec);
+        // Nobody can connect before listen,
+        // so the mode is set in time
+        if (!ec.failed() &&
+            ::chmod(path_.c_str(), S_IRUSR | S_IWUSR) != 0)
+            ec.assign(errno, boost::system::system_category());
+        if (!ec.failed())
+            acceptor_.listen(1, ec);
+        if (ec.failed())
+            return;
+        bound_ = true;
+        do_accept();
+    }
+
+    void
+    close()
+    {
+        error_code ec;
+        acceptor_.close(ec);
+        if (bound_)
+        {
+            ::unlink(path_.c_str());
+            bound_ = false;
+        }
+    }
+
+private:
+    void
+    do_accept()
+    {
+        acceptor_.async_accept(
+            [this](
+                error_code ec,
+                asio::local::stream_protocol::socket s)
+            {
+                if (ec == asio::error::operation_aborted)
+                    return;
+                if (!ec.failed() &&
+                    same_user(s, ec) &&
+                    send(s, ec))
+                {
+                    std::cout << "Listen socket handed off\n";
+                    // The path now belongs to the new
+                    // process, which replaces the socket
+                    bound_ = false;
+                    close();
+                    if (on_handoff_)
+                        on_handoff_();
+                    return;
+                }
+                if (ec.failed())
+                    std::cerr << "Cannot hand off listen socket: " <<
+                        ec.message() << "\n";
+                do_accept();
+            });
+    }
+
+    // Return true if the peer of `s`
+    // runs as the user of this process
+    static
+    bool
+    same_user(
+        asio::local::stream_protocol::socket& s,
+        error_code& ec)
+    {
+        uid_t uid;
+#if defined(SO_PEERCRED)
+        ucred cred{};
+        socklen_t len = sizeof(cred);
+        if (::getsockopt(
+                s.native_handle(), SOL_SOCKET, SO_PEERCRED,
+                &cred, &len) != 0)
+        {
+            ec.assign(errno, boost::system::system_category());
+            return false;
+        }
+        uid = cred.uid;
+#else
+        gid_t gid;
+        if (::getpeereid(s.native_handle(), &uid, &gid) != 0)
+        {
+            ec.assign(errno, boost::system::system_category());
+            return false;
+        }
+#endif
+        if (uid != ::geteuid())
+        {
+            ec = asio::error::access_denied;
+            return false;
+        }
+        return true;
+    }
+
+    bool
+    send(
+        asio::local::stream_protocol::socket& s,
+        error_code& ec)
+    {
+        char byte = 0;
+        iovec iov{&byte, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(c), &listen_fd_, sizeof(int));
+        // One byte and the descriptor fit in the
+        // empty socket buffer, so this does not block
+        ssize_t n;
+        do
+        {
+            n = ::sendmsg(
+                s.native_handle(), &msg, MSG_NOSIGNAL);
+        }
+        while (n < 0 && errno == EINTR);
+        if (n < 0)
+        {
+            ec.assign(errno, boost::system::system_category());
+            return false;
+        }
+        return true;
+    }
+
+    std::string path_;
+    asio::local::stream_protocol::acceptor acceptor_;
+    int listen_fd_{-1};
+    std::function<void()> on_handoff_;
+    bool bound_{false};
+};
+
+#endif
+
+#endif
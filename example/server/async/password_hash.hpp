@@ -0,0 +1,257 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_PASSWORD_HASH_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_PASSWORD_HASH_HPP
+
+#include "sha1.hpp"
+
+#include <boost/core/detail/string_view.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+// Stored passwords are PBKDF2-HMAC-SHA1 records:
+//
+//     pbkdf2-sha1$<iterations>$<salt hex>$<key hex>
+//
+// The iterations make each check expensive, so
+// leaked records are slow to brute force.
+
+inline
+sha1_digest
+sha1(
+    boost::core::string_view a,
+    boost::core::string_view b = {})
+{
+    sha1_context ctx;
+    ctx.update(a.data(), a.size());
+    ctx.update(b.data(), b.size());
+    return ctx.finish();
+}
+
+// HMAC-SHA1 with the key absorbed once, so each
+// PBKDF2 iteration costs two compressions only
+class hmac_sha1
+{
+public:
+    explicit
+    hmac_sha1(boost::core::string_view key)
+    {
+        unsigned char k[64] = {};
+        if (key.size() > sizeof(k))
+        {
+            sha1_digest d = sha1(key);
+            std::memcpy(k, d.data(), d.size());
+        }
+        else
+        {
+            std::memcpy(k, key.data(), key.size());
+        }
+        unsigned char pad[64];
+        for (std::size_t i = 0; i < 64; ++i)
+            pad[i] = k[i] ^ 0x36;
+        inner_.update(pad, sizeof(pad));
+        for (std::size_t i = 0; i < 64; ++i)
+            pad[i] = k[i] ^ 0x5c;
+        outer_.update(pad, sizeof(pad));
+    }
+
+    sha1_digest
+    operator()(
+        void const* data,
+        std::size_t n) const
+    {
+        sha1_context c = inner_;
+        c.update(data, n);
+        sha1_digest d = c.finish();
+        c = outer_;
+        c.update(d.data(), d.size());
+        return c.finish();
+    }
+
+private:
+    sha1_context inner_;
+    sha1_context outer_;
+};
+
+// Derive a 20 byte key with PBKDF2-HMAC-SHA1
+inline
+sha1_digest
+pbkdf2_sha1(
+    boost::core::string_view password,
+    boost::core::string_view salt,
+    std::size_t iterations)
+{
+    hmac_sha1 prf(password);
+    // Block index 1, big endian
+    std::string s(salt.data(), salt.size());
+    s.append("\0\0\0\1", 4);
+    sha1_digest u = prf(s.data(), s.size());
+    sha1_digest key = u;
+    for (std::size_t i = 1; i < iterations; ++i)
+    {
+        u = prf(u.data(), u.size());
+        for (std::size_t j = 0; j < key.size(); ++j)
+            key[j] ^= u[j];
+    }
+    return key;
+}
+
+// Compare without exiting at the first
+// difference, which would leak its position
+// through the time taken
+inline
+bool
+constant_time_equal(
+    unsigned char const* a,
+    unsigned char const* b,
+    std::size_t n) noexcept
+{
+    unsigned char d = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        d |= a[i] ^ b[i];
+    return d == 0;
+}
+
+// A parsed password record
+struct password_record
+{
+    std::size_t iterations{0};
+    std::string salt;
+    sha1_digest key{};
+};
+
+inline
+std::string
+to_hex(
+    unsigned char const* p,
+    std::size_t n)
+{
+    static char const digits[] = "0123456789abcdef";
+    std::string s(2 * n, '\0');
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        s[2 * i] = digits[p[i] >> 4];
+        s[2 * i + 1] = digits[p[i] & 0xf];
+    }
+    return s;
+}
+
+inline
+bool
+from_hex(
+    boost::core::string_view s,
+    unsigned char* out,
+    std::size_t n) noexcept
+{
+    if (s.size() != 2 * n)
+        return false;
+    auto digit = [](char c) -> int
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        int hi = digit(s[2 * i]);
+        int lo = digit(s[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[i] = static_cast<unsigned char>(hi * 16 + lo);
+    }
+    return true;
+}
+
+// Parse a record, returning false if it is invalid
+inline
+bool
+parse_password_record(
+    boost::core::string_view s,
+    password_record& r)
+{
+    boost::core::string_view const prefix = "pbkdf2-sha1$";
+    if (s.substr(0, prefix.size()) != prefix)
+        return false;
+    s.remove_prefix(prefix.size());
+    std::size_t i = s.find('$');
+    if (i == 0 || i == boost::core::string_view::npos)
+        return false;
+    std::size_t iterations = 0;
+    for (char c : s.substr(0, i))
+    {
+        if (c < '0' || c > '9' || iterations > 100000000)
+            return false;
+        iterations = iterations * 10 + static_cast<std::size_t>(c - '0');
+    }
+    if (iterations == 0)
+        return false;
+    s.remove_prefix(i + 1);
+    i = s.find('$');
+    if (i == boost::core::string_view::npos || i % 2 != 0)
+        return false;
+    std::string salt(i / 2, '\0');
+    if (!from_hex(s.substr(0, i),
+            reinterpret_cast<unsigned char*>(&salt[0]), salt.size()))
+        return false;
+    s.remove_prefix(i + 1);
+    if (!from_hex(s, r.key.data(), r.key.size()))
+        return false;
+    r.iterations = iterations;
+    r.salt = std::move(salt);
+    return true;
+}
+
+// Iterations of new records
+constexpr std::size_t default_password_iterations = 20000;
+
+// Return a record of a password with a random salt
+inline
+std::string
+hash_password(
+    boost::core::string_view password,
+    std::size_t iterations = default_password_iterations)
+{
+    std::random_device rd;
+    unsigned char salt[16];
+    for (auto& c : salt)
+        c = static_cast<unsigned char>(rd());
+    sha1_digest key = pbkdf2_sha1(
+        password,
+        boost::core::string_view(
+            reinterpret_cast<char const*>(salt), sizeof(salt)),
+        iterations);
+    return
+        "pbkdf2-sha1$" + std::to_string(iterations) + "$" +
+        to_hex(salt, sizeof(salt)) + "$" +
+        to_hex(key.data(), key.size());
+}
+
+// Return true if the password matches the record
+//
+// This is as expensive as the iterations of the
+// record make it.
+inline
+bool
+verify_password(
+    password_record const& r,
+    boost::core::string_view password)
+{
+    sha1_digest key = pbkdf2_sha1(
+        password, r.salt, r.iterations);
+    return constant_time_equal(
+        key.data(), r.key.data(), key.size());
+}
+
+#endif
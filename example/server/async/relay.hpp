@@ -0,0 +1,335 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_RELAY_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_RELAY_HPP
+
+#include "common.hpp"
+#include "traffic_shaper.hpp"
+
+#include <boost/socks/timer_wheel.hpp>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Close a stream after a failure
+template <class Stream>
+void
+abort_stream(Stream& s)
+{
+    error_code ec;
+    s.close(ec);
+}
+
+// Reset a TCP connection after a failure
+//
+// A zero linger time makes close() send a RST,
+// so the peer does not take the failure on the
+// other side of the relay for the end of the data.
+inline
+void
+abort_stream(tcp::socket& s)
+{
+    error_code ec;
+    s.set_option(asio::socket_base::linger(true, 0), ec);
+    s.close(ec);
+}
+
+// Relays data between a client and a target
+//
+// Each direction copies data from one stream
+// to the other, independently. When a stream
+// reaches the end of its data, the other stream
+// is shut down for sending, so its peer sees the
+// half-close, and data keeps flowing the other
+// way. A client can send a request, shut down
+// its side, and still read the whole response.
+//
+// The relay completes once both directions
+// reached the end of their data. If a direction
+// fails, both streams are aborted and the relay
+// completes with the first error.
+//
+// A direction with a rate limit only reads what
+// its buckets allow. When they are empty, the
+// read is not started until they refill, so the
+// data waits in the socket buffers and TCP flow
+// control slows the sender down. The wait is a
+// deadline in the timer wheel of the thread, so
+// pausing many relays costs one timer.
+template <class Stream>
+class relay
+{
+public:
+    relay(
+        Stream& client,
+        Stream& target,
+        std::size_t buffer_size = 1024)
+        : upstream_(*this, client, target, buffer_size)
+        , downstream_(*this, target, client, buffer_size)
+    {
+    }
+
+    relay(relay const&) = delete;
+    relay& operator=(relay const&) = delete;
+
+    // Limit the rate of each direction
+    //
+    // The limits must outlive the relay.
+    void
+    limit(
+        rate_limit* upload,
+        rate_limit* download) noexcept
+    {
+        if (upload && upload->limited())
+            upstream_.limit = upload;
+        if (download && download->limited())
+            downstream_.limit = download;
+    }
+
+    // Set a function called whenever data is read
+    void
+    on_activity(
+        void (*fn)(void*),
+        void* arg) noexcept
+    {
+        on_activity_ = fn;
+        arg_ = arg;
+    }
+
+    // Start relaying in both directions
+    //
+    // `on_half_close` is called when the first
+    // direction reaches the end of its data while
+    // the other one is still open. `on_done` is
+    // called when the relay completes. The relay
+    // keeps `owner` alive until then.
+    void
+    start(
+        std::shared_ptr<void> owner,
+        std::function<void(error_code)> on_done,
+        std::function<void()> on_half_close = {})
+    {
+        owner_ = std::move(owner);
+        on_done_ = std::move(on_done);
+        on_half_close_ = std::move(on_half_close);
+        do_read(upstream_);
+        do_read(downstream_);
+    }
+
+    // Bytes relayed from the client to the target
+    std::uint64_t
+    bytes_to_target() const noexcept
+    {
+        return upstream_.bytes;
+    }
+
+    // Bytes relayed from the target to the client
+    std::uint64_t
+    bytes_to_client() const noexcept
+    {
+        return downstream_.bytes;
+    }
+
+    // Return true if exactly one
+    // direction reached its end
+    bool
+    half_closed() const noexcept
+    {
+        return upstream_.done != downstream_.done;
+    }
+
+private:
+    struct direction
+    {
+        direction(
+            relay& r,
+            Stream& f,
+            Stream& t,
+            std::size_t n)
+            : self(r)
+            , from(f)
+            , to(t)
+            , buffer(n)
+            , wait(f.get_executor())
+        {
+            wait.on_expire(&relay::on_wait, this);
+        }
+
+        relay& self;
+        Stream& from;
+        Stream& to;
+        std::vector<unsigned char> buffer;
+        rate_limit* limit{nullptr};
+        boost::socks::deadline wait;
+        std::uint64_t bytes{0};
+        bool done{false};
+    };
+
+    static
+    void
+    on_wait(void* p)
+    {
+        direction& d = *static_cast<direction*>(p);
+        d.self.do_read(d);
+    }
+
+    void
+    do_read(direction& d)
+    {
+        std::size_t n = d.buffer.size();
+        if (d.limit)
+        {
+            // Wait for enough tokens to fill the
+            // buffer, or for the burst if smaller,
+            // so slow relays do not read byte
+            // by byte
+            auto now = rate_limit::clock_type::now();
+            std::size_t want = (std::min)(n, d.limit->burst());
+            n = (std::min)(n, d.limit->available(now));
+            if (n < want)
+            {
+                d.wait.expires_after(
+                    std::chrono::duration_cast<
+                        boost::socks::timer_wheel::duration>(
+                            d.limit->wait_time(want, now)) +
+                    boost::socks::timer_wheel::resolution());
+                return;
+            }
+        }
+        d.from.async_read_some(
+            asio::buffer(d.buffer.data(), n),
+            [this, &d](error_code ec, std::size_t n)
+            {
+                on_read(d, ec, n);
+            });
+    }
+
+    void
+    on_read(
+        direction& d,
+        error_code ec,
+        std::size_t n)
+    {
+        if (aborted_)
+            return fail(d, ec.failed() ?
+                ec : asio::error::operation_aborted);
+        if (n == 0)
+        {
+            if (ec == asio::error::eof)
+                return finish(d);
+            if (ec.failed())
+                return fail(d, ec);
+            return do_read(d);
+        }
+        if (on_activity_)
+            on_activity_(arg_);
+        d.bytes += n;
+        if (d.limit)
+            d.limit->consume(n);
+        // Data read with the end of the stream
+        // is written before the shutdown
+        asio::async_write(
+            d.to,
+            asio::buffer(d.buffer.data(), n),
+            [this, &d, ec](error_code wec, std::size_t)
+            {
+                if (wec.failed())
+                    return fail(d, wec);
+                if (ec == asio::error::eof)
+                    return finish(d);
+                if (ec.failed())
+                    return fail(d, ec);
+                if (aborted_)
+                    return fail(d, asio::error::operation_aborted);
+                do_read(d);
+            });
+    }
+
+    // The source reached its end, so the
+    // sink stops sending too
+    void
+    finish(direction& d)
+    {
+        error_code ec;
+        d.to.shutdown(asio::socket_base::shutdown_send, ec);
+        d.done = true;
+        if (upstream_.done && downstream_.done)
+            return complete();
+        if (on_half_close_)
+            on_half_close_();
+    }
+
+    void
+    fail(direction& d, error_code ec)
+    {
+        d.done = true;
+        if (!ec_.failed())
+            ec_ = ec;
+        if (!aborted_)
+        {
+            // The pending operation of the other
+            // direction completes with an error
+            aborted_ = true;
+            abort_stream(upstream_.from);
+            abort_stream(upstream_.to);
+            // A paused direction has no
+            // operation to fail
+            stop_waiting(upstream_);
+            stop_waiting(downstream_);
+        }
+        if (upstream_.done && downstream_.done)
+            complete();
+    }
+
+    static
+    void
+    stop_waiting(direction& d) noexcept
+    {
+        if (!d.wait.pending())
+            return;
+        d.wait.cancel();
+        d.done = true;
+    }
+
+    void
+    complete()
+    {
+        // The owner might own this relay, so it
+        // is released once nothing else is used
+        std::shared_ptr<void> owner = std::move(owner_);
+        std::function<void(error_code)> h =
+            std::move(on_done_);
+        on_done_ = nullptr;
+        on_half_close_ = nullptr;
+        if (h)
+            h(ec_);
+    }
+
+    direction upstream_;
+    direction downstream_;
+    void (*on_activity_)(void*){nullptr};
+    void* arg_{nullptr};
+    std::shared_ptr<void> owner_;
+    std::function<void(error_code)> on_done_;
+    std::function<void()> on_half_close_;
+    error_code ec_;
+    bool aborted_{false};
+};
+
+#endif
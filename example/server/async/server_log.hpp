@@ -0,0 +1,553 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SERVER_LOG_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SERVER_LOG_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+#include "traffic_shaper.hpp"
+
+#include <boost/core/detail/string_view.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A queue with one producer and one consumer
+//
+// Neither side takes a lock. The capacity is
+// rounded up to a power of two, and pushing
+// to a full queue fails instead of waiting.
+template <class T>
+class spsc_ring
+{
+public:
+    explicit
+    spsc_ring(std::size_t capacity)
+    {
+        std::size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    std::size_t
+    capacity() const noexcept
+    {
+        return slots_.size();
+    }
+
+    // Called by the producer
+    bool
+    try_push(T const& v)
+    {
+        std::size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - head_.load(std::memory_order_acquire) == slots_.size())
+            return false;
+        slots_[t & mask_] = v;
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer
+    bool
+    try_pop(T& v)
+    {
+        std::size_t h = head_.load(std::memory_order_relaxed);
+        if (h == tail_.load(std::memory_order_acquire))
+            return false;
+        v = slots_[h & mask_];
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots_;
+    std::size_t mask_{0};
+
+    // Each index on its own cache line, so the
+    // producer and the consumer do not share one
+    char pad0_[64];
+    std::atomic<std::size_t> head_{0};
+    char pad1_[64];
+    std::atomic<std::size_t> tail_{0};
+};
+
+// A log entry
+//
+// Records have a fixed size, so queueing one
+// does not allocate. They are formatted by the
+// writer thread.
+struct log_record
+{
+    enum class kind : unsigned char
+    {
+        access,
+        warning,
+        error
+    };
+
+    kind type{kind::error};
+
+    // Records not written before this one
+    // because of the rate limit
+    std::uint32_t suppressed{0};
+
+    std::chrono::system_clock::time_point time;
+    endpoint client;
+    endpoint target;
+
+    // Errors: what failed and why
+    char const* what{nullptr};
+    error_code ec;
+
+    // Access: the result of a connection. The
+    // version is 0 when no request was read,
+    // and the reply is -1 when none was sent.
+    unsigned char version{0};
+    unsigned char method{0x00};
+    short reply{-1};
+    std::uint64_t bytes_to_target{0};
+    std::uint64_t bytes_to_client{0};
+    std::uint64_t handshake_us{0};
+    std::uint64_t duration_us{0};
+
+    // The target domain name and the user,
+    // truncated to fit
+    unsigned char host_size{0};
+    unsigned char user_size{0};
+    char host[255];
+    char user[255];
+
+    void
+    set_host(boost::core::string_view s) noexcept
+    {
+        host_size = copy(host, s);
+    }
+
+    void
+    set_user(boost::core::string_view s) noexcept
+    {
+        user_size = copy(user, s);
+    }
+
+private:
+    static
+    unsigned char
+    copy(char (&dest)[255], boost::core::string_view s) noexcept
+    {
+        std::size_t n = (std::min)(s.size(), sizeof(dest));
+        std::memcpy(dest, s.data(), n);
+        return static_cast<unsigned char>(n);
+    }
+};
+
+// Writes access and error records
+//
+// Each thread queues its records in its own
+// ring buffer, and a background thread formats
+// them as JSON lines and writes them, so the
+// threads running connections never block on
+// the output. When a ring is full, records are
+// dropped and the writer reports how many.
+//
+// Errors and warnings are rate limited per
+// thread, and the number of records suppressed
+// is reported in the next one written. Access
+// records can be sampled.
+class server_log
+{
+public:
+    explicit
+    server_log(log_options const& opt)
+        : opt_(opt)
+        , id_(next_id())
+    {
+        if (!opt_.path.empty())
+        {
+            out_ = std::fopen(opt_.path.c_str(), "a");
+            if (!out_)
+                std::perror(opt_.path.c_str());
+        }
+        if (!out_)
+            out_ = stderr;
+        writer_ = std::thread(
+            [this]
+            {
+                run();
+            });
+    }
+
+    // Write what is left and stop the writer
+    ~server_log()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        writer_.join();
+        if (out_ != stderr)
+            std::fclose(out_);
+    }
+
+    server_log(server_log const&) = delete;
+    server_log& operator=(server_log const&) = delete;
+
+    log_options const&
+    options() const noexcept
+    {
+        return opt_;
+    }
+
+    // Return true if an access record for the
+    // next connection should be written
+    bool
+    sample_access()
+    {
+        if (!opt_.access)
+            return false;
+        if (opt_.access_sample <= 1)
+            return true;
+        shard& s = local();
+        return s.sampled++ % opt_.access_sample == 0;
+    }
+
+    void
+    access(log_record& r)
+    {
+        r.type = log_record::kind::access;
+        push(local(), r);
+    }
+
+    // Log a failure
+    //
+    // Clients closing or resetting their
+    // connection are logged as warnings.
+    void
+    error(log_record& r)
+    {
+        r.type = expected(r.ec) ?
+            log_record::kind::warning :
+            log_record::kind::error;
+        shard& s = local();
+        if (s.errors.limited())
+        {
+            auto now = token_bucket::clock_type::now();
+            if (s.errors.available(now) == 0)
+            {
+                ++s.suppressed;
+                return;
+            }
+            s.errors.consume(1);
+        }
+        r.suppressed = s.suppressed;
+        s.suppressed = 0;
+        push(s, r);
+    }
+
+    // Return the number of records dropped
+    // because a ring buffer was full
+    std::uint64_t
+    dropped() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uint64_t n = 0;
+        for (auto const& s : shards_)
+            n += s->dropped.load(std::memory_order_relaxed);
+        return n;
+    }
+
+private:
+    // The records of one thread
+    struct shard
+    {
+        explicit
+        shard(log_options const& opt)
+            : ring(opt.buffer_size)
+            , errors(opt.error_rate, opt.error_burst)
+        {
+        }
+
+        std::thread::id thread;
+        spsc_ring<log_record> ring;
+
+        // Only used by the owning thread
+        token_bucket errors;
+        std::uint32_t suppressed{0};
+        std::size_t sampled{0};
+
+        // Written by the owning thread only
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    struct cache
+    {
+        std::uint64_t id{0};
+        shard* s{nullptr};
+    };
+
+    static
+    std::uint64_t
+    next_id() noexcept
+    {
+        static std::atomic<std::uint64_t> n{0};
+        return ++n;
+    }
+
+    static
+    cache&
+    local_cache() noexcept
+    {
+        static thread_local cache c;
+        return c;
+    }
+
+    shard&
+    local()
+    {
+        cache& c = local_cache();
+        if (c.id == id_)
+            return *c.s;
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::thread::id const tid =
+            std::this_thread::get_id();
+        c.id = id_;
+        c.s = nullptr;
+        for (auto const& s : shards_)
+            if (s->thread == tid)
+                c.s = s.get();
+        if (!c.s)
+        {
+            shards_.emplace_back(new shard(opt_));
+            shards_.back()->thread = tid;
+            c.s = shards_.back().get();
+        }
+        return *c.s;
+    }
+
+    static
+    bool
+    expected(error_code const& ec) noexcept
+    {
+        return
+            ec == asio::error::eof ||
+            ec == asio::error::connection_reset ||
+            ec == asio::error::broken_pipe ||
+            ec == asio::error::operation_aborted;
+    }
+
+    void
+    push(shard& s, log_record& r)
+    {
+        r.time = std::chrono::system_clock::now();
+        if (!s.ring.try_push(r))
+            s.dropped.store(
+                s.dropped.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    }
+
+    // The writer thread
+    //
+    // Producers do not wake it up, which would
+    // take a lock, so it polls the rings.
+    void
+    run()
+    {
+        std::string buf;
+        log_record r;
+        std::uint64_t dropped = 0;
+        for (;;)
+        {
+            bool stop;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait_for(
+                    lock,
+                    opt_.flush_interval,
+                    [this]
+                    {
+                        return stop_;
+                    });
+                stop = stop_;
+            }
+            // Shards are never removed, so they can
+            // be used without the lock once found
+            std::vector<shard*> shards;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto const& s : shards_)
+                    shards.push_back(s.get());
+            }
+            std::uint64_t n = 0;
+            for (shard* s : shards)
+            {
+                while (s->ring.try_pop(r))
+                    format(buf, r);
+                n += s->dropped.load(std::memory_order_relaxed);
+            }
+            if (n != dropped)
+            {
+                buf += "{\"type\":\"log\",\"dropped\":";
+                buf += std::to_string(n - dropped);
+                buf += "}\n";
+                dropped = n;
+            }
+            if (!buf.empty())
+            {
+                std::fwrite(buf.data(), 1, buf.size(), out_);
+                std::fflush(out_);
+                buf.clear();
+            }
+            if (stop)
+                return;
+        }
+    }
+
+    static
+    void
+    format(std::string& out, log_record const& r)
+    {
+        static char const* const kinds[] = {
+            "access", "warning", "error" };
+        out += "{\"ts\":";
+        auto ms = std::chrono::duration_cast<
+            std::chrono::milliseconds>(
+                r.time.time_since_epoch()).count();
+        out += std::to_string(ms / 1000);
+        out += '.';
+        std::string frac = std::to_string(ms % 1000);
+        out.append(3 - frac.size(), '0');
+        out += frac;
+        out += ",\"type\":\"";
+        out += kinds[static_cast<int>(r.type)];
+        out += '"';
+        field(out, "client", r.client);
+        if (r.target != endpoint())
+            field(out, "target", r.target);
+        if (r.host_size != 0)
+            field(out, "host", boost::core::string_view(
+                r.host, r.host_size));
+        if (r.type == log_record::kind::access)
+        {
+            if (r.version != 0)
+                field(out, "version", r.version);
+            if (r.version == 5)
+                field(out, "method",
+                    r.method == 0x00 ? "none" :
+                    r.method == 0x02 ? "userpass" :
+                    "no_acceptable");
+            if (r.user_size != 0)
+                field(out, "user", boost::core::string_view(
+                    r.user, r.user_size));
+            if (r.reply >= 0)
+                field(out, "reply", static_cast<std::uint64_t>(r.reply));
+            field(out, "up", r.bytes_to_target);
+            field(out, "down", r.bytes_to_client);
+            field(out, "handshake_us", r.handshake_us);
+            field(out, "duration_us", r.duration_us);
+        }
+        else
+        {
+            field(out, "what", r.what ? r.what : "");
+            field(out, "error", r.ec.message());
+            if (r.suppressed != 0)
+                field(out, "suppressed", r.suppressed);
+        }
+        out += "}\n";
+    }
+
+    static
+    void
+    field(std::string& out, char const* name, std::uint64_t v)
+    {
+        key(out, name);
+        out += std::to_string(v);
+    }
+
+    static
+    void
+    field(std::string& out, char const* name, endpoint const& ep)
+    {
+        field(out, name, ep.address().to_string() +
+            ":" + std::to_string(ep.port()));
+    }
+
+    static
+    void
+    field(std::string& out, char const* name, boost::core::string_view s)
+    {
+        key(out, name);
+        out += '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                static char const hex[] = "0123456789abcdef";
+                out += "\\u00";
+                out += hex[(c >> 4) & 0xF];
+                out += hex[c & 0xF];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    static
+    void
+    field(std::string& out, char const* name, char const* s)
+    {
+        field(out, name, boost::core::string_view(s));
+    }
+
+    static
+    void
+    field(std::string& out, char const* name, std::string const& s)
+    {
+        field(out, name, boost::core::string_view(s));
+    }
+
+    static
+    void
+    key(std::string& out, char const* name)
+    {
+        out += ",\"";
+        out += name;
+        out += "\":";
+    }
+
+    log_options opt_;
+    std::uint64_t id_;
+    std::FILE* out_{nullptr};
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_{false};
+    std::vector<std::unique_ptr<shard>> shards_;
+    std::thread writer_;
+};
+
+#endif
@@ -0,0 +1,559 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SERVER_METRICS_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SERVER_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A counter written by a single thread
+//
+// The owner adds with a plain load and store,
+// which costs no more than a regular increment,
+// and any thread can read the value.
+class metric_counter
+{
+public:
+    void
+    add(std::uint64_t n = 1) noexcept
+    {
+        v_.store(
+            v_.load(std::memory_order_relaxed) + n,
+            std::memory_order_relaxed);
+    }
+
+    std::uint64_t
+    value() const noexcept
+    {
+        return v_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> v_{0};
+};
+
+// A histogram of durations in microseconds
+//
+// Values below 32us have their own bucket, and
+// each power of two above is split in 16 buckets,
+// as in HDR histograms. Each recorded value is
+// within 1/16 of the bucket it falls in. Values
+// above 2^36us (about 19 hours) are clamped.
+class latency_histogram
+{
+public:
+    static constexpr std::size_t linear = 32;
+    static constexpr std::size_t sub_bits = 4;
+    static constexpr std::size_t sub_buckets = 1 << sub_bits;
+    static constexpr std::size_t max_exponent = 36;
+    static constexpr std::size_t size =
+        linear + (max_exponent - 5) * sub_buckets;
+
+    // Return the bucket of a value
+    static
+    std::size_t
+    index(std::uint64_t us) noexcept
+    {
+        if (us < linear)
+            return static_cast<std::size_t>(us);
+        std::size_t e = 0;
+        for (std::uint64_t v = us >> 1; v != 0; v >>= 1)
+            ++e;
+        if (e >= max_exponent)
+            return size - 1;
+        std::size_t sub = static_cast<std::size_t>(
+            us >> (e - sub_bits)) & (sub_buckets - 1);
+        return linear + (e - 5) * sub_buckets + sub;
+    }
+
+    // Return the smallest value in a bucket
+    static
+    std::uint64_t
+    lower_bound(std::size_t i) noexcept
+    {
+        if (i < linear)
+            return i;
+        std::size_t e = 5 + (i - linear) / sub_buckets;
+        std::uint64_t sub = (i - linear) % sub_buckets;
+        return (sub_buckets + sub) << (e - sub_bits);
+    }
+
+    // Return the value after the last one in a bucket
+    static
+    std::uint64_t
+    upper_bound(std::size_t i) noexcept
+    {
+        if (i + 1 < size)
+            return lower_bound(i + 1);
+        return std::uint64_t(1) << max_exponent;
+    }
+
+    void
+    record(std::uint64_t us) noexcept
+    {
+        buckets_[index(us)].add();
+        sum_.add(us);
+    }
+
+    template <class Rep, class Period>
+    void
+    record(std::chrono::duration<Rep, Period> d) noexcept
+    {
+        auto us = std::chrono::duration_cast<
+            std::chrono::microseconds>(d).count();
+        record(static_cast<std::uint64_t>(
+            us > 0 ? us : 0));
+    }
+
+    std::uint64_t
+    count(std::size_t i) const noexcept
+    {
+        return buckets_[i].value();
+    }
+
+    std::uint64_t
+    sum() const noexcept
+    {
+        return sum_.value();
+    }
+
+private:
+    std::array<metric_counter, size> buckets_;
+    metric_counter sum_;
+};
+
+// The SOCKS5 authentication methods
+// chosen by the server
+enum class metric_method
+{
+    none,
+    userpass,
+    no_acceptable,
+    count_
+};
+
+// The commands requested by clients
+enum class metric_command
+{
+    connect,
+    bind,
+    udp_associate,
+    unknown,
+    connect_v4,
+    unknown_v4,
+    count_
+};
+
+// The metrics of one thread
+//
+// Only the owning thread writes to a shard,
+// so recording takes no lock and no atomic
+// read-modify-write.
+struct metrics_shard
+{
+    metric_counter accepted;
+    std::array<metric_counter,
+        static_cast<std::size_t>(
+            metric_method::count_)> methods;
+    std::array<metric_counter,
+        static_cast<std::size_t>(
+            metric_command::count_)> commands;
+
+    // SOCKS5 reply codes 0x00 to 0x08,
+    // and any other code in the last one
+    std::array<metric_counter, 10> replies;
+
+    // SOCKS4 reply codes 90 to 93
+    std::array<metric_counter, 4> replies_v4;
+
+    // Userpass credentials accepted and rejected
+    std::array<metric_counter, 2> auth;
+
+    // Users refused by their tunnels, connect
+    // rate and bytes quotas
+    std::array<metric_counter, 3> quotas;
+
+    metric_counter bytes_to_target;
+    metric_counter bytes_to_client;
+
+    // From the first byte of the greeting to
+    // the reply, including resolve and connect
+    latency_histogram handshake;
+    latency_histogram resolve;
+    latency_histogram connect;
+
+    void
+    reply(unsigned char rep) noexcept
+    {
+        replies[rep < 9 ? rep : 9].add();
+    }
+
+    void
+    reply_v4(unsigned char rep) noexcept
+    {
+        if (rep >= 90 && rep <= 93)
+            replies_v4[rep - 90].add();
+    }
+};
+
+// Metrics of the server
+//
+// Each thread records into its own shard, which
+// is found through a thread-local cache, and a
+// snapshot sums all the shards. Snapshots can be
+// taken from any thread while connections record,
+// and are exported in the Prometheus text format.
+class server_metrics
+{
+public:
+    server_metrics()
+        : id_(next_id())
+    {
+    }
+
+    server_metrics(server_metrics const&) = delete;
+    server_metrics& operator=(server_metrics const&) = delete;
+
+    // Return the shard of the calling thread
+    //
+    // The cache remembers the last instance
+    // used by the thread. Other lookups take
+    // the lock.
+    metrics_shard&
+    local()
+    {
+        cache& c = local_cache();
+        if (c.id == id_)
+            return *c.shard;
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::thread::id const tid =
+            std::this_thread::get_id();
+        c.id = id_;
+        c.shard = nullptr;
+        for (std::size_t i = 0; i < shards_.size(); ++i)
+            if (threads_[i] == tid)
+                c.shard = shards_[i].get();
+        if (!c.shard)
+        {
+            shards_.emplace_back(new metrics_shard);
+            threads_.push_back(tid);
+            c.shard = shards_.back().get();
+        }
+        return *c.shard;
+    }
+
+    // Append a snapshot in the Prometheus
+    // text exposition format
+    void
+    write_prometheus(std::string& out) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto sum = [this](
+            metric_counter metrics_shard::* m)
+        {
+            std::uint64_t n = 0;
+            for (auto const& s : shards_)
+                n += ((*s).*m).value();
+            return n;
+        };
+        auto sum_at = [this](
+            std::size_t i,
+            metric_counter const& (*at)(
+                metrics_shard const&, std::size_t))
+        {
+            std::uint64_t n = 0;
+            for (auto const& s : shards_)
+                n += at(*s, i).value();
+            return n;
+        };
+
+        header(out, "socks_accepted_total", "counter",
+            "Connections accepted from the listen socket");
+        sample(out, "socks_accepted_total", "",
+            sum(&metrics_shard::accepted));
+
+        static char const* const methods[] = {
+            "none", "userpass", "no_acceptable" };
+        header(out, "socks_handshakes_total", "counter",
+            "SOCKS5 greetings by chosen method");
+        for (std::size_t i = 0; i < 3; ++i)
+            sample(out, "socks_handshakes_total",
+                std::string("method=\"") + methods[i] + "\"",
+                sum_at(i, &method_at));
+
+        static char const* const commands[] = {
+            "version=\"5\",command=\"connect\"",
+            "version=\"5\",command=\"bind\"",
+            "version=\"5\",command=\"udp_associate\"",
+            "version=\"5\",command=\"unknown\"",
+            "version=\"4\",command=\"connect\"",
+            "version=\"4\",command=\"unknown\"" };
+        header(out, "socks_requests_total", "counter",
+            "Requests by protocol version and command");
+        for (std::size_t i = 0; i < 6; ++i)
+            sample(out, "socks_requests_total",
+                commands[i], sum_at(i, &command_at));
+
+        header(out, "socks_replies_total", "counter",
+            "Replies by protocol version and code");
+        for (std::size_t i = 0; i < 10; ++i)
+            sample(out, "socks_replies_total",
+                "version=\"5\",code=\"" + (i < 9 ?
+                    std::to_string(i) : std::string("other")) +
+                    "\"",
+                sum_at(i, &reply_at));
+        for (std::size_t i = 0; i < 4; ++i)
+            sample(out, "socks_replies_total",
+                "version=\"4\",code=\"" +
+                    std::to_string(90 + i) + "\"",
+                sum_at(i, &reply_v4_at));
+
+        header(out, "socks_auth_total", "counter",
+            "Userpass credentials checked by the authenticator");
+        sample(out, "socks_auth_total", "result=\"accepted\"",
+            sum_at(0, &auth_at));
+        sample(out, "socks_auth_total", "result=\"rejected\"",
+            sum_at(1, &auth_at));
+
+        static char const* const quotas[] = {
+            "limit=\"tunnels\"",
+            "limit=\"connect_rate\"",
+            "limit=\"bytes\"" };
+        header(out, "socks_quota_rejected_total", "counter",
+            "Authenticated users refused by their quotas");
+        for (std::size_t i = 0; i < 3; ++i)
+            sample(out, "socks_quota_rejected_total",
+                quotas[i], sum_at(i, &quota_at));
+
+        header(out, "socks_relayed_bytes_total", "counter",
+            "Bytes relayed by closed connections");
+        sample(out, "socks_relayed_bytes_total",
+            "direction=\"upload\"",
+            sum(&metrics_shard::bytes_to_target));
+        sample(out, "socks_relayed_bytes_total",
+            "direction=\"download\"",
+            sum(&metrics_shard::bytes_to_client));
+
+        summary(out, "socks_handshake_duration_seconds",
+            "Time from accept to the reply",
+            &metrics_shard::handshake);
+        summary(out, "socks_resolve_duration_seconds",
+            "Time to resolve target domain names",
+            &metrics_shard::resolve);
+        summary(out, "socks_connect_duration_seconds",
+            "Time to connect to targets",
+            &metrics_shard::connect);
+    }
+
+private:
+    struct cache
+    {
+        std::uint64_t id{0};
+        metrics_shard* shard{nullptr};
+    };
+
+    // Ids are never reused, so a cache entry
+    // cannot point to the shard of an
+    // instance that was destroyed
+    static
+    std::uint64_t
+    next_id() noexcept
+    {
+        static std::atomic<std::uint64_t> n{0};
+        return ++n;
+    }
+
+    static
+    cache&
+    local_cache() noexcept
+    {
+        static thread_local cache c;
+        return c;
+    }
+
+    static
+    metric_counter const&
+    method_at(metrics_shard const& s, std::size_t i)
+    {
+        return s.methods[i];
+    }
+
+    static
+    metric_counter const&
+    command_at(metrics_shard const& s, std::size_t i)
+    {
+        return s.commands[i];
+    }
+
+    static
+    metric_counter const&
+    reply_at(metrics_shard const& s, std::size_t i)
+    {
+        return s.replies[i];
+    }
+
+    static
+    metric_counter const&
+    reply_v4_at(metrics_shard const& s, std::size_t i)
+    {
+        return s.replies_v4[i];
+    }
+
+    static
+    metric_counter const&
+    auth_at(metrics_shard const& s, std::size_t i)
+    {
+        return s.auth[i];
+    }
+
+    static
+    metric_counter const&
+    quota_at(metrics_shard const& s, std::size_t i)
+    {
+        return s.quotas[i];
+    }
+
+    static
+    void
+    header(
+        std::string& out,
+        char const* name,
+        char const* type,
+        char const* help)
+    {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    static
+    void
+    sample(
+        std::string& out,
+        char const* name,
+        std::string const& labels,
+        std::uint64_t v)
+    {
+        out += name;
+        if (!labels.empty())
+        {
+            out += '{';
+            out += labels;
+            out += '}';
+        }
+        out += ' ';
+        out += std::to_string(v);
+        out += '\n';
+    }
+
+    // Export a histogram as a summary with
+    // its quantiles, in seconds
+    void
+    summary(
+        std::string& out,
+        char const* name,
+        char const* help,
+        latency_histogram metrics_shard::* h) const
+    {
+        std::vector<std::uint64_t> counts(
+            latency_histogram::size, 0);
+        std::uint64_t total = 0;
+        std::uint64_t sum = 0;
+        for (auto const& s : shards_)
+        {
+            latency_histogram const& sh = (*s).*h;
+            for (std::size_t i = 0; i < counts.size(); ++i)
+            {
+                std::uint64_t n = sh.count(i);
+                counts[i] += n;
+                total += n;
+            }
+            sum += sh.sum();
+        }
+        header(out, name, "summary", help);
+        static double const qs[] = { 0.5, 0.9, 0.99, 0.999 };
+        static char const* const qnames[] = {
+            "0.5", "0.9", "0.99", "0.999" };
+        for (std::size_t q = 0; q < 4; ++q)
+        {
+            out += name;
+            out += "{quantile=\"";
+            out += qnames[q];
+            out += "\"} ";
+            out += seconds(quantile(counts, total, qs[q]));
+            out += '\n';
+        }
+        out += name;
+        out += "_sum ";
+        out += seconds(sum);
+        out += '\n';
+        out += name;
+        out += "_count ";
+        out += std::to_string(total);
+        out += '\n';
+    }
+
+    // Return the upper bound of the bucket
+    // holding a quantile, in microseconds
+    static
+    std::uint64_t
+    quantile(
+        std::vector<std::uint64_t> const& counts,
+        std::uint64_t total,
+        double q) noexcept
+    {
+        if (total == 0)
+            return 0;
+        std::uint64_t rank = static_cast<std::uint64_t>(
+            q * static_cast<double>(total) + 0.5);
+        if (rank == 0)
+            rank = 1;
+        std::uint64_t n = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i)
+        {
+            n += counts[i];
+            if (n >= rank)
+                return latency_histogram::upper_bound(i);
+        }
+        return latency_histogram::upper_bound(
+            counts.size() - 1);
+    }
+
+    static
+    std::string
+    seconds(std::uint64_t us)
+    {
+        std::string s = std::to_string(us / 1000000);
+        std::string frac = std::to_string(us % 1000000);
+        s += '.';
+        s.append(6 - frac.size(), '0');
+        s += frac;
+        return s;
+    }
+
+    std::uint64_t id_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<metrics_shard>> shards_;
+    std::vector<std::thread::id> threads_;
+};
+
+#endif
@@ -0,0 +1,362 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SERVER_OPTIONS_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SERVER_OPTIONS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Limits applied to client connections
+//
+// A value of 0 means the limit is disabled.
+struct admission_options
+{
+    // Maximum number of open client connections
+    std::size_t max_connections{0};
+
+    // Maximum number of connections still
+    // in the SOCKS handshake
+    std::size_t max_handshakes{0};
+
+    // Maximum number of open connections
+    // from a single client address
+    std::size_t max_connections_per_ip{0};
+};
+
+// Deadlines applied to each phase of a connection
+//
+// A value of 0 means the timeout is disabled.
+struct timeout_options
+{
+    // Time to receive the SOCKS greeting
+    // (or the SOCKS4 CONNECT request)
+    std::chrono::milliseconds greeting{std::chrono::seconds(10)};
+
+    // Time to receive the userpass sub-negotiation
+    std::chrono::milliseconds auth{std::chrono::seconds(10)};
+
+    // Time to receive the SOCKS5 request
+    std::chrono::milliseconds request{std::chrono::seconds(10)};
+
+    // Time to resolve and connect to the target
+    std::chrono::milliseconds connect{std::chrono::seconds(10)};
+
+    // Time a relay can go without
+    // transferring data in any direction
+    std::chrono::milliseconds idle{std::chrono::minutes(5)};
+
+    // Time a relay can go without transferring
+    // data once one side shut down its sending
+    // direction
+    std::chrono::milliseconds linger{std::chrono::seconds(30)};
+};
+
+// How the server connects to targets
+// with more than one address
+struct connect_options
+{
+    // Time an attempt has before the next
+    // address is tried in parallel. RFC 8305
+    // recommends 250ms.
+    std::chrono::milliseconds attempt_delay{250};
+
+    // Maximum number of attempts in flight
+    // for a single request
+    std::size_t max_attempts{4};
+};
+
+// Deadlines applied while the server drains
+//
+// A value of 0 means the deadline is disabled.
+struct drain_options
+{
+    // Time a connection still in the handshake
+    // has to start relaying
+    std::chrono::milliseconds handshake{std::chrono::seconds(5)};
+
+    // Time a relay can be idle before it is closed
+    std::chrono::milliseconds idle{std::chrono::seconds(5)};
+
+    // Time after which all connections are closed
+    std::chrono::milliseconds cutoff{std::chrono::seconds(60)};
+};
+
+// Options applied to the listen socket, to
+// accepted clients, and to target connections
+//
+// A value of 0 leaves the system default.
+struct socket_options
+{
+    // Disable Nagle's algorithm, as the
+    // handshake messages are small
+    bool no_delay{true};
+
+    // Idle time before keepalive probes
+    // are sent. 0 disables keepalive.
+    std::chrono::milliseconds keepalive_idle{std::chrono::seconds(60)};
+
+    // Time between keepalive probes
+    std::chrono::milliseconds keepalive_interval{std::chrono::seconds(10)};
+
+    // Probes lost before the connection is dropped
+    std::size_t keepalive_count{6};
+
+    // SO_RCVBUF and SO_SNDBUF in bytes
+    std::size_t receive_buffer_size{0};
+    std::size_t send_buffer_size{0};
+
+    // Acknowledge data immediately (Linux)
+    bool quick_ack{false};
+
+    // Queue of pending TCP Fast Open requests
+    // on the listen socket. 0 disables it.
+    std::size_t fast_open_queue{0};
+
+    // Use TCP Fast Open to connect to targets
+    bool fast_open_connect{false};
+
+    // Only accept clients once they sent data
+    // (Linux). 0 disables it.
+    std::chrono::milliseconds defer_accept{0};
+};
+
+// Rates of relayed data, in bytes per second
+//
+// A value of 0 means the rate is not limited.
+struct shaping_options
+{
+    // From the client to the target, and from
+    // the target to the client, per connection
+    std::size_t upload_rate{0};
+    std::size_t download_rate{0};
+
+    // The same, shared by all the connections
+    // of an authenticated user
+    std::size_t user_upload_rate{0};
+    std::size_t user_download_rate{0};
+
+    // Bytes that can be relayed at once after
+    // a pause. 0 allows one second of the rate.
+    std::size_t burst{0};
+};
+
+// How the server logs connections and errors
+struct log_options
+{
+    // File the records are appended to.
+    // Empty writes to the standard error.
+    std::string path;
+
+    // Write one access record per connection
+    bool access{true};
+
+    // Write the access record of one
+    // connection in this many
+    std::size_t access_sample{1};
+
+    // Errors written per second by each thread,
+    // and the burst allowed after a quiet period.
+    // A rate of 0 does not limit errors.
+    std::size_t error_rate{100};
+    std::size_t error_burst{0};
+
+    // Records each thread can queue
+    // before they are dropped
+    std::size_t buffer_size{1024};
+
+    // Time between writes of the queued records
+    std::chrono::milliseconds flush_interval{50};
+};
+
+// How the server authenticates users
+struct authentication_options
+{
+    // File with one user:record line per user,
+    // where records come from --hash-password.
+    // Empty accepts any username and password.
+    std::string users_file;
+
+    // Time between checks of the file for
+    // changes. 0 disables reloading.
+    std::chrono::milliseconds reload_interval{std::chrono::seconds(5)};
+
+    // Verified credentials remembered, so
+    // repeated logins skip the key derivation.
+    // 0 disables the cache.
+    std::size_t cache_size{4096};
+
+    // Time a verified credential is remembered.
+    // 0 keeps it until it is evicted.
+    std::chrono::milliseconds cache_ttl{std::chrono::minutes(5)};
+
+    // Threads deriving keys, so the io thread
+    // never does. 0 derives them on the io thread.
+    std::size_t verify_threads{2};
+
+    // Checks waiting for a verify thread before
+    // new ones are rejected. 0 does not limit them.
+    std::size_t verify_queue{256};
+};
+
+// Which targets clients can connect to
+struct access_options
+{
+    // File with one allow or deny rule per line,
+    // where the first matching rule decides and
+    // requests no rule matches are denied.
+    // Empty allows every request.
+    std::string rules_file;
+
+    // Time between checks of the file for
+    // changes. 0 disables reloading.
+    std::chrono::milliseconds reload_interval{std::chrono::seconds(5)};
+};
+
+// Limits on the tunnels of each authenticated user
+//
+// A value of 0 means the limit is disabled.
+struct quota_options
+{
+    // Tunnels a user can have open at once
+    std::size_t max_tunnels{0};
+
+    // Connections a user can open per second,
+    // and the burst allowed after a quiet
+    // period. A burst of 0 allows one second
+    // of the rate.
+    std::size_t connect_rate{0};
+    std::size_t connect_burst{0};
+
+    // Bytes the closed tunnels of a user can
+    // have relayed in each window. A window
+    // of 0 never forgets the bytes.
+    std::size_t max_bytes{0};
+    std::chrono::milliseconds window{std::chrono::hours(1)};
+
+    // Time between merges of the counters of
+    // each thread. Other threads can exceed
+    // the limits by what they did since.
+    // 0 merges them on every new tunnel.
+    std::chrono::milliseconds sync_interval{100};
+};
+
+// A parent proxy connections can be forwarded to
+struct upstream_proxy
+{
+    // Name the rules select the proxy with
+    std::string name;
+
+    std::string host;
+    std::string port;
+
+    // 4 or 5
+    int version{5};
+
+    // Username and password sent to a SOCKS5
+    // proxy. The username is the ident of the
+    // requests to a SOCKS4 proxy.
+    std::string user;
+    std::string password;
+};
+
+// How the server forwards connections
+// to parent proxies
+struct upstream_options
+{
+    std::vector<upstream_proxy> proxies;
+
+    // Idle connections kept open to each proxy,
+    // authenticated in advance, so forwarding a
+    // request only costs its round trip.
+    // 0 opens a connection per request.
+    std::size_t pool_size{4};
+
+    // Time to connect to a proxy and
+    // authenticate, for pooled connections
+    std::chrono::milliseconds timeout{std::chrono::seconds(10)};
+
+    // Time before filling the pool again
+    // after a proxy could not be reached
+    std::chrono::milliseconds retry_delay{std::chrono::seconds(1)};
+};
+
+// A target the server connects to in advance
+struct hot_target
+{
+    std::string host;
+    std::string port;
+};
+
+// How the server keeps connections
+// open to hot targets
+struct preconnect_options
+{
+    std::vector<hot_target> targets;
+
+    // Idle connections kept open to each
+    // target, so a request for it is
+    // answered without a TCP handshake
+    std::size_t pool_size{4};
+
+    // Time an idle connection is kept open.
+    // Connections are only replaced while the
+    // target is used, so the pool of a target
+    // nobody asked for in this time is empty.
+    // It should be shorter than the idle
+    // timeout of the target itself.
+    std::chrono::milliseconds idle_timeout{std::chrono::seconds(30)};
+
+    // Time before filling the pool again
+    // after a target could not be reached
+    std::chrono::milliseconds retry_delay{std::chrono::seconds(1)};
+};
+
+// Where connections to targets leave the server from
+struct egress_options
+{
+    // Local addresses connections to targets
+    // are bound to. Each address has its own
+    // ephemeral ports, so more addresses allow
+    // more connections to a single target.
+    // Empty lets the kernel pick.
+    std::vector<std::string> source_addresses;
+
+    // Pick the source from a hash of the target
+    // address, so a target always sees the same
+    // one, rather than taking them in turn,
+    // which spreads the connections to a
+    // single target
+    bool hash_target{false};
+
+    // Pick the port at connect rather than at
+    // bind (IP_BIND_ADDRESS_NO_PORT, Linux), so
+    // a port can be used with different targets
+    bool bind_no_port{true};
+};
+
+// Options for the SOCKS server
+struct server_options
+{
+    admission_options admission;
+    timeout_options timeouts;
+    connect_options connect;
+    drain_options drain;
+    socket_options sockets;
+    shaping_options shaping;
+    log_options logging;
+    authentication_options auth;
+    access_options access;
+    quota_options quotas;
+    upstream_options upstreams;
+    preconnect_options preconnect;
+    egress_options egress;
+};
+
+#endif
@@ -0,0 +1,159 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SHA1_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SHA1_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+using sha1_digest = std::array<unsigned char, 20>;
+
+// Incremental SHA-1 (FIPS 180-4)
+//
+// The state is a plain value, so a context that
+// absorbed a common prefix can be copied and
+// continued, as HMAC does with its padded keys.
+class sha1_context
+{
+public:
+    sha1_context() noexcept
+        : h_{
+            0x67452301, 0xefcdab89, 0x98badcfe,
+            0x10325476, 0xc3d2e1f0}
+    {
+    }
+
+    void
+    update(
+        void const* data,
+        std::size_t n) noexcept
+    {
+        auto p = static_cast<unsigned char const*>(data);
+        size_ += n;
+        if (used_ != 0)
+        {
+            std::size_t k = sizeof(block_) - used_;
+            if (k > n)
+                k = n;
+            std::memcpy(block_ + used_, p, k);
+            used_ += k;
+            p += k;
+            n -= k;
+            if (used_ < sizeof(block_))
+                return;
+            compress(block_);
+            used_ = 0;
+        }
+        for (; n >= sizeof(block_); n -= sizeof(block_))
+        {
+            compress(p);
+            p += sizeof(block_);
+        }
+        std::memcpy(block_, p, n);
+        used_ = n;
+    }
+
+    sha1_digest
+    finish() noexcept
+    {
+        std::uint64_t bits = size_ * 8;
+        block_[used_++] = 0x80;
+        if (used_ > 56)
+        {
+            std::memset(block_ + used_, 0, sizeof(block_) - used_);
+            compress(block_);
+            used_ = 0;
+        }
+        std::memset(block_ + used_, 0, 56 - used_);
+        for (int i = 0; i < 8; ++i)
+            block_[56 + i] = static_cast<unsigned char>(
+                bits >> (56 - 8 * i));
+        compress(block_);
+        sha1_digest d;
+        for (std::size_t i = 0; i < 5; ++i)
+        {
+            d[4 * i] = static_cast<unsigned char>(h_[i] >> 24);
+            d[4 * i + 1] = static_cast<unsigned char>(h_[i] >> 16);
+            d[4 * i + 2] = static_cast<unsigned char>(h_[i] >> 8);
+            d[4 * i + 3] = static_cast<unsigned char>(h_[i]);
+        }
+        return d;
+    }
+
+private:
+    static
+    std::uint32_t
+    rol(std::uint32_t x, int n) noexcept
+    {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    void
+    compress(unsigned char const* p) noexcept
+    {
+        std::uint32_t w[80];
+        for (std::size_t i = 0; i < 16; ++i)
+            w[i] =
+                (std::uint32_t(p[4 * i]) << 24) |
+                (std::uint32_t(p[4 * i + 1]) << 16) |
+                (std::uint32_t(p[4 * i + 2]) << 8) |
+                std::uint32_t(p[4 * i + 3]);
+        for (std::size_t i = 16; i < 80; ++i)
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        std::uint32_t a = h_[0];
+        std::uint32_t b = h_[1];
+        std::uint32_t c = h_[2];
+        std::uint32_t d = h_[3];
+        std::uint32_t e = h_[4];
+        for (std::size_t i = 0; i < 80; ++i)
+        {
+            std::uint32_t f;
+            std::uint32_t k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            std::uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+        h_[0] += a;
+        h_[1] += b;
+        h_[2] += c;
+        h_[3] += d;
+        h_[4] += e;
+    }
+
+    std::uint32_t h_[5];
+    unsigned char block_[64] = {};
+    std::size_t used_{0};
+    std::uint64_t size_{0};
+};
+
+#endif
@@ -0,0 +1,240 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SOCKET_TUNING_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SOCKET_TUNING_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+// Functions applying the socket_options profile
+//
+// Options are applied on a best effort basis.
+// Those not supported by the platform are
+// skipped, and failures are ignored, since a
+// socket without them still works.
+
+namespace tuning {
+
+// An integer socket option Asio has no type for
+//
+// This meets the GettableSocketOption and
+// SettableSocketOption requirements.
+template <int Level, int Name>
+class int_option
+{
+public:
+    int_option() = default;
+
+    explicit
+    int_option(int v) noexcept
+        : value_(v)
+    {
+    }
+
+    int
+    value() const noexcept
+    {
+        return value_;
+    }
+
+    template <class Protocol>
+    int
+    level(Protocol const&) const noexcept
+    {
+        return Level;
+    }
+
+    template <class Protocol>
+    int
+    name(Protocol const&) const noexcept
+    {
+        return Name;
+    }
+
+    template <class Protocol>
+    int*
+    data(Protocol const&) noexcept
+    {
+        return &value_;
+    }
+
+    template <class Protocol>
+    int const*
+    data(Protocol const&) const noexcept
+    {
+        return &value_;
+    }
+
+    template <class Protocol>
+    std::size_t
+    size(Protocol const&) const noexcept
+    {
+        return sizeof(value_);
+    }
+
+    template <class Protocol>
+    void
+    resize(Protocol const&, std::size_t n)
+    {
+        if (n != sizeof(value_))
+            throw std::length_error(
+                "int_option resize");
+    }
+
+private:
+    int value_{0};
+};
+
+inline
+int
+to_seconds(std::chrono::milliseconds d) noexcept
+{
+    auto s = (d.count() + 999) / 1000;
+    return s < 1 ? 1 : static_cast<int>(s);
+}
+
+template <class Socket>
+void
+set_keepalive(
+    Socket& s,
+    socket_options const& opt)
+{
+    error_code ec;
+    bool on = opt.keepalive_idle.count() > 0;
+    s.set_option(asio::socket_base::keep_alive(on), ec);
+    if (!on)
+        return;
+#if defined(TCP_KEEPIDLE)
+    s.set_option(int_option<IPPROTO_TCP, TCP_KEEPIDLE>(
+        to_seconds(opt.keepalive_idle)), ec);
+#endif
+#if defined(TCP_KEEPINTVL)
+    if (opt.keepalive_interval.count() > 0)
+        s.set_option(int_option<IPPROTO_TCP, TCP_KEEPINTVL>(
+            to_seconds(opt.keepalive_interval)), ec);
+#endif
+#if defined(TCP_KEEPCNT)
+    if (opt.keepalive_count > 0)
+        s.set_option(int_option<IPPROTO_TCP, TCP_KEEPCNT>(
+            static_cast<int>(opt.keepalive_count)), ec);
+#endif
+}
+
+template <class Socket>
+void
+set_buffer_sizes(
+    Socket& s,
+    socket_options const& opt)
+{
+    error_code ec;
+    if (opt.receive_buffer_size != 0)
+        s.set_option(asio::socket_base::receive_buffer_size(
+            static_cast<int>(opt.receive_buffer_size)), ec);
+    if (opt.send_buffer_size != 0)
+        s.set_option(asio::socket_base::send_buffer_size(
+            static_cast<int>(opt.send_buffer_size)), ec);
+}
+
+} // tuning
+
+// Tune the listen socket
+//
+// Accepted sockets inherit the buffer sizes
+// and keepalive settings of the listener on
+// most platforms, and TCP_DEFER_ACCEPT only
+// wakes the server once the client sent its
+// greeting.
+inline
+void
+tune_listener(
+    tcp::acceptor& a,
+    socket_options const& opt)
+{
+    error_code ec;
+    tuning::set_buffer_sizes(a, opt);
+#if defined(TCP_DEFER_ACCEPT)
+    if (opt.defer_accept.count() > 0)
+        a.set_option(tuning::int_option<
+            IPPROTO_TCP, TCP_DEFER_ACCEPT>(
+                tuning::to_seconds(opt.defer_accept)), ec);
+#endif
+#if defined(TCP_FASTOPEN)
+    if (opt.fast_open_queue > 0)
+        a.set_option(tuning::int_option<
+            IPPROTO_TCP, TCP_FASTOPEN>(
+                static_cast<int>(opt.fast_open_queue)), ec);
+#endif
+}
+
+// Tune an accepted client socket
+inline
+void
+tune_accepted(
+    tcp::socket& s,
+    socket_options const& opt)
+{
+    error_code ec;
+    if (opt.no_delay)
+        s.set_option(tcp::no_delay(true), ec);
+    tuning::set_keepalive(s, opt);
+    tuning::set_buffer_sizes(s, opt);
+#if defined(TCP_QUICKACK)
+    // Linux clears this flag as the connection
+    // goes on, so it mostly speeds up the
+    // acknowledgement of the handshake
+    if (opt.quick_ack)
+        s.set_option(tuning::int_option<
+            IPPROTO_TCP, TCP_QUICKACK>(1), ec);
+#endif
+}
+
+// Tune an outbound socket before it connects
+//
+// Buffer sizes must be set before connecting
+// for the window scale to account for them.
+inline
+void
+tune_outbound(
+    tcp::socket& s,
+    socket_options const& opt)
+{
+    error_code ec;
+    if (opt.no_delay)
+        s.set_option(tcp::no_delay(true), ec);
+    tuning::set_keepalive(s, opt);
+    tuning::set_buffer_sizes(s, opt);
+#if defined(TCP_QUICKACK)
+    if (opt.quick_ack)
+        s.set_option(tuning::int_option<
+            IPPROTO_TCP, TCP_QUICKACK>(1), ec);
+#endif
+#if defined(TCP_FASTOPEN_CONNECT)
+    // The SYN carries the first data written
+    // when the target gave us a cookie before.
+    // The connect completes before the target
+    // answers, so failures to reach it are only
+    // seen when relaying.
+    if (opt.fast_open_connect)
+        s.set_option(tuning::int_option<
+            IPPROTO_TCP, TCP_FASTOPEN_CONNECT>(1), ec);
+#endif
+}
+
+#endif
@@ -0,0 +1,1602 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SOCKS_CONNECTION_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SOCKS_CONNECTION_HPP
+
+#include "access_rules.hpp"
+#include "admission_control.hpp"
+#include "authenticator.hpp"
+#include "common.hpp"
+#include "drain_control.hpp"
+#include "relay.hpp"
+#include "server_log.hpp"
+#include "server_metrics.hpp"
+#include "server_options.hpp"
+#include "target_connector.hpp"
+#include "traffic_shaper.hpp"
+#include "target_pool.hpp"
+#include "upstream_pool.hpp"
+#include "user_quotas.hpp"
+
+#include <boost/socks/timer_wheel.hpp>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <boost/core/detail/string_view.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class socks_connection
+    : public std::enable_shared_from_this<socks_connection>
+    , private drain_control::hook
+{
+public:
+    using pointer = std::shared_ptr<socks_connection>;
+
+    static
+    pointer
+    create(
+        boost::asio::io_context& io_context,
+        tcp::socket socket,
+        admission_ticket ticket,
+        std::shared_ptr<server_options const> opt,
+        std::shared_ptr<drain_control> drain,
+        std::shared_ptr<traffic_shaper> shaper,
+        std::shared_ptr<server_metrics> metrics,
+        std::shared_ptr<server_log> log,
+        std::shared_ptr<authenticator> auth = {},
+        std::shared_ptr<access_rules> rules = {},
+        std::shared_ptr<user_quotas> quotas = {},
+        std::shared_ptr<upstream_set> upstreams = {},
+        std::shared_ptr<target_set> targets = {},
+        std::shared_ptr<source_pool> sources = {})
+    {
+        return pointer(new socks_connection(
+            io_context,
+            std::move(socket),
+            std::move(ticket),
+            std::move(opt),
+            std::move(drain),
+            std::move(shaper),
+            std::move(metrics),
+            std::move(log),
+            std::move(auth),
+            std::move(rules),
+            std::move(quotas),
+            std::move(upstreams),
+            std::move(targets),
+            std::move(sources)));
+    }
+
+    ~socks_connection()
+    {
+        drain_->remove(*this);
+        quota_.close(
+            relay_.bytes_to_target() +
+            relay_.bytes_to_client());
+        if (log_access_)
+            write_access_record();
+    }
+
+    tcp::socket&
+    socket()
+    {
+        return socket_;
+    }
+
+    void
+    start()
+    {
+        started_ = clock_type::now();
+        error_code ec;
+        client_ = socket_.remote_endpoint(ec);
+        if (ec.failed())
+            return fail(ec, "Cannot get client endpoint");
+        log_access_ = log_->sample_access();
+        set_phase(phase::greeting);
+        auto self(shared_from_this());
+        /*
+         * Read a
+         * - SOCKS5 greeting, or
+         * - SOCKS4 connect
+         */
+        asio::async_read(
+            socket_,
+            asio::buffer(buffer_),
+            [this](const error_code& ec, std::size_t n)
+            {
+                // Stop reading at invalid version
+                if (ec.failed()
+                    || (n > 0 &&
+                        buffer_[0] != 0x05
+                        && buffer_[0] != 0x04))
+                    return std::size_t(0);
+
+                // SOCKS4 Connect
+                // - VER | CMD | DSTPORT | DSTIP | USERID | NULLs
+                if (buffer_[0] == 0x04)
+                {
+                    // USERID ends with NULL
+                    // We read from until we find a NULL,
+                    // with a limit of buffer_.size()
+                    // which means a username of
+                    // up to 250 chars
+                    const std::size_t maxn = buffer_.size();
+                    // Check CMD
+                    if (n >= 1 && buffer_[1] != 0x01)
+                        return std::size_t(0);
+                    // Anything is valid for the next
+                    // 6 bytes DSTPORT | DSTIP, so we
+                    // look for NULL after buffer_[8]
+                    // to stop reading
+                    if (n >= 9)
+                        for (std::size_t i = 8; i < n; ++i)
+                            if (buffer_[i] == 0x00)
+                                return std::size_t(0);
+                    // Keep allowing the max otherwise
+                    return maxn - n;
+                }
+
+                // SOCKS5 Greeting
+                // - VER / NMETHODS / METHODS
+                // Read all methods
+                if (n >= 2)
+                {
+                    std::size_t nmethods = buffer_[1];
+                    std::size_t greet_n = 2 + nmethods;
+                    if (n < greet_n)
+                        return greet_n - n;
+                    return std::size_t(0);
+                }
+                // Read VER / NMETHODS first, so a
+                // request pipelined with the greeting
+                // is left for the next read
+                return std::size_t(2) - n;
+            },
+            [this, self](error_code ec, std::size_t n)
+            {
+                if (!ec.failed())
+                {
+                    buffer_.resize(n);
+                    if (buffer_[0] == 0x05)
+                        return parse_socks_greeting();
+                    else if (buffer_[0] == 0x04)
+                        return parse_socks_connect_v4();
+                }
+                fail(ec, "Failure to read SOCKS greeting");
+            }
+        );
+    }
+
+private:
+    using clock_type = std::chrono::steady_clock;
+
+    socks_connection(
+        asio::io_context& ioc,
+        tcp::socket socket,
+        admission_ticket ticket,
+        std::shared_ptr<server_options const> opt,
+        std::shared_ptr<drain_control> drain,
+        std::shared_ptr<traffic_shaper> shaper,
+        std::shared_ptr<server_metrics> metrics,
+        std::shared_ptr<server_log> log,
+        std::shared_ptr<authenticator> auth,
+        std::shared_ptr<access_rules> rules,
+        std::shared_ptr<user_quotas> quotas,
+        std::shared_ptr<upstream_set> upstreams,
+        std::shared_ptr<target_set> targets,
+        std::shared_ptr<source_pool> sources)
+        : ioc_(ioc),
+          socket_(std::move(socket)),
+          ticket_(std::move(ticket)),
+          opt_(std::move(opt)),
+          drain_(std::move(drain)),
+          shaper_(std::move(shaper)),
+          metrics_(std::move(metrics)),
+          stats_(metrics_->local()),
+          log_(std::move(log)),
+          auth_(std::move(auth)),
+          rules_(std::move(rules)),
+          quotas_(std::move(quotas)),
+          upstreams_(std::move(upstreams)),
+          targets_(std::move(targets)),
+          sources_(std::move(sources)),
+          buffer_(258, 0x00),
+          target_socket_(ioc),
+          resolver_(ioc),
+          deadline_(ioc.get_executor()),
+          relay_(socket_, target_socket_)
+    {
+        deadline_.on_expire(
+            &socks_connection::on_deadline, this);
+        relay_.on_activity(
+            &socks_connection::on_activity, this);
+        drain_->add(*this);
+    }
+
+    // The phases of a connection with their own deadline
+    enum class phase
+    {
+        greeting,
+        auth,
+        request,
+        connect,
+        relay,
+        half_closed
+    };
+
+    // Return the timeout of a phase
+    //
+    // Timeouts are shortened while the server
+    // drains, so handshakes finish and relays
+    // close once idle or at the cutoff.
+    std::chrono::milliseconds
+    phase_timeout(phase p) const noexcept
+    {
+        std::chrono::milliseconds d{0};
+        timeout_options const& t = opt_->timeouts;
+        switch (p)
+        {
+        case phase::greeting: d = t.greeting; break;
+        case phase::auth:     d = t.auth;     break;
+        case phase::request:  d = t.request;  break;
+        case phase::connect:  d = t.connect;  break;
+        case phase::relay:    d = t.idle;     break;
+        case phase::half_closed:
+            d = t.linger;
+            if (t.idle.count() > 0 &&
+                (d.count() == 0 || t.idle < d))
+                d = t.idle;
+            break;
+        }
+        if (!drain_->draining())
+            return d;
+        drain_options const& o = drain_->options();
+        std::chrono::milliseconds grace =
+            relaying(p) ? o.idle : o.handshake;
+        if (grace.count() > 0 &&
+            (d.count() == 0 || grace < d))
+            d = grace;
+        std::chrono::milliseconds left =
+            drain_->remaining();
+        if (left.count() > 0 &&
+            (d.count() == 0 || left < d))
+            d = left;
+        return d;
+    }
+
+    static
+    bool
+    relaying(phase p) noexcept
+    {
+        return
+            p == phase::relay ||
+            p == phase::half_closed;
+    }
+
+    // Enter a phase and schedule its deadline
+    void
+    set_phase(phase p)
+    {
+        phase_ = p;
+        std::chrono::milliseconds d = phase_timeout(p);
+        if (d.count() > 0)
+        {
+            last_active_ = deadline_.wheel().now();
+            deadline_.expires_after(d);
+        }
+        else
+        {
+            deadline_.cancel();
+        }
+    }
+
+    // Record relay activity
+    //
+    // The idle deadline is not rescheduled on
+    // every read. It only checks this tick when
+    // it expires.
+    void
+    touch() noexcept
+    {
+        last_active_ = deadline_.wheel().now();
+    }
+
+    static
+    void
+    on_activity(void* p)
+    {
+        static_cast<socks_connection*>(p)->touch();
+    }
+
+    static
+    void
+    on_deadline(void* p)
+    {
+        static_cast<socks_connection*>(p)->on_deadline();
+    }
+
+    // Shorten the deadline of the current phase
+    void
+    on_drain() override
+    {
+        set_phase(phase_);
+    }
+
+    void
+    on_deadline()
+    {
+        if (relaying(phase_))
+        {
+            if (drain_->past_cutoff())
+            {
+                fail(asio::error::timed_out, "Relay drained");
+                return close();
+            }
+            std::uint64_t idle =
+                deadline_.wheel().now() - last_active_;
+            std::uint64_t limit =
+                boost::socks::timer_wheel::to_ticks(
+                    phase_timeout(phase_));
+            if (idle < limit)
+            {
+                // Some data went through since the
+                // deadline was set
+                deadline_.expires_after(
+                    boost::socks::timer_wheel::resolution() *
+                    static_cast<int>(limit - idle));
+                return;
+            }
+            fail(asio::error::timed_out, phase_ == phase::relay ?
+                "Relay idle" : "Half-closed relay idle");
+            return close();
+        }
+        if (phase_ == phase::connect)
+        {
+            // The pending resolve or connect completes
+            // with operation_aborted, and its handler
+            // sends the failure reply
+            resolver_.cancel();
+            if (connector_)
+                connector_->cancel();
+            if (upstream_request_)
+                upstream_request_->cancel();
+            return;
+        }
+        fail(asio::error::timed_out, "SOCKS handshake");
+        close();
+    }
+
+    void
+    close()
+    {
+        deadline_.cancel();
+        resolver_.cancel();
+        if (connector_)
+            connector_->cancel();
+        if (upstream_request_)
+            upstream_request_->cancel();
+        error_code ec;
+        socket_.close(ec);
+        target_socket_.close(ec);
+    }
+
+    void
+    parse_socks_greeting()
+    {
+        // VER / NMETHODS / METHODS
+        if (buffer_.empty())
+            return fail(
+                asio::error::message_size,
+                "Empty SOCKS greeting");
+        if (buffer_[0] != 0x05)
+            return fail(
+                asio::error::no_protocol_option,
+                "Bad SOCKS version");
+        if (buffer_.size() == 1)
+            return fail(
+                asio::error::message_size,
+                "Empty SOCKS auth methods");
+        if (buffer_[1] != buffer_.size() - 2)
+            return fail(
+                asio::error::message_size,
+                "Missing SOCKS auth methods");
+        version_ = 5;
+
+        // At this point, the range [buffer[2], ...]
+        // contains the possible authentication methods
+        // We attempt 0x02 (userpass) or 0x00 (no auth),
+        // which is only acceptable without an
+        // authenticator
+        for (std::size_t i = 2; i < buffer_.size(); ++i)
+        {
+            if (buffer_[i] == 0x02)
+            {
+                server_choice_ = 0x02;
+                return do_server_choice();
+            }
+        }
+
+        for (std::size_t i = 2; !auth_ && i < buffer_.size(); ++i)
+        {
+            if (buffer_[i] == 0x00)
+            {
+                server_choice_ = 0x00;
+                return do_server_choice();
+            }
+        }
+
+        // No acceptable method
+        server_choice_ = 0xFF;
+        do_server_choice();
+    }
+
+    void
+    do_server_choice()
+    {
+        stats_.methods[static_cast<std::size_t>(
+            server_choice_ == 0x02 ? metric_method::userpass :
+            server_choice_ == 0x00 ? metric_method::none :
+            metric_method::no_acceptable)].add();
+        buffer_ = {0x05, server_choice_};
+        auto self(shared_from_this());
+        asio::async_write(
+            socket_,
+            asio::buffer(buffer_),
+            [this, self](error_code ec, std::size_t)
+            {
+                if (ec.failed())
+                    fail(ec, "Cannot write greeting response");
+                else if (self->server_choice_ == 0xFF)
+                    fail(ec, "No compatible client auth method");
+                else if (self->server_choice_ == 0x02)
+                    do_userpass_greet();
+                else
+                    do_read_connect_request();
+            }
+        );
+    }
+
+    void
+    do_userpass_greet()
+    {
+        set_phase(phase::auth);
+        buffer_.resize(513);
+        auto self(shared_from_this());
+        asio::async_read(
+            socket_,
+            asio::buffer(buffer_),
+            [this](const error_code& ec, std::size_t n)
+            {
+                if (ec.failed())
+                    return std::size_t(0);
+                // Userpass greeting
+                constexpr std::size_t nmax = 513;
+                // VER | IDLEN | ID  | PWLEN | PW
+                // Stop reading at invalid version
+                if (n >= 1 && buffer_[0] != 0x01)
+                    return std::size_t(0);
+                // Never read past the message, as
+                // the request might follow it
+                if (n < 2)
+                    return 2 - n;
+                std::size_t idlen = buffer_[1];
+                if (n < 3 + idlen)
+                    return 3 + idlen - n;
+                std::size_t pwlen = buffer_[2+idlen];
+                std::size_t req_n = 3 + idlen + pwlen;
+                BOOST_ASSERT(req_n <= nmax);
+                boost::ignore_unused(nmax);
+                return req_n - n;
+            },
+            [this, self](error_code ec, std::size_t n)
+            {
+                if (!ec.failed())
+                {
+                    buffer_.resize(n);
+                    parse_userpass_greeting();
+                }
+                else
+                {
+                    fail(ec, "Failure to read SOCKS userpass greeting");
+                }
+            }
+        );
+    }
+
+    void
+    parse_userpass_greeting()
+    {
+        // VER | IDLEN | ID  | PWLEN | PW
+        if (buffer_.empty())
+            return fail(
+                asio::error::message_size,
+                "Empty userpass greeting");
+        if (buffer_[0] != 0x01)
+            return fail(
+                asio::error::no_protocol_option,
+                "Bad userpass version");
+        if (buffer_.size() == 1)
+            return fail(
+                asio::error::message_size,
+                "Missing SOCKS username");
+        std::size_t idlen = buffer_[1];
+        if (buffer_.size() < idlen + 2)
+            return fail(
+                asio::error::message_size,
+                "Incomplete SOCKS username");
+        if (buffer_.size() < idlen + 3)
+            return fail(
+                asio::error::message_size,
+                "Missing SOCKS password");
+        std::size_t passlen = buffer_[2 + idlen];
+        if (buffer_.size() < idlen + 3 + passlen)
+            return fail(
+                asio::error::message_size,
+                "Incomplete SOCKS password");
+
+        // Message is OK
+        boost::core::string_view username(
+            reinterpret_cast<char*>(buffer_.data()) + 2,
+            idlen);
+        boost::core::string_view password(
+            reinterpret_cast<char*>(buffer_.data()) + 3 + idlen,
+            passlen);
+        user_.assign(username.data(), username.size());
+
+        // Without an authenticator, this server
+        // accepts any username and password
+        if (!auth_)
+            return do_userpass_reply(true);
+
+        // The authenticator might complete on
+        // another thread, which must not hold the
+        // last reference to this connection
+        auto self(shared_from_this());
+        auth_->async_verify(
+            user_,
+            std::string(password.data(), password.size()),
+            [self](bool ok) mutable
+            {
+                auto ex = self->socket_.get_executor();
+                asio::post(
+                    ex,
+                    std::bind(
+                        &socks_connection::on_verified,
+                        std::move(self),
+                        ok));
+            });
+    }
+
+    void
+    on_verified(bool ok)
+    {
+        // The deadline closed the socket
+        if (!socket_.is_open())
+            return;
+        stats_.auth[ok ? 0 : 1].add();
+        do_userpass_reply(ok);
+    }
+
+    void
+    do_userpass_reply(bool ok)
+    {
+        // Users over a quota fail the
+        // sub-negotiation like a bad password
+        char const* what = "Authentication failed";
+        if (ok && quotas_)
+        {
+            quota_limit l = quotas_->open(user_, quota_);
+            if (l != quota_limit::none)
+            {
+                stats_.quotas[static_cast<std::size_t>(l) - 1].add();
+                what = "User quota exceeded";
+                ok = false;
+            }
+        }
+        // VER | STATUS
+        buffer_ = {0x01, static_cast<unsigned char>(ok ? 0x00 : 0x01)};
+        auto self(shared_from_this());
+        asio::async_write(
+            socket_,
+            asio::buffer(buffer_),
+            [this, self, ok, what](error_code ec, std::size_t)
+            {
+                if (ec.failed())
+                    fail(ec, "Cannot write userpass response");
+                else if (!ok)
+                    fail(asio::error::access_denied, what);
+                else
+                    do_read_connect_request();
+            }
+        );
+    }
+
+    void
+    do_read_connect_request()
+    {
+        set_phase(phase::request);
+        buffer_.resize(263);
+        auto self(shared_from_this());
+        asio::async_read(
+            socket_,
+            asio::buffer(buffer_),
+            [this](const error_code& ec, std::size_t n)
+            {
+                // Greeting
+                // VER | CMD |  RSV  | ATYP | DST.ADDR | DST.PORT
+                // Stop reading at invalid VER,
+                // CMD, or RSV.
+                if (ec.failed()
+                    || (n >= 1 && buffer_[0] != 0x05)
+                    || (n >= 2 && buffer_[1] != 0x01)
+                    || (n >= 3 && buffer_[2] != 0x00))
+                    return std::size_t(0);
+                // Never read past the request, as
+                // the client might send data before
+                // the reply
+                if (n < 4)
+                    return 4 - n;
+                std::size_t req_n;
+                switch (buffer_[3])
+                {
+                case 0x01:
+                    req_n = 10;
+                    break;
+                case 0x03:
+                {
+                    if (n < 5)
+                        return 5 - n;
+                    req_n = 7 + buffer_[4];
+                    break;
+                }
+                case 0x04:
+                    req_n = 22;
+                    break;
+                default:
+                    req_n = 0;
+                    break;
+                }
+                if (n < req_n)
+                    return req_n - n;
+                return std::size_t(0);
+            },
+            [this, self](error_code ec, std::size_t n)
+            {
+                if (!ec.failed())
+                {
+                    buffer_.resize(n);
+                    return parse_socks_connect();
+                }
+                fail(ec, "Failure to read SOCKS connect");
+            }
+        );
+    }
+
+    void
+    parse_socks_connect()
+    {
+        // VER | IDLEN | ID  | PWLEN | PW
+        if (buffer_.empty())
+            return fail(
+                asio::error::message_size,
+                "Empty SOCKS connect");
+        if (buffer_[0] != 0x05)
+        {
+            fail(
+                asio::error::no_protocol_option,
+                "Bad SOCKS request version");
+            // general SOCKS server failure
+            return do_connect_reply(0x01);
+        }
+        if (buffer_.size() == 1)
+        {
+            fail(
+                asio::error::message_size,
+                "Missing SOCKS command");
+            // general SOCKS server failure
+            return do_connect_reply(0x01);
+        }
+        stats_.commands[static_cast<std::size_t>(
+            buffer_[1] == 0x01 ? metric_command::connect :
+            buffer_[1] == 0x02 ? metric_command::bind :
+            buffer_[1] == 0x03 ? metric_command::udp_associate :
+            metric_command::unknown)].add();
+        if (buffer_[1] != 0x01)
+        {
+            fail(
+                asio::error::message_size,
+                "Invalid SOCKS connect command");
+            // Command not supported
+            return do_connect_reply(0x07);
+        }
+        if (buffer_.size() == 2)
+        {
+            fail(
+                asio::error::message_size,
+                "Missing SOCKS reserved byte");
+            // general SOCKS server failure
+            return do_connect_reply(0x01);
+        }
+        if (buffer_[2] != 0x00)
+        {
+            fail(
+                asio::error::message_size,
+                "Invalid SOCKS reserved byte");
+            // general SOCKS server failure
+            return do_connect_reply(0x01);
+        }
+        if (buffer_.size() == 3)
+        {
+            fail(
+                asio::error::message_size,
+                "Missing SOCKS address type");
+            // general SOCKS server failure
+            return do_connect_reply(0x01);
+        }
+        if (buffer_[3] != 0x01
+            && buffer_[3] != 0x03
+            && buffer_[3] != 0x04)
+        {
+            fail(
+                asio::error::message_size,
+                "Invalid SOCKS address type");
+            // Address type not supported
+            return do_connect_reply(0x08);
+        }
+        if (buffer_[3] == 0x01)
+        {
+            if (buffer_.size() == 10)
+            {
+                asio::ip::address_v4::bytes_type addr;
+                addr[0] = buffer_[4];
+                addr[1] = buffer_[5];
+                addr[2] = buffer_[6];
+                addr[3] = buffer_[7];
+                auto ip = ip::make_address_v4(addr);
+                std::uint16_t port = 0;
+                port |= buffer_[8];
+                port <<= 8;
+                port |= buffer_[9];
+                target_ = {ip, port};
+                if (!allowed())
+                {
+                    fail(
+                        asio::error::access_denied,
+                        "Connection not allowed by ruleset",
+                        target_);
+                    // connection not allowed by ruleset
+                    return do_connect_reply(0x02);
+                }
+                do_target_connect();
+            }
+            else
+            {
+                fail(
+                    asio::error::message_size,
+                    "Invalid SOCKS ipv4 address");
+                // general SOCKS server failure
+                return do_connect_reply(0x01);
+            }
+        }
+        else if (buffer_[3] == 0x04)
+        {
+            if (buffer_.size() == 22)
+            {
+                ip::address_v6::bytes_type addr;
+                for (std::size_t i = 0; i < 16; ++i)
+                    addr[i] = buffer_[4 + i];
+                auto ip = ip::make_address_v6(addr);
+                std::uint16_t port = 0;
+                port |= buffer_[20];
+                port <<= 8;
+                port |= buffer_[21];
+                target_ = {ip, port};
+                if (!allowed())
+                {
+                    fail(
+                        asio::error::access_denied,
+                        "Connection not allowed by ruleset",
+                        target_);
+                    // connection not allowed by ruleset
+                    return do_connect_reply(0x02);
+                }
+                do_target_connect();
+            }
+            else
+            {
+                fail(
+                    asio::error::message_size,
+                    "Invalid SOCKS ipv6 address");
+                // general SOCKS server failure
+                return do_connect_reply(0x01);
+            }
+        }
+        else if (buffer_[3] == 0x03)
+        {
+            if (buffer_.size() == std::size_t(7) + buffer_[4])
+            {
+                host_.assign(
+                    buffer_.data() + 5,
+                    buffer_.data() + 5 + buffer_[4]);
+                std::uint16_t port = buffer_[buffer_.size() - 2];
+                port <<= 8;
+                port |= buffer_[buffer_.size() - 1];
+                if (!allowed(port))
+                {
+                    fail(
+                        asio::error::access_denied,
+                        "Connection not allowed by ruleset",
+                        host_);
+                    // connection not allowed by ruleset
+                    return do_connect_reply(0x02);
+                }
+                if (upstream_ && upstream_->forwards_names())
+                {
+                    // The parent proxy resolves the name
+                    return connect_upstream(
+                        port,
+                        [this](error_code ec)
+                        {
+                            do_connect_reply(
+                                static_cast<unsigned char>(
+                                    to_reply_code(ec)));
+                        });
+                }
+                // Pooled connections are to addresses
+                // the rules must allow too
+                tcp::socket pooled(ioc_);
+                if (!upstream_ &&
+                    egress_.empty() &&
+                    targets_ &&
+                    targets_->take(
+                        host_, port, pooled,
+                        [this](endpoint const& ep)
+                        {
+                            return allowed_resolved(ep);
+                        }))
+                {
+                    // Skip resolving the name too
+                    return connect_pooled(
+                        std::move(pooled),
+                        [this](error_code)
+                        {
+                            do_connect_reply(0x00);
+                        });
+                }
+                std::string service = to_string(port);
+                set_phase(phase::connect);
+                step_started_ = clock_type::now();
+                auto self(shared_from_this());
+                resolver_.async_resolve(
+                    host_,
+                    service,
+                    [this, self](
+                        error_code ec,
+                        tcp::resolver::results_type eps)
+                    {
+                        stats_.resolve.record(
+                            clock_type::now() - step_started_);
+                        if (ec.failed())
+                        {
+                            if (ec == asio::error::operation_aborted &&
+                                deadline_.expired())
+                                ec = asio::error::timed_out;
+                            fail(
+                                ec,
+                                "Cannot resolve domain name",
+                                host_);
+                            return do_connect_reply(
+                                static_cast<unsigned char>(
+                                    to_reply_code(ec)));
+                        }
+                        std::vector<endpoint> v;
+                        v.reserve(eps.size());
+                        for (auto const& e : eps)
+                            if (allowed_resolved(e.endpoint()))
+                                v.push_back(e.endpoint());
+                        if (v.empty())
+                        {
+                            fail(
+                                asio::error::access_denied,
+                                "Connection not allowed by ruleset",
+                                host_);
+                            // connection not allowed by ruleset
+                            return do_connect_reply(0x02);
+                        }
+                        target_ = v.front();
+                        do_target_connect(std::move(v));
+                    }
+                );
+            }
+            else
+            {
+                fail(asio::error::message_size,
+                     "Invalid SOCKS domain address");
+                // general SOCKS server failure
+                do_connect_reply(0x01);
+            }
+        }
+    }
+
+    void
+    parse_socks_connect_v4()
+    {
+        // VER | CMD | DSTPORT | DSTIP | USERID | NULL
+        if (buffer_.empty())
+            return fail(
+                asio::error::message_size,
+                "Empty SOCKS connect");
+        if (buffer_[0] != 0x04)
+        {
+            fail(
+                asio::error::no_protocol_option,
+                "Bad request version");
+            // request rejected or failed
+            return do_connect_reply_v4(91);
+        }
+        if (buffer_.size() == 1)
+        {
+            fail(
+                asio::error::message_size,
+                "Missing SOCKS command");
+            // request rejected or failed
+            return do_connect_reply_v4(91);
+        }
+        version_ = 4;
+        stats_.commands[static_cast<std::size_t>(
+            buffer_[1] == 0x01 ? metric_command::connect_v4 :
+            metric_command::unknown_v4)].add();
+        if (buffer_[1] != 0x01)
+        {
+            fail(
+                asio::error::message_size,
+                "Invalid SOCKS connect command");
+            // request rejected or failed
+            return do_connect_reply_v4(91);
+        }
+        if (auth_)
+        {
+            // SOCKS4 has no password to verify
+            fail(
+                asio::error::access_denied,
+                "SOCKS4 client without authentication");
+            return do_connect_reply_v4(91);
+        }
+        if (buffer_.size() >= 8)
+        {
+            std::uint16_t port = 0;
+            port |= buffer_[2];
+            port <<= 8;
+            port |= buffer_[3];
+            asio::ip::address_v4::bytes_type addr;
+            addr[0] = buffer_[4];
+            addr[1] = buffer_[5];
+            addr[2] = buffer_[6];
+            addr[3] = buffer_[7];
+            auto ip = ip::make_address_v4(addr);
+            target_ = {ip, port};
+            /*
+             * [buffer[8], ...] contain the
+             * ident id, which this server
+             * ignores
+             */
+            if (!allowed())
+            {
+                fail(
+                    asio::error::access_denied,
+                    "Connection not allowed by ruleset",
+                    target_);
+                // request rejected or failed
+                return do_connect_reply_v4(91);
+            }
+            return do_target_connect_v4();
+        }
+        else
+        {
+            fail(
+                asio::error::message_size,
+                "Invalid SOCKS ipv4 address");
+            // request rejected or failed
+                return do_connect_reply_v4(91);
+        }
+    }
+
+    // Return true if the rules let the client
+    // connect to host_, or to target_ when
+    // there is no host
+    //
+    // Names that are address literals are
+    // checked as addresses, so they cannot
+    // bypass the rules on target addresses.
+    //
+    // The rule allowing the request selects
+    // the parent proxy it is forwarded to, or
+    // the interface the connection leaves from.
+    bool
+    allowed(std::uint16_t port)
+    {
+        if (!rules_)
+            return true;
+        access_request req;
+        req.client = client_.address();
+        req.user = user_;
+        req.port = port;
+        if (host_.empty())
+        {
+            req.target = target_.address();
+        }
+        else
+        {
+            error_code ec;
+            req.target = ip::make_address(host_, ec);
+            if (ec.failed())
+                req.host = host_;
+        }
+        std::shared_ptr<rule_set const> rules = rules_->rules();
+        access_rule const* r = rules->find(req);
+        if (!r || !r->allow)
+            return false;
+        egress_ = r->egress;
+        if (r->via.empty())
+            return true;
+        if (upstreams_)
+            upstream_ = upstreams_->find(r->via);
+        if (!upstream_)
+        {
+            fail(
+                asio::error::not_found,
+                "Unknown upstream in rule");
+            return false;
+        }
+        return true;
+    }
+
+    bool
+    allowed()
+    {
+        return allowed(target_.port());
+    }
+
+    // Return true if the rules let the client
+    // connect to `ep`, an address host_
+    // resolved to
+    bool
+    allowed_resolved(endpoint const& ep)
+    {
+        if (!rules_)
+            return true;
+        access_request req;
+        req.client = client_.address();
+        req.user = user_;
+        req.target = ep.address();
+        req.port = ep.port();
+        return rules_->rules()->allows_resolved(req);
+    }
+
+    // Connect to the target, racing its
+    // addresses when it has more than one
+    template <class Handler>
+    void
+    connect_to_target(
+        std::vector<endpoint> eps,
+        Handler&& h)
+    {
+        if (upstream_)
+            return connect_upstream(
+                std::move(eps), std::forward<Handler>(h));
+        // Pooled connections leave from
+        // the default interface
+        tcp::socket pooled(ioc_);
+        if (egress_.empty() &&
+            targets_ &&
+            targets_->take(
+                eps, pooled,
+                [this](endpoint const& ep)
+                {
+                    return allowed_resolved(ep);
+                }))
+            return connect_pooled(
+                std::move(pooled), std::forward<Handler>(h));
+        if (phase_ != phase::connect)
+            set_phase(phase::connect);
+        connector_ = target_connector::create(
+            ioc_, opt_->connect, opt_->sockets,
+            sources_, egress_);
+        step_started_ = clock_type::now();
+        auto self(shared_from_this());
+        connector_->start(
+            std::move(eps),
+            [this, self, h](error_code ec, tcp::socket s)
+            {
+                connector_.reset();
+                stats_.connect.record(
+                    clock_type::now() - step_started_);
+                if (ec == asio::error::operation_aborted &&
+                    deadline_.expired())
+                    ec = asio::error::timed_out;
+                if (!ec.failed())
+                {
+                    error_code ep_ec;
+                    target_ = s.remote_endpoint(ep_ec);
+                    target_socket_ = std::move(s);
+                }
+                else
+                {
+                    fail(
+                        ec,
+                        "Cannot connect to target",
+                        target_);
+                }
+                h(ec);
+            });
+    }
+
+    // Use a connection the server opened to
+    // the target before the request came
+    template <class Handler>
+    void
+    connect_pooled(
+        tcp::socket s,
+        Handler&& h)
+    {
+        stats_.connect.record(clock_type::duration::zero());
+        error_code ec;
+        target_ = s.remote_endpoint(ec);
+        target_socket_ = std::move(s);
+        h(error_code());
+    }
+
+    // Forward the request to the parent proxy,
+    // which connects to the target
+    //
+    // The target keeps the requested address,
+    // rather than the address of the proxy, so
+    // the access log shows where clients went.
+    template <class Handler>
+    void
+    connect_upstream(
+        std::vector<endpoint> eps,
+        Handler&& h)
+    {
+        start_upstream(
+            [this, eps](upstream_request::handler_type f)
+            {
+                return upstream_->connect(eps, std::move(f));
+            },
+            std::forward<Handler>(h));
+    }
+
+    template <class Handler>
+    void
+    connect_upstream(
+        std::uint16_t port,
+        Handler&& h)
+    {
+        start_upstream(
+            [this, port](upstream_request::handler_type f)
+            {
+                return upstream_->connect(host_, port, std::move(f));
+            },
+            std::forward<Handler>(h));
+    }
+
+    template <class Start, class Handler>
+    void
+    start_upstream(
+        Start start,
+        Handler&& h)
+    {
+        if (phase_ != phase::connect)
+            set_phase(phase::connect);
+        step_started_ = clock_type::now();
+        auto self(shared_from_this());
+        upstream_request_ = start(
+            [this, self, h](error_code ec, tcp::socket s)
+            {
+                upstream_request_.reset();
+                stats_.connect.record(
+                    clock_type::now() - step_started_);
+                if (ec == asio::error::operation_aborted &&
+                    deadline_.expired())
+                    ec = asio::error::timed_out;
+                if (!ec.failed())
+                {
+                    target_socket_ = std::move(s);
+                }
+                else if (host_.empty())
+                {
+                    fail(
+                        ec,
+                        "Cannot connect through upstream",
+                        target_);
+                }
+                else
+                {
+                    fail(
+                        ec,
+                        "Cannot connect through upstream",
+                        host_);
+                }
+                h(ec);
+            });
+    }
+
+    void
+    do_target_connect(std::vector<endpoint> eps)
+    {
+        connect_to_target(
+            std::move(eps),
+            [this](error_code ec)
+            {
+                do_connect_reply(
+                    static_cast<unsigned char>(
+                        to_reply_code(ec)));
+            });
+    }
+
+    void
+    do_target_connect()
+    {
+        do_target_connect(
+            std::vector<endpoint>(1, target_));
+    }
+
+    void
+    do_target_connect_v4()
+    {
+        connect_to_target(
+            std::vector<endpoint>(1, target_),
+            [this](error_code ec)
+            {
+                // request rejected or failed,
+                // or request granted
+                do_connect_reply_v4(
+                    ec.failed() ? 91 : 90);
+            });
+    }
+
+    void
+    do_connect_reply(unsigned char rep)
+    {
+        stats_.reply(rep);
+        end_handshake(rep);
+        // The target socket is not open when the
+        // request failed before connecting
+        error_code ep_ec;
+        endpoint bnd_ep =
+            target_socket_.local_endpoint(ep_ec);
+        if (rep != 0x00)
+        {
+            buffer_.resize(10);
+            // VER
+            buffer_[0] = 0x05;
+            // REP
+            buffer_[1] = rep;
+            // RSV
+            buffer_[2] = 0x00;
+            // ATYP
+            buffer_[3] = 0x01;
+            // DST.ADDR
+            buffer_[4] = 0x00;
+            buffer_[5] = 0x00;
+            buffer_[6] = 0x00;
+            buffer_[7] = 0x00;
+            // DST.PORT
+            buffer_[8] = 0x00;
+            buffer_[9] = 0x00;
+        }
+        else if (bnd_ep.address().is_v4())
+        {
+            buffer_.resize(10);
+            // VER
+            buffer_[0] = 0x05;
+            // REP
+            buffer_[1] = rep;
+            // RSV
+            buffer_[2] = 0x00;
+            // ATYP
+            buffer_[3] = 0x01;
+            // DST.ADDR
+            auto bnd_v4 = bnd_ep.address().to_v4();
+            auto bnd_bytes = bnd_v4.to_bytes();
+            buffer_[4] = bnd_bytes[0];
+            buffer_[5] = bnd_bytes[1];
+            buffer_[6] = bnd_bytes[2];
+            buffer_[7] = bnd_bytes[3];
+            // DST.PORT
+            std::uint16_t p = bnd_ep.port();
+            buffer_[8] = (p >> 8) & 0xFF;
+            buffer_[9] = p & 0xFF;
+        }
+        else /* if (bnd_ep.address().is_v6()) */
+        {
+            buffer_.resize(22);
+            // VER
+            buffer_[0] = 0x05;
+            // REP
+            buffer_[1] = rep;
+            // RSV
+            buffer_[2] = 0x00;
+            // ATYP
+            buffer_[3] = 0x04;
+            // DST.ADDR
+            auto bnd_v6 = bnd_ep.address().to_v6();
+            auto bnd_bytes = bnd_v6.to_bytes();
+            for (std::size_t i = 0; i < 16; ++i)
+                buffer_[i + 4] = bnd_bytes[i];
+            // DST.PORT
+            std::uint16_t p = bnd_ep.port();
+            buffer_[20] = (p >> 8) & 0xFF;
+            buffer_[21] = p & 0xFF;
+        }
+        auto self(shared_from_this());
+        asio::async_write(
+            socket_,
+            asio::buffer(buffer_),
+            [this, self](error_code ec, std::size_t)
+            {
+                if (ec.failed())
+                    return fail(
+                        ec, "Cannot write connect reply");
+                unsigned char rep = buffer_[1];
+                if (rep == 0x00)
+                    do_relay();
+                else
+                    socket_.close();
+            }
+        );
+    }
+
+    void
+    do_connect_reply_v4(unsigned char rep)
+    {
+        stats_.reply_v4(rep);
+        end_handshake(rep);
+        // The target socket is not open when the
+        // request failed before connecting
+        error_code ep_ec;
+        endpoint bnd_ep =
+            target_socket_.local_endpoint(ep_ec);
+        buffer_.resize(8);
+        // VER
+        buffer_[0] = 0x04;
+        // REP
+        buffer_[1] = rep;
+        if (rep != 90)
+        {
+            // DST.PORT
+            buffer_[2] = 0x00;
+            buffer_[3] = 0x00;
+            // DST.ADDR
+            buffer_[4] = 0x00;
+            buffer_[5] = 0x00;
+            buffer_[6] = 0x00;
+            buffer_[7] = 0x00;
+        }
+        else
+        {
+            // DST.PORT
+            std::uint16_t p = bnd_ep.port();
+            buffer_[2] = (p >> 8) & 0xFF;
+            buffer_[3] = p & 0xFF;
+            // DST.ADDR
+            if (bnd_ep.address().is_v4())
+            {
+                auto bnd_v4 = bnd_ep.address().to_v4();
+                auto bnd_bytes = bnd_v4.to_bytes();
+                buffer_[4] = bnd_bytes[0];
+                buffer_[5] = bnd_bytes[1];
+                buffer_[6] = bnd_bytes[2];
+                buffer_[7] = bnd_bytes[3];
+            }
+            else
+            {
+                buffer_[4] = 0x00;
+                buffer_[5] = 0x00;
+                buffer_[6] = 0x00;
+                buffer_[7] = 0x00;
+            }
+        }
+        auto self(shared_from_this());
+        asio::async_write(
+            socket_,
+            asio::buffer(buffer_),
+            [this, self](error_code ec, std::size_t)
+            {
+                if (ec.failed())
+                    return fail(
+                        ec, "Cannot write connect reply");
+                unsigned char v = buffer_[0];
+                unsigned char rep = buffer_[1];
+                if ((v == 0x05
+                     && rep == 0x00)
+                    || (v == 0x04
+                        && rep == 90))
+                    do_relay();
+                else
+                    socket_.close();
+            }
+        );
+    }
+
+    void
+    do_relay()
+    {
+        // The handshake is over, so this connection
+        // no longer counts against max_handshakes
+        ticket_.handshake_done();
+        set_phase(phase::relay);
+        limit_rates();
+
+        // Relay anything from client to target
+        // and vice-versa, until both sides
+        // shut down their sending direction
+        relay_.start(
+            shared_from_this(),
+            [this](error_code ec)
+            {
+                deadline_.cancel();
+                stats_.bytes_to_target.add(
+                    relay_.bytes_to_target());
+                stats_.bytes_to_client.add(
+                    relay_.bytes_to_client());
+                if (ec.failed() &&
+                    ec != asio::error::operation_aborted)
+                    fail(ec, "Relay failed");
+            },
+            [this]
+            {
+                set_phase(phase::half_closed);
+            });
+    }
+
+
+    // Apply the rates of the connection,
+    // and of its user if authenticated
+    void
+    limit_rates()
+    {
+        shaping_options const& o = shaper_->options();
+        upload_bucket_ = token_bucket(o.upload_rate, o.burst);
+        download_bucket_ = token_bucket(o.download_rate, o.burst);
+        upload_limit_.add(upload_bucket_);
+        download_limit_.add(download_bucket_);
+        if (server_choice_ == 0x02)
+            user_buckets_ = shaper_->user(user_);
+        if (user_buckets_)
+        {
+            upload_limit_.add(user_buckets_->upload);
+            download_limit_.add(user_buckets_->download);
+        }
+        relay_.limit(&upload_limit_, &download_limit_);
+    }
+
+    void
+    end_handshake(unsigned char rep)
+    {
+        reply_ = rep;
+        handshake_time_ = clock_type::now() - started_;
+        stats_.handshake.record(handshake_time_);
+    }
+
+    void
+    write_access_record()
+    {
+        log_record r;
+        r.client = client_;
+        r.target = target_;
+        r.set_host(host_);
+        r.version = version_;
+        r.method = server_choice_;
+        if (server_choice_ == 0x02)
+            r.set_user(user_);
+        r.reply = reply_;
+        r.bytes_to_target = relay_.bytes_to_target();
+        r.bytes_to_client = relay_.bytes_to_client();
+        r.handshake_us = to_us(handshake_time_);
+        r.duration_us = to_us(clock_type::now() - started_);
+        log_->access(r);
+    }
+
+    static
+    std::uint64_t
+    to_us(clock_type::duration d) noexcept
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<
+                std::chrono::microseconds>(d).count());
+    }
+
+    // Queue an error record for the log
+    void
+    fail(error_code ec, char const* what)
+    {
+        log_record r;
+        r.client = client_;
+        r.what = what;
+        r.ec = ec;
+        log_->error(r);
+    }
+
+    void
+    fail(error_code ec, char const* what, endpoint const& target)
+    {
+        log_record r;
+        r.client = client_;
+        r.target = target;
+        r.what = what;
+        r.ec = ec;
+        log_->error(r);
+    }
+
+    void
+    fail(error_code ec, char const* what, std::string const& host)
+    {
+        log_record r;
+        r.client = client_;
+        r.set_host(host);
+        r.what = what;
+        r.ec = ec;
+        log_->error(r);
+    }
+
+    asio::io_context& ioc_;
+    tcp::socket socket_;
+    admission_ticket ticket_;
+    std::shared_ptr<server_options const> opt_;
+    std::shared_ptr<drain_control> drain_;
+    std::shared_ptr<traffic_shaper> shaper_;
+    std::shared_ptr<server_metrics> metrics_;
+    metrics_shard& stats_;
+    std::shared_ptr<server_log> log_;
+    std::shared_ptr<authenticator> auth_;
+    std::shared_ptr<access_rules> rules_;
+    std::shared_ptr<user_quotas> quotas_;
+    quota_ticket quota_;
+    std::shared_ptr<upstream_set> upstreams_;
+    upstream_pool* upstream_{nullptr};
+    std::shared_ptr<upstream_request> upstream_request_;
+    std::shared_ptr<target_set> targets_;
+    std::shared_ptr<source_pool> sources_;
+    std::string egress_;
+    clock_type::time_point started_;
+    clock_type::time_point step_started_;
+    clock_type::duration handshake_time_{0};
+    endpoint client_;
+    std::string host_;
+    unsigned char version_{0};
+    short reply_{-1};
+    bool log_access_{false};
+    std::vector<unsigned char> buffer_;
+    unsigned char server_choice_{0x00};
+    endpoint target_{};
+    tcp::socket target_socket_;
+    tcp::resolver resolver_;
+    std::shared_ptr<target_connector> connector_;
+    boost::socks::deadline deadline_;
+    std::string user_;
+    token_bucket upload_bucket_;
+    token_bucket download_bucket_;
+    std::shared_ptr<user_buckets> user_buckets_;
+    rate_limit upload_limit_;
+    rate_limit download_limit_;
+    relay<tcp::socket> relay_;
+    phase phase_{phase::greeting};
+    std::uint64_t last_active_{0};
+};
+
+#endif
@@ -0,0 +1,433 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SOCKS_SERVER_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SOCKS_SERVER_HPP
+
+#include "access_rules.hpp"
+#include "admission_control.hpp"
+#include "authenticator.hpp"
+#include "common.hpp"
+#include "drain_control.hpp"
+#include "server_log.hpp"
+#include "server_metrics.hpp"
+#include "server_options.hpp"
+#include "socket_tuning.hpp"
+#include "socks_connection.hpp"
+#include "source_pool.hpp"
+#include "target_pool.hpp"
+#include "traffic_shaper.hpp"
+#include "upstream_pool.hpp"
+#include "user_quotas.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Accepts clients and hands them to socks_connection
+//
+// The server only takes clients from the listen
+// backlog while the admission control has room
+// for them. When it is saturated, async_accept is
+// not called again until a connection is released,
+// so the kernel applies backpressure to new
+// clients instead of this process running out of
+// file descriptors or memory.
+class socks_server
+{
+public:
+    socks_server(
+        asio::io_context& io_context,
+        std::string const& listen_address,
+        std::string const& listen_port,
+        server_options const& opt = {})
+        : socks_server(
+            io_context,
+            tcp::acceptor(
+                io_context,
+                *tcp::resolver(io_context).resolve(
+                    listen_address,
+                    listen_port,
+                    tcp::resolver::passive)),
+            opt)
+    {
+    }
+
+    // Serve clients from a socket already listening
+    //
+    // This adopts listen sockets inherited from
+    // systemd or from a previous server process,
+    // keeping the clients in their backlog.
+    socks_server(
+        asio::io_context& io_context,
+        tcp::acceptor acceptor,
+        server_options const& opt = {})
+        : ioc_(io_context),
+          listen_endpoint_(acceptor.local_endpoint()),
+          acceptor_(std::move(acceptor)),
+          opt_(std::make_shared<server_options const>(opt)),
+          admission_(std::make_shared<admission_control>(
+            opt.admission)),
+          drain_(std::make_shared<drain_control>(io_context)),
+          shaper_(std::make_shared<traffic_shaper>(opt.shaping)),
+          metrics_(std::make_shared<server_metrics>()),
+          log_(std::make_shared<server_log>(opt.logging)),
+          retry_timer_(io_context)
+    {
+        tune_listener(acceptor_, opt.sockets);
+        if (!opt.auth.users_file.empty())
+        {
+            users_file_ = std::make_shared<file_authenticator>(
+                io_context, opt.auth);
+            if (opt.auth.verify_threads != 0)
+            {
+                verify_pool_ = std::make_shared<verify_pool>(
+                    opt.auth.verify_threads,
+                    opt.auth.verify_queue);
+                users_file_->set_pool(verify_pool_);
+            }
+            std::string error;
+            if (!users_file_->reload(error))
+                throw std::runtime_error(error);
+            users_file_->start();
+            auth_ = users_file_;
+        }
+        if (!opt.access.rules_file.empty())
+        {
+            rules_file_ = std::make_shared<file_access_rules>(
+                io_context, opt.access);
+            std::string error;
+            if (!rules_file_->reload(error))
+                throw std::runtime_error(error);
+            rules_file_->start();
+            rules_ = rules_file_;
+        }
+        quotas_ = std::make_shared<user_quotas>(
+            io_context, opt.quotas);
+        if (quotas_->limited())
+            quotas_->start();
+        else
+            quotas_.reset();
+        sources_ = std::make_shared<source_pool>(opt.egress);
+        if (!opt.upstreams.proxies.empty())
+        {
+            upstreams_ = std::make_shared<upstream_set>(
+                io_context, opt.upstreams,
+                opt.connect, opt.sockets, sources_);
+            upstreams_->start();
+        }
+        if (!opt.preconnect.targets.empty())
+        {
+            targets_ = std::make_shared<target_set>(
+                io_context, opt.preconnect,
+                opt.connect, opt.sockets, sources_);
+            targets_->start();
+        }
+        admission_->on_resume(
+            [this]
+            {
+                do_accept();
+            });
+        do_accept();
+    }
+
+    ~socks_server()
+    {
+        // Connections might outlive the server
+        admission_->on_resume({});
+    }
+
+    // Return the listen socket
+    //
+    // Its native handle can be handed to
+    // the process replacing this one.
+    tcp::acceptor&
+    acceptor() noexcept
+    {
+        return acceptor_;
+    }
+
+    admission_counters const&
+    counters() const noexcept
+    {
+        return admission_->counters();
+    }
+
+    // Check the credentials of clients with this
+    //
+    // Clients must then authenticate with
+    // username and password. Without one, any
+    // username and password are accepted.
+    void
+    set_authenticator(std::shared_ptr<authenticator> a)
+    {
+        auth_ = std::move(a);
+    }
+
+    // Check the requests of clients with these
+    //
+    // Requests the rules deny are refused
+    // before connecting. Without rules, any
+    // target is allowed.
+    void
+    set_access_rules(std::shared_ptr<access_rules> r)
+    {
+        rules_ = std::move(r);
+    }
+
+    server_metrics const&
+    metrics() const noexcept
+    {
+        return *metrics_;
+    }
+
+    // Append a snapshot of the metrics and of
+    // the admission counters in the Prometheus
+    // text format
+    void
+    write_metrics(std::string& out) const
+    {
+        metrics_->write_prometheus(out);
+        admission_counters const& c = counters();
+        out +=
+            "# HELP socks_open_connections Client connections currently open\n"
+            "# TYPE socks_open_connections gauge\n"
+            "socks_open_connections ";
+        out += std::to_string(c.active_connections.load());
+        out +=
+            "\n# HELP socks_open_handshakes Client connections in the SOCKS handshake\n"
+            "# TYPE socks_open_handshakes gauge\n"
+            "socks_open_handshakes ";
+        out += std::to_string(c.active_handshakes.load());
+        out +=
+            "\n# HELP socks_rejected_total Connections rejected by the per-address limit\n"
+            "# TYPE socks_rejected_total counter\n"
+            "socks_rejected_total ";
+        out += std::to_string(c.rejected_per_ip.load());
+        out +=
+            "\n# HELP socks_log_dropped_total Log records dropped by full buffers\n"
+            "# TYPE socks_log_dropped_total counter\n"
+            "socks_log_dropped_total ";
+        out += std::to_string(log_->dropped());
+        out += "\n";
+        if (verify_pool_)
+        {
+            out +=
+                "# HELP socks_auth_queued Password checks waiting for a verify thread\n"
+                "# TYPE socks_auth_queued gauge\n"
+                "socks_auth_queued ";
+            out += std::to_string(verify_pool_->queued());
+            out +=
+                "\n# HELP socks_auth_overloaded_total Password checks rejected by a full queue\n"
+                "# TYPE socks_auth_overloaded_total counter\n"
+                "socks_auth_overloaded_total ";
+            out += std::to_string(verify_pool_->rejected());
+            out += "\n";
+        }
+        if (upstreams_)
+            upstreams_->write_prometheus(out);
+        if (targets_)
+            targets_->write_prometheus(out);
+    }
+
+    // Stop taking clients from the listen backlog
+    void
+    pause_accept()
+    {
+        if (paused_)
+            return;
+        paused_ = true;
+        admission_->accept_paused();
+        error_code ec;
+        acceptor_.cancel(ec);
+        retry_timer_.cancel();
+    }
+
+    // Take clients from the listen backlog again
+    void
+    resume_accept()
+    {
+        if (!paused_ || draining())
+            return;
+        paused_ = false;
+        do_accept();
+    }
+
+    // Stop accepting and drain the open connections
+    //
+    // The listen socket is closed, connections
+    // in the handshake get a deadline to finish
+    // it, and relays are closed once idle or at
+    // the cutoff of `drain_options`. `on_done` is
+    // called when no connection is left.
+    void
+    drain(std::function<void()> on_done)
+    {
+        if (draining())
+            return;
+        paused_ = true;
+        admission_->on_resume({});
+        error_code ec;
+        acceptor_.close(ec);
+        retry_timer_.cancel();
+        if (users_file_)
+            users_file_->stop();
+        if (rules_file_)
+            rules_file_->stop();
+        if (quotas_)
+            quotas_->stop();
+        if (upstreams_)
+            upstreams_->stop();
+        if (targets_)
+            targets_->stop();
+        drain_->start(opt_->drain, std::move(on_done));
+    }
+
+    bool
+    draining() const noexcept
+    {
+        return drain_->draining();
+    }
+
+    // Number of connections still open
+    std::size_t
+    connections() const noexcept
+    {
+        return drain_->size();
+    }
+
+private:
+    void do_accept()
+    {
+        if (accepting_ ||
+            paused_ ||
+            retrying_ ||
+            !acceptor_.is_open())
+            return;
+        if (admission_->saturated())
+        {
+            // Resumed by admission_control::on_resume
+            if (!saturated_)
+            {
+                saturated_ = true;
+                admission_->accept_paused();
+            }
+            return;
+        }
+        saturated_ = false;
+        accepting_ = true;
+        acceptor_.async_accept(
+            ioc_,
+            [this](error_code ec, tcp::socket socket)
+            {
+                accepting_ = false;
+                on_accept(ec, std::move(socket));
+            });
+    }
+
+    void
+    on_accept(error_code ec, tcp::socket socket)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // pause_accept was called, but resume_accept
+            // might have been called since then
+            return do_accept();
+        }
+        if (ec.failed())
+        {
+            admission_->accept_failed();
+            if (ec == asio::error::no_descriptors ||
+                ec == asio::error::no_buffer_space ||
+                ec == asio::error::no_memory)
+            {
+                // Retrying right away would spin on
+                // the same error, so give the process
+                // some time to release resources
+                return do_retry_accept();
+            }
+            return do_accept();
+        }
+
+        metrics_->local().accepted.add();
+        error_code ep_ec;
+        endpoint client_ep = socket.remote_endpoint(ep_ec);
+        if (!ep_ec.failed())
+        {
+            admission_ticket ticket =
+                admission_->admit(client_ep.address());
+            if (ticket)
+            {
+                tune_accepted(socket, opt_->sockets);
+                socks_connection::create(
+                    ioc_,
+                    std::move(socket),
+                    std::move(ticket),
+                    opt_,
+                    drain_,
+                    shaper_,
+                    metrics_,
+                    log_,
+                    auth_,
+                    rules_,
+                    quotas_,
+                    upstreams_,
+                    targets_,
+                    sources_)->start();
+            }
+        }
+        // Rejected sockets are closed here
+        do_accept();
+    }
+
+    void
+    do_retry_accept()
+    {
+        retrying_ = true;
+        retry_timer_.expires_after(
+            std::chrono::milliseconds(100));
+        retry_timer_.async_wait(
+            [this](error_code ec)
+            {
+                boost::ignore_unused(ec);
+                retrying_ = false;
+                do_accept();
+            });
+    }
+
+    boost::asio::io_context& ioc_;
+    tcp::endpoint listen_endpoint_;
+    tcp::acceptor acceptor_;
+    std::shared_ptr<server_options const> opt_;
+    std::shared_ptr<admission_control> admission_;
+    std::shared_ptr<drain_control> drain_;
+    std::shared_ptr<traffic_shaper> shaper_;
+    std::shared_ptr<server_metrics> metrics_;
+    std::shared_ptr<server_log> log_;
+    std::shared_ptr<authenticator> auth_;
+    std::shared_ptr<file_authenticator> users_file_;
+    std::shared_ptr<verify_pool> verify_pool_;
+    std::shared_ptr<access_rules> rules_;
+    std::shared_ptr<file_access_rules> rules_file_;
+    std::shared_ptr<user_quotas> quotas_;
+    std::shared_ptr<upstream_set> upstreams_;
+    std::shared_ptr<target_set> targets_;
+    std::shared_ptr<source_pool> sources_;
+    asio::steady_timer retry_timer_;
+    bool accepting_{false};
+    bool paused_{false};
+    bool retrying_{false};
+    bool saturated_{false};
+};
+
+#endif
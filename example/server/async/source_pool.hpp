@@ -0,0 +1,246 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_SOURCE_POOL_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_SOURCE_POOL_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+#include "socket_tuning.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+#endif
+
+// The local addresses connections to targets leave from
+//
+// The kernel gives each connection to a target
+// a distinct source port, so a single source
+// address runs out of ephemeral ports at about
+// 28k connections to the same target. Binding
+// connections to several source addresses
+// multiplies that limit.
+//
+// Binding a socket to an address without a port
+// makes the kernel reserve a port right away,
+// which must then be unique among all the
+// connections of that address. With
+// IP_BIND_ADDRESS_NO_PORT the port is picked at
+// connect, when the target is known, so the
+// same port can be used with other targets.
+//
+// A connection can also be bound to a network
+// interface. It then only uses the source
+// addresses assigned to that interface, or the
+// default address of the interface if there
+// are none.
+class source_pool
+{
+public:
+    explicit
+    source_pool(egress_options const& opt)
+        : hash_target_(opt.hash_target)
+        , bind_no_port_(opt.bind_no_port)
+    {
+        for (std::string const& s : opt.source_addresses)
+        {
+            error_code ec;
+            source src;
+            src.address = ip::make_address(s, ec);
+            if (ec.failed())
+                continue;
+            src.device = device_of(src.address);
+            if (src.address.is_v6())
+                v6_.push_back(std::move(src));
+            else
+                v4_.push_back(std::move(src));
+        }
+    }
+
+    // Return the number of source addresses
+    std::size_t
+    size() const noexcept
+    {
+        return v4_.size() + v6_.size();
+    }
+
+    // Bind `s`, open for the protocol of `target`,
+    // to a source address and to the network
+    // interface named `device`, when it is
+    // not empty
+    void
+    bind(
+        tcp::socket& s,
+        endpoint const& target,
+        boost::core::string_view device,
+        error_code& ec)
+    {
+        ec = {};
+        if (!device.empty())
+        {
+            bind_to_device(s, device, ec);
+            if (ec.failed())
+                return;
+        }
+        std::vector<source> const& v =
+            target.address().is_v6() ? v6_ : v4_;
+        std::size_t n = 0;
+        for (source const& src : v)
+            if (device.empty() || src.device == device)
+                ++n;
+        if (n == 0)
+            return;
+        std::size_t k = hash_target_ ?
+            hash(target.address()) % n :
+            next_.fetch_add(1, std::memory_order_relaxed) % n;
+        for (source const& src : v)
+        {
+            if (!device.empty() && src.device != device)
+                continue;
+            if (k-- != 0)
+                continue;
+#if defined(__linux__)
+            if (bind_no_port_)
+            {
+                error_code ignored;
+                s.set_option(tuning::int_option<
+                    IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT>(1), ignored);
+            }
+#endif
+            s.bind(endpoint(src.address, 0), ec);
+            return;
+        }
+    }
+
+private:
+    struct source
+    {
+        ip::address address;
+        std::string device;
+    };
+
+    // Return the name of the interface
+    // `a` is assigned to, if any
+    static
+    std::string
+    device_of(ip::address const& a)
+    {
+        std::string name;
+#if defined(__linux__)
+        ifaddrs* list = nullptr;
+        if (::getifaddrs(&list) != 0)
+            return name;
+        for (ifaddrs* i = list; i; i = i->ifa_next)
+        {
+            if (!i->ifa_addr)
+                continue;
+            if (i->ifa_addr->sa_family == AF_INET && a.is_v4())
+            {
+                auto sin = reinterpret_cast<sockaddr_in const*>(
+                    i->ifa_addr);
+                ip::address_v4::bytes_type b;
+                std::memcpy(b.data(), &sin->sin_addr, b.size());
+                if (ip::address_v4(b) == a.to_v4())
+                {
+                    name = i->ifa_name;
+                    break;
+                }
+            }
+            else if (i->ifa_addr->sa_family == AF_INET6 && a.is_v6())
+            {
+                auto sin6 = reinterpret_cast<sockaddr_in6 const*>(
+                    i->ifa_addr);
+                ip::address_v6::bytes_type b;
+                std::memcpy(b.data(), &sin6->sin6_addr, b.size());
+                if (ip::address_v6(b) == a.to_v6())
+                {
+                    name = i->ifa_name;
+                    break;
+                }
+            }
+        }
+        ::freeifaddrs(list);
+#endif
+        return name;
+    }
+
+    static
+    void
+    bind_to_device(
+        tcp::socket& s,
+        boost::core::string_view device,
+        error_code& ec)
+    {
+#if defined(__linux__)
+        // Kernels before 5.7 require CAP_NET_RAW
+        std::string name(device);
+        if (::setsockopt(
+                s.native_handle(),
+                SOL_SOCKET,
+                SO_BINDTODEVICE,
+                name.c_str(),
+                static_cast<socklen_t>(name.size() + 1)) != 0)
+            ec = error_code(errno, boost::system::system_category());
+#else
+        boost::ignore_unused(s, device);
+        ec = asio::error::operation_not_supported;
+#endif
+    }
+
+    // FNV-1a of the address bytes
+    static
+    std::size_t
+    hash(ip::address const& a) noexcept
+    {
+        std::uint32_t h = 2166136261u;
+        auto mix = [&h](unsigned char const* p, std::size_t n)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                h ^= p[i];
+                h *= 16777619u;
+            }
+        };
+        if (a.is_v4())
+        {
+            auto b = a.to_v4().to_bytes();
+            mix(b.data(), b.size());
+        }
+        else
+        {
+            auto b = a.to_v6().to_bytes();
+            mix(b.data(), b.size());
+        }
+        return h;
+    }
+
+    std::vector<source> v4_;
+    std::vector<source> v6_;
+    std::atomic<std::size_t> next_{0};
+    bool hash_target_;
+    bool bind_no_port_;
+};
+
+#endif
@@ -0,0 +1,351 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_TARGET_CONNECTOR_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_TARGET_CONNECTOR_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+#include "socket_tuning.hpp"
+#include "source_pool.hpp"
+
+#include <boost/socks/timer_wheel.hpp>
+#include <boost/socks/detail/reply_code.hpp>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using reply_code = boost::socks::detail::reply_code;
+
+// Return the SOCKS5 reply for a failure
+// to resolve or connect to the target
+inline
+reply_code
+to_reply_code(error_code const& ec) noexcept
+{
+    if (!ec.failed())
+        return reply_code::succeeded;
+    if (ec == asio::error::network_unreachable ||
+        ec == asio::error::network_down)
+        return reply_code::network_unreachable;
+    if (ec == asio::error::host_unreachable ||
+        ec == asio::error::host_not_found ||
+        ec == asio::error::host_not_found_try_again ||
+        ec == asio::error::no_data)
+        return reply_code::host_unreachable;
+    if (ec == asio::error::connection_refused)
+        return reply_code::connection_refused;
+    if (ec == asio::error::timed_out)
+        return reply_code::ttl_expired;
+    if (ec == asio::error::access_denied ||
+        ec == asio::error::no_permission)
+        return reply_code::connection_not_allowed_by_ruleset;
+    if (ec == asio::error::address_family_not_supported)
+        return reply_code::address_type_not_supported;
+    // The SOCKS5 reply of a parent proxy
+    // is passed on to the client
+    if (ec.category() == error_code(
+            boost::socks::error::general_failure).category() &&
+        ec.value() >= 0x01 &&
+        ec.value() <= 0x08)
+        return static_cast<reply_code>(ec.value());
+    return reply_code::general_failure;
+}
+
+// Connects to the first target endpoint that answers
+//
+// This implements the connection racing of
+// Happy Eyeballs (RFC 8305, section 5). The
+// endpoints are sorted so address families
+// alternate, starting with the family of the
+// first resolved address. A new attempt starts
+// whenever the previous one fails or takes
+// longer than the attempt delay, up to a limit
+// of attempts in flight. The first connection
+// established wins and the others are closed.
+//
+// When every attempt fails, the handler gets
+// the error that best describes the target,
+// so a refusal from one address is reported
+// over an unreachable route to another.
+//
+// Sockets are bound to an address of the
+// source pool, and to the network interface
+// named `device` when it is not empty, before
+// they connect.
+class target_connector
+    : public std::enable_shared_from_this<target_connector>
+{
+public:
+    using handler_type =
+        std::function<void(error_code, tcp::socket)>;
+
+    static
+    std::shared_ptr<target_connector>
+    create(
+        asio::io_context& ioc,
+        connect_options const& opt,
+        socket_options const& sock_opt,
+        std::shared_ptr<source_pool> sources = {},
+        std::string device = {})
+    {
+        return std::shared_ptr<target_connector>(
+            new target_connector(
+                ioc, opt, sock_opt,
+                std::move(sources),
+                std::move(device)));
+    }
+
+    // Start connecting to `eps`
+    //
+    // The handler is called once, and never
+    // from within this function.
+    void
+    start(
+        std::vector<endpoint> eps,
+        handler_type h)
+    {
+        BOOST_ASSERT(!handler_);
+        handler_ = std::move(h);
+        eps_ = interleave(std::move(eps));
+        sockets_.reserve(eps_.size());
+        if (eps_.empty())
+        {
+            done_ = true;
+            ec_ = asio::error::host_not_found;
+            auto self = shared_from_this();
+            asio::post(ioc_, [self]
+            {
+                self->complete();
+            });
+            return;
+        }
+        start_next();
+    }
+
+    // Close all attempts
+    //
+    // The handler gets operation_aborted, unless
+    // an attempt already failed with an error
+    // that describes the target better.
+    void
+    cancel()
+    {
+        delay_.cancel();
+        error_code ec;
+        for (tcp::socket& s : sockets_)
+            s.close(ec);
+        next_ = eps_.size();
+        if (done_ || !handler_ || in_flight_ > 0)
+            return;
+        // No attempt completes to
+        // call the handler
+        done_ = true;
+        if (!ec_.failed())
+            ec_ = asio::error::operation_aborted;
+        auto self = shared_from_this();
+        asio::post(ioc_, [self]
+        {
+            self->complete();
+        });
+    }
+
+    // Alternate address families, keeping the
+    // resolver order within each family
+    static
+    std::vector<endpoint>
+    interleave(std::vector<endpoint> eps)
+    {
+        if (eps.size() < 3)
+            return eps;
+        bool first_v6 = eps.front().address().is_v6();
+        std::vector<endpoint> a;
+        std::vector<endpoint> b;
+        for (endpoint const& ep : eps)
+        {
+            if (ep.address().is_v6() == first_v6)
+                a.push_back(ep);
+            else
+                b.push_back(ep);
+        }
+        std::vector<endpoint> r;
+        r.reserve(eps.size());
+        std::size_t i = 0;
+        std::size_t j = 0;
+        while (i < a.size() || j < b.size())
+        {
+            if (i < a.size())
+                r.push_back(a[i++]);
+            if (j < b.size())
+                r.push_back(b[j++]);
+        }
+        return r;
+    }
+
+    // Return how well a failed attempt describes
+    // the target, where higher values win
+    static
+    int
+    rank(error_code const& ec) noexcept
+    {
+        switch (to_reply_code(ec))
+        {
+        case reply_code::connection_refused:
+            return 5;
+        case reply_code::host_unreachable:
+            return 4;
+        case reply_code::ttl_expired:
+            return 3;
+        case reply_code::network_unreachable:
+            return 2;
+        case reply_code::general_failure:
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+private:
+    target_connector(
+        asio::io_context& ioc,
+        connect_options const& opt,
+        socket_options const& sock_opt,
+        std::shared_ptr<source_pool> sources,
+        std::string device)
+        : ioc_(ioc)
+        , opt_(opt)
+        , sock_opt_(sock_opt)
+        , sources_(std::move(sources))
+        , device_(std::move(device))
+        , delay_(ioc.get_executor())
+    {
+        // Without attempts the
+        // handler is never called
+        if (opt_.max_attempts == 0)
+            opt_.max_attempts = 1;
+        delay_.on_expire(
+            &target_connector::on_delay, this);
+    }
+
+    static
+    void
+    on_delay(void* p)
+    {
+        static_cast<target_connector*>(p)->start_next();
+    }
+
+    void
+    start_next()
+    {
+        if (next_ >= eps_.size() ||
+            in_flight_ >= opt_.max_attempts)
+            return;
+        std::size_t i = next_++;
+        ++in_flight_;
+        sockets_.emplace_back(ioc_);
+        error_code ec;
+        sockets_[i].open(eps_[i].protocol(), ec);
+        if (!ec.failed())
+            tune_outbound(sockets_[i], sock_opt_);
+        if (!ec.failed() && sources_)
+            sources_->bind(sockets_[i], eps_[i], device_, ec);
+        auto self = shared_from_this();
+        if (ec.failed())
+        {
+            // The attempt fails as its
+            // connect would have
+            asio::post(ioc_, [self, i, ec]
+            {
+                self->on_connect(i, ec);
+            });
+        }
+        else
+        {
+            sockets_[i].async_connect(
+                eps_[i],
+                [self, i](error_code ec)
+                {
+                    self->on_connect(i, ec);
+                });
+        }
+        // Give this attempt a head start
+        // before racing the next one
+        if (next_ < eps_.size() &&
+            opt_.attempt_delay.count() > 0)
+            delay_.expires_after(opt_.attempt_delay);
+        else if (next_ < eps_.size())
+            start_next();
+    }
+
+    void
+    on_connect(std::size_t i, error_code ec)
+    {
+        --in_flight_;
+        if (done_)
+            return;
+        if (!ec.failed())
+        {
+            done_ = true;
+            delay_.cancel();
+            error_code ignored;
+            for (std::size_t j = 0; j < sockets_.size(); ++j)
+                if (j != i)
+                    sockets_[j].close(ignored);
+            ec_ = {};
+            winner_ = i;
+            return complete();
+        }
+        if (!ec_.failed() ||
+            rank(ec) >= rank(ec_))
+            ec_ = ec;
+        if (next_ < eps_.size())
+            return start_next();
+        if (in_flight_ == 0)
+        {
+            done_ = true;
+            delay_.cancel();
+            complete();
+        }
+    }
+
+    void
+    complete()
+    {
+        handler_type h = std::move(handler_);
+        handler_ = nullptr;
+        if (!ec_.failed())
+            h(ec_, std::move(sockets_[winner_]));
+        else
+            h(ec_, tcp::socket(ioc_));
+    }
+
+    asio::io_context& ioc_;
+    connect_options opt_;
+    socket_options sock_opt_;
+    std::shared_ptr<source_pool> sources_;
+    std::string device_;
+    boost::socks::deadline delay_;
+    std::vector<endpoint> eps_;
+    std::vector<tcp::socket> sockets_;
+    handler_type handler_;
+    error_code ec_;
+    std::size_t next_{0};
+    std::size_t in_flight_{0};
+    std::size_t winner_{0};
+    bool done_{false};
+};
+
+#endif
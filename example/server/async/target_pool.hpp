@@ -0,0 +1,543 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_TARGET_POOL_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_TARGET_POOL_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+#include "target_connector.hpp"
+
+#include <boost/socks/timer_wheel.hpp>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Connections opened in advance to a target
+//
+// The pool connects to the target before any
+// client asks for it, so a request is answered
+// as soon as it is read. Each idle connection
+// waits for the socket to become readable,
+// which means the target closed it or sent
+// data nobody asked for, and is then dropped.
+// The pool is filled when it starts and after
+// each request for the target, and idle
+// connections expire, so a target that is no
+// longer used does not keep connections open.
+//
+// Targets that speak first, such as SMTP
+// servers, should not be pooled, as their
+// greeting gets the connection dropped.
+//
+// The pool is used from the thread running
+// the io_context.
+class target_pool
+    : public std::enable_shared_from_this<target_pool>
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    target_pool(
+        asio::io_context& ioc,
+        hot_target const& target,
+        preconnect_options const& opt,
+        connect_options const& connect_opt,
+        socket_options const& sock_opt,
+        std::shared_ptr<source_pool> sources = {})
+        : ioc_(ioc)
+        , target_(target)
+        , opt_(opt)
+        , connect_opt_(connect_opt)
+        , sock_opt_(sock_opt)
+        , sources_(std::move(sources))
+        , resolver_(ioc)
+        , retry_(ioc)
+    {
+        port_ = static_cast<std::uint16_t>(
+            std::strtoul(target_.port.c_str(), nullptr, 10));
+    }
+
+    hot_target const&
+    target() const noexcept
+    {
+        return target_;
+    }
+
+    // Open the pooled connections
+    void
+    start()
+    {
+        running_ = true;
+        fill();
+    }
+
+    // Close the pooled connections
+    void
+    stop()
+    {
+        running_ = false;
+        retry_.cancel();
+        resolver_.cancel();
+        for (auto const& c : idle_)
+            discard(*c);
+        idle_.clear();
+    }
+
+    // Return true if a request for `host`
+    // and `port` is for this target
+    bool
+    matches(
+        boost::core::string_view host,
+        std::uint16_t port) const noexcept
+    {
+        return port == port_ && host == target_.host;
+    }
+
+    // Return true if a request for `eps`
+    // is for this target
+    bool
+    matches(std::vector<endpoint> const& eps) const noexcept
+    {
+        for (endpoint const& ep : eps)
+            for (endpoint const& e : eps_)
+                if (ep == e)
+                    return true;
+        return false;
+    }
+
+    // Take a connection to the target to an
+    // address for which `usable` returns true
+    //
+    // Returns false when the pool has no live
+    // connection to such an address, which
+    // leaves connections to other addresses in
+    // the pool. Either way, the pool is filled
+    // again.
+    template <class Predicate>
+    bool
+    take(
+        tcp::socket& s,
+        Predicate const& usable)
+    {
+        bool hit = false;
+        std::size_t i = idle_.size();
+        while (i-- > 0)
+        {
+            error_code ec;
+            endpoint ep = idle_[i]->socket.remote_endpoint(ec);
+            if (ec.failed() || !usable(ep))
+                continue;
+            std::shared_ptr<idle_connection> c =
+                std::move(idle_[i]);
+            idle_.erase(idle_.begin() + i);
+            c->taken = true;
+            c->expiry.cancel();
+            c->socket.cancel(ec);
+            if (ec.failed() || !alive(c->socket))
+            {
+                // The wait did not complete yet
+                ++dropped_;
+                discard(*c);
+                continue;
+            }
+            s = std::move(c->socket);
+            hit = true;
+            break;
+        }
+        if (hit)
+            ++hits_;
+        else
+            ++misses_;
+        fill();
+        return hit;
+    }
+
+    std::size_t
+    idle() const noexcept
+    {
+        return idle_.size();
+    }
+
+    std::uint64_t
+    hits() const noexcept
+    {
+        return hits_;
+    }
+
+    std::uint64_t
+    misses() const noexcept
+    {
+        return misses_;
+    }
+
+    std::uint64_t
+    expired() const noexcept
+    {
+        return expired_;
+    }
+
+    std::uint64_t
+    dropped() const noexcept
+    {
+        return dropped_;
+    }
+
+private:
+    struct idle_connection
+    {
+        idle_connection(
+            tcp::socket s,
+            target_pool& p)
+            : socket(std::move(s))
+            , expiry(p.ioc_.get_executor())
+            , owner(p)
+        {
+            expiry.on_expire(
+                &idle_connection::on_expire, this);
+        }
+
+        static
+        void
+        on_expire(void* p)
+        {
+            auto c = static_cast<idle_connection*>(p);
+            c->owner.remove(*c, c->owner.expired_);
+        }
+
+        tcp::socket socket;
+        boost::socks::deadline expiry;
+        target_pool& owner;
+        bool taken{false};
+    };
+
+    // Return true if the target did not close
+    // the socket and sent nothing
+    static
+    bool
+    alive(tcp::socket& s)
+    {
+        unsigned char byte = 0;
+        error_code ec;
+        s.non_blocking(true, ec);
+        if (ec.failed())
+            return false;
+        s.receive(
+            asio::buffer(&byte, 1),
+            tcp::socket::message_peek,
+            ec);
+        error_code ignored;
+        s.non_blocking(false, ignored);
+        return ec == asio::error::would_block;
+    }
+
+    static
+    void
+    discard(idle_connection& c)
+    {
+        c.taken = true;
+        c.expiry.cancel();
+        error_code ec;
+        c.socket.close(ec);
+    }
+
+    // Open connections until the pool is full
+    void
+    fill()
+    {
+        if (!running_ || waiting_)
+            return;
+        // Resolve the target again from time to
+        // time, so pooled connections follow
+        // changes to its addresses
+        if (!eps_.empty() &&
+            clock_type::now() - resolved_ > opt_.idle_timeout)
+            eps_.clear();
+        if (eps_.empty())
+        {
+            if (idle_.size() + filling_ < opt_.pool_size &&
+                !resolving_)
+                resolve();
+            return;
+        }
+        while (idle_.size() + filling_ < opt_.pool_size)
+        {
+            ++filling_;
+            auto self = shared_from_this();
+            target_connector::create(
+                ioc_, connect_opt_, sock_opt_, sources_)->start(
+                    eps_,
+                    [self](error_code ec, tcp::socket s)
+                    {
+                        self->on_filled(ec, std::move(s));
+                    });
+        }
+    }
+
+    void
+    resolve()
+    {
+        resolving_ = true;
+        auto self = shared_from_this();
+        resolver_.async_resolve(
+            target_.host,
+            target_.port,
+            [self](
+                error_code ec,
+                tcp::resolver::results_type res)
+            {
+                self->resolving_ = false;
+                if (!self->running_)
+                    return;
+                if (!ec.failed() && res.empty())
+                    ec = asio::error::host_not_found;
+                if (ec.failed())
+                    return self->retry();
+                self->eps_.clear();
+                for (auto const& e : res)
+                    self->eps_.push_back(e.endpoint());
+                self->resolved_ = clock_type::now();
+                self->fill();
+            });
+    }
+
+    void
+    on_filled(error_code ec, tcp::socket s)
+    {
+        --filling_;
+        if (!running_)
+            return;
+        if (ec.failed())
+        {
+            eps_.clear();
+            return retry();
+        }
+        auto c = std::make_shared<idle_connection>(
+            std::move(s), *this);
+        idle_.push_back(c);
+        c->expiry.expires_after(opt_.idle_timeout);
+        watch(c);
+    }
+
+    // Wait before filling the pool again, so an
+    // unreachable target is not retried in a loop
+    void
+    retry()
+    {
+        if (waiting_)
+            return;
+        waiting_ = true;
+        auto self = shared_from_this();
+        retry_.expires_after(opt_.retry_delay);
+        retry_.async_wait(
+            [self](error_code ec)
+            {
+                self->waiting_ = false;
+                if (!ec.failed())
+                    self->fill();
+            });
+    }
+
+    void
+    watch(std::shared_ptr<idle_connection> const& c)
+    {
+        auto self = shared_from_this();
+        c->socket.async_wait(
+            tcp::socket::wait_read,
+            [self, c](error_code)
+            {
+                if (c->taken)
+                    return;
+                self->remove(*c, self->dropped_);
+            });
+    }
+
+    // Close an idle connection without
+    // replacing it, counting it in `n`
+    void
+    remove(
+        idle_connection& c,
+        std::uint64_t& n)
+    {
+        ++n;
+        for (std::size_t i = 0; i < idle_.size(); ++i)
+        {
+            if (idle_[i].get() == &c)
+            {
+                // Keep the connection alive
+                // until it is discarded
+                std::shared_ptr<idle_connection> p =
+                    std::move(idle_[i]);
+                idle_.erase(idle_.begin() + i);
+                discard(*p);
+                return;
+            }
+        }
+    }
+
+    asio::io_context& ioc_;
+    hot_target target_;
+    std::uint16_t port_{0};
+    preconnect_options opt_;
+    connect_options connect_opt_;
+    socket_options sock_opt_;
+    std::shared_ptr<source_pool> sources_;
+    tcp::resolver resolver_;
+    asio::steady_timer retry_;
+    std::vector<endpoint> eps_;
+    clock_type::time_point resolved_;
+    std::vector<std::shared_ptr<idle_connection>> idle_;
+    std::size_t filling_{0};
+    std::uint64_t hits_{0};
+    std::uint64_t misses_{0};
+    std::uint64_t expired_{0};
+    std::uint64_t dropped_{0};
+    bool running_{false};
+    bool waiting_{false};
+    bool resolving_{false};
+};
+
+// The pools of the hot targets
+class target_set
+{
+public:
+    target_set(
+        asio::io_context& ioc,
+        preconnect_options const& opt,
+        connect_options const& connect_opt,
+        socket_options const& sock_opt,
+        std::shared_ptr<source_pool> sources = {})
+    {
+        for (hot_target const& t : opt.targets)
+            pools_.push_back(std::make_shared<target_pool>(
+                ioc, t, opt, connect_opt, sock_opt, sources));
+    }
+
+    // Take a pooled connection for a request
+    // for `host` and `port`, before resolving
+    // it, to an address `allowed` accepts
+    template <class Predicate>
+    bool
+    take(
+        boost::core::string_view host,
+        std::uint16_t port,
+        tcp::socket& s,
+        Predicate const& allowed)
+    {
+        for (auto const& p : pools_)
+            if (p->matches(host, port))
+                return p->take(s, allowed);
+        return false;
+    }
+
+    // Take a pooled connection for a request
+    // for `eps`, to one of these addresses
+    // `allowed` accepts
+    template <class Predicate>
+    bool
+    take(
+        std::vector<endpoint> const& eps,
+        tcp::socket& s,
+        Predicate const& allowed)
+    {
+        for (auto const& p : pools_)
+            if (p->matches(eps))
+                return p->take(s,
+                    [&eps, &allowed](endpoint const& ep)
+                    {
+                        for (endpoint const& e : eps)
+                            if (e == ep)
+                                return allowed(ep);
+                        return false;
+                    });
+        return false;
+    }
+
+    void
+    start()
+    {
+        for (auto const& p : pools_)
+            p->start();
+    }
+
+    void
+    stop()
+    {
+        for (auto const& p : pools_)
+            p->stop();
+    }
+
+    // Append the counters of the pools
+    // in the Prometheus text format
+    void
+    write_prometheus(std::string& out) const
+    {
+        out +=
+            "# HELP socks_preconnect_idle Connections opened in advance to a target\n"
+            "# TYPE socks_preconnect_idle gauge\n";
+        for (auto const& p : pools_)
+            sample(out, "socks_preconnect_idle", *p, "", p->idle());
+        out +=
+            "# HELP socks_preconnect_requests_total Requests for a pooled target\n"
+            "# TYPE socks_preconnect_requests_total counter\n";
+        for (auto const& p : pools_)
+        {
+            sample(out, "socks_preconnect_requests_total",
+                *p, ",pool=\"hit\"", p->hits());
+            sample(out, "socks_preconnect_requests_total",
+                *p, ",pool=\"miss\"", p->misses());
+        }
+        out +=
+            "# HELP socks_preconnect_closed_total Pooled connections closed before a request\n"
+            "# TYPE socks_preconnect_closed_total counter\n";
+        for (auto const& p : pools_)
+        {
+            sample(out, "socks_preconnect_closed_total",
+                *p, ",reason=\"expired\"", p->expired());
+            sample(out, "socks_preconnect_closed_total",
+                *p, ",reason=\"dropped\"", p->dropped());
+        }
+    }
+
+private:
+    static
+    void
+    sample(
+        std::string& out,
+        char const* name,
+        target_pool const& p,
+        char const* labels,
+        std::uint64_t v)
+    {
+        out += name;
+        out += "{target=\"";
+        out += p.target().host;
+        out += ":";
+        out += p.target().port;
+        out += "\"";
+        out += labels;
+        out += "} ";
+        out += std::to_string(v);
+        out += "\n";
+    }
+
+    std::vector<std::shared_ptr<target_pool>> pools_;
+};
+
+#endif
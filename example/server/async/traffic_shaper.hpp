@@ -0,0 +1,260 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_TRAFFIC_SHAPER_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_TRAFFIC_SHAPER_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+
+#include <boost/core/detail/string_view.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+// Limits a rate in bytes per second
+//
+// Tokens accumulate at the rate, up to the
+// burst size, and each byte read takes one.
+class token_bucket
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    token_bucket() = default;
+
+    // A burst of 0 allows one second of data
+    token_bucket(
+        std::size_t rate,
+        std::size_t burst)
+        : rate_(static_cast<double>(rate))
+        , burst_(static_cast<double>(
+            burst != 0 ? burst : rate))
+        , tokens_(burst_)
+        , last_(clock_type::now())
+    {
+    }
+
+    bool
+    limited() const noexcept
+    {
+        return rate_ > 0;
+    }
+
+    std::size_t
+    burst() const noexcept
+    {
+        return static_cast<std::size_t>(burst_);
+    }
+
+    // Return the bytes that can be read now
+    std::size_t
+    available(clock_type::time_point now) noexcept
+    {
+        refill(now);
+        // Connections sharing a bucket can
+        // take more than what was available
+        if (tokens_ <= 0)
+            return 0;
+        return static_cast<std::size_t>(tokens_);
+    }
+
+    void
+    consume(std::size_t n) noexcept
+    {
+        tokens_ -= static_cast<double>(n);
+    }
+
+    // Return the time until `n` bytes can be read
+    clock_type::duration
+    wait_time(
+        std::size_t n,
+        clock_type::time_point now) noexcept
+    {
+        refill(now);
+        double missing =
+            static_cast<double>(n) - tokens_;
+        if (missing <= 0)
+            return clock_type::duration::zero();
+        return std::chrono::duration_cast<
+            clock_type::duration>(
+                std::chrono::duration<double>(
+                    missing / rate_));
+    }
+
+private:
+    void
+    refill(clock_type::time_point now) noexcept
+    {
+        if (now <= last_)
+            return;
+        std::chrono::duration<double> dt = now - last_;
+        last_ = now;
+        tokens_ = (std::min)(
+            burst_, tokens_ + dt.count() * rate_);
+    }
+
+    double rate_{0};
+    double burst_{0};
+    double tokens_{0};
+    clock_type::time_point last_;
+};
+
+// The buckets limiting one direction of a relay
+//
+// A read must fit in all of them, so a
+// connection is held to its own rate and to
+// the rate shared by the connections of its user.
+class rate_limit
+{
+public:
+    using clock_type = token_bucket::clock_type;
+
+    void
+    add(token_bucket& b) noexcept
+    {
+        if (!b.limited())
+            return;
+        BOOST_ASSERT(n_ < 2);
+        buckets_[n_++] = &b;
+    }
+
+    bool
+    limited() const noexcept
+    {
+        return n_ != 0;
+    }
+
+    // Return the bytes that can be read now
+    std::size_t
+    available(clock_type::time_point now) noexcept
+    {
+        std::size_t n = std::size_t(-1);
+        for (std::size_t i = 0; i < n_; ++i)
+            n = (std::min)(n, buckets_[i]->available(now));
+        return n;
+    }
+
+    // Return the smallest burst
+    std::size_t
+    burst() const noexcept
+    {
+        std::size_t n = std::size_t(-1);
+        for (std::size_t i = 0; i < n_; ++i)
+            n = (std::min)(n, buckets_[i]->burst());
+        return n;
+    }
+
+    void
+    consume(std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n_; ++i)
+            buckets_[i]->consume(n);
+    }
+
+    // Return the time until `n` bytes can be read
+    clock_type::duration
+    wait_time(
+        std::size_t n,
+        clock_type::time_point now) noexcept
+    {
+        clock_type::duration d{0};
+        for (std::size_t i = 0; i < n_; ++i)
+            d = (std::max)(d, buckets_[i]->wait_time(n, now));
+        return d;
+    }
+
+private:
+    token_bucket* buckets_[2]{};
+    std::size_t n_{0};
+};
+
+// The buckets shared by the connections of a user
+struct user_buckets
+{
+    token_bucket upload;
+    token_bucket download;
+};
+
+// Hands out the buckets of each user
+//
+// The buckets of a user live while one of
+// its connections does. The shaper is not
+// thread-safe, as is the timer wheel that
+// schedules the paused reads, so each thread
+// running connections needs its own.
+class traffic_shaper
+{
+public:
+    explicit
+    traffic_shaper(shaping_options const& opt)
+        : opt_(opt)
+    {
+    }
+
+    shaping_options const&
+    options() const noexcept
+    {
+        return opt_;
+    }
+
+    // Return the buckets shared by the
+    // connections of `user`
+    //
+    // The result is null when the rate
+    // of users is not limited.
+    std::shared_ptr<user_buckets>
+    user(boost::core::string_view name)
+    {
+        if (opt_.user_upload_rate == 0 &&
+            opt_.user_download_rate == 0)
+            return nullptr;
+        std::string key(name.data(), name.size());
+        auto it = users_.find(key);
+        if (it != users_.end())
+        {
+            if (auto p = it->second.lock())
+                return p;
+        }
+        auto p = std::make_shared<user_buckets>();
+        p->upload = token_bucket(
+            opt_.user_upload_rate, opt_.burst);
+        p->download = token_bucket(
+            opt_.user_download_rate, opt_.burst);
+        users_[std::move(key)] = p;
+        if (users_.size() >= 2 * pruned_size_)
+            prune();
+        return p;
+    }
+
+private:
+    // Forget the users with no connection
+    void
+    prune()
+    {
+        for (auto it = users_.begin(); it != users_.end();)
+        {
+            if (it->second.expired())
+                it = users_.erase(it);
+            else
+                ++it;
+        }
+        pruned_size_ = (std::max)(
+            users_.size(), std::size_t(16));
+    }
+
+    shaping_options opt_;
+    std::map<std::string, std::weak_ptr<user_buckets>> users_;
+    std::size_t pruned_size_{16};
+};
+
+#endif
@@ -0,0 +1,671 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_UPSTREAM_POOL_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_UPSTREAM_POOL_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+#include "target_connector.hpp"
+
+#include <boost/socks/connect.hpp>
+#include <boost/socks/connect_v4.hpp>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Parse a proxy in the form
+//
+//   <name>=socks5://[<user>:<password>@]<host>:<port>
+//   <name>=socks4://[<user>@]<host>:<port>
+//
+// where IPv6 hosts are in brackets.
+inline
+bool
+parse_upstream(
+    boost::core::string_view s,
+    upstream_proxy& p)
+{
+    std::size_t eq = s.find('=');
+    if (eq == 0 || eq == boost::core::string_view::npos)
+        return false;
+    p.name = std::string(s.substr(0, eq));
+    s.remove_prefix(eq + 1);
+    if (s.starts_with("socks5://"))
+        p.version = 5;
+    else if (s.starts_with("socks4://"))
+        p.version = 4;
+    else
+        return false;
+    s.remove_prefix(9);
+    std::size_t at = s.rfind('@');
+    p.user.clear();
+    p.password.clear();
+    if (at != boost::core::string_view::npos)
+    {
+        boost::core::string_view cred = s.substr(0, at);
+        s.remove_prefix(at + 1);
+        std::size_t colon = cred.find(':');
+        if (p.version == 4 &&
+            colon != boost::core::string_view::npos)
+            return false;
+        p.user = std::string(cred.substr(0, colon));
+        if (colon != boost::core::string_view::npos)
+            p.password = std::string(cred.substr(colon + 1));
+        if (p.user.size() > 255 || p.password.size() > 255)
+            return false;
+    }
+    return parse_host_port(s, p.host, p.port);
+}
+
+// A request forwarded to a parent proxy
+//
+// Cancelling the request closes its socket,
+// and its handler gets operation_aborted.
+class upstream_request
+{
+public:
+    using handler_type =
+        std::function<void(error_code, tcp::socket)>;
+
+    explicit
+    upstream_request(asio::io_context& ioc)
+        : socket_(ioc)
+    {
+    }
+
+    void
+    cancel()
+    {
+        cancelled_ = true;
+        if (connector_)
+            connector_->cancel();
+        error_code ec;
+        socket_.close(ec);
+    }
+
+private:
+    friend class upstream_pool;
+
+    tcp::socket socket_;
+    std::shared_ptr<target_connector> connector_;
+    endpoint target_;
+    std::string host_;
+    std::uint16_t port_{0};
+    handler_type handler_;
+    bool pooled_{false};
+    bool cancelled_{false};
+};
+
+// Forwards requests to a parent proxy
+//
+// The pool keeps connections to the proxy open,
+// past the greeting and the authentication, so
+// forwarding a request only costs the round trip
+// of its CONNECT. Each idle connection has a read
+// pending, which completes when the proxy closes
+// it, so the pool replaces the connections the
+// proxy dropped. When the pool is empty, or a
+// pooled connection fails before the proxy
+// replied, the request opens a new connection
+// and runs the whole handshake.
+//
+// SOCKS4 has no authentication, so the pool of
+// a SOCKS4 proxy only saves the TCP handshake.
+//
+// The pool is used from the thread running
+// the io_context.
+class upstream_pool
+    : public std::enable_shared_from_this<upstream_pool>
+{
+public:
+    using handler_type = upstream_request::handler_type;
+
+    upstream_pool(
+        asio::io_context& ioc,
+        upstream_proxy const& proxy,
+        upstream_options const& opt,
+        connect_options const& connect_opt,
+        socket_options const& sock_opt,
+        std::shared_ptr<source_pool> sources = {})
+        : ioc_(ioc)
+        , proxy_(proxy)
+        , opt_(opt)
+        , connect_opt_(connect_opt)
+        , sock_opt_(sock_opt)
+        , sources_(std::move(sources))
+        , resolver_(ioc)
+        , retry_(ioc)
+    {
+        if (!proxy_.user.empty() && proxy_.version == 5)
+            auth_ = std::make_shared<
+                boost::socks::userpass_credentials const>(
+                    proxy_.user, proxy_.password);
+    }
+
+    upstream_proxy const&
+    proxy() const noexcept
+    {
+        return proxy_;
+    }
+
+    // Return true if the proxy resolves the
+    // names of targets, which SOCKS4 cannot
+    bool
+    forwards_names() const noexcept
+    {
+        return proxy_.version == 5;
+    }
+
+    // Open the pooled connections
+    void
+    start()
+    {
+        running_ = true;
+        fill();
+    }
+
+    // Close the pooled connections
+    //
+    // Requests still work, with a
+    // new connection each.
+    void
+    stop()
+    {
+        running_ = false;
+        retry_.cancel();
+        for (auto const& c : idle_)
+        {
+            c->taken = true;
+            error_code ec;
+            c->socket.close(ec);
+        }
+        idle_.clear();
+    }
+
+    // Forward a request for `eps`
+    //
+    // The first address the proxy version
+    // supports is used. The handler is called
+    // once, and never from within this function.
+    std::shared_ptr<upstream_request>
+    connect(
+        std::vector<endpoint> const& eps,
+        handler_type h)
+    {
+        auto r = std::make_shared<upstream_request>(ioc_);
+        r->handler_ = std::move(h);
+        for (endpoint const& ep : eps)
+        {
+            if (proxy_.version == 5 || ep.address().is_v4())
+            {
+                r->target_ = ep;
+                start_request(r);
+                return r;
+            }
+        }
+        auto self = shared_from_this();
+        asio::post(ioc_, [self, r]
+        {
+            self->complete(
+                r, asio::error::address_family_not_supported);
+        });
+        return r;
+    }
+
+    // Forward a request for a name the proxy
+    // resolves, when forwards_names() is true
+    std::shared_ptr<upstream_request>
+    connect(
+        std::string host,
+        std::uint16_t port,
+        handler_type h)
+    {
+        BOOST_ASSERT(forwards_names());
+        auto r = std::make_shared<upstream_request>(ioc_);
+        r->handler_ = std::move(h);
+        r->host_ = std::move(host);
+        r->port_ = port;
+        start_request(r);
+        return r;
+    }
+
+    // Connections waiting for a request
+    std::size_t
+    idle() const noexcept
+    {
+        return idle_.size();
+    }
+
+    // Requests that found a pooled connection
+    std::uint64_t
+    hits() const noexcept
+    {
+        return hits_;
+    }
+
+    // Requests that opened a connection
+    std::uint64_t
+    misses() const noexcept
+    {
+        return misses_;
+    }
+
+    // Pooled connections the proxy closed
+    // or that failed their request
+    std::uint64_t
+    dropped() const noexcept
+    {
+        return dropped_;
+    }
+
+private:
+    struct idle_connection
+    {
+        explicit
+        idle_connection(tcp::socket s)
+            : socket(std::move(s))
+        {
+        }
+
+        tcp::socket socket;
+        unsigned char byte{0};
+        bool taken{false};
+    };
+
+    void
+    start_request(std::shared_ptr<upstream_request> const& r)
+    {
+        if (take(r->socket_))
+        {
+            ++hits_;
+            r->pooled_ = true;
+            request(r);
+        }
+        else
+        {
+            ++misses_;
+            open_request(r);
+        }
+        fill();
+    }
+
+    // Send the request on a pooled connection
+    void
+    request(std::shared_ptr<upstream_request> const& r)
+    {
+        auto self = shared_from_this();
+        auto h = [self, r](error_code ec, endpoint)
+        {
+            self->on_request(r, ec);
+        };
+        if (proxy_.version == 4)
+            boost::socks::async_connect_v4(
+                r->socket_, r->target_, proxy_.user, h);
+        else if (!r->host_.empty())
+            boost::socks::async_connect_authenticated(
+                r->socket_, r->host_, r->port_, h);
+        else
+            boost::socks::async_connect_authenticated(
+                r->socket_, r->target_, h);
+    }
+
+    void
+    on_request(
+        std::shared_ptr<upstream_request> const& r,
+        error_code ec)
+    {
+        // The proxy might have closed the pooled
+        // connection before reading the request
+        if (ec.failed() &&
+            r->pooled_ &&
+            !r->cancelled_ &&
+            ec != boost::socks::condition::reply_error)
+        {
+            ++dropped_;
+            r->pooled_ = false;
+            error_code ignored;
+            r->socket_.close(ignored);
+            return open_request(r);
+        }
+        complete(r, ec);
+    }
+
+    // Run the whole handshake on a new connection
+    void
+    open_request(std::shared_ptr<upstream_request> const& r)
+    {
+        auto self = shared_from_this();
+        open(r, [self, r](error_code ec, tcp::socket s)
+        {
+            if (ec.failed())
+                return self->complete(r, ec);
+            r->socket_ = std::move(s);
+            auto h = [self, r](error_code ec, endpoint)
+            {
+                self->complete(r, ec);
+            };
+            upstream_proxy const& p = self->proxy_;
+            if (p.version == 4)
+                boost::socks::async_connect_v4(
+                    r->socket_, r->target_, p.user, h);
+            else if (!r->host_.empty())
+                boost::socks::async_connect(
+                    r->socket_, r->host_, r->port_,
+                    self->options(), h);
+            else
+                boost::socks::async_connect(
+                    r->socket_, r->target_,
+                    self->options(), h);
+        });
+    }
+
+    void
+    complete(
+        std::shared_ptr<upstream_request> const& r,
+        error_code ec)
+    {
+        if (r->cancelled_)
+            ec = asio::error::operation_aborted;
+        handler_type h = std::move(r->handler_);
+        r->handler_ = nullptr;
+        if (!ec.failed())
+            h(ec, std::move(r->socket_));
+        else
+            h(ec, tcp::socket(ioc_));
+    }
+
+    boost::socks::auth_options
+    options() const
+    {
+        if (auth_)
+            return auth_;
+        return boost::socks::auth_options::none{};
+    }
+
+    // Take the most recently opened
+    // connection of the pool
+    bool
+    take(tcp::socket& s)
+    {
+        while (!idle_.empty())
+        {
+            std::shared_ptr<idle_connection> c =
+                std::move(idle_.back());
+            idle_.pop_back();
+            c->taken = true;
+            error_code ec;
+            c->socket.cancel(ec);
+            if (ec.failed())
+                continue;
+            s = std::move(c->socket);
+            return true;
+        }
+        return false;
+    }
+
+    // Open connections until the pool is full
+    void
+    fill()
+    {
+        while (running_ &&
+            !waiting_ &&
+            idle_.size() + filling_ < opt_.pool_size)
+        {
+            ++filling_;
+            auto self = shared_from_this();
+            open(nullptr, [self](error_code ec, tcp::socket s)
+            {
+                if (ec.failed())
+                    return self->on_filled(ec, std::move(s));
+                auto sp = std::make_shared<tcp::socket>(
+                    std::move(s));
+                if (self->proxy_.version == 4)
+                    return self->on_filled(ec, std::move(*sp));
+                boost::socks::async_authenticate(
+                    *sp, self->options(), self->opt_.timeout,
+                    [self, sp](error_code ec)
+                    {
+                        self->on_filled(ec, std::move(*sp));
+                    });
+            });
+        }
+    }
+
+    void
+    on_filled(error_code ec, tcp::socket s)
+    {
+        --filling_;
+        if (!running_)
+            return;
+        if (ec.failed())
+        {
+            // Resolve the proxy again and wait,
+            // so an unreachable proxy is not
+            // retried in a loop
+            eps_.clear();
+            if (waiting_)
+                return;
+            waiting_ = true;
+            auto self = shared_from_this();
+            retry_.expires_after(opt_.retry_delay);
+            retry_.async_wait(
+                [self](error_code ec)
+                {
+                    self->waiting_ = false;
+                    if (!ec.failed())
+                        self->fill();
+                });
+            return;
+        }
+        auto c = std::make_shared<idle_connection>(
+            std::move(s));
+        idle_.push_back(c);
+        watch(c);
+    }
+
+    // Wait for the proxy to close an idle connection,
+    // as it sends nothing before a request
+    void
+    watch(std::shared_ptr<idle_connection> const& c)
+    {
+        auto self = shared_from_this();
+        c->socket.async_read_some(
+            asio::buffer(&c->byte, 1),
+            [self, c](error_code, std::size_t)
+            {
+                if (c->taken)
+                    return;
+                self->drop(c);
+            });
+    }
+
+    void
+    drop(std::shared_ptr<idle_connection> const& c)
+    {
+        ++dropped_;
+        for (std::size_t i = 0; i < idle_.size(); ++i)
+        {
+            if (idle_[i] == c)
+            {
+                idle_.erase(idle_.begin() + i);
+                break;
+            }
+        }
+        error_code ec;
+        c->socket.close(ec);
+        fill();
+    }
+
+    // Connect a socket to the proxy, resolving
+    // it first when its addresses are unknown
+    void
+    open(
+        std::shared_ptr<upstream_request> const& r,
+        handler_type h)
+    {
+        auto self = shared_from_this();
+        if (eps_.empty())
+        {
+            resolver_.async_resolve(
+                proxy_.host,
+                proxy_.port,
+                [self, r, h](
+                    error_code ec,
+                    tcp::resolver::results_type res)
+                {
+                    if (!ec.failed() && res.empty())
+                        ec = asio::error::host_not_found;
+                    if (!ec.failed() && r && r->cancelled_)
+                        ec = asio::error::operation_aborted;
+                    if (ec.failed())
+                        return h(ec, tcp::socket(self->ioc_));
+                    self->eps_.clear();
+                    for (auto const& e : res)
+                        self->eps_.push_back(e.endpoint());
+                    self->open(r, h);
+                });
+            return;
+        }
+        auto c = target_connector::create(
+            ioc_, connect_opt_, sock_opt_, sources_);
+        if (r)
+            r->connector_ = c;
+        c->start(
+            eps_,
+            [r, h](error_code ec, tcp::socket s)
+            {
+                if (r)
+                    r->connector_.reset();
+                h(ec, std::move(s));
+            });
+    }
+
+    asio::io_context& ioc_;
+    upstream_proxy proxy_;
+    upstream_options opt_;
+    connect_options connect_opt_;
+    socket_options sock_opt_;
+    std::shared_ptr<source_pool> sources_;
+    std::shared_ptr<
+        boost::socks::userpass_credentials const> auth_;
+    tcp::resolver resolver_;
+    asio::steady_timer retry_;
+    std::vector<endpoint> eps_;
+    std::vector<std::shared_ptr<idle_connection>> idle_;
+    std::size_t filling_{0};
+    std::uint64_t hits_{0};
+    std::uint64_t misses_{0};
+    std::uint64_t dropped_{0};
+    bool running_{false};
+    bool waiting_{false};
+};
+
+// The parent proxies, by name
+class upstream_set
+{
+public:
+    upstream_set(
+        asio::io_context& ioc,
+        upstream_options const& opt,
+        connect_options const& connect_opt,
+        socket_options const& sock_opt,
+        std::shared_ptr<source_pool> sources = {})
+    {
+        for (upstream_proxy const& p : opt.proxies)
+            pools_.push_back(std::make_shared<upstream_pool>(
+                ioc, p, opt, connect_opt, sock_opt, sources));
+    }
+
+    // Return the proxy named `name`, or nullptr
+    upstream_pool*
+    find(boost::core::string_view name) const noexcept
+    {
+        for (auto const& p : pools_)
+            if (p->proxy().name == name)
+                return p.get();
+        return nullptr;
+    }
+
+    void
+    start()
+    {
+        for (auto const& p : pools_)
+            p->start();
+    }
+
+    void
+    stop()
+    {
+        for (auto const& p : pools_)
+            p->stop();
+    }
+
+    // Append the counters of the pools
+    // in the Prometheus text format
+    void
+    write_prometheus(std::string& out) const
+    {
+        out +=
+            "# HELP socks_upstream_idle Connections pooled for a parent proxy\n"
+            "# TYPE socks_upstream_idle gauge\n";
+        for (auto const& p : pools_)
+            sample(out, "socks_upstream_idle", *p, "", p->idle());
+        out +=
+            "# HELP socks_upstream_requests_total Requests forwarded to a parent proxy\n"
+            "# TYPE socks_upstream_requests_total counter\n";
+        for (auto const& p : pools_)
+        {
+            sample(out, "socks_upstream_requests_total",
+                *p, ",pool=\"hit\"", p->hits());
+            sample(out, "socks_upstream_requests_total",
+                *p, ",pool=\"miss\"", p->misses());
+        }
+        out +=
+            "# HELP socks_upstream_dropped_total Pooled connections lost before a request\n"
+            "# TYPE socks_upstream_dropped_total counter\n";
+        for (auto const& p : pools_)
+            sample(out, "socks_upstream_dropped_total",
+                *p, "", p->dropped());
+    }
+
+private:
+    static
+    void
+    sample(
+        std::string& out,
+        char const* name,
+        upstream_pool const& p,
+        char const* labels,
+        std::uint64_t v)
+    {
+        out += name;
+        out += "{upstream=\"";
+        out += p.proxy().name;
+        out += "\"";
+        out += labels;
+        out += "} ";
+        out += std::to_string(v);
+        out += "\n";
+    }
+
+    std::vector<std::shared_ptr<upstream_pool>> pools_;
+};
+
+#endif
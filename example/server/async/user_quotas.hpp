@@ -0,0 +1,477 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_USER_QUOTAS_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_USER_QUOTAS_HPP
+
+#include "common.hpp"
+#include "server_options.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/core/detail/string_view.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The limit that refused a user
+enum class quota_limit
+{
+    none,
+    tunnels,
+    connect_rate,
+    bytes
+};
+
+// What the connections of a user did
+// since the counters were last merged
+struct quota_usage
+{
+    // Tunnels opened minus tunnels closed,
+    // which is negative in the shard of a
+    // thread that closed more than it opened
+    std::int64_t tunnels{0};
+    std::uint64_t connects{0};
+    std::uint64_t bytes{0};
+
+    quota_usage&
+    operator+=(quota_usage const& other) noexcept
+    {
+        tunnels += other.tunnels;
+        connects += other.connects;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
+// The usage of each user when the
+// counters were last merged
+struct quota_totals
+{
+    using clock_type = std::chrono::steady_clock;
+
+    struct entry
+    {
+        std::int64_t tunnels{0};
+
+        // Connections the user could
+        // open at `time`
+        double tokens{0};
+
+        // Bytes relayed in the window
+        std::uint64_t bytes{0};
+    };
+
+    clock_type::time_point time;
+    std::unordered_map<std::string, entry> users;
+};
+
+// The counters of one thread
+//
+// Only the owning thread updates the usage,
+// and the lock is contended only while the
+// counters are merged, so checks never wait
+// for other threads.
+struct quota_shard
+{
+    std::mutex m;
+
+    // Not merged yet
+    std::unordered_map<std::string, quota_usage> pending;
+
+    // Merged, but not in `totals` yet
+    std::unordered_map<std::string, quota_usage> merging;
+
+    std::shared_ptr<quota_totals const> totals;
+};
+
+class user_quotas;
+
+// The tunnel of a user counted by the quotas
+//
+// The tunnel is counted until the ticket is
+// closed or destroyed.
+class quota_ticket
+{
+public:
+    quota_ticket() = default;
+
+    quota_ticket(quota_ticket&& other) noexcept
+        : quotas_(std::move(other.quotas_))
+        , user_(std::move(other.user_))
+    {
+    }
+
+    quota_ticket&
+    operator=(quota_ticket&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close(0);
+            quotas_ = std::move(other.quotas_);
+            user_ = std::move(other.user_);
+        }
+        return *this;
+    }
+
+    ~quota_ticket()
+    {
+        close(0);
+    }
+
+    explicit
+    operator bool() const noexcept
+    {
+        return quotas_ != nullptr;
+    }
+
+    // Stop counting the tunnel, adding
+    // the bytes it relayed to the window
+    inline
+    void
+    close(std::uint64_t bytes);
+
+private:
+    friend class user_quotas;
+
+    std::shared_ptr<user_quotas> quotas_;
+    std::string user_;
+};
+
+// Limits the tunnels of each authenticated user
+//
+// A user can be limited in the tunnels open at
+// once, in the connections opened per second,
+// and in the bytes relayed per window. Each
+// thread counts the connections it handles in
+// its own shard, and a timer merges the shards
+// into totals that are handed back to them. A
+// check adds the totals to what its shard did
+// since, so it takes no lock other threads use,
+// and the limits can be exceeded by what the
+// other threads did since the last merge.
+//
+// Bytes are counted when the tunnel closes, so
+// a tunnel open when its user runs out of bytes
+// is not cut.
+//
+// With a sync interval of 0 there is no timer,
+// and each check merges the shards, so the
+// limits are exact but checks contend.
+class user_quotas
+    : public std::enable_shared_from_this<user_quotas>
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    user_quotas(
+        asio::io_context& ioc,
+        quota_options const& opt)
+        : opt_(opt)
+        , id_(next_id())
+        , timer_(ioc)
+        , window_start_(clock_type::now())
+        , last_sync_(window_start_)
+        , totals_(std::make_shared<quota_totals const>())
+    {
+    }
+
+    user_quotas(user_quotas const&) = delete;
+    user_quotas& operator=(user_quotas const&) = delete;
+
+    quota_options const&
+    options() const noexcept
+    {
+        return opt_;
+    }
+
+    // Return true if any limit is set
+    bool
+    limited() const noexcept
+    {
+        return opt_.max_tunnels != 0 ||
+            opt_.connect_rate != 0 ||
+            opt_.max_bytes != 0;
+    }
+
+    // Count a new tunnel of `user`
+    //
+    // If a limit refuses it, the ticket is
+    // left empty and the limit is returned.
+    quota_limit
+    open(
+        boost::core::string_view user,
+        quota_ticket& ticket)
+    {
+        ticket.close(0);
+        // Without the timer, every check
+        // merges the counters itself
+        if (opt_.sync_interval.count() == 0)
+            sync();
+        quota_shard& s = local();
+        std::string key(user.data(), user.size());
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> lock(s.m);
+        quota_totals const& t = *s.totals;
+        quota_totals::entry e;
+        e.tokens = burst();
+        auto it = t.users.find(key);
+        if (it != t.users.end())
+            e = it->second;
+        e.tokens = (std::min)(burst(), e.tokens +
+            std::chrono::duration<double>(now - t.time).count() *
+                static_cast<double>(opt_.connect_rate));
+        quota_usage u;
+        add(s.merging, key, u);
+        add(s.pending, key, u);
+        if (opt_.max_tunnels != 0 &&
+            e.tunnels + u.tunnels >=
+                static_cast<std::int64_t>(opt_.max_tunnels))
+            return quota_limit::tunnels;
+        if (opt_.connect_rate != 0 &&
+            e.tokens - static_cast<double>(u.connects) < 1)
+            return quota_limit::connect_rate;
+        if (opt_.max_bytes != 0 &&
+            e.bytes + u.bytes >= opt_.max_bytes)
+            return quota_limit::bytes;
+        quota_usage& p = s.pending[key];
+        ++p.tunnels;
+        ++p.connects;
+        ticket.quotas_ = shared_from_this();
+        ticket.user_ = std::move(key);
+        return quota_limit::none;
+    }
+
+    // Merge the counters of all threads
+    void
+    sync()
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_m_);
+        std::vector<quota_shard*> shards;
+        {
+            std::lock_guard<std::mutex> lock(shards_m_);
+            for (auto const& s : shards_)
+                shards.push_back(s.get());
+        }
+
+        // Shards keep counting what is being
+        // merged until they get the new totals
+        auto now = clock_type::now();
+        double dt = std::chrono::duration<double>(
+            now - last_sync_).count();
+        last_sync_ = now;
+        for (auto& u : table_)
+            u.second.tokens = (std::min)(burst(), u.second.tokens +
+                dt * static_cast<double>(opt_.connect_rate));
+        if (opt_.window.count() != 0 &&
+            now - window_start_ >= opt_.window)
+        {
+            window_start_ = now;
+            for (auto& u : table_)
+                u.second.bytes = 0;
+        }
+        for (quota_shard* s : shards)
+        {
+            std::lock_guard<std::mutex> lock(s->m);
+            for (auto const& p : s->pending)
+            {
+                auto r = table_.emplace(p.first, quota_totals::entry{});
+                if (r.second)
+                    r.first->second.tokens = burst();
+                quota_totals::entry& e = r.first->second;
+                e.tunnels += p.second.tunnels;
+                if (opt_.connect_rate != 0)
+                    e.tokens -= static_cast<double>(p.second.connects);
+                e.bytes += p.second.bytes;
+                s->merging[p.first] += p.second;
+            }
+            s->pending.clear();
+        }
+
+        // Forget the users that
+        // are back to no usage
+        for (auto it = table_.begin(); it != table_.end();)
+        {
+            if (it->second.tunnels == 0 &&
+                it->second.bytes == 0 &&
+                it->second.tokens >= burst())
+                it = table_.erase(it);
+            else
+                ++it;
+        }
+
+        auto t = std::make_shared<quota_totals>();
+        t->time = now;
+        t->users = table_;
+        std::shared_ptr<quota_totals const> ct = std::move(t);
+        for (quota_shard* s : shards)
+        {
+            std::lock_guard<std::mutex> lock(s->m);
+            s->merging.clear();
+            s->totals = ct;
+        }
+        std::lock_guard<std::mutex> lock(shards_m_);
+        totals_ = std::move(ct);
+    }
+
+    // The totals of the last merge
+    std::shared_ptr<quota_totals const>
+    totals() const
+    {
+        std::lock_guard<std::mutex> lock(shards_m_);
+        return totals_;
+    }
+
+    // Merge the counters periodically
+    void
+    start()
+    {
+        if (opt_.sync_interval.count() == 0)
+            return;
+        timer_.expires_after(opt_.sync_interval);
+        timer_.async_wait(
+            [this](error_code ec)
+            {
+                if (ec.failed())
+                    return;
+                sync();
+                start();
+            });
+    }
+
+    void
+    stop()
+    {
+        timer_.cancel();
+    }
+
+private:
+    friend class quota_ticket;
+
+    struct cache
+    {
+        std::uint64_t id{0};
+        quota_shard* shard{nullptr};
+    };
+
+    double
+    burst() const noexcept
+    {
+        return static_cast<double>(
+            opt_.connect_burst != 0 ?
+                opt_.connect_burst : opt_.connect_rate);
+    }
+
+    static
+    void
+    add(
+        std::unordered_map<std::string, quota_usage> const& m,
+        std::string const& key,
+        quota_usage& u)
+    {
+        auto it = m.find(key);
+        if (it != m.end())
+            u += it->second;
+    }
+
+    void
+    close(
+        std::string const& user,
+        std::uint64_t bytes)
+    {
+        quota_shard& s = local();
+        std::lock_guard<std::mutex> lock(s.m);
+        quota_usage& p = s.pending[user];
+        --p.tunnels;
+        p.bytes += bytes;
+    }
+
+    // Return the shard of the calling thread
+    //
+    // The cache remembers the last instance
+    // used by the thread. Other lookups take
+    // the lock.
+    quota_shard&
+    local()
+    {
+        cache& c = local_cache();
+        if (c.id == id_)
+            return *c.shard;
+        std::lock_guard<std::mutex> lock(shards_m_);
+        std::thread::id const tid =
+            std::this_thread::get_id();
+        c.id = id_;
+        c.shard = nullptr;
+        for (std::size_t i = 0; i < shards_.size(); ++i)
+            if (threads_[i] == tid)
+                c.shard = shards_[i].get();
+        if (!c.shard)
+        {
+            shards_.emplace_back(new quota_shard);
+            shards_.back()->totals = totals_;
+            threads_.push_back(tid);
+            c.shard = shards_.back().get();
+        }
+        return *c.shard;
+    }
+
+    // Ids are never reused, so a cache entry
+    // cannot point to the shard of an
+    // instance that was destroyed
+    static
+    std::uint64_t
+    next_id() noexcept
+    {
+        static std::atomic<std::uint64_t> n{0};
+        return ++n;
+    }
+
+    static
+    cache&
+    local_cache() noexcept
+    {
+        static thread_local cache c;
+        return c;
+    }
+
+    quota_options opt_;
+    std::uint64_t id_;
+    asio::steady_timer timer_;
+
+    mutable std::mutex shards_m_;
+    std::vector<std::unique_ptr<quota_shard>> shards_;
+    std::vector<std::thread::id> threads_;
+
+    // Only used by sync
+    std::mutex sync_m_;
+    std::unordered_map<std::string, quota_totals::entry> table_;
+    clock_type::time_point window_start_;
+    clock_type::time_point last_sync_;
+    std::shared_ptr<quota_totals const> totals_;
+};
+
+void
+quota_ticket::
+close(std::uint64_t bytes)
+{
+    if (!quotas_)
+        return;
+    quotas_->close(user_, bytes);
+    quotas_.reset();
+}
+
+#endif
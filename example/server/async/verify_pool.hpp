@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_EXAMPLE_SERVER_VERIFY_POOL_HPP
+#define BOOST_SOCKS_EXAMPLE_SERVER_VERIFY_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs password checks away from the io threads
+//
+// Key derivation is slow by design, and running
+// it in a completion handler stalls every other
+// connection of the thread. The queue is bounded,
+// so under overload a check is refused right away
+// rather than waiting longer than its client.
+class verify_pool
+{
+public:
+    using task = std::function<void()>;
+
+    // A queue size of 0 does not limit the queue
+    verify_pool(
+        std::size_t threads,
+        std::size_t queue_size)
+        : queue_size_(queue_size)
+    {
+        if (threads == 0)
+            threads = 1;
+        workers_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+            workers_.emplace_back(
+                [this]
+                {
+                    run();
+                });
+    }
+
+    verify_pool(verify_pool const&) = delete;
+    verify_pool& operator=(verify_pool const&) = delete;
+
+    // Queued tasks are dropped
+    ~verify_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stopped_ = true;
+            tasks_.clear();
+        }
+        cv_.notify_all();
+        for (auto& t : workers_)
+            t.join();
+    }
+
+    // Queue a task, returning false if
+    // the queue is full
+    bool
+    try_post(task t)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            if (stopped_ ||
+                (queue_size_ != 0 &&
+                    tasks_.size() >= queue_size_))
+            {
+                rejected_.fetch_add(
+                    1, std::memory_order_relaxed);
+                return false;
+            }
+            tasks_.push_back(std::move(t));
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    std::size_t
+    threads() const noexcept
+    {
+        return workers_.size();
+    }
+
+    // Tasks waiting for a worker
+    std::size_t
+    queued() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return tasks_.size();
+    }
+
+    // Tasks refused by a full queue
+    std::size_t
+    rejected() const noexcept
+    {
+        return rejected_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void
+    run()
+    {
+        for (;;)
+        {
+            task t;
+            {
+                std::unique_lock<std::mutex> lock(m_);
+                cv_.wait(lock,
+                    [this]
+                    {
+                        return stopped_ || !tasks_.empty();
+                    });
+                if (stopped_)
+                    return;
+                t = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            t();
+        }
+    }
+
+    std::size_t queue_size_;
+    mutable std::mutex m_;
+    std::condition_variable cv_;
+    std::deque<task> tasks_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> rejected_{0};
+    bool stopped_{false};
+};
+
+#endif
@@ -13,9 +13,14 @@
 
 #include <boost/socks/auth_options.hpp>
 #include <boost/socks/connect.hpp>
+#include <boost/socks/connect_trace.hpp>
 #include <boost/socks/connect_v4.hpp>
 #include <boost/socks/endpoint.hpp>
 #include <boost/socks/error.hpp>
+#include <boost/socks/fast_open.hpp>
+#include <boost/socks/handshake_template.hpp>
 #include <boost/socks/string_view.hpp>
+#include <boost/socks/timer_wheel.hpp>
+#include <boost/socks/userpass_credentials.hpp>
 
 #endif
@@ -11,16 +11,141 @@
 #define BOOST_SOCKS_AUTH_OPTIONS_HPP
 
 #include <boost/socks/detail/config.hpp>
+#include <boost/socks/error.hpp>
 #include <boost/socks/string_view.hpp>
+#include <boost/socks/userpass_credentials.hpp>
+#include <boost/assert.hpp>
+#include <boost/throw_exception.hpp>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
 
 namespace boost {
 namespace socks {
 
+/** A SOCKS5 authentication method
+
+    Methods other than no authentication and
+    username/password, such as the private
+    methods 0x80-0xFE, are implemented by
+    deriving from this class and offering the
+    object in @ref auth_options.
+
+    When the server chooses the method, the
+    client runs its sub-negotiation in rounds.
+    Each round writes the message from
+    `prepare`, if any, reads the reply until
+    `reply_remaining` returns 0, and passes it
+    to `on_reply`, which tells whether another
+    round follows. A method with a single round
+    trip, such as a token, has one round.
+
+    The functions receive the index of the
+    round, so a method without other state can
+    be shared by concurrent handshakes. The
+    buffer holds at least 513 bytes, and is
+    owned by the handshake, so the method does
+    not allocate for its messages.
+
+    The object is not copied, and must remain
+    valid until the handshakes using it complete.
+
+    @par References
+    @li <a href="https://datatracker.ietf.org/doc/html/rfc1928#section-3">
+        SOCKS Protocol Version 5: Procedure for TCP-based clients</a>
+ */
+class auth_mechanism
+{
+public:
+    virtual ~auth_mechanism() = default;
+
+    /** Return the code of the method
+     */
+    virtual
+    unsigned char
+    code() const noexcept = 0;
+
+    /** Write the message of a round
+
+        @return The size of the message, which
+        can be 0 if the round only reads.
+
+        @param buffer The buffer for the message
+        @param n The size of the buffer
+        @param round The index of the round
+        @param ec Set to the error, if the
+        message cannot be written
+     */
+    virtual
+    std::size_t
+    prepare(
+        unsigned char* buffer,
+        std::size_t n,
+        std::size_t round,
+        error_code& ec) = 0;
+
+    /** Return the size of the reply still to be read
+
+        This is called with the bytes read so
+        far, starting with none, and the read
+        completes when it returns 0.
+
+        @param buffer The bytes read
+        @param n The number of bytes read
+        @param round The index of the round
+     */
+    virtual
+    std::size_t
+    reply_remaining(
+        unsigned char const* buffer,
+        std::size_t n,
+        std::size_t round) const noexcept = 0;
+
+    /** Validate the reply of a round
+
+        @return `true` if another round follows
+
+        @param buffer The reply
+        @param n The size of the reply
+        @param round The index of the round
+        @param ec Set to the error, if the
+        server rejected the client
+     */
+    virtual
+    bool
+    on_reply(
+        unsigned char const* buffer,
+        std::size_t n,
+        std::size_t round,
+        error_code& ec) = 0;
+};
+
 /** Authentication options for SOCKS5 requests
 
-    No authentication (0x00) and
-    username/password (0x02) are
-    supported.
+    The options hold the methods offered in the
+    greeting, in order of preference. No
+    authentication (0x00) and username/password
+    (0x02) are built in, and other methods are
+    offered through an @ref auth_mechanism.
+
+    The default options offer no authentication.
+    The username/password options offer no
+    authentication and username/password, so a
+    server that does not need credentials can
+    choose no authentication.
+
+    The @ref userpass tag refers to strings the
+    options do not own, which must outlive the
+    handshakes. Options holding
+    @ref userpass_credentials share them instead,
+    and send their encoded request as it is.
+
+    @par Example
+    @code
+    token_auth token(t);
+    auth_options opt(token);
+    opt.add(auth_options::userpass{user, pass});
+    @endcode
 
     @par References
     @li <a href="https://datatracker.ietf.org/doc/html/rfc1928#section-3">
@@ -36,9 +161,15 @@ struct auth_options {
         string_view pass;
     };
 
+    /// The maximum number of methods offered
+    static constexpr std::size_t max_methods = 8;
+
     /** Constructor
      */
-    auth_options() = default;
+    auth_options()
+    {
+        add(none{});
+    }
 
     /** Constructor
      */
@@ -47,22 +178,214 @@ struct auth_options {
     /** Constructor
      */
     auth_options( userpass const& opt)
-        : is_userpass(true)
-        , user(opt.user)
-        , pass(opt.pass)
-    {}
+        : auth_options()
+    {
+        add(opt);
+    }
+
+    /** Constructor
+     */
+    auth_options(
+        std::shared_ptr<userpass_credentials const> c)
+        : auth_options()
+    {
+        add(std::move(c));
+    }
+
+    /** Constructor
+
+        Only `m` is offered.
+     */
+    auth_options( auth_mechanism& m )
+    {
+        add(m);
+    }
+
+    /** Offer no authentication after the methods offered
+
+        @throw std::length_error if @ref max_methods
+        other methods are offered already.
+     */
+    auth_options&
+    add( none const& )
+    {
+        return add(0x00, nullptr);
+    }
+
+    /** Offer username/password after the methods offered
+
+        @throw std::length_error if @ref max_methods
+        other methods are offered already.
+     */
+    auth_options&
+    add( userpass const& opt )
+    {
+        add(0x02, nullptr);
+        is_userpass = true;
+        user = opt.user;
+        pass = opt.pass;
+        credentials_.reset();
+        return *this;
+    }
+
+    /** Offer username/password after the methods offered
+
+        The options share the credentials.
+
+        @throw std::length_error if @ref max_methods
+        other methods are offered already.
+     */
+    auth_options&
+    add( std::shared_ptr<userpass_credentials const> c )
+    {
+        BOOST_ASSERT(c);
+        add(0x02, nullptr);
+        is_userpass = true;
+        user = c->user();
+        pass = c->pass();
+        credentials_ = std::move(c);
+        return *this;
+    }
+
+    /** Offer a method after the methods offered
+
+        A method with the code of one offered
+        already replaces it.
+
+        @throw std::length_error if @ref max_methods
+        other methods are offered already.
+
+        @throw std::invalid_argument if the code
+        of `m` is 0xFF, which means no acceptable
+        method.
+     */
+    auth_options&
+    add( auth_mechanism& m )
+    {
+        return add(m.code(), &m);
+    }
+
+    /** Stop offering any method
+
+        Methods added afterwards are the only
+        methods offered, such as username/password
+        alone for a client that must not connect
+        without authenticating.
+     */
+    auth_options&
+    clear() noexcept
+    {
+        size_ = 0;
+        is_userpass = false;
+        user = {};
+        pass = {};
+        credentials_.reset();
+        return *this;
+    }
 
     /** Return the authentication code
+
+        This is the code of the first method
+        offered other than no authentication,
+        or 0x00 if no other method is offered.
      */
     unsigned char
     code() const
     {
-        return is_userpass ? 0x02 : 0x00;
+        for (std::size_t i = 0; i < size_; ++i)
+            if (codes_[i] != 0x00)
+                return codes_[i];
+        return 0x00;
+    }
+
+    /** Return the codes of the methods offered
+     */
+    unsigned char const*
+    methods() const noexcept
+    {
+        return codes_;
+    }
+
+    /** Return the number of methods offered
+     */
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+    /** Return true if the method is offered
+     */
+    bool
+    offers(unsigned char code) const noexcept
+    {
+        for (std::size_t i = 0; i < size_; ++i)
+            if (codes_[i] == code)
+                return true;
+        return false;
+    }
+
+    /** Return the mechanism of a method
+
+        @return The mechanism, or `nullptr` if
+        the method is not offered or is built in.
+     */
+    auth_mechanism*
+    find(unsigned char code) const noexcept
+    {
+        for (std::size_t i = 0; i < size_; ++i)
+            if (codes_[i] == code)
+                return mechanisms_[i];
+        return nullptr;
+    }
+
+    /** Return the credentials shared by the options
+
+        @return The credentials, or `nullptr` if
+        the options refer to strings or do not
+        offer username/password.
+     */
+    std::shared_ptr<userpass_credentials const> const&
+    credentials() const noexcept
+    {
+        return credentials_;
     }
 
     bool is_userpass{false};
     string_view user;
     string_view pass;
+
+private:
+    auth_options&
+    add(
+        unsigned char code,
+        auth_mechanism* m)
+    {
+        // 0xFF means no acceptable method
+        if (code == 0xFF)
+            throw_exception(std::invalid_argument(
+                "reserved authentication method"));
+        for (std::size_t i = 0; i < size_; ++i)
+        {
+            if (codes_[i] == code)
+            {
+                mechanisms_[i] = m;
+                return *this;
+            }
+        }
+        if (size_ == max_methods)
+            throw_exception(std::length_error(
+                "too many authentication methods"));
+        codes_[size_] = code;
+        mechanisms_[size_] = m;
+        ++size_;
+        return *this;
+    }
+
+    unsigned char codes_[max_methods]{};
+    auth_mechanism* mechanisms_[max_methods]{};
+    std::size_t size_{0};
+    std::shared_ptr<userpass_credentials const> credentials_;
 };
 
 } // socks
@@ -13,10 +13,13 @@
 #include <boost/asio/async_result.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/socks/auth_options.hpp>
+#include <boost/socks/connect_trace.hpp>
 #include <boost/socks/detail/config.hpp>
 #include <boost/socks/endpoint.hpp>
 #include <boost/socks/error.hpp>
+#include <boost/socks/handshake_template.hpp>
 #include <boost/socks/string_view.hpp>
+#include <boost/socks/timer_wheel.hpp>
 
 namespace boost {
 namespace socks {
@@ -219,6 +222,452 @@ async_connect(
     auth_options const& opt,
     CompletionToken&& token);
 
+/** Asynchronously connect to the application server through a SOCKS5 server, with a deadline
+
+    This function behaves as the overload without
+    a timeout, but the stream is closed if the
+    handshake does not complete within `timeout`,
+    and the operation completes with
+    `asio::error::timed_out`.
+
+    The deadline is tracked by the @ref timer_wheel
+    of the execution context of the stream, so
+    starting many handshakes only adds one entry
+    to the timer queue of the context.
+
+    @par Preconditions
+    The `AsyncStream` should be connected to a
+    SOCKS5 server and provide a member function
+    `close(error_code&)`.
+
+    The execution context of the stream should
+    be run by a single thread.
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param ep Application server endpoint.
+    @param opt Authentication options
+    @param timeout Maximum duration of the handshake.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see timer_wheel
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    endpoint const& ep,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through a SOCKS5 server, with a deadline
+
+    This function behaves as the overload without
+    a timeout, but the stream is closed if the
+    handshake does not complete within `timeout`,
+    and the operation completes with
+    `asio::error::timed_out`.
+
+    @par Preconditions
+    The `AsyncStream` should be connected to a
+    SOCKS5 server and provide a member function
+    `close(error_code&)`.
+
+    The execution context of the stream should
+    be run by a single thread.
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param opt Authentication options
+    @param timeout Maximum duration of the handshake.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see timer_wheel
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through a SOCKS5 server, with a tracer
+
+    This function behaves as the overload with
+    a deadline, but reports each phase of the
+    handshake to `tracer` as it starts, transfers
+    bytes, and ends. This tells which of the
+    greeting, the authentication, or the reply
+    stalled in a slow handshake.
+
+    The tracer is a template parameter, so the
+    overloads without one, which use
+    @ref null_connect_tracer, do not pay for it.
+
+    @par Example
+    @code
+    socks::connect_trace trace;
+    socks::async_connect(
+        s, app_host_endpoint, opt,
+        std::chrono::seconds(5), trace,
+        [&trace](error_code ec, endpoint ep)
+        {
+            auto const& g = trace[socks::connect_phase::greeting];
+            // g.end - g.start, g.bytes_written, ...
+        });
+    @endcode
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param ep Application server endpoint.
+    @param opt Authentication options
+    @param timeout Maximum duration of the handshake.
+    A duration of zero disables the deadline.
+    @param tracer Receives the handshake events.
+    It must outlive the operation.
+    @param token Asio CompletionToken.
+
+    @see connect_trace, null_connect_tracer
+*/
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    endpoint const& ep,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    Tracer& tracer,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through a SOCKS5 server, with a tracer
+
+    This function behaves as the overload with
+    a deadline, but reports each phase of the
+    handshake to `tracer`.
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param opt Authentication options
+    @param timeout Maximum duration of the handshake.
+    A duration of zero disables the deadline.
+    @param tracer Receives the handshake events.
+    It must outlive the operation.
+    @param token Asio CompletionToken.
+
+    @see connect_trace, null_connect_tracer
+*/
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    Tracer& tracer,
+    CompletionToken&& token);
+
+/** Connect to the application server through a SOCKS5 server, with a template
+
+    This function behaves as the overloads with
+    a target and options, but writes the
+    messages encoded in the template as they are.
+
+    @param s SyncStream connected to a SOCKS server.
+    @param t The handshake template.
+    @param ec Error code.
+
+    @return server bound address and port
+
+    @see handshake_template
+*/
+template <class SyncStream>
+endpoint
+connect(
+    SyncStream& s,
+    handshake_template const& t,
+    error_code& ec);
+
+/** Asynchronously connect to the application server through a SOCKS5 server, with a template
+
+    This function behaves as the overloads with
+    a target and options, but writes the
+    messages encoded in the template as they are.
+    When the template is pipelined, they are
+    written at once.
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param t The handshake template.
+    It must outlive the operation.
+    @param token Asio CompletionToken.
+
+    @see handshake_template
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    handshake_template const& t,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through a SOCKS5 server, with a template and a deadline
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param t The handshake template.
+    It must outlive the operation.
+    @param timeout Maximum duration of the handshake.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see handshake_template
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    handshake_template const& t,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through a SOCKS5 server, with a template and a tracer
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param t The handshake template.
+    It must outlive the operation.
+    @param timeout Maximum duration of the handshake.
+    A duration of zero disables the deadline.
+    @param tracer Receives the handshake events.
+    It must outlive the operation.
+    @param token Asio CompletionToken.
+
+    @see handshake_template, connect_trace
+*/
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    handshake_template const& t,
+    timer_wheel::duration timeout,
+    Tracer& tracer,
+    CompletionToken&& token);
+
+/** Authenticate with a SOCKS5 server
+
+    This function runs the greeting and the
+    sub-negotiation of the method the server
+    chooses, and leaves the stream ready for
+    a single CONNECT request.
+
+    A client can authenticate connections ahead
+    of time, and later connect them to targets
+    with @ref connect_authenticated, which only
+    costs the round trip of the request.
+
+    @par Preconditions
+    The `SyncStream` should be connected to a
+    SOCKS5 server.
+
+    @param s SyncStream connected to a SOCKS server.
+    @param opt Authentication options.
+    @param ec Error code.
+*/
+template <class SyncStream>
+void
+authenticate(
+    SyncStream& s,
+    auth_options const& opt,
+    error_code& ec);
+
+/** Connect to the application server through an authenticated SOCKS5 server
+
+    This function sends the CONNECT request on a
+    stream that was authenticated by
+    @ref authenticate or @ref async_authenticate,
+    and reads the reply.
+
+    @param s SyncStream authenticated with a SOCKS server.
+    @param ep Application server endpoint.
+    @param ec Error code.
+
+    @return server bound address and port
+*/
+template <class SyncStream>
+endpoint
+connect_authenticated(
+    SyncStream& s,
+    endpoint const& ep,
+    error_code& ec);
+
+/** Connect to the application server through an authenticated SOCKS5 server
+
+    The application server is described as the
+    domain name of the target host, which the
+    SOCKS server resolves.
+
+    @param s SyncStream authenticated with a SOCKS server.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param ec Error code.
+
+    @return server bound address and port
+*/
+template <class SyncStream>
+endpoint
+connect_authenticated(
+    SyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    error_code& ec);
+
+/** Asynchronously authenticate with a SOCKS5 server
+
+    This function runs the greeting and the
+    sub-negotiation of the method the server
+    chooses, and leaves the stream ready for
+    a single CONNECT request.
+
+    A client keeping a pool of connections to
+    the same SOCKS server can authenticate them
+    ahead of time, and later connect them to
+    targets with @ref async_connect_authenticated,
+    which only costs the round trip of the
+    request.
+
+    @par Preconditions
+    The `AsyncStream` should be connected to a
+    SOCKS5 server.
+
+    @par Example
+    @code
+    socks::async_authenticate(s, opt,
+        [&](error_code ec)
+        {
+            // later
+            socks::async_connect_authenticated(
+                s, app_host_endpoint, handler);
+        });
+    @endcode
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param opt Authentication options
+    @param token Asio CompletionToken.
+    The completion signature is `void(error_code)`.
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ERROR(CompletionToken)
+async_authenticate(
+    AsyncStream& s,
+    auth_options const& opt,
+    CompletionToken&& token);
+
+/** Asynchronously authenticate with a SOCKS5 server, with a deadline
+
+    @par Preconditions
+    The `AsyncStream` should be connected to a
+    SOCKS5 server and provide a member function
+    `close(error_code&)`.
+
+    The execution context of the stream should
+    be run by a single thread.
+
+    @param s AsyncStream connected to a SOCKS server.
+    @param opt Authentication options
+    @param timeout Maximum duration of the greeting
+    and sub-negotiation. A duration of zero disables
+    the deadline.
+    @param token Asio CompletionToken.
+    The completion signature is `void(error_code)`.
+
+    @see timer_wheel
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ERROR(CompletionToken)
+async_authenticate(
+    AsyncStream& s,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through an authenticated SOCKS5 server
+
+    This function sends the CONNECT request on a
+    stream that was authenticated by
+    @ref async_authenticate, and reads the reply.
+
+    @param s AsyncStream authenticated with a SOCKS server.
+    @param ep Application server endpoint.
+    @param token Asio CompletionToken.
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    endpoint const& ep,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through an authenticated SOCKS5 server, with a deadline
+
+    @param s AsyncStream authenticated with a SOCKS server.
+    @param ep Application server endpoint.
+    @param timeout Maximum duration of the request.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see timer_wheel
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    endpoint const& ep,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through an authenticated SOCKS5 server
+
+    The application server is described as the
+    domain name of the target host, which the
+    SOCKS server resolves.
+
+    @param s AsyncStream authenticated with a SOCKS server.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param token Asio CompletionToken.
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    CompletionToken&& token);
+
+/** Asynchronously connect to the application server through an authenticated SOCKS5 server, with a deadline
+
+    @param s AsyncStream authenticated with a SOCKS server.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param timeout Maximum duration of the request.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see timer_wheel
+*/
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
 } // socks
 } // boost
 
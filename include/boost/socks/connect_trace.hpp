@@ -0,0 +1,233 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+#ifndef BOOST_SOCKS_CONNECT_TRACE_HPP
+#define BOOST_SOCKS_CONNECT_TRACE_HPP
+
+#include <boost/socks/detail/config.hpp>
+#include <boost/socks/error.hpp>
+
+#include <chrono>
+#include <cstddef>
+
+namespace boost {
+namespace socks {
+
+/** The phases of a SOCKS handshake
+
+    A SOCKS5 handshake goes through the greeting,
+    the optional authentication sub-negotiation,
+    the request and the reply. A SOCKS4 handshake
+    only has a request and a reply.
+
+    When the request is pipelined with the greeting,
+    its bytes are reported with the greeting and
+    there is no request phase.
+*/
+enum class connect_phase
+{
+    /// Greeting and server choice
+    greeting,
+
+    /// Authentication sub-negotiation
+    auth,
+
+    /// CONNECT request
+    request,
+
+    /// CONNECT reply
+    reply
+};
+
+/** A handshake tracer that does nothing
+
+    This is the tracer of the connect functions
+    without a tracer. Its functions are empty,
+    so tracing costs nothing when disabled.
+
+    A tracer provides the same functions, which
+    the handshake calls as it goes:
+
+    @li `on_start(p)` when phase `p` starts
+    @li `on_write(p, n)` when `n` bytes were written
+    @li `on_read(p, n)` when `n` bytes were read
+    @li `on_end(p, ec)` when phase `p` ends with `ec`
+
+    Tracers take their own timestamps, so the
+    handshake does not read the clock for them.
+
+    @see connect_trace
+*/
+struct null_connect_tracer
+{
+    void
+    on_start(connect_phase) noexcept
+    {
+    }
+
+    void
+    on_write(connect_phase, std::size_t) noexcept
+    {
+    }
+
+    void
+    on_read(connect_phase, std::size_t) noexcept
+    {
+    }
+
+    void
+    on_end(connect_phase, error_code const&) noexcept
+    {
+    }
+};
+
+/** A handshake tracer recording each phase
+
+    This tracer keeps the start and end time,
+    the bytes transferred, and the result of each
+    phase, so a slow handshake can be broken down
+    into the phase that stalled.
+
+    @par Example
+    @code
+    socks::connect_trace trace;
+    socks::async_connect(
+        s, ep, opt, std::chrono::seconds(5), trace,
+        [&trace](error_code ec, endpoint)
+        {
+            auto const& r = trace[socks::connect_phase::reply];
+            if (r.started)
+                report("reply", r.end - r.start);
+        });
+    @endcode
+*/
+class connect_trace
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    /// The record of a phase
+    struct phase_record
+    {
+        /// True if the phase was started
+        bool started{false};
+
+        /// True if the phase ended
+        bool ended{false};
+
+        clock_type::time_point start;
+        clock_type::time_point end;
+        std::size_t bytes_written{0};
+        std::size_t bytes_read{0};
+
+        /// The error the phase ended with
+        error_code ec;
+    };
+
+    /// Return the record of a phase
+    phase_record const&
+    operator[](connect_phase p) const noexcept
+    {
+        return phases_[static_cast<std::size_t>(p)];
+    }
+
+    /// Forget all the records
+    void
+    clear() noexcept
+    {
+        for (auto& r : phases_)
+            r = phase_record();
+    }
+
+    void
+    on_start(connect_phase p) noexcept
+    {
+        phase_record& r = at(p);
+        r.started = true;
+        r.start = clock_type::now();
+    }
+
+    void
+    on_write(connect_phase p, std::size_t n) noexcept
+    {
+        at(p).bytes_written += n;
+    }
+
+    void
+    on_read(connect_phase p, std::size_t n) noexcept
+    {
+        at(p).bytes_read += n;
+    }
+
+    void
+    on_end(connect_phase p, error_code const& ec) noexcept
+    {
+        phase_record& r = at(p);
+        r.ended = true;
+        r.end = clock_type::now();
+        r.ec = ec;
+    }
+
+private:
+    phase_record&
+    at(connect_phase p) noexcept
+    {
+        return phases_[static_cast<std::size_t>(p)];
+    }
+
+    phase_record phases_[4];
+};
+
+namespace detail {
+
+// Refers to the tracer of the caller
+// from inside an operation
+template <class Tracer>
+class tracer_ref
+{
+public:
+    explicit
+    tracer_ref(Tracer& t) noexcept
+        : t_(&t)
+    {
+    }
+
+    void
+    on_start(connect_phase p)
+    {
+        t_->on_start(p);
+    }
+
+    void
+    on_write(connect_phase p, std::size_t n)
+    {
+        t_->on_write(p, n);
+    }
+
+    void
+    on_read(connect_phase p, std::size_t n)
+    {
+        t_->on_read(p, n);
+    }
+
+    void
+    on_end(connect_phase p, error_code const& ec)
+    {
+        t_->on_end(p, ec);
+    }
+
+private:
+    Tracer* t_;
+};
+
+} // detail
+} // socks
+} // boost
+
+#endif
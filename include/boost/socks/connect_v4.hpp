@@ -7,6 +7,7 @@
 #define BOOST_SOCKS_CONNECT_V4_HPP
 
 #include <boost/socks/detail/config.hpp>
+#include <boost/socks/connect_trace.hpp>
 #include <boost/socks/endpoint.hpp>
 #include <boost/socks/string_view.hpp>
 #include <boost/socks/error.hpp>
@@ -99,6 +100,31 @@ async_connect_v4(
     string_view ident_id,
     CompletionToken&& token);
 
+/** Asynchronously connect to the application server through a SOCKS4 server, with a tracer
+
+    This function behaves as the overload without
+    a tracer, but reports the request and reply
+    phases of the handshake to `tracer` as they
+    start, transfer bytes, and end.
+
+    @param s SyncStream connected to a SOCKS server.
+    @param ep Application server endpoint.
+    @param ident_id Client ident ID.
+    @param tracer Receives the handshake events.
+    It must outlive the operation.
+    @param token Completion token.
+
+    @see connect_trace, null_connect_tracer
+*/
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_v4(
+    AsyncStream& s,
+    endpoint const& ep,
+    string_view ident_id,
+    Tracer& tracer,
+    CompletionToken&& token);
+
 } // socks
 } // boost
 
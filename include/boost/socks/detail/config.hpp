@@ -56,6 +56,11 @@ namespace socks {
      BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(type, void(::boost::socks::error_code, ::boost::asio::ip::tcp::endpoint))
 #endif
 
+#ifndef BOOST_SOCKS_ASYNC_ERROR
+# define BOOST_SOCKS_ASYNC_ERROR(type) \
+     BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(type, void(::boost::socks::error_code))
+#endif
+
 } // socks
 
 } // boost
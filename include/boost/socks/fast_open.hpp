@@ -0,0 +1,185 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+#ifndef BOOST_SOCKS_FAST_OPEN_HPP
+#define BOOST_SOCKS_FAST_OPEN_HPP
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/basic_stream_socket.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/socks/auth_options.hpp>
+#include <boost/socks/connect.hpp>
+#include <boost/socks/detail/config.hpp>
+#include <boost/socks/endpoint.hpp>
+#include <boost/socks/error.hpp>
+#include <boost/socks/string_view.hpp>
+#include <boost/socks/timer_wheel.hpp>
+
+namespace boost {
+namespace socks {
+
+/** Asynchronously connect to a SOCKS5 server with TCP Fast Open, and to the application server through it
+
+    This function opens the connection to the
+    SOCKS5 server and establishes a connection
+    to the application server through it.
+
+    The socket is opened with
+    `TCP_FASTOPEN_CONNECT`, so the SOCKS5 greeting
+    is sent in the SYN to the SOCKS server when
+    this host holds a Fast Open cookie from a
+    previous connection to it. This saves one
+    round trip per connection.
+
+    When no authentication is requested, the
+    CONNECT request is pipelined with the greeting,
+    as the only method the server can choose is
+    known in advance. Both messages are then sent
+    in the SYN, and the handshake completes in a
+    single round trip to the SOCKS server.
+
+    The replies are then parsed as in
+    @ref async_connect. If the platform does not
+    support TCP Fast Open, or the SOCKS server does
+    not accept it, the connection falls back to a
+    regular three-way handshake.
+
+    @par Preconditions
+    The socket is not connected. If it is not
+    open, it is opened with the protocol of
+    `proxy`.
+
+    The SOCKS server should accept requests
+    pipelined with the greeting.
+
+    @par Example
+    @code
+    asio::ip::tcp::socket s(ioc);
+    socks::async_connect_fast_open(
+        s, proxy_endpoint, app_host_endpoint,
+        socks::auth_options::none{},
+        [](error_code ec, endpoint ep)
+    {
+        if (!ec.failed())
+        {
+            // write to the application host
+            do_write();
+        }
+    });
+    @endcode
+
+    @param s Socket to connect to the SOCKS server.
+    @param proxy SOCKS server endpoint.
+    @param ep Application server endpoint.
+    @param opt Authentication options
+    @param token Asio CompletionToken.
+
+    @par References
+    @li <a href="https://datatracker.ietf.org/doc/html/rfc7413">
+        RFC 7413: TCP Fast Open</a>
+*/
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    endpoint const& ep,
+    auth_options const& opt,
+    CompletionToken&& token);
+
+/** Asynchronously connect to a SOCKS5 server with TCP Fast Open, and to the application server through it
+
+    This function behaves as the overload with
+    an application server endpoint, but the
+    application server is described as a domain
+    name, which is resolved on the SOCKS server.
+
+    @param s Socket to connect to the SOCKS server.
+    @param proxy SOCKS server endpoint.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param opt Authentication options
+    @param token Asio CompletionToken.
+*/
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    CompletionToken&& token);
+
+/** Asynchronously connect to a SOCKS5 server with TCP Fast Open, and to the application server through it, with a deadline
+
+    This function behaves as the overload without
+    a timeout, but the socket is closed if the
+    connection to the SOCKS server and the
+    handshake do not complete within `timeout`,
+    and the operation completes with
+    `asio::error::timed_out`.
+
+    @param s Socket to connect to the SOCKS server.
+    @param proxy SOCKS server endpoint.
+    @param ep Application server endpoint.
+    @param opt Authentication options
+    @param timeout Maximum duration of the operation.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see timer_wheel
+*/
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    endpoint const& ep,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+/** Asynchronously connect to a SOCKS5 server with TCP Fast Open, and to the application server through it, with a deadline
+
+    This function behaves as the overload without
+    a timeout, but the socket is closed if the
+    connection to the SOCKS server and the
+    handshake do not complete within `timeout`,
+    and the operation completes with
+    `asio::error::timed_out`.
+
+    @param s Socket to connect to the SOCKS server.
+    @param proxy SOCKS server endpoint.
+    @param app_domain Domain name of the application server
+    @param app_port Port of the application server
+    @param opt Authentication options
+    @param timeout Maximum duration of the operation.
+    A duration of zero disables the deadline.
+    @param token Asio CompletionToken.
+
+    @see timer_wheel
+*/
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token);
+
+} // socks
+} // boost
+
+#include <boost/socks/impl/fast_open.hpp>
+
+#endif
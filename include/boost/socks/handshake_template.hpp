@@ -0,0 +1,166 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+#ifndef BOOST_SOCKS_HANDSHAKE_TEMPLATE_HPP
+#define BOOST_SOCKS_HANDSHAKE_TEMPLATE_HPP
+
+#include <boost/socks/detail/config.hpp>
+#include <boost/socks/auth_options.hpp>
+#include <boost/socks/endpoint.hpp>
+#include <boost/socks/string_view.hpp>
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace boost {
+namespace socks {
+
+/** The messages of a SOCKS5 handshake, encoded once
+
+    A client connecting to the same target with
+    the same options many times can encode the
+    greeting, the username/password request and
+    the CONNECT request once, and replay them in
+    each handshake with @ref connect or
+    @ref async_connect.
+
+    The messages are stored inline, so the
+    template does not allocate, and the strings
+    of the target and the credentials are not
+    referred to after construction. Mechanisms
+    of the options are still called, and must
+    outlive the handshakes.
+
+    When pipelined, the handshake sends all the
+    messages in one write, without waiting for
+    the server choice. The greeting then offers
+    a single method, which is username/password
+    if the options offer it, so the choice of
+    the server is known in advance. This needs
+    options without other mechanisms, and a
+    server that reads the messages in order, as
+    most do.
+
+    @par Example
+    @code
+    handshake_template t(target_ep, opt, true);
+    async_connect(s, t, handler);
+    @endcode
+
+    @par References
+    @li <a href="https://datatracker.ietf.org/doc/html/rfc1928">
+        SOCKS Protocol Version 5</a>
+ */
+class handshake_template
+{
+public:
+    /** Constructor
+
+        @param target The application server
+        @param opt Authentication options
+        @param pipeline Send the messages in one write
+     */
+    BOOST_SOCKS_DECL
+    explicit
+    handshake_template(
+        endpoint const& target,
+        auth_options const& opt = {},
+        bool pipeline = false);
+
+    /** Constructor
+
+        @param domain The domain of the application server
+        @param port The port of the application server
+        @param opt Authentication options
+        @param pipeline Send the messages in one write
+     */
+    BOOST_SOCKS_DECL
+    handshake_template(
+        string_view domain,
+        std::uint16_t port,
+        auth_options const& opt = {},
+        bool pipeline = false);
+
+    /** Return the methods offered by the greeting
+     */
+    auth_options const&
+    options() const noexcept
+    {
+        return opt_;
+    }
+
+    /** Return true if the messages are sent in one write
+     */
+    bool
+    pipelined() const noexcept
+    {
+        return pipeline_;
+    }
+
+    /** Return the greeting
+     */
+    asio::const_buffer
+    greeting() const noexcept
+    {
+        return {buf_, greeting_size_};
+    }
+
+    /** Return the username/password request
+
+        The buffer is empty if the options
+        do not offer username/password.
+     */
+    asio::const_buffer
+    userpass_request() const noexcept
+    {
+        return {buf_ + greeting_size_, userpass_size_};
+    }
+
+    /** Return the CONNECT request
+     */
+    asio::const_buffer
+    request() const noexcept
+    {
+        std::size_t i = greeting_size_ + userpass_size_;
+        return {buf_ + i, size_ - i};
+    }
+
+    /** Return all the messages, as sent when pipelined
+     */
+    asio::const_buffer
+    data() const noexcept
+    {
+        return {buf_, size_};
+    }
+
+private:
+    BOOST_SOCKS_DECL
+    std::size_t
+    prepare(
+        auth_options const& opt,
+        bool pipeline);
+
+    auth_options opt_;
+    bool pipeline_;
+    std::uint16_t greeting_size_{0};
+    std::uint16_t userpass_size_{0};
+    std::uint16_t size_{0};
+
+    // Greeting, username/password
+    // and domain CONNECT requests
+    unsigned char buf_[
+        (2 + auth_options::max_methods) +
+        (3 + 2 * 255) +
+        (7 + 255)];
+};
+
+} // socks
+} // boost
+
+#endif
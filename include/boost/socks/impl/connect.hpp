@@ -12,7 +12,11 @@
 
 #include <boost/socks/detail/config.hpp>
 
+#include <boost/socks/auth_options.hpp>
+#include <boost/socks/connect_trace.hpp>
 #include <boost/socks/error.hpp>
+#include <boost/socks/handshake_template.hpp>
+#include <boost/socks/timer_wheel.hpp>
 #include <boost/socks/detail/auth_method.hpp>
 #include <boost/socks/detail/address_type.hpp>
 #include <boost/socks/detail/command.hpp>
@@ -151,6 +155,123 @@ validate_server_choice(
     auth_options const& opt,
     error_code& ec);
 
+// Return true if the server choice has
+// a sub-negotiation, where `m` is null for
+// the built-in username/password
+inline
+bool
+has_auth_rounds(
+    auth_options const& opt,
+    unsigned char choice,
+    auth_mechanism*& m) noexcept
+{
+    m = opt.find(choice);
+    return m || choice == static_cast<unsigned char>(
+        auth_method::userpass);
+}
+
+inline
+std::size_t
+prepare_auth_round(
+    unsigned char* buffer,
+    std::size_t n,
+    auth_options const& opt,
+    auth_mechanism* m,
+    std::size_t round,
+    error_code& ec)
+{
+    if (m)
+        return m->prepare(buffer, n, round, ec);
+    return prepare_userpass_request(buffer, n, opt);
+}
+
+struct read_auth_reply_cond {
+    std::size_t operator()(
+        const error_code& ec,
+        std::size_t n)
+    {
+        if (ec.failed())
+            return 0;
+        if (m)
+            return m->reply_remaining(buf, n, round);
+        // VER + STATUS
+        return n < 2 ? 2 - n : 0;
+    }
+
+    auth_mechanism const* m;
+    std::size_t round;
+    unsigned char const* buf;
+};
+
+// Return true if another round follows
+inline
+bool
+on_auth_round_reply(
+    unsigned char const* buffer,
+    std::size_t n,
+    auth_mechanism* m,
+    std::size_t round,
+    error_code& ec)
+{
+    if (m)
+        return m->on_reply(buffer, n, round, ec);
+    validate_userpass_reply(buffer, n, ec);
+    return false;
+}
+
+// Run the sub-negotiation of the server choice,
+// where the username/password request of a
+// template is written as it is, or not at all
+// when it was pipelined
+template <class SyncStream>
+void
+authenticate_rounds(
+    SyncStream& stream,
+    unsigned char* buffer,
+    std::size_t n,
+    auth_options const& opt,
+    auth_mechanism* m,
+    handshake_template const* t,
+    error_code& ec)
+{
+    for (std::size_t round = 0;; ++round)
+    {
+        asio::const_buffer out;
+        if (t && !m)
+        {
+            if (!t->pipelined())
+                out = t->userpass_request();
+        }
+        else
+        {
+            out = asio::buffer(buffer, prepare_auth_round(
+                buffer, n, opt, m, round, ec));
+            if (ec.failed())
+                return;
+        }
+        if (out.size() != 0)
+        {
+            asio::write(stream, out, ec);
+            if (ec.failed())
+                return;
+        }
+
+        std::size_t rn = asio::read(
+            stream,
+            asio::buffer(buffer, n),
+            read_auth_reply_cond{m, round, buffer},
+            ec);
+        if (ec.failed() &&
+            ec != asio::error::eof)
+            return;
+        ec = {};
+        if (!on_auth_round_reply(
+                buffer, rn, m, round, ec) ||
+            ec.failed())
+            return;
+    }
+}
+
 // authenticate and return server choice
 template <class SyncStream>
 unsigned char
@@ -161,9 +282,8 @@ authenticate(
     auth_options const& opt,
     error_code& ec)
 {
-    // Send a GREETING request
-    // Create a list with only opt as a method
-    // accepted by the client
+    // Send a GREETING request with the
+    // methods accepted by the client
     std::size_t gn = prepare_greeting(buffer, n, opt);
     BOOST_ASSERT(gn > 2);
     asio::write(
@@ -184,27 +304,13 @@ authenticate(
     if (ec.failed())
         return buffer[1];
 
-    // Only user/pass is supported
+    // Run the sub-negotiation of the method
     unsigned char choice = buffer[1];
-    if (choice == static_cast<unsigned char>(
-            auth_method::userpass))
-    {
-        // Send a User/pass request
-        std::size_t n2 = prepare_userpass_request(
-            buffer, n, opt);
-        asio::write(
-            stream, asio::buffer(buffer, n2), ec);
-        if (ec.failed())
-            return 0;
-
-        // Read User/pass reply
-        n = asio::read(
-            stream, asio::buffer(buffer, 2), ec);
-        if (!ec.failed() ||
-            ec == asio::error::eof)
-            validate_userpass_reply(buffer, n, ec);
-    }
-    return buffer[1];
+    auth_mechanism* m;
+    if (has_auth_rounds(opt, choice, m))
+        authenticate_rounds(
+            stream, buffer, n, opt, m, nullptr, ec);
+    return choice;
 }
 
 template <class SyncStream>
@@ -300,22 +406,163 @@ read_connect_reply(
     return detail::parse_reply_v5(buffer, n, ec);
 }
 
-template <class Stream, class Endpoint, class Allocator>
+// The parts of the handshake an operation runs
+enum class connect_steps
+{
+    // Greeting, sub-negotiation and request
+    all,
+
+    // Greeting and sub-negotiation, leaving
+    // the stream ready for a request
+    authenticate,
+
+    // Request, on an authenticated stream
+    request
+};
+
+// A deadline allocated with the allocator
+// of a composed operation, so it does not
+// move with the operation
+template <class Allocator>
+class deadline_handle
+    : private empty_value<
+        allocator_rebind_t<Allocator, deadline>, 0>
+{
+    using allocator_type =
+        allocator_rebind_t<Allocator, deadline>;
+
+public:
+    explicit
+    deadline_handle(Allocator const& a)
+        : empty_value<allocator_type, 0>(
+            empty_init, allocator_type(a))
+    {}
+
+    deadline_handle(deadline_handle&& other) noexcept
+        : empty_value<allocator_type, 0>(
+            empty_init, other.get())
+        , p_(other.p_)
+    {
+        other.p_ = nullptr;
+    }
+
+    deadline_handle&
+    operator=(deadline_handle&&) = delete;
+
+    ~deadline_handle()
+    {
+        reset();
+    }
+
+    template <class Executor>
+    deadline&
+    emplace(Executor const& ex)
+    {
+        reset();
+        deadline* p = allocator_allocate(this->get(), 1);
+        try
+        {
+            ::new(static_cast<void*>(p)) deadline(ex);
+        }
+        catch (...)
+        {
+            allocator_deallocate(this->get(), p, 1);
+            throw;
+        }
+        p_ = p;
+        return *p_;
+    }
+
+    void
+    reset() noexcept
+    {
+        if (p_)
+        {
+            p_->~deadline();
+            allocator_deallocate(this->get(), p_, 1);
+            p_ = nullptr;
+        }
+    }
+
+    bool
+    expired() const noexcept
+    {
+        return p_ && p_->expired();
+    }
+
+private:
+    deadline* p_{nullptr};
+};
+
+template <
+    class Stream,
+    class Endpoint,
+    class Allocator,
+    class Tracer = null_connect_tracer>
 class connect_op
     : private empty_value<Allocator, 0>
+    , private empty_value<Tracer, 1>
 {
 public:
     connect_op(
         Stream& s,
         Endpoint target_host,
         auth_options opt,
+        timer_wheel::duration timeout,
+        bool pipeline,
+        Allocator const& a,
+        Tracer const& t = Tracer())
+        : empty_value<Allocator, 0>(empty_init, a)
+        , empty_value<Tracer, 1>(empty_init, t)
+        , s_(s)
+        , buf_(513, 0x00, a)
+        , target_(target_host)
+        , opt_(opt)
+        , timeout_(timeout)
+        , deadline_(a)
+        , pipeline_(pipeline)
+    {
+        // The server can only choose the
+        // method before it reads the request
+        BOOST_ASSERT(!pipeline || opt.code() == 0x00);
+    }
+
+    connect_op(
+        Stream& s,
+        Endpoint target_host,
+        auth_options opt,
+        timer_wheel::duration timeout,
+        connect_steps steps,
         Allocator const& a)
         : empty_value<Allocator, 0>(empty_init, a)
+        , empty_value<Tracer, 1>(empty_init, Tracer())
         , s_(s)
         , buf_(513, 0x00, a)
         , target_(target_host)
         , opt_(opt)
-    {}
+        , timeout_(timeout)
+        , deadline_(a)
+        , pipeline_(false)
+        , steps_(steps)
+    {
+    }
+
+    connect_op(
+        Stream& s,
+        handshake_template const& t,
+        timer_wheel::duration timeout,
+        Allocator const& a,
+        Tracer const& tr = Tracer())
+        : empty_value<Allocator, 0>(empty_init, a)
+        , empty_value<Tracer, 1>(empty_init, tr)
+        , s_(s)
+        , buf_(513, 0x00, a)
+        , timeout_(timeout)
+        , deadline_(a)
+        , pipeline_(t.pipelined())
+        , tpl_(&t)
+    {
+    }
 
     template <typename Self>
     void
@@ -327,20 +574,37 @@ public:
         endpoint ep{};
         BOOST_ASIO_CORO_REENTER(coro_)
         {
-            // Send a GREETING request
-            n = prepare_greeting(
-                buf_.data(), buf_.size(), opt_);
-            BOOST_ASSERT(n > 2);
+            // Closing the stream makes the pending
+            // operation fail when the deadline expires
+            if (timeout_ > timer_wheel::duration::zero())
+            {
+                deadline& d = deadline_.emplace(
+                    s_.get_executor());
+                d.on_expire(&connect_op::on_timeout, &s_);
+                d.expires_after(timeout_);
+            }
+
+            if (steps_ == connect_steps::request)
+                goto send_request;
+
+            // Send a GREETING request, followed
+            // by the CONNECT request when pipelined
+            trace().on_start(connect_phase::greeting);
+            out_ = prepare_greeting_buffer();
             BOOST_ASIO_HANDLER_LOCATION((
                 __FILE__, __LINE__,
                 "asio::async_write"));
             BOOST_ASIO_CORO_YIELD
             asio::async_write(
                 s_,
-                asio::buffer(buf_.data(), n),
+                out_,
                 std::move(self));
+            trace().on_write(connect_phase::greeting, n);
             if (ec.failed())
+            {
+                trace().on_end(connect_phase::greeting, ec);
                 goto complete;
+            }
 
             // Read GREETING reply (or "server choice")
             BOOST_ASIO_HANDLER_LOCATION((
@@ -351,61 +615,91 @@ public:
                 s_,
                 asio::buffer(buf_.data(), 2),
                 std::move(self));
+            trace().on_read(connect_phase::greeting, n);
             if (!ec.failed() ||
                 ec == asio::error::eof)
                 validate_server_choice(
-                    buf_.data(), n, opt_, ec);
+                    buf_.data(), n, opt(), ec);
+            trace().on_end(connect_phase::greeting, ec);
             if (ec.failed())
                 goto complete;
 
-            // Only user/pass is supported
-            if (buf_[1] == static_cast<unsigned char>(
-                    auth_method::userpass))
+            // Run the sub-negotiation of the method
+            if (has_auth_rounds(opt(), buf_[1], mech_))
             {
-                // Send a user/pass request
-                n = prepare_userpass_request(
-                    buf_.data(), buf_.size(), opt_);
-                BOOST_ASIO_HANDLER_LOCATION((
-                    __FILE__, __LINE__,
-                    "asio::async_write"));
-                BOOST_ASIO_CORO_YIELD
-                asio::async_write(
-                    s_,
-                    asio::buffer(buf_.data(), n),
-                    std::move(self));
-                if (ec.failed())
-                    goto complete;
+                trace().on_start(connect_phase::auth);
+                for (round_ = 0;; ++round_)
+                {
+                    // Send the message of the round
+                    out_ = prepare_auth_round_buffer(ec);
+                    if (ec.failed())
+                        break;
+                    if (out_.size() != 0)
+                    {
+                        BOOST_ASIO_HANDLER_LOCATION((
+                            __FILE__, __LINE__,
+                            "asio::async_write"));
+                        BOOST_ASIO_CORO_YIELD
+                        asio::async_write(
+                            s_,
+                            out_,
+                            std::move(self));
+                        trace().on_write(connect_phase::auth, n);
+                        if (ec.failed())
+                            break;
+                    }
 
-                // Read User/pass reply
-                BOOST_ASIO_HANDLER_LOCATION((
-                    __FILE__, __LINE__,
-                    "asio::async_read"));
-                BOOST_ASIO_CORO_YIELD
-                asio::async_read(
-                    s_,
-                    asio::buffer(buf_.data(), 2),
-                    std::move(self));
-                validate_userpass_reply(buf_.data(), n, ec);
-                if (ec.failed() &&
-                    ec != asio::error::eof)
+                    // Read the reply of the round
+                    BOOST_ASIO_HANDLER_LOCATION((
+                        __FILE__, __LINE__,
+                        "asio::async_read"));
+                    BOOST_ASIO_CORO_YIELD
+                    asio::async_read(
+                        s_,
+                        asio::buffer(buf_.data(), buf_.size()),
+                        read_auth_reply_cond{
+                            mech_, round_, buf_.data()},
+                        std::move(self));
+                    trace().on_read(connect_phase::auth, n);
+                    if (ec.failed() &&
+                        ec != asio::error::eof)
+                        break;
+                    ec = {};
+                    if (!on_auth_round_reply(
+                            buf_.data(), n, mech_, round_, ec) ||
+                        ec.failed())
+                        break;
+                }
+                trace().on_end(connect_phase::auth, ec);
+                if (ec.failed())
                     goto complete;
             }
 
+            if (steps_ == connect_steps::authenticate)
+                goto complete;
+            if (pipeline_)
+                goto read_reply;
+
+        send_request:
             // Send the CONNECT request
-            n = prepare_request(
-                buf_.data(), buf_.size(), target_);
+            trace().on_start(connect_phase::request);
+            out_ = prepare_request_buffer();
             BOOST_ASIO_HANDLER_LOCATION((
                 __FILE__, __LINE__,
                 "asio::async_write"));
             BOOST_ASIO_CORO_YIELD
             asio::async_write(
                 s_,
-                asio::buffer(buf_.data(), n),
+                out_,
                 std::move(self));
+            trace().on_write(connect_phase::request, n);
+            trace().on_end(connect_phase::request, ec);
             if (ec.failed())
                 goto complete;
 
+        read_reply:
             // Read the CONNECT reply
+            trace().on_start(connect_phase::reply);
             BOOST_ASIO_HANDLER_LOCATION((
                 __FILE__, __LINE__,
                 "asio::async_read"));
@@ -415,6 +709,7 @@ public:
                 asio::buffer(buf_.data(), 22),
                 read_reply_cond{buf_.data()},
                 std::move(self));
+            trace().on_read(connect_phase::reply, n);
             if (ec.failed() &&
                 ec != asio::error::eof)
             {
@@ -426,33 +721,116 @@ public:
                 // We still want to parse the response
                 // to find out what kind of error
                 // this is.
-                goto complete;
             }
-            if (n != 10 &&
+            else if (
+                n != 10 &&
                 n != 22)
             {
                 ec = error::bad_reply_size;
-                goto complete;
             }
-            ep = parse_reply_v5(buf_.data(), n, ec);
+            else
+            {
+                ep = parse_reply_v5(buf_.data(), n, ec);
+            }
+            trace().on_end(connect_phase::reply, ec);
         complete:
+            if (deadline_.expired())
+            {
+                ec = asio::error::timed_out;
+                ep = {};
+            }
             {
                 // Free memory before invoking the handler
                 decltype(buf_) tmp( std::move(buf_) );
+                deadline_.reset();
             }
             return self.complete(ec, ep);
         }
     }
 
 private:
+    static
+    void
+    on_timeout(void* p)
+    {
+        error_code ec;
+        static_cast<Stream*>(p)->close(ec);
+    }
+
+    Tracer&
+    trace() noexcept
+    {
+        return empty_value<Tracer, 1>::get();
+    }
+
+    auth_options const&
+    opt() const noexcept
+    {
+        return tpl_ ? tpl_->options() : opt_;
+    }
+
+    // The messages of a template are written
+    // as they are, and others are encoded
+    // in the buffer
+
+    asio::const_buffer
+    prepare_greeting_buffer()
+    {
+        if (tpl_)
+            return pipeline_ ?
+                tpl_->data() : tpl_->greeting();
+        std::size_t n = prepare_greeting(
+            buf_.data(), buf_.size(), opt_);
+        BOOST_ASSERT(n > 2);
+        if (pipeline_)
+            n += prepare_request(
+                buf_.data() + n, buf_.size() - n, target_);
+        return asio::buffer(buf_.data(), n);
+    }
+
+    asio::const_buffer
+    prepare_auth_round_buffer(error_code& ec)
+    {
+        if (tpl_ && !mech_)
+            return pipeline_ ?
+                asio::const_buffer() :
+                tpl_->userpass_request();
+        std::size_t n = prepare_auth_round(
+            buf_.data(), buf_.size(),
+            opt(), mech_, round_, ec);
+        return asio::buffer(buf_.data(), n);
+    }
+
+    asio::const_buffer
+    prepare_request_buffer()
+    {
+        if (tpl_)
+            return tpl_->request();
+        std::size_t n = prepare_request(
+            buf_.data(), buf_.size(), target_);
+        return asio::buffer(buf_.data(), n);
+    }
+
     Stream& s_;
     std::vector<unsigned char, Allocator> buf_;
     Endpoint target_;
     auth_options const opt_;
+    timer_wheel::duration timeout_;
+    deadline_handle<Allocator> deadline_;
+    bool pipeline_;
+    connect_steps steps_{connect_steps::all};
+    handshake_template const* tpl_{nullptr};
+    asio::const_buffer out_;
+    auth_mechanism* mech_{nullptr};
+    std::size_t round_{0};
     asio::coroutine coro_;
 };
 
-template <class AsyncStream, class Endpoint, class CompletionToken>
+template <
+    class AsyncStream,
+    class Endpoint,
+    class Tracer,
+    class CompletionToken>
 typename asio::async_result<
     typename asio::decay<CompletionToken>::type,
     void (error_code, endpoint)
@@ -461,6 +839,9 @@ async_connect_any(
     AsyncStream& s,
     Endpoint const& target_host,
     auth_options const& opt,
+    timer_wheel::duration timeout,
+    bool pipeline,
+    Tracer const& tracer,
     CompletionToken&& token)
 {
     using DecayedToken =
@@ -478,11 +859,14 @@ async_connect_any(
         (
             // implementation of the composed asynchronous operation
             detail::connect_op<
-                AsyncStream, Endpoint, allocator_type>{
+                AsyncStream, Endpoint, allocator_type, Tracer>{
                 s,
                 target_host,
                 opt,
-                asio::get_associated_allocator(token)
+                timeout,
+                pipeline,
+                asio::get_associated_allocator(token),
+                tracer
             },
             // the completion token
             token,
@@ -491,6 +875,131 @@ async_connect_any(
             s
         );
 }
+
+template <
+    class AsyncStream,
+    class Tracer,
+    class CompletionToken>
+typename asio::async_result<
+    typename asio::decay<CompletionToken>::type,
+    void (error_code, endpoint)
+    >::return_type
+async_connect_template(
+    AsyncStream& s,
+    handshake_template const& t,
+    timer_wheel::duration timeout,
+    Tracer const& tracer,
+    CompletionToken&& token)
+{
+    using DecayedToken =
+        typename std::decay<CompletionToken>::type;
+    using allocator_type =
+        allocator_rebind_t<
+            typename asio::associated_allocator<
+                DecayedToken>::type, unsigned char>;
+    // The target is encoded in the template
+    return asio::async_compose<
+        CompletionToken,
+        void (error_code, endpoint)>
+        (
+            detail::connect_op<
+                AsyncStream, domain_endpoint_view,
+                allocator_type, Tracer>{
+                s,
+                t,
+                timeout,
+                asio::get_associated_allocator(token),
+                tracer
+            },
+            token,
+            s
+        );
+}
+
+template <
+    class AsyncStream,
+    class Endpoint,
+    class CompletionToken>
+typename asio::async_result<
+    typename asio::decay<CompletionToken>::type,
+    void (error_code, endpoint)
+    >::return_type
+async_connect_steps(
+    AsyncStream& s,
+    Endpoint const& target_host,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    connect_steps steps,
+    CompletionToken&& token)
+{
+    using DecayedToken =
+        typename std::decay<CompletionToken>::type;
+    using allocator_type =
+        allocator_rebind_t<
+            typename asio::associated_allocator<
+                DecayedToken>::type, unsigned char>;
+    return asio::async_compose<
+        CompletionToken,
+        void (error_code, endpoint)>
+        (
+            detail::connect_op<
+                AsyncStream, Endpoint, allocator_type>{
+                s,
+                target_host,
+                opt,
+                timeout,
+                steps,
+                asio::get_associated_allocator(token)
+            },
+            token,
+            s
+        );
+}
+
+// Run the greeting and sub-negotiation,
+// completing without the endpoint
+template <class AsyncStream>
+class authenticate_op
+{
+public:
+    authenticate_op(
+        AsyncStream& s,
+        auth_options const& opt,
+        timer_wheel::duration timeout)
+        : s_(s)
+        , opt_(opt)
+        , timeout_(timeout)
+    {
+    }
+
+    template <typename Self>
+    void
+    operator()(Self& self)
+    {
+        async_connect_steps(
+            s_,
+            domain_endpoint_view(),
+            opt_,
+            timeout_,
+            connect_steps::authenticate,
+            std::move(self));
+    }
+
+    template <typename Self>
+    void
+    operator()(
+        Self& self,
+        error_code ec,
+        endpoint)
+    {
+        self.complete(ec);
+    }
+
+private:
+    AsyncStream& s_;
+    auth_options const opt_;
+    timer_wheel::duration timeout_;
+};
 } // detail
 
 
@@ -551,6 +1060,103 @@ connect(
     return ep;
 }
 
+template <class SyncStream>
+endpoint
+connect(
+    SyncStream& stream,
+    handshake_template const& t,
+    error_code& ec)
+{
+    unsigned char buffer[513];
+    asio::write(
+        stream,
+        t.pipelined() ? t.data() : t.greeting(),
+        ec);
+    if (ec.failed())
+        return {};
+
+    std::size_t n = asio::read(
+        stream,
+        asio::buffer(buffer, 2),
+        ec);
+    if (!ec.failed() ||
+        ec == asio::error::eof)
+        detail::validate_server_choice(
+            buffer, n, t.options(), ec);
+    if (ec.failed())
+        return {};
+
+    auth_mechanism* m;
+    if (detail::has_auth_rounds(t.options(), buffer[1], m))
+    {
+        detail::authenticate_rounds(
+            stream, buffer, 513, t.options(), m, &t, ec);
+        if (ec.failed())
+            return {};
+    }
+
+    if (!t.pipelined())
+    {
+        asio::write(stream, t.request(), ec);
+        if (ec.failed())
+            return {};
+    }
+
+    auto ep = detail::read_connect_reply(
+        stream, buffer, 513, ec);
+    if (ec.failed())
+        return {};
+    return ep;
+}
+
+template <class SyncStream>
+void
+authenticate(
+    SyncStream& stream,
+    auth_options const& opt,
+    error_code& ec)
+{
+    unsigned char buffer[513];
+    detail::authenticate(
+        stream, buffer, 513, opt, ec);
+}
+
+template <class SyncStream>
+endpoint
+connect_authenticated(
+    SyncStream& stream,
+    endpoint const& target_host,
+    error_code& ec)
+{
+    unsigned char buffer[513];
+    detail::write_connect_request(
+        stream, buffer, 513, target_host, ec);
+    if (ec.failed())
+        return {};
+    return detail::read_connect_reply(
+        stream, buffer, 513, ec);
+}
+
+template <class SyncStream>
+endpoint
+connect_authenticated(
+    SyncStream& stream,
+    string_view target_host,
+    std::uint16_t target_port,
+    error_code& ec)
+{
+    unsigned char buffer[513];
+    detail::domain_endpoint_view target;
+    target.domain = target_host;
+    target.port = target_port;
+    detail::write_connect_request(
+        stream, buffer, 513, target, ec);
+    if (ec.failed())
+        return {};
+    return detail::read_connect_reply(
+        stream, buffer, 513, ec);
+}
+
 // SOCKS4 connect initiating function
 // - These overloads look similar to what we
 // should have in socks_io.
@@ -566,7 +1172,41 @@ async_connect(
     CompletionToken&& token)
 {
     return detail::async_connect_any(
-        s, target_host, opt, token);
+        s, target_host, opt,
+        timer_wheel::duration::zero(), false,
+        null_connect_tracer(), token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    endpoint const& target_host,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    return detail::async_connect_any(
+        s, target_host, opt, timeout, false,
+        null_connect_tracer(), token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    CompletionToken&& token)
+{
+    detail::domain_endpoint ep;
+    ep.domain = std::string(app_domain);
+    ep.port = app_port;
+    return detail::async_connect_any(
+        s, ep, opt,
+        timer_wheel::duration::zero(), false,
+        null_connect_tracer(), token);
 }
 
 template <class AsyncStream, class CompletionToken>
@@ -576,13 +1216,176 @@ async_connect(
     string_view app_domain,
     std::uint16_t app_port,
     auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    detail::domain_endpoint ep;
+    ep.domain = std::string(app_domain);
+    ep.port = app_port;
+    return detail::async_connect_any(
+        s, ep, opt, timeout, false,
+        null_connect_tracer(), token);
+}
+
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    endpoint const& target_host,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    Tracer& tracer,
+    CompletionToken&& token)
+{
+    return detail::async_connect_any(
+        s, target_host, opt, timeout, false,
+        detail::tracer_ref<Tracer>(tracer), token);
+}
+
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    Tracer& tracer,
     CompletionToken&& token)
 {
     detail::domain_endpoint ep;
     ep.domain = std::string(app_domain);
     ep.port = app_port;
     return detail::async_connect_any(
-        s, ep, opt, token);
+        s, ep, opt, timeout, false,
+        detail::tracer_ref<Tracer>(tracer), token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    handshake_template const& t,
+    CompletionToken&& token)
+{
+    return detail::async_connect_template(
+        s, t, timer_wheel::duration::zero(),
+        null_connect_tracer(), token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    handshake_template const& t,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    return detail::async_connect_template(
+        s, t, timeout,
+        null_connect_tracer(), token);
+}
+
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect(
+    AsyncStream& s,
+    handshake_template const& t,
+    timer_wheel::duration timeout,
+    Tracer& tracer,
+    CompletionToken&& token)
+{
+    return detail::async_connect_template(
+        s, t, timeout,
+        detail::tracer_ref<Tracer>(tracer), token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ERROR(CompletionToken)
+async_authenticate(
+    AsyncStream& s,
+    auth_options const& opt,
+    CompletionToken&& token)
+{
+    return async_authenticate(
+        s, opt, timer_wheel::duration::zero(),
+        std::forward<CompletionToken>(token));
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ERROR(CompletionToken)
+async_authenticate(
+    AsyncStream& s,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    return asio::async_compose<
+        CompletionToken,
+        void (error_code)>
+        (
+            detail::authenticate_op<AsyncStream>{
+                s, opt, timeout},
+            token,
+            s
+        );
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    endpoint const& target_host,
+    CompletionToken&& token)
+{
+    return detail::async_connect_steps(
+        s, target_host, auth_options(),
+        timer_wheel::duration::zero(),
+        detail::connect_steps::request, token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    endpoint const& target_host,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    return detail::async_connect_steps(
+        s, target_host, auth_options(), timeout,
+        detail::connect_steps::request, token);
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    CompletionToken&& token)
+{
+    return async_connect_authenticated(
+        s, app_domain, app_port,
+        timer_wheel::duration::zero(),
+        std::forward<CompletionToken>(token));
+}
+
+template <class AsyncStream, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_authenticated(
+    AsyncStream& s,
+    string_view app_domain,
+    std::uint16_t app_port,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    detail::domain_endpoint ep;
+    ep.domain = std::string(app_domain);
+    ep.port = app_port;
+    return detail::async_connect_steps(
+        s, ep, auth_options(), timeout,
+        detail::connect_steps::request, token);
 }
 
 } // socks
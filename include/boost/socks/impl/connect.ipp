@@ -51,12 +51,21 @@ prepare_greeting(
     std::size_t n,
     auth_options const& opt)
 {
-    unsigned char auth_code = opt.code();
-    if (auth_code != 0x00)
-        return prepare_greeting(
-            buffer, n, {0x00, auth_code});
-    else
-        return prepare_greeting(buffer, n, {0x00});
+    BOOST_ASSERT(opt.size() != 0);
+    BOOST_ASSERT(n >= 2 + opt.size());
+
+    // VER
+    buffer[0] = static_cast<unsigned char>(
+        version::socks_5);
+
+    // NMETHODS
+    buffer[1] = static_cast<unsigned char>(
+        opt.size());
+
+    // METHODS, in order of preference
+    std::memcpy(
+        buffer + 2, opt.methods(), opt.size());
+    return 2 + opt.size();
 }
 
 std::size_t
@@ -65,6 +74,13 @@ prepare_userpass_request(
     std::size_t n,
     auth_options const& opt)
 {
+    // Shared credentials are encoded
+    if (auto const& c = opt.credentials())
+    {
+        BOOST_ASSERT(n >= c->size());
+        std::memcpy(buffer, c->data(), c->size());
+        return c->size();
+    }
     BOOST_ASSERT(opt.user.size() <= 255);
     BOOST_ASSERT(opt.pass.size() <= 255);
     std::size_t n2 =
@@ -81,7 +97,7 @@ prepare_userpass_request(
         buffer[i++] = static_cast<unsigned char>(c);
     // PWLEN
     buffer[i++] = static_cast<unsigned char>(
-        opt.user.size());
+        opt.pass.size());
     // PW
     for (auto c: opt.pass)
         buffer[i++] = static_cast<unsigned char>(c);
@@ -309,7 +325,12 @@ validate_server_choice(
     auth_options const& opt,
     error_code& ec)
 {
-    validate_server_choice(buffer, n, opt.code(), ec);
+    if (n < 2)
+        ec = error::bad_reply_size;
+    else if (buffer[0] != 0x05)
+        ec = error::bad_reply_version;
+    else if (!opt.offers(buffer[1]))
+        ec = error::bad_server_choice;
 }
 
 } // detail
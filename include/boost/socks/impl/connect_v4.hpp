@@ -12,6 +12,7 @@
 
 #include <boost/socks/detail/config.hpp>
 
+#include <boost/socks/connect_trace.hpp>
 #include <boost/socks/detail/command.hpp>
 #include <boost/socks/detail/version.hpp>
 #include <boost/socks/error.hpp>
@@ -48,16 +49,22 @@ parse_reply_v4(
     std::size_t n,
     error_code& ec);
 
-template <class Stream, class Allocator>
+template <
+    class Stream,
+    class Allocator,
+    class Tracer = null_connect_tracer>
 class connect_v4_op
+    : private empty_value<Tracer, 0>
 {
 public:
     connect_v4_op(
         Stream& s,
         endpoint target_host,
         string_view socks_user,
-        Allocator const& a)
-        : s_(s)
+        Allocator const& a,
+        Tracer const& t = Tracer())
+        : empty_value<Tracer, 0>(empty_init, t)
+        , s_(s)
         , buf_(9 + socks_user.size(), 0x00, a)
     {
         std::size_t n = prepare_request_v4(
@@ -80,6 +87,7 @@ public:
         BOOST_ASIO_CORO_REENTER(coro_)
         {
             // Send the CONNECT request
+            trace().on_start(connect_phase::request);
             BOOST_ASIO_HANDLER_LOCATION((
                 __FILE__, __LINE__,
                 "asio::async_write"));
@@ -88,10 +96,13 @@ public:
                 s_,
                 asio::buffer(buf_),
                 std::move(self));
+            trace().on_write(connect_phase::request, n);
+            trace().on_end(connect_phase::request, ec);
             if (ec.failed())
                 goto complete;
 
             // Read the CONNECT reply
+            trace().on_start(connect_phase::reply);
             BOOST_ASSERT(buf_.capacity() >= 8);
             BOOST_ASIO_HANDLER_LOCATION((
                 __FILE__, __LINE__,
@@ -101,6 +112,7 @@ public:
                 s_,
                 asio::buffer(buf_.data(), 8),
                 std::move(self));
+            trace().on_read(connect_phase::reply, n);
             if (ec.failed() &&
                 ec != asio::error::eof)
             {
@@ -112,15 +124,17 @@ public:
                 // We still want to parse the response
                 // to find out what kind of error
                 // this is.
-                goto complete;
             }
-            if (n != 8)
+            else if (n != 8)
             {
                 ec = error::bad_reply_size;
-                goto complete;
             }
-            ep = parse_reply_v4(
-                buf_.data(), n, ec);
+            else
+            {
+                ep = parse_reply_v4(
+                    buf_.data(), n, ec);
+            }
+            trace().on_end(connect_phase::reply, ec);
         complete:
             {
                 // Free memory before invoking the handler
@@ -131,11 +145,56 @@ public:
     }
 
 private:
+    Tracer&
+    trace() noexcept
+    {
+        return empty_value<Tracer, 0>::get();
+    }
+
     Stream& s_;
     std::vector<unsigned char, Allocator> buf_;
     asio::coroutine coro_;
 };
 
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_v4_any(
+    AsyncStream& s,
+    endpoint const& target_host,
+    string_view socks_user,
+    Tracer const& tracer,
+    CompletionToken&& token)
+{
+    using DecayedToken =
+        typename std::decay<CompletionToken>::type;
+    using allocator_type =
+        allocator_rebind_t<
+            typename asio::associated_allocator<
+                DecayedToken>::type, unsigned char>;
+    // async_initiate will:
+    // - transform token into handler
+    // - call initiation_fn(handler, args...)
+    return asio::async_compose<
+            CompletionToken,
+            void (error_code, endpoint)>
+    (
+        // implementation of the composed asynchronous operation
+        detail::connect_v4_op<
+            AsyncStream, allocator_type, Tracer>{
+                s,
+                target_host,
+                socks_user,
+                asio::get_associated_allocator(token),
+                tracer
+            },
+        // the completion token
+        token,
+        // I/O objects or I/O executors for which
+        // outstanding work must be maintained
+        s
+    );
+}
+
 } // detail
 
 
@@ -213,33 +272,23 @@ async_connect_v4(
     string_view socks_user,
     CompletionToken&& token)
 {
-    using DecayedToken =
-        typename std::decay<CompletionToken>::type;
-    using allocator_type =
-        allocator_rebind_t<
-            typename asio::associated_allocator<
-                DecayedToken>::type, unsigned char>;
-    // async_initiate will:
-    // - transform token into handler
-    // - call initiation_fn(handler, args...)
-    return asio::async_compose<
-            CompletionToken,
-            void (error_code, endpoint)>
-    (
-        // implementation of the composed asynchronous operation
-        detail::connect_v4_op<
-            AsyncStream, allocator_type>{
-                s,
-                target_host,
-                socks_user,
-                asio::get_associated_allocator(token)
-            },
-        // the completion token
-        token,
-        // I/O objects or I/O executors for which
-        // outstanding work must be maintained
-        s
-    );
+    return detail::async_connect_v4_any(
+        s, target_host, socks_user,
+        null_connect_tracer(), token);
+}
+
+template <class AsyncStream, class Tracer, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_v4(
+    AsyncStream& s,
+    endpoint const& target_host,
+    string_view socks_user,
+    Tracer& tracer,
+    CompletionToken&& token)
+{
+    return detail::async_connect_v4_any(
+        s, target_host, socks_user,
+        detail::tracer_ref<Tracer>(tracer), token);
 }
 
 } // socks
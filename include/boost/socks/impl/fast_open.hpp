@@ -0,0 +1,317 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+#ifndef BOOST_SOCKS_IMPL_FAST_OPEN_HPP
+#define BOOST_SOCKS_IMPL_FAST_OPEN_HPP
+
+#include <boost/socks/detail/config.hpp>
+#include <boost/socks/connect.hpp>
+
+#include <boost/asio/compose.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+
+#include <boost/core/allocator_access.hpp>
+#include <boost/core/empty_value.hpp>
+#include <boost/core/ignore_unused.hpp>
+
+#include <cstddef>
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+namespace boost {
+namespace socks {
+namespace detail {
+
+#if defined(TCP_FASTOPEN_CONNECT)
+// The TCP_FASTOPEN_CONNECT socket option, which
+// meets the SettableSocketOption requirements
+class fast_open_connect_option
+{
+public:
+    explicit
+    fast_open_connect_option(bool v) noexcept
+        : value_(v ? 1 : 0)
+    {
+    }
+
+    template <class Protocol>
+    int
+    level(Protocol const&) const noexcept
+    {
+        return IPPROTO_TCP;
+    }
+
+    template <class Protocol>
+    int
+    name(Protocol const&) const noexcept
+    {
+        return TCP_FASTOPEN_CONNECT;
+    }
+
+    template <class Protocol>
+    int const*
+    data(Protocol const&) const noexcept
+    {
+        return &value_;
+    }
+
+    template <class Protocol>
+    std::size_t
+    size(Protocol const&) const noexcept
+    {
+        return sizeof(value_);
+    }
+
+private:
+    int value_;
+};
+#endif
+
+// Make connect() complete at once and send
+// the SYN with the first data written
+template <class Socket>
+void
+enable_fast_open_connect(
+    Socket& s,
+    error_code& ec)
+{
+#if defined(TCP_FASTOPEN_CONNECT)
+    s.set_option(
+        fast_open_connect_option(true), ec);
+#else
+    boost::ignore_unused(s);
+    ec = asio::error::operation_not_supported;
+#endif
+}
+
+template <class Socket, class Endpoint, class Allocator>
+class fast_open_op
+    : private empty_value<Allocator, 0>
+{
+public:
+    fast_open_op(
+        Socket& s,
+        asio::ip::tcp::endpoint const& proxy,
+        Endpoint target_host,
+        auth_options opt,
+        timer_wheel::duration timeout,
+        Allocator const& a)
+        : empty_value<Allocator, 0>(empty_init, a)
+        , s_(s)
+        , proxy_(proxy)
+        , target_(target_host)
+        , opt_(opt)
+        , timeout_(timeout)
+        , deadline_(a)
+    {}
+
+    template <typename Self>
+    void
+    operator()(
+        Self& self,
+        error_code ec = {},
+        endpoint ep = {})
+    {
+        BOOST_ASIO_CORO_REENTER(coro_)
+        {
+            // The deadline covers the connection
+            // to the proxy and the handshake
+            if (timeout_ > timer_wheel::duration::zero())
+            {
+                deadline& d = deadline_.emplace(
+                    s_.get_executor());
+                d.on_expire(&fast_open_op::on_timeout, &s_);
+                d.expires_after(timeout_);
+            }
+
+            if (!s_.is_open())
+                s_.open(proxy_.protocol(), ec_);
+            if (ec_.failed())
+            {
+                BOOST_ASIO_CORO_YIELD
+                asio::post(
+                    s_.get_executor(),
+                    std::move(self));
+                ec = ec_;
+                goto complete;
+            }
+
+            // Without Fast Open, this is a
+            // regular three-way handshake
+            {
+                error_code ignored;
+                enable_fast_open_connect(s_, ignored);
+            }
+
+            BOOST_ASIO_HANDLER_LOCATION((
+                __FILE__, __LINE__,
+                "basic_stream_socket::async_connect"));
+            BOOST_ASIO_CORO_YIELD
+            s_.async_connect(proxy_, std::move(self));
+            if (ec.failed())
+                goto complete;
+
+            // The greeting, and the request when no
+            // authentication is needed, are the
+            // first data written, so they ride
+            // in the SYN
+            BOOST_ASIO_HANDLER_LOCATION((
+                __FILE__, __LINE__,
+                "socks::async_connect"));
+            BOOST_ASIO_CORO_YIELD
+            async_connect_any(
+                s_,
+                target_,
+                opt_,
+                timer_wheel::duration::zero(),
+                opt_.code() == 0x00,
+                null_connect_tracer(),
+                std::move(self));
+        complete:
+            if (deadline_.expired())
+            {
+                ec = asio::error::timed_out;
+                ep = {};
+            }
+            deadline_.reset();
+            return self.complete(ec, ep);
+        }
+    }
+
+private:
+    static
+    void
+    on_timeout(void* p)
+    {
+        error_code ec;
+        static_cast<Socket*>(p)->close(ec);
+    }
+
+    Socket& s_;
+    asio::ip::tcp::endpoint proxy_;
+    Endpoint target_;
+    auth_options const opt_;
+    timer_wheel::duration timeout_;
+    deadline_handle<Allocator> deadline_;
+    error_code ec_;
+    asio::coroutine coro_;
+};
+
+template <class Socket, class Endpoint, class CompletionToken>
+typename asio::async_result<
+    typename asio::decay<CompletionToken>::type,
+    void (error_code, endpoint)
+    >::return_type
+async_connect_fast_open_any(
+    Socket& s,
+    asio::ip::tcp::endpoint const& proxy,
+    Endpoint const& target_host,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    using DecayedToken =
+        typename std::decay<CompletionToken>::type;
+    using allocator_type =
+        allocator_rebind_t<
+            typename asio::associated_allocator<
+                DecayedToken>::type, unsigned char>;
+    return asio::async_compose<
+        CompletionToken,
+        void (error_code, endpoint)>
+        (
+            detail::fast_open_op<
+                Socket, Endpoint, allocator_type>{
+                s,
+                proxy,
+                target_host,
+                opt,
+                timeout,
+                asio::get_associated_allocator(token)
+            },
+            token,
+            s
+        );
+}
+
+} // detail
+
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    endpoint const& ep,
+    auth_options const& opt,
+    CompletionToken&& token)
+{
+    return detail::async_connect_fast_open_any(
+        s, proxy, ep, opt,
+        timer_wheel::duration::zero(), token);
+}
+
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    endpoint const& ep,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    return detail::async_connect_fast_open_any(
+        s, proxy, ep, opt, timeout, token);
+}
+
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    CompletionToken&& token)
+{
+    detail::domain_endpoint ep;
+    ep.domain = std::string(app_domain);
+    ep.port = app_port;
+    return detail::async_connect_fast_open_any(
+        s, proxy, ep, opt,
+        timer_wheel::duration::zero(), token);
+}
+
+template <class Executor, class CompletionToken>
+BOOST_SOCKS_ASYNC_ENDPOINT(CompletionToken)
+async_connect_fast_open(
+    asio::basic_stream_socket<asio::ip::tcp, Executor>& s,
+    asio::ip::tcp::endpoint const& proxy,
+    string_view app_domain,
+    std::uint16_t app_port,
+    auth_options const& opt,
+    timer_wheel::duration timeout,
+    CompletionToken&& token)
+{
+    detail::domain_endpoint ep;
+    ep.domain = std::string(app_domain);
+    ep.port = app_port;
+    return detail::async_connect_fast_open_any(
+        s, proxy, ep, opt, timeout, token);
+}
+
+} // socks
+} // boost
+
+#endif
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_IMPL_HANDSHAKE_TEMPLATE_IPP
+#define BOOST_SOCKS_IMPL_HANDSHAKE_TEMPLATE_IPP
+
+#include <boost/socks/handshake_template.hpp>
+#include <boost/socks/connect.hpp>
+#include <boost/assert.hpp>
+
+namespace boost {
+namespace socks {
+
+handshake_template::
+handshake_template(
+    endpoint const& target,
+    auth_options const& opt,
+    bool pipeline)
+{
+    std::size_t i = prepare(opt, pipeline);
+    i += detail::prepare_request(
+        buf_ + i, sizeof(buf_) - i, target);
+    size_ = static_cast<std::uint16_t>(i);
+}
+
+handshake_template::
+handshake_template(
+    string_view domain,
+    std::uint16_t port,
+    auth_options const& opt,
+    bool pipeline)
+{
+    BOOST_ASSERT(domain.size() <= 255);
+    detail::domain_endpoint_view target;
+    target.domain = domain;
+    target.port = port;
+    std::size_t i = prepare(opt, pipeline);
+    i += detail::prepare_request(
+        buf_ + i, sizeof(buf_) - i, target);
+    size_ = static_cast<std::uint16_t>(i);
+}
+
+std::size_t
+handshake_template::
+prepare(
+    auth_options const& opt,
+    bool pipeline)
+{
+    opt_ = opt;
+    pipeline_ = pipeline;
+    if (pipeline)
+    {
+        // Offer a single method, so the
+        // server choice is known in advance
+        opt_.clear();
+        if (opt.credentials())
+            opt_.add(opt.credentials());
+        else if (opt.is_userpass)
+            opt_.add(auth_options::userpass{
+                opt.user, opt.pass});
+        else
+        {
+            // Other mechanisms need the choice
+            BOOST_ASSERT(opt.offers(0x00));
+            opt_.add(auth_options::none{});
+        }
+    }
+
+    std::size_t i = detail::prepare_greeting(
+        buf_, sizeof(buf_), opt_);
+    greeting_size_ = static_cast<std::uint16_t>(i);
+    if (opt_.is_userpass)
+    {
+        i += detail::prepare_userpass_request(
+            buf_ + i, sizeof(buf_) - i, opt_);
+        userpass_size_ = static_cast<std::uint16_t>(
+            i - greeting_size_);
+    }
+
+    // The strings are encoded, and the
+    // template does not refer to them
+    opt_.user = {};
+    opt_.pass = {};
+    return i;
+}
+
+} // socks
+} // boost
+
+#endif
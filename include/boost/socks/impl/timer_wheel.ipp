@@ -0,0 +1,371 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_IMPL_TIMER_WHEEL_IPP
+#define BOOST_SOCKS_IMPL_TIMER_WHEEL_IPP
+
+#include <boost/socks/timer_wheel.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/assert.hpp>
+
+namespace boost {
+namespace socks {
+
+namespace detail {
+
+// Bits of the expiry tick indexing each level
+constexpr unsigned wheel_level_bits = 8;
+
+constexpr std::uint64_t wheel_slot_mask = 0xFF;
+
+// Return the index of the first bit set
+// in [from, 256), or 256 if none is set
+inline
+std::size_t
+find_next_bit(
+    std::uint64_t const* words,
+    std::size_t from) noexcept
+{
+    while (from < 256)
+    {
+        std::uint64_t w =
+            words[from / 64] >> (from % 64);
+        if (w != 0)
+        {
+            std::size_t i = from;
+            while ((w & 1) == 0)
+            {
+                w >>= 1;
+                ++i;
+            }
+            return i;
+        }
+        from = (from / 64 + 1) * 64;
+    }
+    return 256;
+}
+
+} // detail
+
+asio::execution_context::id timer_wheel::id;
+
+constexpr std::size_t timer_wheel::slots_per_level;
+constexpr std::size_t timer_wheel::levels;
+
+std::uint64_t
+timer_wheel::
+to_ticks(duration d) noexcept
+{
+    duration r = resolution();
+    if (d <= duration::zero())
+        return 1;
+    std::uint64_t n = static_cast<std::uint64_t>(
+        (d + r - duration(1)) / r);
+    return n == 0 ? 1 : n;
+}
+
+timer_wheel::
+timer_wheel(asio::execution_context& ctx)
+    : asio::execution_context::service(ctx)
+    , epoch_(clock_type::now())
+{
+}
+
+timer_wheel::
+~timer_wheel()
+{
+    // Deadlines destroyed after the wheel
+    // should not touch it
+    for (auto& level : slots_)
+    {
+        for (deadline*& head : level)
+        {
+            while (head)
+            {
+                deadline* d = head;
+                head = d->next_;
+                d->prev_ = nullptr;
+                d->next_ = nullptr;
+                d->list_ = nullptr;
+            }
+        }
+    }
+}
+
+void
+timer_wheel::
+init(asio::any_io_executor const& ex)
+{
+    if (!timer_)
+        timer_.reset(new asio::steady_timer(ex));
+}
+
+void
+timer_wheel::
+shutdown()
+{
+    stopped_ = true;
+    if (timer_)
+    {
+        error_code ec;
+        timer_->cancel(ec);
+    }
+}
+
+std::uint64_t
+timer_wheel::
+clock_tick() const noexcept
+{
+    return static_cast<std::uint64_t>(
+        (clock_type::now() - epoch_) / resolution());
+}
+
+void
+timer_wheel::
+schedule(deadline& d, duration dur)
+{
+    BOOST_ASSERT(!d.list_);
+    // The wheel only moves when the timer fires,
+    // so now_ can be up to a turn behind the
+    // clock. The expiry counts from the clock,
+    // and the deadline is inserted relative to
+    // now_, which moves it to an outer level.
+    std::uint64_t tick = clock_tick();
+    // While the wheel is empty the
+    // timer is not moving it
+    if (size_ == 0 && !advancing_)
+        now_ = tick;
+    d.expiry_ = tick + to_ticks(dur);
+    d.expired_ = false;
+    insert(d);
+    ++size_;
+    if (!advancing_ &&
+        (!running_ || d.expiry_ < armed_))
+        arm();
+}
+
+void
+timer_wheel::
+cancel(deadline& d) noexcept
+{
+    unlink(d);
+    // An idle wheel does not keep
+    // the context running
+    if (--size_ == 0 &&
+        running_ &&
+        !advancing_)
+    {
+        error_code ec;
+        timer_->cancel(ec);
+        running_ = false;
+    }
+}
+
+void
+timer_wheel::
+insert(deadline& d) noexcept
+{
+    // Choose the level by how far in the future
+    // the deadline is and the slot by the bits
+    // of the expiry tick for that level
+    std::uint64_t delta = d.expiry_ > now_ ?
+        d.expiry_ - now_ : 0;
+    std::size_t level = 0;
+    while (level + 1 < levels &&
+           delta >> (detail::wheel_level_bits * (level + 1)))
+        ++level;
+    if (level == levels - 1)
+    {
+        // Clamp to the range of the wheel
+        std::uint64_t max_delta =
+            (std::uint64_t(1) << (
+                detail::wheel_level_bits * levels)) - 1;
+        if (delta > max_delta)
+            d.expiry_ = now_ + max_delta;
+    }
+    std::size_t slot = static_cast<std::size_t>(
+        (d.expiry_ >> (detail::wheel_level_bits * level)) &
+        detail::wheel_slot_mask);
+    link(d, slots_[level][slot]);
+}
+
+void
+timer_wheel::
+link(deadline& d, deadline*& head) noexcept
+{
+    d.list_ = &head;
+    d.prev_ = nullptr;
+    d.next_ = head;
+    if (head)
+        head->prev_ = &d;
+    else if (&head != &expired_)
+    {
+        std::size_t i = static_cast<std::size_t>(
+            &head - &slots_[0][0]);
+        bits_[i / slots_per_level][(i % slots_per_level) / 64] |=
+            std::uint64_t(1) << (i % 64);
+    }
+    head = &d;
+}
+
+void
+timer_wheel::
+unlink(deadline& d) noexcept
+{
+    deadline*& head = *d.list_;
+    if (d.prev_)
+        d.prev_->next_ = d.next_;
+    else
+        head = d.next_;
+    if (d.next_)
+        d.next_->prev_ = d.prev_;
+    if (!head && &head != &expired_)
+    {
+        std::size_t i = static_cast<std::size_t>(
+            &head - &slots_[0][0]);
+        bits_[i / slots_per_level][(i % slots_per_level) / 64] &=
+            ~(std::uint64_t(1) << (i % 64));
+    }
+    d.prev_ = nullptr;
+    d.next_ = nullptr;
+    d.list_ = nullptr;
+}
+
+void
+timer_wheel::
+cascade(std::size_t level, std::size_t slot) noexcept
+{
+    // Deadlines are reinserted relative to the
+    // current tick, which moves them inwards
+    deadline*& head = slots_[level][slot];
+    while (head)
+    {
+        deadline& d = *head;
+        unlink(d);
+        insert(d);
+    }
+}
+
+std::uint64_t
+timer_wheel::
+next_event() const noexcept
+{
+    // The next occupied slot of the inner
+    // level in this turn, or the end of the
+    // turn, when outer levels might cascade
+    std::size_t cur = static_cast<std::size_t>(
+        now_ & detail::wheel_slot_mask);
+    std::size_t i = detail::find_next_bit(
+        bits_[0], cur + 1);
+    if (i < slots_per_level)
+        return now_ - cur + i;
+    return (now_ | detail::wheel_slot_mask) + 1;
+}
+
+void
+timer_wheel::
+advance(std::uint64_t to)
+{
+    advancing_ = true;
+    while (size_ != 0 && now_ < to)
+    {
+        std::uint64_t t = next_event();
+        if (t > to)
+            break;
+        now_ = t;
+
+        // Cascade the outer levels at the end of
+        // each turn of the previous level
+        for (std::size_t level = 1; level < levels; ++level)
+        {
+            unsigned shift =
+                detail::wheel_level_bits * level;
+            if ((now_ & ((std::uint64_t(1) << shift) - 1)) != 0)
+                break;
+            cascade(level, static_cast<std::size_t>(
+                (now_ >> shift) & detail::wheel_slot_mask));
+        }
+
+        // Everything in the inner slot expires now.
+        // They are moved to a list first, so the
+        // callbacks can schedule and cancel any
+        // deadline.
+        deadline*& head = slots_[0][
+            now_ & detail::wheel_slot_mask];
+        while (head)
+        {
+            deadline& d = *head;
+            unlink(d);
+            link(d, expired_);
+        }
+        while (expired_)
+        {
+            deadline& d = *expired_;
+            cancel(d);
+            d.expired_ = true;
+            if (d.fn_)
+                d.fn_(d.arg_);
+        }
+    }
+    if (now_ < to)
+        now_ = to;
+    advancing_ = false;
+}
+
+void
+timer_wheel::
+arm()
+{
+    if (stopped_ || size_ == 0)
+        return;
+    BOOST_ASSERT(timer_);
+    armed_ = next_event();
+    running_ = true;
+    timer_->expires_at(
+        epoch_ + resolution() * armed_);
+    timer_->async_wait(
+        [this](error_code ec)
+        {
+            on_timer(ec);
+        });
+}
+
+void
+timer_wheel::
+on_timer(error_code ec)
+{
+    // The timer was rearmed for an earlier
+    // deadline, or the context is shutting down
+    if (ec == asio::error::operation_aborted ||
+        stopped_)
+        return;
+    running_ = false;
+    advance(clock_tick());
+    if (size_ != 0)
+        arm();
+}
+
+void
+deadline::
+expires_after(duration d)
+{
+    cancel();
+    wheel_->schedule(*this, d);
+}
+
+void
+deadline::
+cancel() noexcept
+{
+    if (list_)
+        wheel_->cancel(*this);
+}
+
+} // socks
+} // boost
+
+#endif
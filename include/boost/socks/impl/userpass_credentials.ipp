@@ -0,0 +1,65 @@
+//
+// Copyright (c) 2022 alandefreitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// https://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef BOOST_SOCKS_IMPL_USERPASS_CREDENTIALS_IPP
+#define BOOST_SOCKS_IMPL_USERPASS_CREDENTIALS_IPP
+
+#include <boost/socks/userpass_credentials.hpp>
+#include <boost/throw_exception.hpp>
+#include <cstring>
+#include <stdexcept>
+
+namespace boost {
+namespace socks {
+
+userpass_credentials::
+userpass_credentials() noexcept
+    : size_(3)
+{
+    // VER
+    buf_[0] = 0x01;
+    // ULEN
+    buf_[1] = 0x00;
+    // PLEN
+    buf_[2] = 0x00;
+}
+
+userpass_credentials::
+userpass_credentials(
+    string_view user,
+    string_view pass)
+{
+    if (user.size() > max_size)
+        throw_exception(std::length_error(
+            "username too long"));
+    if (pass.size() > max_size)
+        throw_exception(std::length_error(
+            "password too long"));
+    // VER
+    buf_[0] = 0x01;
+    // ULEN
+    buf_[1] = static_cast<unsigned char>(
+        user.size());
+    // UNAME
+    std::size_t i = 2;
+    if (!user.empty())
+        std::memcpy(buf_ + i, user.data(), user.size());
+    i += user.size();
+    // PLEN
+    buf_[i++] = static_cast<unsigned char>(
+        pass.size());
+    // PASSWD
+    if (!pass.empty())
+        std::memcpy(buf_ + i, pass.data(), pass.size());
+    i += pass.size();
+    size_ = static_cast<std::uint16_t>(i);
+}
+
+} // socks
+} // boost
+
+#endif
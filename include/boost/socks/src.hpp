@@ -27,6 +27,9 @@ in a translation unit of the program.
 #include <boost/socks/impl/connect.ipp>
 #include <boost/socks/impl/connect_v4.ipp>
 #include <boost/socks/impl/error.ipp>
+#include <boost/socks/impl/handshake_template.ipp>
+#include <boost/socks/impl/timer_wheel.ipp>
+#include <boost/socks/impl/userpass_credentials.ipp>
 
 #include <boost/socks/detail/impl/address_type.ipp>
 #include <boost/socks/detail/impl/reply_code.ipp>
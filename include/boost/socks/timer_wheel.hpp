@@ -0,0 +1,328 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+#ifndef BOOST_SOCKS_TIMER_WHEEL_HPP
+#define BOOST_SOCKS_TIMER_WHEEL_HPP
+
+#include <boost/socks/detail/config.hpp>
+#include <boost/socks/error.hpp>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/execution_context.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace boost {
+namespace socks {
+
+class deadline;
+
+/** A hierarchical timing wheel shared by the deadlines of an execution context
+
+    Deadlines are rounded up to the wheel
+    resolution and placed in one of four levels
+    of 256 slots, each level covering 256 times
+    the range of the previous one. Scheduling and
+    cancelling a deadline are O(1) and do not
+    allocate, as deadlines are intrusive list
+    nodes. Deadlines in the outer levels are
+    moved inwards as the wheel turns, and the
+    ones in the innermost slot of the current
+    tick expire.
+
+    A single `asio::steady_timer` drives the
+    wheel. It is only armed while there are
+    pending deadlines and it skips ticks with
+    no work, so the cost of a deadline in the
+    Asio timer queue is shared by all the
+    deadlines that expire in the same tick.
+
+    @par Thread Safety
+    The wheel is not thread safe. All the
+    deadlines of an execution context should
+    be used from the thread running it, as in
+    an `io_context` per thread design.
+
+    @see deadline
+ */
+class timer_wheel
+    : public asio::execution_context::service
+{
+public:
+    /// The clock used by the wheel
+    using clock_type = std::chrono::steady_clock;
+
+    /// The type used to represent durations
+    using duration = clock_type::duration;
+
+    /// The service identifier
+    BOOST_SOCKS_DECL
+    static asio::execution_context::id id;
+
+    /// The number of slots in each level
+    static constexpr std::size_t slots_per_level = 256;
+
+    /// The number of levels in the wheel
+    static constexpr std::size_t levels = 4;
+
+    /** Return the duration of a tick
+     */
+    static
+    constexpr
+    std::chrono::milliseconds
+    resolution() noexcept
+    {
+        return std::chrono::milliseconds(10);
+    }
+
+    /** Return the number of ticks in a duration, rounded up
+
+        The result is at least one tick.
+     */
+    BOOST_SOCKS_DECL
+    static
+    std::uint64_t
+    to_ticks(duration d) noexcept;
+
+    /** Constructor
+     */
+    BOOST_SOCKS_DECL
+    explicit
+    timer_wheel(asio::execution_context& ctx);
+
+    /** Destructor
+     */
+    BOOST_SOCKS_DECL
+    ~timer_wheel();
+
+    /** Return the current tick
+
+        Ticks are counted from the creation of
+        the wheel, so they can be compared with
+        the expiry of deadlines in @ref to_ticks
+        units.
+     */
+    std::uint64_t
+    now() const noexcept
+    {
+        return clock_tick();
+    }
+
+    /** Return the number of pending deadlines
+     */
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+    /** Set the executor used to drive the wheel
+
+        This is called by the deadlines of the
+        wheel and only the first executor is used.
+     */
+    BOOST_SOCKS_DECL
+    void
+    init(asio::any_io_executor const& ex);
+
+private:
+    friend class deadline;
+
+    BOOST_SOCKS_DECL
+    void
+    shutdown() override;
+
+    std::uint64_t
+    clock_tick() const noexcept;
+
+    void
+    schedule(deadline& d, duration dur);
+
+    void
+    cancel(deadline& d) noexcept;
+
+    void
+    insert(deadline& d) noexcept;
+
+    void
+    link(deadline& d, deadline*& head) noexcept;
+
+    void
+    unlink(deadline& d) noexcept;
+
+    void
+    cascade(std::size_t level, std::size_t slot) noexcept;
+
+    std::uint64_t
+    next_event() const noexcept;
+
+    void
+    advance(std::uint64_t to);
+
+    void
+    arm();
+
+    void
+    on_timer(error_code ec);
+
+    std::unique_ptr<asio::steady_timer> timer_;
+    deadline* slots_[levels][slots_per_level]{};
+    std::uint64_t bits_[levels][slots_per_level / 64]{};
+    deadline* expired_{nullptr};
+    clock_type::time_point epoch_;
+    std::uint64_t now_{0};
+    std::uint64_t armed_{0};
+    std::size_t size_{0};
+    bool running_{false};
+    bool advancing_{false};
+    bool stopped_{false};
+};
+
+/** A deadline tracked by a timer_wheel
+
+    A deadline calls a function when it expires.
+    It is cancelled when destroyed, so the
+    object owning it does not need to keep
+    itself alive for the wheel.
+
+    @par Example
+    @code
+    struct session
+    {
+        static void on_timeout(void* p)
+        {
+            static_cast<session*>(p)->sock.close();
+        }
+
+        explicit session(asio::io_context& ioc)
+            : sock(ioc), d(ioc.get_executor())
+        {
+            d.on_expire(&session::on_timeout, this);
+            d.expires_after(std::chrono::seconds(30));
+        }
+
+        asio::ip::tcp::socket sock;
+        deadline d;
+    };
+    @endcode
+
+    @see timer_wheel
+ */
+class deadline
+{
+public:
+    /// The type of function called when the deadline expires
+    using callback = void (*)(void*);
+
+    /// The type used to represent durations
+    using duration = timer_wheel::duration;
+
+    /** Constructor
+
+        The deadline uses the wheel of the
+        execution context of `ex`.
+     */
+    template <class Executor>
+    explicit
+    deadline(Executor const& ex)
+        : wheel_(&asio::use_service<timer_wheel>(
+            asio::query(ex, asio::execution::context)))
+    {
+        wheel_->init(ex);
+    }
+
+    /** Constructor
+     */
+    explicit
+    deadline(timer_wheel& w) noexcept
+        : wheel_(&w)
+    {
+    }
+
+    deadline(deadline const&) = delete;
+    deadline& operator=(deadline const&) = delete;
+
+    /** Destructor
+
+        A pending deadline is cancelled.
+     */
+    ~deadline()
+    {
+        cancel();
+    }
+
+    /** Set the function called when the deadline expires
+     */
+    void
+    on_expire(callback fn, void* arg) noexcept
+    {
+        fn_ = fn;
+        arg_ = arg;
+    }
+
+    /** Schedule the deadline
+
+        A pending deadline is rescheduled.
+     */
+    BOOST_SOCKS_DECL
+    void
+    expires_after(duration d);
+
+    /** Cancel the deadline
+
+        The function is not called.
+     */
+    BOOST_SOCKS_DECL
+    void
+    cancel() noexcept;
+
+    /** Return true if the deadline is scheduled
+     */
+    bool
+    pending() const noexcept
+    {
+        return list_ != nullptr;
+    }
+
+    /** Return true if the deadline expired since it was last scheduled
+     */
+    bool
+    expired() const noexcept
+    {
+        return expired_;
+    }
+
+    /** Return the wheel of the deadline
+     */
+    timer_wheel&
+    wheel() const noexcept
+    {
+        return *wheel_;
+    }
+
+private:
+    friend class timer_wheel;
+
+    timer_wheel* wheel_;
+    callback fn_{nullptr};
+    void* arg_{nullptr};
+    std::uint64_t expiry_{0};
+    deadline* prev_{nullptr};
+    deadline* next_{nullptr};
+    deadline** list_{nullptr};
+    bool expired_{false};
+};
+
+} // socks
+} // boost
+
+#endif
@@ -0,0 +1,119 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+#ifndef BOOST_SOCKS_USERPASS_CREDENTIALS_HPP
+#define BOOST_SOCKS_USERPASS_CREDENTIALS_HPP
+
+#include <boost/socks/detail/config.hpp>
+#include <boost/socks/string_view.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace boost {
+namespace socks {
+
+/** Username/password credentials
+
+    The credentials own their username and
+    password, stored inline in the form of the
+    username/password request, so they are
+    encoded once and copied as they are into
+    each handshake using them.
+
+    The object does not allocate. Credentials
+    shared by many connections are usually held
+    by a `std::shared_ptr` in the @ref auth_options
+    of the connections, so the options do not
+    refer to strings that might not outlive an
+    asynchronous handshake.
+
+    @par Example
+    @code
+    auth_options opt(
+        std::make_shared<userpass_credentials const>(
+            "user", "password"));
+    @endcode
+
+    @par References
+    @li <a href="https://datatracker.ietf.org/doc/html/rfc1929">
+        Username/Password Authentication for SOCKS V5</a>
+ */
+class userpass_credentials
+{
+public:
+    /// The maximum size of the username or password
+    static constexpr std::size_t max_size = 255;
+
+    /** Constructor
+
+        The credentials have an empty
+        username and password.
+     */
+    BOOST_SOCKS_DECL
+    userpass_credentials() noexcept;
+
+    /** Constructor
+
+        @throw std::length_error if the username
+        or password has more than 255 bytes.
+     */
+    BOOST_SOCKS_DECL
+    userpass_credentials(
+        string_view user,
+        string_view pass);
+
+    /** Return the username
+     */
+    string_view
+    user() const noexcept
+    {
+        return string_view(
+            reinterpret_cast<char const*>(buf_ + 2),
+            buf_[1]);
+    }
+
+    /** Return the password
+     */
+    string_view
+    pass() const noexcept
+    {
+        return string_view(
+            reinterpret_cast<char const*>(
+                buf_ + 3 + buf_[1]),
+            buf_[2 + buf_[1]]);
+    }
+
+    /** Return the username/password request
+
+        This is VER, ULEN, UNAME, PLEN and PASSWD,
+        as sent by the client.
+     */
+    unsigned char const*
+    data() const noexcept
+    {
+        return buf_;
+    }
+
+    /** Return the size of the username/password request
+     */
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+private:
+    unsigned char buf_[3 + 2 * max_size];
+    std::uint16_t size_;
+};
+
+} // socks
+} // boost
+
+#endif
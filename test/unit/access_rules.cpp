@@ -0,0 +1,409 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "access_rules.hpp"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class access_rules_test
+{
+public:
+    static
+    access_request
+    to_address(
+        char const* client,
+        char const* target,
+        std::uint16_t port,
+        core::string_view user = {})
+    {
+        access_request r;
+        r.client = ip::make_address(client);
+        r.target = ip::make_address(target);
+        r.port = port;
+        r.user = user;
+        return r;
+    }
+
+    static
+    access_request
+    to_host(
+        char const* client,
+        core::string_view host,
+        std::uint16_t port,
+        core::string_view user = {})
+    {
+        access_request r;
+        r.client = ip::make_address(client);
+        r.host = host;
+        r.port = port;
+        r.user = user;
+        return r;
+    }
+
+    // Return the line of the deciding
+    // rule, or 0 if none matches
+    static
+    std::size_t
+    line(
+        rule_set const& s,
+        access_request const& req)
+    {
+        access_rule const* r = s.find(req);
+        return r ? r->line : 0;
+    }
+
+    static
+    void
+    testCidr()
+    {
+        address_key k;
+        std::size_t len = 0;
+        BOOST_TEST(parse_cidr("10.0.0.0/8", k, len));
+        BOOST_TEST_EQ(len, 104u);
+        BOOST_TEST(parse_cidr("10.1.2.3", k, len));
+        BOOST_TEST_EQ(len, 128u);
+        BOOST_TEST(parse_cidr("2001:db8::/32", k, len));
+        BOOST_TEST_EQ(len, 32u);
+        BOOST_TEST(parse_cidr("::/0", k, len));
+        BOOST_TEST_EQ(len, 0u);
+        BOOST_TEST_NOT(parse_cidr("10.0.0.0/33", k, len));
+        BOOST_TEST_NOT(parse_cidr("10.0.0.0/", k, len));
+        BOOST_TEST_NOT(parse_cidr("10.0.0.0/8x", k, len));
+        BOOST_TEST_NOT(parse_cidr("example.com", k, len));
+
+        // IPv4 addresses and their
+        // mapped IPv6 form are the same
+        address_key a = address_key::from(
+            ip::make_address("192.0.2.1"));
+        address_key b = address_key::from(
+            ip::make_address("::ffff:192.0.2.1"));
+        BOOST_TEST_EQ(a.common_prefix(b, 128), 128u);
+        address_key c = address_key::from(
+            ip::make_address("192.0.2.129"));
+        BOOST_TEST_EQ(a.common_prefix(c, 128), 120u);
+        BOOST_TEST_EQ(a.common_prefix(c, 100), 100u);
+        BOOST_TEST(a.same_prefix(c, 120));
+        BOOST_TEST_NOT(a.same_prefix(c, 121));
+        BOOST_TEST(a.same_prefix(c, 0));
+        address_key d = address_key::from(
+            ip::make_address("2001:db8::1"));
+        address_key e = address_key::from(
+            ip::make_address("2001:db9::1"));
+        BOOST_TEST_EQ(d.common_prefix(e, 128), 31u);
+        BOOST_TEST(d.same_prefix(e, 31));
+        BOOST_TEST_NOT(d.same_prefix(e, 32));
+        BOOST_TEST_NOT(d.same_prefix(e, 64));
+        BOOST_TEST_NOT(d.same_prefix(e, 96));
+    }
+
+    static
+    void
+    testPrefixTrie()
+    {
+        // Overlapping prefixes inserted out
+        // of order split the edges
+        prefix_trie t;
+        auto insert = [&t](char const* s, std::uint32_t id)
+        {
+            address_key k;
+            std::size_t len = 0;
+            BOOST_TEST(parse_cidr(s, k, len));
+            t.insert(k, len, id);
+        };
+        insert("10.1.2.0/24", 0);
+        insert("10.0.0.0/8", 1);
+        insert("10.1.0.0/16", 2);
+        insert("10.1.2.3", 3);
+        insert("10.128.0.0/9", 4);
+        insert("0.0.0.0/0", 5);
+        insert("::/0", 6);
+        insert("10.1.0.0/16", 7);
+        t.finish();
+
+        auto matches = [&t](char const* s)
+        {
+            std::vector<std::uint32_t> v;
+            t.match(
+                address_key::from(ip::make_address(s)),
+                [&v](
+                    std::uint32_t const* first,
+                    std::uint32_t const* last)
+                {
+                    v.insert(v.end(), first, last);
+                });
+            return v;
+        };
+        using v = std::vector<std::uint32_t>;
+        BOOST_TEST(matches("10.1.2.3") == (v{6, 5, 1, 2, 7, 0, 3}));
+        BOOST_TEST(matches("10.1.2.4") == (v{6, 5, 1, 2, 7, 0}));
+        BOOST_TEST(matches("10.1.3.1") == (v{6, 5, 1, 2, 7}));
+        BOOST_TEST(matches("10.200.0.1") == (v{6, 5, 1, 4}));
+        BOOST_TEST(matches("11.0.0.1") == (v{6, 5}));
+        BOOST_TEST(matches("2001:db8::1") == (v{6}));
+    }
+
+    static
+    void
+    testSuffixTrie()
+    {
+        suffix_trie t;
+        t.insert("example.com", 0);
+        t.insert("www.example.com", 1);
+        t.insert("com", 2);
+        t.insert("example.org", 3);
+        t.finish();
+
+        auto matches = [&t](core::string_view s)
+        {
+            std::vector<std::uint32_t> v;
+            t.match(s,
+                [&v](
+                    std::uint32_t const* first,
+                    std::uint32_t const* last)
+                {
+                    v.insert(v.end(), first, last);
+                });
+            return v;
+        };
+        using v = std::vector<std::uint32_t>;
+        BOOST_TEST(matches("example.com") == (v{2, 0}));
+        BOOST_TEST(matches("WWW.Example.COM.") == (v{2, 0, 1}));
+        BOOST_TEST(matches("a.b.example.com") == (v{2, 0}));
+        BOOST_TEST(matches("badexample.com") == (v{2}));
+        BOOST_TEST(matches("example.net") == (v{}));
+        BOOST_TEST(matches("www.example.org") == (v{3}));
+        BOOST_TEST(matches(".com") == (v{2}));
+        BOOST_TEST(matches("") == (v{}));
+        BOOST_TEST(matches(std::string(300, 'a')) == (v{}));
+    }
+
+    static
+    void
+    testParse()
+    {
+        std::string error;
+        BOOST_TEST_NOT(rule_set::parse("allow\npermit\n", error));
+        BOOST_TEST_EQ(error, "Invalid rule at line 2");
+        BOOST_TEST_NOT(rule_set::parse("allow from\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow from x\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow via\n", error));
+        BOOST_TEST_NOT(rule_set::parse("deny via x\n", error));
+        BOOST_TEST_NOT(rule_set::parse("deny egress eth1\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow egress\n", error));
+        BOOST_TEST_NOT(rule_set::parse(
+            "allow egress a-very-long-interface\n", error));
+        BOOST_TEST_NOT(rule_set::parse(
+            "allow via x egress eth1\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow bogus x\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow to a..b\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow port 70000\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow port 2-1\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow port 1-\n", error));
+        BOOST_TEST_NOT(rule_set::parse("allow port 80x\n", error));
+
+        auto s = rule_set::parse(
+            "# rules\n"
+            "\n"
+            "   \n"
+            "deny to 10.0.0.0/8\r\n"
+            "allow from 192.0.2.0/24 user alice to *.Example.com port 443 egress eth1\n"
+            "allow to .example.org port 8000-8080 via parent\n",
+            error);
+        BOOST_TEST(s);
+        BOOST_TEST_EQ(s->size(), 3u);
+        access_rule const* r = s->find(to_host(
+            "192.0.2.1", "www.example.com", 443, "alice"));
+        BOOST_TEST(r);
+        BOOST_TEST(r->allow);
+        BOOST_TEST_EQ(r->line, 5u);
+        BOOST_TEST_EQ(r->domain, "example.com");
+        BOOST_TEST_EQ(r->port_min, 443u);
+        BOOST_TEST_EQ(r->port_max, 443u);
+        BOOST_TEST(r->via.empty());
+        BOOST_TEST_EQ(r->egress, "eth1");
+        r = s->find(to_host("192.0.2.1", "example.org", 8000));
+        BOOST_TEST(r && r->via == "parent");
+        BOOST_TEST(r && r->egress.empty());
+        BOOST_TEST_EQ(line(*s, to_host(
+            "192.0.2.1", "example.org", 8080)), 6u);
+        BOOST_TEST_EQ(line(*s, to_host(
+            "192.0.2.1", "example.org", 8081)), 0u);
+    }
+
+    static
+    void
+    testFirstMatch()
+    {
+        // Rules indexed by different conditions
+        // are still decided by their order
+        std::string error;
+        auto s = rule_set::parse(
+            "deny from 192.0.2.66\n"
+            "allow user admin\n"
+            "deny to 10.0.0.0/8\n"
+            "deny to internal.example.com\n"
+            "allow from 192.0.2.0/24 to 10.1.0.0/16\n"
+            "allow to example.com port 80\n"
+            "allow from 192.0.2.0/24 port 443\n"
+            "deny port 25\n"
+            "allow from ::/0\n",
+            error);
+        BOOST_TEST(s);
+
+        BOOST_TEST_EQ(line(*s, to_address(
+            "192.0.2.66", "203.0.113.1", 443, "admin")), 1u);
+        BOOST_TEST_EQ(line(*s, to_address(
+            "192.0.2.1", "10.1.0.1", 443, "admin")), 2u);
+        BOOST_TEST_EQ(line(*s, to_address(
+            "192.0.2.1", "10.1.0.1", 443)), 3u);
+        BOOST_TEST_EQ(line(*s, to_host(
+            "192.0.2.1", "db.internal.example.com", 80)), 4u);
+        BOOST_TEST_EQ(line(*s, to_host(
+            "192.0.2.1", "www.example.com", 80)), 6u);
+        BOOST_TEST_EQ(line(*s, to_host(
+            "192.0.2.1", "www.example.com", 443)), 7u);
+        BOOST_TEST_EQ(line(*s, to_host(
+            "198.51.100.1", "www.example.com", 25)), 8u);
+        BOOST_TEST_EQ(line(*s, to_address(
+            "198.51.100.1", "203.0.113.1", 443)), 9u);
+        BOOST_TEST_EQ(line(*s, to_address(
+            "2001:db8::1", "2001:db8::2", 443)), 9u);
+
+        // Users must match exactly
+        BOOST_TEST_EQ(line(*s, to_address(
+            "192.0.2.1", "10.1.0.1", 443, "Admin")), 3u);
+
+        // Requests no rule matches are denied
+        auto t = rule_set::parse(
+            "allow to example.com\n", error);
+        BOOST_TEST(t->allows(to_host(
+            "192.0.2.1", "example.com", 80)));
+        BOOST_TEST_NOT(t->allows(to_host(
+            "192.0.2.1", "example.net", 80)));
+        BOOST_TEST_NOT(t->allows(to_address(
+            "192.0.2.1", "203.0.113.1", 80)));
+        BOOST_TEST_NOT(access_rules().allows(to_address(
+            "192.0.2.1", "203.0.113.1", 80)));
+    }
+
+    static
+    void
+    testResolved()
+    {
+        // A name cannot reach a prefix the
+        // rules deny, like localhost does
+        std::string error;
+        auto s = rule_set::parse(
+            "deny to 127.0.0.0/8\n"
+            "allow to internal.example.com\n"
+            "deny to 10.0.0.0/8\n"
+            "allow from 192.0.2.0/24\n",
+            error);
+        BOOST_TEST(s);
+        BOOST_TEST(s->allows(to_host(
+            "192.0.2.1", "localhost", 80)));
+        BOOST_TEST_NOT(s->allows_resolved(to_address(
+            "192.0.2.1", "127.0.0.1", 80)));
+        BOOST_TEST(s->allows_resolved(to_address(
+            "192.0.2.1", "203.0.113.1", 80)));
+
+        // Address rules apply whatever the
+        // order of the rule allowing the name
+        BOOST_TEST(s->allows(to_host(
+            "198.51.100.1", "internal.example.com", 80)));
+        BOOST_TEST_NOT(s->allows_resolved(to_address(
+            "198.51.100.1", "10.1.0.1", 80)));
+
+        // The name decided the other rules
+        BOOST_TEST_NOT(s->allows(to_address(
+            "198.51.100.1", "203.0.113.1", 80)));
+        BOOST_TEST(s->allows_resolved(to_address(
+            "198.51.100.1", "203.0.113.1", 80)));
+    }
+
+    static
+    void
+    testFile()
+    {
+        std::string path = "access_rules_test_rules.txt";
+        asio::io_context ioc;
+        access_options opt;
+        opt.rules_file = path;
+        opt.reload_interval = std::chrono::milliseconds(1);
+        file_access_rules a(ioc, opt);
+        auto req = to_host("192.0.2.1", "example.com", 80);
+
+        std::remove(path.c_str());
+        std::string error;
+        BOOST_TEST_NOT(a.reload(error));
+        BOOST_TEST_EQ(error, "Cannot open " + path);
+
+        {
+            std::ofstream f(path, std::ios::binary | std::ios::trunc);
+            f << "allow to example.com\n";
+        }
+        BOOST_TEST(a.reload(error));
+        auto r = a.rules();
+        BOOST_TEST(a.allows(req));
+
+        // An unchanged file keeps the rules
+        BOOST_TEST(a.reload(error));
+        BOOST_TEST_EQ(a.rules(), r);
+
+        // An invalid file keeps the rules
+        {
+            std::ofstream f(path, std::ios::binary | std::ios::trunc);
+            f << "allow to\n";
+        }
+        BOOST_TEST_NOT(a.reload(error));
+        BOOST_TEST_EQ(error, path + ": Invalid rule at line 1");
+        BOOST_TEST_EQ(a.rules(), r);
+
+        // The timer picks up changes
+        {
+            std::ofstream f(path, std::ios::binary | std::ios::trunc);
+            f << "deny to example.com\n";
+        }
+        a.start();
+        for (int i = 0; i < 1000 && a.rules() == r; ++i)
+            ioc.run_one_for(std::chrono::milliseconds(10));
+        a.stop();
+        ioc.run();
+        BOOST_TEST_NOT(a.allows(req));
+
+        // Checks in flight keep their rules
+        BOOST_TEST(r->allows(req));
+        std::remove(path.c_str());
+    }
+
+    void
+    run()
+    {
+        testCidr();
+        testPrefixTrie();
+        testSuffixTrie();
+        testParse();
+        testFirstMatch();
+        testResolved();
+        testFile();
+    }
+};
+
+TEST_SUITE(
+    access_rules_test,
+    "boost.socks.access_rules");
+
+} // socks
+} // boost
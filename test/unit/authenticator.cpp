@@ -0,0 +1,401 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "authenticator.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class authenticator_test
+{
+public:
+    // Return the result of a check that
+    // completes before async_verify returns
+    static
+    int
+    verify(
+        ::authenticator& a,
+        std::string const& user,
+        std::string const& pass)
+    {
+        int r = -1;
+        a.async_verify(user, pass,
+            [&r](bool ok)
+            {
+                r = ok;
+            });
+        return r;
+    }
+
+    static
+    void
+    write_file(
+        std::string const& path,
+        std::string const& text)
+    {
+        std::ofstream f(path, std::ios::binary | std::ios::trunc);
+        f << text;
+    }
+
+    static
+    void
+    testSha1()
+    {
+        // FIPS 180 examples
+        auto hex = [](sha1_digest const& d)
+        {
+            return to_hex(d.data(), d.size());
+        };
+        BOOST_TEST_EQ(hex(sha1("")),
+            "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+        BOOST_TEST_EQ(hex(sha1("abc")),
+            "a9993e364706816aba3e25717850c26c9cd0d89d");
+        BOOST_TEST_EQ(hex(sha1(
+            "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")),
+            "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+
+        // Updates in pieces of any size
+        std::string m(1000000, 'a');
+        sha1_context ctx;
+        for (std::size_t i = 0, n = 1; i < m.size(); n = n % 97 + 1)
+        {
+            n = (std::min)(n, m.size() - i);
+            ctx.update(m.data() + i, n);
+            i += n;
+        }
+        BOOST_TEST_EQ(hex(ctx.finish()),
+            "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+        BOOST_TEST_EQ(hex(sha1(m.substr(0, 500000), m.substr(500000))),
+            "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+    }
+
+    static
+    void
+    testPbkdf2()
+    {
+        // RFC 6070
+        auto hex = [](sha1_digest const& d)
+        {
+            return to_hex(d.data(), d.size());
+        };
+        BOOST_TEST_EQ(hex(pbkdf2_sha1("password", "salt", 1)),
+            "0c60c80f961f0e71f3a9b524af6012062fe037a6");
+        BOOST_TEST_EQ(hex(pbkdf2_sha1("password", "salt", 2)),
+            "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957");
+        BOOST_TEST_EQ(hex(pbkdf2_sha1("password", "salt", 4096)),
+            "4b007901b765489abead49d926f721d065a429c1");
+
+        // Keys longer than a block are hashed first
+        BOOST_TEST_EQ(hex(pbkdf2_sha1(
+            std::string(100, 'k'), "salt", 1)),
+            hex(pbkdf2_sha1(
+                std::string(
+                    reinterpret_cast<char const*>(
+                        sha1(std::string(100, 'k')).data()), 20),
+                "salt", 1)));
+    }
+
+    static
+    void
+    testRecords()
+    {
+        std::string rec = hash_password("secret", 10);
+        BOOST_TEST_EQ(rec.substr(0, 15), "pbkdf2-sha1$10$");
+        password_record r;
+        BOOST_TEST(parse_password_record(rec, r));
+        BOOST_TEST_EQ(r.iterations, 10u);
+        BOOST_TEST_EQ(r.salt.size(), 16u);
+        BOOST_TEST(verify_password(r, "secret"));
+        BOOST_TEST_NOT(verify_password(r, "secreT"));
+        BOOST_TEST_NOT(verify_password(r, ""));
+
+        // Salts are random
+        BOOST_TEST_NE(hash_password("secret", 10), rec);
+
+        BOOST_TEST(parse_password_record(
+            "pbkdf2-sha1$1$73616c74$"
+            "0c60c80f961f0e71f3a9b524af6012062fe037a6", r));
+        BOOST_TEST_EQ(r.salt, "salt");
+        BOOST_TEST(verify_password(r, "password"));
+
+        BOOST_TEST_NOT(parse_password_record("", r));
+        BOOST_TEST_NOT(parse_password_record("secret", r));
+        BOOST_TEST_NOT(parse_password_record(
+            "pbkdf2-sha1$0$73616c74$"
+            "0c60c80f961f0e71f3a9b524af6012062fe037a6", r));
+        BOOST_TEST_NOT(parse_password_record(
+            "pbkdf2-sha1$x$73616c74$"
+            "0c60c80f961f0e71f3a9b524af6012062fe037a6", r));
+        BOOST_TEST_NOT(parse_password_record(
+            "pbkdf2-sha1$1$73616c7$"
+            "0c60c80f961f0e71f3a9b524af6012062fe037a6", r));
+        BOOST_TEST_NOT(parse_password_record(
+            "pbkdf2-sha1$1$73616c74$0c60", r));
+        BOOST_TEST_NOT(parse_password_record(
+            "pbkdf2-sha1$1$73616c74$"
+            "0c60c80f961f0e71f3a9b524af6012062fe037zz", r));
+    }
+
+    static
+    void
+    testCache()
+    {
+        verified_cache c(2, std::chrono::milliseconds(0));
+        BOOST_TEST_NOT(c.contains("alice", "r1", "pw"));
+        c.insert("alice", "r1", "pw");
+        BOOST_TEST(c.contains("alice", "r1", "pw"));
+        BOOST_TEST_NOT(c.contains("alice", "r1", "other"));
+        BOOST_TEST_NOT(c.contains("alice", "r2", "pw"));
+        BOOST_TEST_NOT(c.contains("bob", "r1", "pw"));
+        BOOST_TEST_EQ(c.hits(), 1u);
+        BOOST_TEST_EQ(c.misses(), 4u);
+
+        // The least recently used entry is evicted
+        c.insert("bob", "r1", "pw");
+        BOOST_TEST(c.contains("alice", "r1", "pw"));
+        c.insert("carol", "r1", "pw");
+        BOOST_TEST_EQ(c.size(), 2u);
+        BOOST_TEST(c.contains("alice", "r1", "pw"));
+        BOOST_TEST_NOT(c.contains("bob", "r1", "pw"));
+        BOOST_TEST(c.contains("carol", "r1", "pw"));
+
+        // Entries expire
+        verified_cache e(2, std::chrono::milliseconds(1));
+        e.insert("alice", "r1", "pw");
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        BOOST_TEST_NOT(e.contains("alice", "r1", "pw"));
+        BOOST_TEST_EQ(e.size(), 0u);
+
+        // A capacity of 0 disables the cache
+        verified_cache d(0, std::chrono::milliseconds(0));
+        d.insert("alice", "r1", "pw");
+        BOOST_TEST_NOT(d.contains("alice", "r1", "pw"));
+    }
+
+    static
+    void
+    testTable()
+    {
+        std::string error;
+        BOOST_TEST_NOT(credential_table::parse(
+            "alice:" + hash_password("a", 10) + "\nbob\n", error));
+        BOOST_TEST_EQ(error, "Invalid user at line 2");
+        BOOST_TEST_NOT(credential_table::parse(
+            "alice:plaintext\n", error));
+
+        auto t = credential_table::parse(
+            "# users\n"
+            "\n"
+            "alice:" + hash_password("a", 10) + "\r\n"
+            "b:ob:" + hash_password("b", 10) + "\n",
+            error);
+        BOOST_TEST(t);
+        BOOST_TEST_EQ(t->size(), 2u);
+        BOOST_TEST(t->find("b:ob"));
+
+        authentication_options opt;
+        table_authenticator a(opt, t);
+        BOOST_TEST_EQ(verify(a, "alice", "a"), 1);
+        BOOST_TEST_EQ(verify(a, "alice", "b"), 0);
+        BOOST_TEST_EQ(verify(a, "carol", "a"), 0);
+        BOOST_TEST_EQ(verify(a, "b:ob", "b"), 1);
+
+        // The second login is found in the cache
+        BOOST_TEST_EQ(a.cache().hits(), 0u);
+        BOOST_TEST_EQ(verify(a, "alice", "a"), 1);
+        BOOST_TEST_EQ(a.cache().hits(), 1u);
+
+        // A new record for the user is not
+        // satisfied by the cached password
+        a.set_table(credential_table::parse(
+            "alice:" + hash_password("c", 10) + "\n", error));
+        BOOST_TEST_EQ(verify(a, "alice", "a"), 0);
+        BOOST_TEST_EQ(verify(a, "alice", "c"), 1);
+        BOOST_TEST_EQ(verify(a, "b:ob", "b"), 0);
+        BOOST_TEST_EQ(a.cache().hits(), 1u);
+    }
+
+    static
+    void
+    testPool()
+    {
+        std::string error;
+        authentication_options opt;
+        table_authenticator a(opt, credential_table::parse(
+            "alice:" + hash_password("a", 10) + "\n", error));
+        auto pool = std::make_shared<verify_pool>(1, 1);
+        a.set_pool(pool);
+
+        // Keys are derived on the pool
+        std::promise<bool> r;
+        a.async_verify("alice", "a",
+            [&r](bool ok)
+            {
+                r.set_value(ok);
+            });
+        BOOST_TEST(r.get_future().get());
+
+        // Cached checks complete right away
+        BOOST_TEST_EQ(verify(a, "alice", "a"), 1);
+
+        // A full queue rejects right away
+        std::promise<void> started;
+        std::promise<void> release;
+        BOOST_TEST(pool->try_post(
+            [&started, &release]
+            {
+                started.set_value();
+                release.get_future().wait();
+            }));
+        started.get_future().wait();
+        std::promise<bool> queued;
+        a.async_verify("alice", "b",
+            [&queued](bool ok)
+            {
+                queued.set_value(ok);
+            });
+        BOOST_TEST_EQ(verify(a, "alice", "c"), 0);
+        BOOST_TEST_EQ(pool->rejected(), 1u);
+
+        // Unknown users take the same path,
+        // so they cost as much to reject
+        BOOST_TEST_EQ(verify(a, "carol", "c"), 0);
+        BOOST_TEST_EQ(pool->rejected(), 2u);
+        release.set_value();
+        BOOST_TEST_NOT(queued.get_future().get());
+        std::promise<bool> unknown;
+        a.async_verify("carol", "c",
+            [&unknown](bool ok)
+            {
+                unknown.set_value(ok);
+            });
+        BOOST_TEST_NOT(unknown.get_future().get());
+    }
+
+    static
+    void
+    testFile()
+    {
+        std::string path = "authenticator_test_users.txt";
+        asio::io_context ioc;
+        authentication_options opt;
+        opt.users_file = path;
+        opt.reload_interval = std::chrono::milliseconds(1);
+        file_authenticator a(ioc, opt);
+
+        std::remove(path.c_str());
+        std::string error;
+        BOOST_TEST_NOT(a.reload(error));
+        BOOST_TEST_EQ(error, "Cannot open " + path);
+
+        write_file(path, "alice:" + hash_password("a", 10) + "\n");
+        BOOST_TEST(a.reload(error));
+        auto t = a.table();
+        BOOST_TEST_EQ(verify(a, "alice", "a"), 1);
+
+        // An unchanged file keeps the table
+        BOOST_TEST(a.reload(error));
+        BOOST_TEST_EQ(a.table(), t);
+
+        // An invalid file keeps the table
+        write_file(path, "alice\n");
+        BOOST_TEST_NOT(a.reload(error));
+        BOOST_TEST_EQ(a.table(), t);
+
+        // The timer picks up changes
+        write_file(path, "bob:" + hash_password("b", 10) + "\n");
+        a.start();
+        for (int i = 0; i < 1000 && a.table() == t; ++i)
+            ioc.run_one_for(std::chrono::milliseconds(10));
+        a.stop();
+        ioc.run();
+        BOOST_TEST_EQ(verify(a, "alice", "a"), 0);
+        BOOST_TEST_EQ(verify(a, "bob", "b"), 1);
+        std::remove(path.c_str());
+    }
+
+    static
+    void
+    testExternal()
+    {
+        // A stub of the external service, which
+        // answers from another thread
+        std::size_t calls = 0;
+        std::vector<std::thread> threads;
+        authentication_options opt;
+        external_authenticator a(
+            [&](std::string const& user,
+                std::string const& pass,
+                ::authenticator::handler h)
+            {
+                ++calls;
+                bool ok = user == "alice" && pass == "a";
+                threads.emplace_back(
+                    [h, ok]
+                    {
+                        h(ok);
+                    });
+            },
+            opt);
+
+        int r = -1;
+        auto check = [&](std::string const& user, std::string const& pass)
+        {
+            r = -1;
+            a.async_verify(user, pass,
+                [&r](bool ok)
+                {
+                    r = ok;
+                });
+            for (auto& t : threads)
+                t.join();
+            threads.clear();
+            return r;
+        };
+        BOOST_TEST_EQ(check("alice", "a"), 1);
+        BOOST_TEST_EQ(calls, 1u);
+        BOOST_TEST_EQ(check("alice", "a"), 1);
+        BOOST_TEST_EQ(calls, 1u);
+        BOOST_TEST_EQ(check("alice", "b"), 0);
+        BOOST_TEST_EQ(calls, 2u);
+
+        // Rejections are not cached
+        BOOST_TEST_EQ(check("alice", "b"), 0);
+        BOOST_TEST_EQ(calls, 3u);
+    }
+
+    void
+    run()
+    {
+        testSha1();
+        testPbkdf2();
+        testRecords();
+        testCache();
+        testTable();
+        testPool();
+        testFile();
+        testExternal();
+    }
+};
+
+TEST_SUITE(
+    authenticator_test,
+    "boost.socks.authenticator");
+
+} // socks
+} // boost
@@ -12,7 +12,11 @@
 #include <boost/socks/connect.hpp>
 #include <boost/socks/detail/auth_method.hpp>
 #include <boost/socks/detail/reply_code.hpp>
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
 #include "stream.hpp"
 #include "test_suite.hpp"
 
@@ -279,6 +283,29 @@ public:
                 error::succeeded);
         }
 
+        // user and password of different sizes
+        {
+            auth_options a =
+                auth_options::userpass{
+                    "username", "pw"};
+            BOOST_TEST_CHECKPOINT();
+            checkEndpoint(
+                {
+                    make_greeting(a),
+                    {0x01, 8, 'u', 's', 'e', 'r', 'n', 'a', 'm', 'e',
+                     2, 'p', 'w'},
+                    make_request()
+                },
+                {
+                    make_greet_reply(
+                        auth_method::userpass),
+                    {0x01, 0x00},
+                    make_reply()
+                },
+                a,
+                error::succeeded);
+        }
+
         // user (failed to write request)
         {
             auth_options a =
@@ -1052,11 +1079,792 @@ public:
         }
     }
 
+    static
+    void
+    testAsyncTimeout()
+    {
+        using std::chrono::milliseconds;
+
+        // the server never replies
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            s.wait_for_data(true);
+            bool invoked = false;
+            async_connect(
+                s, endpoint{}, auth_options::none{},
+                milliseconds(20),
+                [&](error_code ec, endpoint app_ep)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, asio::error::timed_out);
+                    BOOST_TEST_EQ(app_ep, endpoint{});
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST_NOT(s.is_open());
+            BOOST_TEST(s.equal_write_buffers(
+                asio::buffer(make_greeting())));
+        }
+
+        // the server stops after the greeting - domain name
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            s.wait_for_data(true);
+            auto r = make_greet_reply();
+            s.reset_read(r.data(), r.size());
+            bool invoked = false;
+            async_connect(
+                s, "www.example.com", 80, auth_options::none{},
+                milliseconds(20),
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, asio::error::timed_out);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST_NOT(s.is_open());
+        }
+
+        // the handshake completes in time
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            s.wait_for_data(true);
+            auto r1 = make_greet_reply();
+            auto r2 = make_reply();
+            s.reset_read(r1.data(), r1.size());
+            s.append_read(r2.data(), r2.size());
+            bool invoked = false;
+            async_connect(
+                s, endpoint{}, auth_options::none{},
+                std::chrono::seconds(10),
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            auto t0 = timer_wheel::clock_type::now();
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST(s.is_open());
+            BOOST_TEST(
+                timer_wheel::clock_type::now() - t0 <
+                std::chrono::seconds(5));
+            BOOST_TEST_EQ(
+                asio::use_service<timer_wheel>(ioc).size(), 0u);
+        }
+    }
+
+    static
+    void
+    testAsyncPipeline()
+    {
+        // the request follows the greeting
+        // in the same write
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r1 = make_greet_reply();
+            auto r2 = make_reply();
+            s.reset_read(r1.data(), r1.size());
+            s.append_read(r2.data(), r2.size());
+            bool invoked = false;
+            detail::async_connect_any(
+                s, endpoint{}, auth_options::none{},
+                timer_wheel::duration::zero(), true,
+                null_connect_tracer(),
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            auto g = make_greeting();
+            auto r = make_request();
+            std::array<asio::const_buffer, 2> w{{
+                asio::buffer(g), asio::buffer(r)}};
+            BOOST_TEST(s.equal_write_buffers(w));
+        }
+
+        // both messages were written when
+        // the first read fails
+        {
+            io_context ioc;
+            test::stream s(ioc, 1, error::general_failure);
+            detail::domain_endpoint d;
+            d.domain = "www.example.com";
+            d.port = 80;
+            bool invoked = false;
+            detail::async_connect_any(
+                s, d, auth_options::none{},
+                timer_wheel::duration::zero(), true,
+                null_connect_tracer(),
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, error::general_failure);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+        }
+
+        // the server refuses the request
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r1 = make_greet_reply();
+            auto r2 = make_reply(
+                reply_code::connection_refused);
+            s.reset_read(r1.data(), r1.size());
+            s.append_read(r2.data(), r2.size());
+            bool invoked = false;
+            detail::async_connect_any(
+                s, endpoint{}, auth_options::none{},
+                timer_wheel::duration::zero(), true,
+                null_connect_tracer(),
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(
+                        ec, error::connection_refused);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+        }
+    }
+
+    static
+    void
+    testAsyncTrace()
+    {
+        // each phase is reported
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auth_options a =
+                auth_options::userpass{
+                    "user", "pass"};
+            auto r1 = make_greet_reply(
+                auth_method::userpass);
+            std::vector<unsigned char> r2 = {0x01, 0x00};
+            auto r3 = make_reply();
+            s.reset_read(r1.data(), r1.size());
+            s.append_read(r2.data(), r2.size());
+            s.append_read(r3.data(), r3.size());
+            connect_trace trace;
+            bool invoked = false;
+            async_connect(
+                s, endpoint{}, a,
+                timer_wheel::duration::zero(), trace,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            auto const& g = trace[connect_phase::greeting];
+            auto const& u = trace[connect_phase::auth];
+            auto const& q = trace[connect_phase::request];
+            auto const& r = trace[connect_phase::reply];
+            BOOST_TEST(g.started && g.ended);
+            BOOST_TEST(u.started && u.ended);
+            BOOST_TEST(q.started && q.ended);
+            BOOST_TEST(r.started && r.ended);
+            BOOST_TEST_EQ(g.bytes_written, make_greeting(a).size());
+            BOOST_TEST_EQ(g.bytes_read, 2u);
+            BOOST_TEST_EQ(
+                u.bytes_written, make_userpass_request(a).size());
+            BOOST_TEST_EQ(u.bytes_read, 2u);
+            BOOST_TEST_EQ(q.bytes_written, make_request().size());
+            BOOST_TEST_EQ(q.bytes_read, 0u);
+            BOOST_TEST_EQ(r.bytes_read, 10u);
+            BOOST_TEST(g.start <= g.end);
+            BOOST_TEST(g.end <= u.start);
+            BOOST_TEST(q.end <= r.start);
+            BOOST_TEST_NOT(r.ec.failed());
+        }
+
+        // the phase that stalled ends with the error
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            s.wait_for_data(true);
+            auto r1 = make_greet_reply();
+            s.reset_read(r1.data(), r1.size());
+            connect_trace trace;
+            bool invoked = false;
+            async_connect(
+                s, "www.example.com", 80, auth_options::none{},
+                std::chrono::milliseconds(20), trace,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, asio::error::timed_out);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            auto const& g = trace[connect_phase::greeting];
+            auto const& u = trace[connect_phase::auth];
+            auto const& r = trace[connect_phase::reply];
+            BOOST_TEST(g.ended);
+            BOOST_TEST_NOT(g.ec.failed());
+            BOOST_TEST_NOT(u.started);
+            BOOST_TEST(r.started && r.ended);
+            BOOST_TEST(r.ec.failed());
+            BOOST_TEST(r.end - r.start >=
+                std::chrono::milliseconds(10));
+            trace.clear();
+            BOOST_TEST_NOT(
+                trace[connect_phase::reply].started);
+        }
+    }
+
+    // A private method sending a token
+    // in a single round trip
+    class token_auth
+        : public auth_mechanism
+    {
+    public:
+        explicit
+        token_auth(string_view token)
+            : token_(token)
+        {
+        }
+
+        unsigned char
+        code() const noexcept override
+        {
+            return 0x80;
+        }
+
+        std::size_t
+        prepare(
+            unsigned char* buffer,
+            std::size_t n,
+            std::size_t,
+            error_code&) override
+        {
+            BOOST_TEST(n >= 513);
+            buffer[0] = 0x01;
+            buffer[1] = static_cast<unsigned char>(
+                token_.size());
+            std::memcpy(
+                buffer + 2, token_.data(), token_.size());
+            return 2 + token_.size();
+        }
+
+        std::size_t
+        reply_remaining(
+            unsigned char const*,
+            std::size_t n,
+            std::size_t) const noexcept override
+        {
+            return 2 - n;
+        }
+
+        bool
+        on_reply(
+            unsigned char const* buffer,
+            std::size_t n,
+            std::size_t,
+            error_code& ec) override
+        {
+            if (n != 2)
+                ec = error::bad_reply_size;
+            else if (buffer[1] != 0x00)
+                ec = error::access_denied;
+            return false;
+        }
+
+    private:
+        string_view token_;
+    };
+
+    // A private method where the server sends a
+    // challenge of variable size, and the client
+    // answers with the challenge reversed
+    class challenge_auth
+        : public auth_mechanism
+    {
+    public:
+        unsigned char
+        code() const noexcept override
+        {
+            return 0xFE;
+        }
+
+        std::size_t
+        prepare(
+            unsigned char* buffer,
+            std::size_t,
+            std::size_t round,
+            error_code&) override
+        {
+            if (round == 0)
+            {
+                buffer[0] = 0x01;
+                return 1;
+            }
+            buffer[0] = static_cast<unsigned char>(
+                challenge_.size());
+            std::copy(
+                challenge_.rbegin(),
+                challenge_.rend(),
+                buffer + 1);
+            return 1 + challenge_.size();
+        }
+
+        std::size_t
+        reply_remaining(
+            unsigned char const* buffer,
+            std::size_t n,
+            std::size_t round) const noexcept override
+        {
+            if (round != 0 || n < 2)
+                return 2 - n;
+            return 2 + buffer[1] - n;
+        }
+
+        bool
+        on_reply(
+            unsigned char const* buffer,
+            std::size_t n,
+            std::size_t round,
+            error_code& ec) override
+        {
+            if (round != 0)
+            {
+                if (n != 2 || buffer[1] != 0x00)
+                    ec = error::access_denied;
+                return false;
+            }
+            challenge_.assign(buffer + 2, buffer + n);
+            ++rounds;
+            return true;
+        }
+
+        std::size_t rounds{0};
+
+    private:
+        std::vector<unsigned char> challenge_;
+    };
+
+    // A method with any code
+    class coded_auth
+        : public token_auth
+    {
+    public:
+        explicit
+        coded_auth(unsigned char code)
+            : token_auth("")
+            , code_(code)
+        {
+        }
+
+        unsigned char
+        code() const noexcept override
+        {
+            return code_;
+        }
+
+    private:
+        unsigned char code_;
+    };
+
+    static
+    void
+    testAuthMechanism()
+    {
+        // methods are offered in order
+        {
+            token_auth t("abc");
+            auth_options a(t);
+            BOOST_TEST_EQ(a.size(), 1u);
+            BOOST_TEST_EQ(a.code(), 0x80);
+            BOOST_TEST_NOT(a.offers(0x00));
+            a.add(auth_options::userpass{"user", "pass"})
+             .add(auth_options::none{});
+            BOOST_TEST_EQ(a.size(), 3u);
+            BOOST_TEST_EQ(a.code(), 0x80);
+            BOOST_TEST(a.find(0x80) == &t);
+            BOOST_TEST(a.find(0x02) == nullptr);
+            BOOST_TEST(a.find(0x01) == nullptr);
+
+            // a method is offered once
+            a.add(t);
+            BOOST_TEST_EQ(a.size(), 3u);
+
+            std::vector<unsigned char> g(16);
+            g.resize(detail::prepare_greeting(
+                g.data(), g.size(), a));
+            BOOST_TEST((g == std::vector<unsigned char>{
+                0x05, 0x03, 0x80, 0x02, 0x00}));
+
+            // the old options are unchanged
+            auth_options u =
+                auth_options::userpass{"user", "pass"};
+            BOOST_TEST_EQ(u.code(), 0x02);
+            g.resize(16);
+            g.resize(detail::prepare_greeting(
+                g.data(), g.size(), u));
+            BOOST_TEST((g == std::vector<unsigned char>{
+                0x05, 0x02, 0x00, 0x02}));
+        }
+
+        // at most max_methods methods are offered
+        {
+            std::vector<coded_auth> m;
+            for (unsigned char c = 0x80; c < 0x88; ++c)
+                m.emplace_back(c);
+            auth_options a(m[0]);
+            for (std::size_t i = 1; i + 1 < m.size(); ++i)
+                a.add(m[i]);
+            a.add(auth_options::none{});
+            std::size_t const n = auth_options::max_methods;
+            BOOST_TEST_EQ(a.size(), n);
+            BOOST_TEST_THROWS(
+                a.add(m.back()), std::length_error);
+            BOOST_TEST_THROWS(
+                a.add(auth_options::userpass{"user", "pass"}),
+                std::length_error);
+            BOOST_TEST_EQ(a.size(), n);
+            BOOST_TEST_NOT(a.is_userpass);
+            BOOST_TEST(a.find(m.back().code()) == nullptr);
+
+            // replacing a method offered still works
+            a.add(m[0]);
+            BOOST_TEST_EQ(a.size(), n);
+
+            // 0xFF means no acceptable method
+            coded_auth x(0xFF);
+            auth_options b;
+            BOOST_TEST_THROWS(
+                b.add(x), std::invalid_argument);
+            BOOST_TEST_NOT(b.offers(0xFF));
+        }
+
+        // single round trip
+        {
+            token_auth t("abc");
+            BOOST_TEST_CHECKPOINT();
+            checkEndpoint(
+                {
+                    {0x05, 0x01, 0x80},
+                    {0x01, 0x03, 'a', 'b', 'c'},
+                    make_request()
+                },
+                {
+                    {0x05, 0x80},
+                    {0x01, 0x00},
+                    make_reply()
+                },
+                t,
+                error::succeeded);
+            checkAsyncEndpoint(
+                {
+                    {0x05, 0x01, 0x80},
+                    {0x01, 0x03, 'a', 'b', 'c'},
+                    make_request()
+                },
+                {
+                    {0x05, 0x80},
+                    {0x01, 0x00},
+                    make_reply()
+                },
+                t,
+                error::succeeded);
+        }
+
+        // rejected
+        {
+            token_auth t("abc");
+            BOOST_TEST_CHECKPOINT();
+            checkEndpoint(
+                {
+                    {0x05, 0x01, 0x80},
+                    {0x01, 0x03, 'a', 'b', 'c'}
+                },
+                {
+                    {0x05, 0x80},
+                    {0x01, 0x01}
+                },
+                t,
+                error::access_denied);
+            checkAsyncEndpoint(
+                {
+                    {0x05, 0x01, 0x80},
+                    {0x01, 0x03, 'a', 'b', 'c'}
+                },
+                {
+                    {0x05, 0x80},
+                    {0x01, 0x01}
+                },
+                t,
+                error::access_denied);
+        }
+
+        // the server chooses another method offered
+        {
+            token_auth t("abc");
+            auth_options a(t);
+            a.add(auth_options::userpass{"user", "pass"})
+             .add(auth_options::none{});
+            BOOST_TEST_CHECKPOINT();
+            checkAsyncEndpoint(
+                {
+                    {0x05, 0x03, 0x80, 0x02, 0x00},
+                    make_userpass_request(a),
+                    make_request()
+                },
+                {
+                    make_greet_reply(auth_method::userpass),
+                    {0x01, 0x00},
+                    make_reply()
+                },
+                a,
+                error::succeeded);
+            checkEndpoint(
+                {
+                    {0x05, 0x03, 0x80, 0x02, 0x00},
+                    make_request()
+                },
+                {
+                    make_greet_reply(),
+                    make_reply()
+                },
+                a,
+                error::succeeded);
+        }
+
+        // the server chooses a method not offered
+        {
+            token_auth t("abc");
+            BOOST_TEST_CHECKPOINT();
+            checkEndpoint(
+                {
+                    {0x05, 0x01, 0x80}
+                },
+                {
+                    make_greet_reply()
+                },
+                t,
+                error::bad_server_choice);
+            checkAsyncEndpoint(
+                {
+                    {0x05, 0x01, 0x80}
+                },
+                {
+                    make_greet_reply()
+                },
+                t,
+                error::bad_server_choice);
+        }
+
+        // several rounds with replies of variable size
+        {
+            challenge_auth c;
+            BOOST_TEST_CHECKPOINT();
+            checkEndpoint(
+                {
+                    {0x05, 0x01, 0xFE},
+                    {0x01},
+                    {0x03, 'z', 'y', 'x'},
+                    make_request()
+                },
+                {
+                    {0x05, 0xFE},
+                    {0x01, 0x03, 'x', 'y', 'z'},
+                    {0x01, 0x00},
+                    make_reply()
+                },
+                c,
+                error::succeeded);
+            BOOST_TEST_EQ(c.rounds, 1u);
+        }
+
+        // the rounds are traced as one phase
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            challenge_auth c;
+            std::vector<unsigned char> r1 = {0x05, 0xFE};
+            std::vector<unsigned char> r2 = {0x01, 0x02, 'a', 'b'};
+            std::vector<unsigned char> r3 = {0x01, 0x00};
+            auto r4 = make_reply();
+            s.reset_read(r1.data(), r1.size());
+            s.append_read(r2.data(), r2.size());
+            s.append_read(r3.data(), r3.size());
+            s.append_read(r4.data(), r4.size());
+            connect_trace trace;
+            bool invoked = false;
+            async_connect(
+                s, endpoint{}, c,
+                timer_wheel::duration::zero(), trace,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST_EQ(c.rounds, 1u);
+            auto const& u = trace[connect_phase::auth];
+            BOOST_TEST(u.started && u.ended);
+            BOOST_TEST_EQ(u.bytes_written, 1u + 3u);
+            BOOST_TEST_EQ(u.bytes_read, 4u + 2u);
+            BOOST_TEST_EQ(
+                trace[connect_phase::reply].bytes_read, 10u);
+        }
+    }
+
+    static
+    void
+    testAuthenticated()
+    {
+        auth_options opt = auth_options::userpass{"user", "pass"};
+        endpoint target(asio::ip::make_address("10.0.0.1"), 80);
+        detail::domain_endpoint_view domain;
+        domain.domain = "example.com";
+        domain.port = 443;
+
+        auto cat = [](
+            std::initializer_list<std::vector<unsigned char>> l)
+        {
+            std::vector<unsigned char> r;
+            for (auto const& b : l)
+                r.insert(r.end(), b.begin(), b.end());
+            return r;
+        };
+
+        // The request follows a
+        // separate authentication
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r = cat({
+                make_greet_reply(auth_method::userpass),
+                {0x01, 0x00},
+                make_reply()});
+            s.reset_read(r.data(), r.size());
+            error_code ec;
+            authenticate(s, opt, ec);
+            BOOST_TEST_NOT(ec.failed());
+            auto w = cat({make_greeting(opt), make_userpass_request(opt)});
+            BOOST_TEST(s.equal_write_buffers(asio::buffer(w)));
+            s.reset_write();
+            connect_authenticated(s, target, ec);
+            BOOST_TEST_NOT(ec.failed());
+            BOOST_TEST(s.equal_write_buffers(
+                asio::buffer(make_request(target))));
+        }
+
+        // sync, domain, rejected
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r = make_reply(reply_code::host_unreachable);
+            s.reset_read(r.data(), r.size());
+            error_code ec;
+            connect_authenticated(s, "example.com", 443, ec);
+            BOOST_TEST_EQ(ec, error::host_unreachable);
+            BOOST_TEST(s.equal_write_buffers(
+                asio::buffer(make_request(domain))));
+        }
+
+        // async
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r = cat({
+                make_greet_reply(auth_method::userpass),
+                {0x01, 0x00}});
+            s.reset_read(r.data(), r.size());
+            bool invoked = false;
+            async_authenticate(s, opt,
+                [&](error_code ec)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            auto w = cat({make_greeting(opt), make_userpass_request(opt)});
+            BOOST_TEST(s.equal_write_buffers(asio::buffer(w)));
+
+            // Only the request is written
+            s.reset_write();
+            auto rep = make_reply();
+            s.reset_read(rep.data(), rep.size());
+            invoked = false;
+            ioc.restart();
+            async_connect_authenticated(s, "example.com", 443,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST(s.equal_write_buffers(
+                asio::buffer(make_request(domain))));
+        }
+
+        // async, rejected credentials
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r = cat({
+                make_greet_reply(auth_method::userpass),
+                {0x01, 0x01}});
+            s.reset_read(r.data(), r.size());
+            bool invoked = false;
+            async_authenticate(s, opt,
+                std::chrono::seconds(5),
+                [&](error_code ec)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, error::access_denied);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+        }
+
+        // async, rejected request
+        {
+            io_context ioc;
+            test::stream s(ioc);
+            auto r = make_reply(reply_code::connection_refused);
+            s.reset_read(r.data(), r.size());
+            bool invoked = false;
+            async_connect_authenticated(s, target,
+                std::chrono::seconds(5),
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, error::connection_refused);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST(s.equal_write_buffers(
+                asio::buffer(make_request(target))));
+        }
+    }
+
     void
     run()
     {
         testEndpoint();
         testAsyncEndpoint();
+        testAsyncTimeout();
+        testAsyncPipeline();
+        testAsyncTrace();
+        testAuthMechanism();
+        testAuthenticated();
     }
 };
 
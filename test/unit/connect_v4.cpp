@@ -356,11 +356,41 @@ public:
         }
     }
 
+    static
+    void
+    testAsyncTrace()
+    {
+        io_context ioc;
+        test::stream s(ioc);
+        auto r = make_reply();
+        s.reset_read(asio::buffer(r));
+        connect_trace trace;
+        bool invoked = false;
+        async_connect_v4(
+            s, endpoint{}, "user", trace,
+            [&](error_code ec, endpoint)
+            {
+                invoked = true;
+                BOOST_TEST_EQ(ec, error::request_granted);
+            });
+        ioc.run();
+        BOOST_TEST(invoked);
+        auto const& q = trace[connect_phase::request];
+        auto const& p = trace[connect_phase::reply];
+        BOOST_TEST_NOT(trace[connect_phase::greeting].started);
+        BOOST_TEST(q.started && q.ended);
+        BOOST_TEST_EQ(q.bytes_written, 13u);
+        BOOST_TEST(p.started && p.ended);
+        BOOST_TEST_EQ(p.bytes_read, 8u);
+        BOOST_TEST_EQ(p.ec, error::request_granted);
+    }
+
     void
     run()
     {
         testEndpoint();
         testAsyncEndpoint();
+        testAsyncTrace();
     }
 };
 
@@ -0,0 +1,211 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include <boost/socks/fast_open.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <memory>
+#include <vector>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class fast_open_test
+{
+public:
+    using io_context = asio::io_context;
+    using tcp = asio::ip::tcp;
+
+    // A SOCKS server on the loopback interface
+    // answering a single connection
+    struct proxy
+    {
+        explicit
+        proxy(io_context& ioc)
+            : acceptor(ioc, tcp::endpoint(
+                asio::ip::address_v4::loopback(), 0))
+            , socket(ioc)
+        {
+        }
+
+        tcp::endpoint
+        endpoint() const
+        {
+            return acceptor.local_endpoint();
+        }
+
+        // Read `n` bytes at once and reply with `r`
+        void
+        expect(
+            std::size_t n,
+            std::vector<unsigned char> r)
+        {
+            acceptor.async_accept(
+                socket,
+                [this, n, r](error_code ec)
+                {
+                    if (ec.failed())
+                        return;
+                    received.resize(n);
+                    asio::async_read(
+                        socket,
+                        asio::buffer(received),
+                        [this, r](error_code ec, std::size_t)
+                        {
+                            if (ec.failed())
+                                return;
+                            reply = r;
+                            asio::async_write(
+                                socket,
+                                asio::buffer(reply),
+                                [](error_code, std::size_t)
+                                {
+                                });
+                        });
+                });
+        }
+
+        tcp::acceptor acceptor;
+        tcp::socket socket;
+        std::vector<unsigned char> received;
+        std::vector<unsigned char> reply;
+    };
+
+    static
+    void
+    testPipelined()
+    {
+        io_context ioc;
+        proxy p(ioc);
+        // greeting, then the CONNECT request
+        p.expect(13, {
+            0x05, 0x00,
+            0x05, 0x00, 0x00, 0x01,
+            10, 0, 0, 1, 0x1F, 0x90});
+        tcp::socket s(ioc);
+        endpoint app_ep(
+            asio::ip::make_address_v4("192.168.0.1"), 80);
+        bool invoked = false;
+        async_connect_fast_open(
+            s, p.endpoint(), app_ep,
+            auth_options::none{},
+            [&](error_code ec, endpoint ep)
+            {
+                invoked = true;
+                BOOST_TEST_NOT(ec.failed());
+                BOOST_TEST_EQ(ep, endpoint(
+                    asio::ip::make_address_v4("10.0.0.1"),
+                    8080));
+            });
+        ioc.run();
+        BOOST_TEST(invoked);
+        BOOST_TEST(s.is_open());
+        std::vector<unsigned char> exp = {
+            0x05, 0x01, 0x00,
+            0x05, 0x01, 0x00, 0x01,
+            192, 168, 0, 1, 0x00, 0x50};
+        BOOST_TEST(p.received == exp);
+    }
+
+    static
+    void
+    testRefused()
+    {
+        io_context ioc;
+        tcp::endpoint closed;
+        {
+            // Take a free port and release it
+            tcp::acceptor a(ioc, tcp::endpoint(
+                asio::ip::address_v4::loopback(), 0));
+            closed = a.local_endpoint();
+        }
+        tcp::socket s(ioc);
+        bool invoked = false;
+        async_connect_fast_open(
+            s, closed, "www.example.com", 80,
+            auth_options::none{},
+            [&](error_code ec, endpoint ep)
+            {
+                invoked = true;
+                BOOST_TEST(ec.failed());
+                BOOST_TEST_EQ(ep, endpoint{});
+            });
+        ioc.run();
+        BOOST_TEST(invoked);
+    }
+
+    static
+    void
+    testTimeout()
+    {
+        // The proxy accepts the connection
+        // but never replies
+        io_context ioc;
+        tcp::acceptor a(ioc, tcp::endpoint(
+            asio::ip::address_v4::loopback(), 0));
+        tcp::socket s(ioc);
+        bool invoked = false;
+        async_connect_fast_open(
+            s, a.local_endpoint(), "www.example.com", 80,
+            auth_options::none{},
+            std::chrono::milliseconds(20),
+            [&](error_code ec, endpoint)
+            {
+                invoked = true;
+                BOOST_TEST_EQ(ec, asio::error::timed_out);
+            });
+        ioc.run();
+        BOOST_TEST(invoked);
+        BOOST_TEST_NOT(s.is_open());
+        BOOST_TEST_EQ(
+            asio::use_service<timer_wheel>(ioc).size(), 0u);
+    }
+
+    void
+    testOption()
+    {
+        io_context ioc;
+        tcp::socket s(ioc);
+        s.open(tcp::v4());
+        error_code ec;
+        detail::enable_fast_open_connect(s, ec);
+#if defined(TCP_FASTOPEN_CONNECT)
+        // Older kernels do not know the option
+        if (ec.failed())
+            return;
+        int v = 0;
+        socklen_t len = sizeof(v);
+        BOOST_TEST_EQ(::getsockopt(
+            s.native_handle(), IPPROTO_TCP,
+            TCP_FASTOPEN_CONNECT, &v, &len), 0);
+        BOOST_TEST_EQ(v, 1);
+#else
+        BOOST_TEST_EQ(ec, asio::error::operation_not_supported);
+#endif
+    }
+
+    void
+    run()
+    {
+        testOption();
+        testPipelined();
+        testRefused();
+        testTimeout();
+    }
+};
+
+TEST_SUITE(
+    fast_open_test,
+    "boost.socks.fast_open");
+
+} // socks
+} // boost
@@ -0,0 +1,317 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include <boost/socks/handshake_template.hpp>
+#include <boost/socks/connect.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stream.hpp"
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class handshake_template_test
+{
+public:
+    using bytes = std::vector<unsigned char>;
+
+    static
+    bytes
+    to_bytes(asio::const_buffer b)
+    {
+        auto p = static_cast<unsigned char const*>(b.data());
+        return bytes(p, p + b.size());
+    }
+
+    static
+    bytes
+    cat(std::initializer_list<bytes> l)
+    {
+        bytes r;
+        for (auto const& b : l)
+            r.insert(r.end(), b.begin(), b.end());
+        return r;
+    }
+
+    static
+    endpoint
+    target()
+    {
+        return {asio::ip::make_address("10.0.0.1"), 80};
+    }
+
+    static
+    bytes
+    request()
+    {
+        return {
+            0x05, 0x01, 0x00, 0x01,
+            10, 0, 0, 1, 0x00, 80};
+    }
+
+    static
+    bytes
+    reply()
+    {
+        return {
+            0x05, 0x00, 0x00, 0x01,
+            10, 0, 0, 2, 0x04, 0x38};
+    }
+
+    static
+    bytes
+    userpass_request()
+    {
+        return {0x01, 4, 'u', 's', 'e', 'r', 4, 'p', 'a', 's', 's'};
+    }
+
+    static
+    void
+    testEncode()
+    {
+        // no authentication
+        {
+            handshake_template t(target());
+            BOOST_TEST_NOT(t.pipelined());
+            BOOST_TEST((to_bytes(t.greeting()) == bytes{0x05, 0x01, 0x00}));
+            BOOST_TEST_EQ(t.userpass_request().size(), 0u);
+            BOOST_TEST(to_bytes(t.request()) == request());
+            BOOST_TEST(to_bytes(t.data()) ==
+                cat({to_bytes(t.greeting()), request()}));
+        }
+
+        // username/password, from strings
+        // that do not outlive the template
+        std::unique_ptr<handshake_template> t;
+        {
+            std::string user = "user";
+            std::string pass = "pass";
+            t.reset(new handshake_template(
+                target(),
+                auth_options::userpass{user, pass}));
+            user.assign(4, 'x');
+            pass.assign(4, 'x');
+        }
+        BOOST_TEST((to_bytes(t->greeting()) ==
+            bytes{0x05, 0x02, 0x00, 0x02}));
+        BOOST_TEST(to_bytes(t->userpass_request()) == userpass_request());
+        BOOST_TEST(to_bytes(t->request()) == request());
+        BOOST_TEST(t->options().is_userpass);
+        BOOST_TEST(t->options().user.empty());
+
+        // domain target
+        {
+            handshake_template d("example.com", 443);
+            BOOST_TEST((to_bytes(d.request()) == bytes{
+                0x05, 0x01, 0x00, 0x03, 11,
+                'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+                0x01, 0xBB}));
+        }
+
+        // pipelined templates offer a single method
+        {
+            handshake_template p(
+                target(),
+                std::make_shared<userpass_credentials const>(
+                    "user", "pass"),
+                true);
+            BOOST_TEST(p.pipelined());
+            BOOST_TEST((to_bytes(p.greeting()) == bytes{0x05, 0x01, 0x02}));
+            BOOST_TEST(to_bytes(p.data()) == cat({
+                {0x05, 0x01, 0x02}, userpass_request(), request()}));
+            BOOST_TEST(p.options().credentials());
+
+            handshake_template n(target(), {}, true);
+            BOOST_TEST(to_bytes(n.data()) == cat({
+                {0x05, 0x01, 0x00}, request()}));
+        }
+    }
+
+    static
+    void
+    testConnect()
+    {
+        asio::io_context ioc;
+        handshake_template t(
+            target(),
+            auth_options::userpass{"user", "pass"});
+
+        // A template is replayed
+        for (int i = 0; i < 3; ++i)
+        {
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x02}, {0x01, 0x00}, reply()});
+            s.reset_read(r.data(), r.size());
+            error_code ec;
+            endpoint ep = connect(s, t, ec);
+            BOOST_TEST_NOT(ec.failed());
+            BOOST_TEST_EQ(ep, endpoint(
+                asio::ip::make_address("10.0.0.2"), 1080));
+            auto w = cat({
+                {0x05, 0x02, 0x00, 0x02},
+                userpass_request(),
+                request()});
+            BOOST_TEST(s.equal_write_buffers(asio::buffer(w)));
+        }
+
+        // The server chose no authentication
+        {
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x00}, reply()});
+            s.reset_read(r.data(), r.size());
+            error_code ec;
+            connect(s, t, ec);
+            BOOST_TEST_NOT(ec.failed());
+            auto w = cat({{0x05, 0x02, 0x00, 0x02}, request()});
+            BOOST_TEST(s.equal_write_buffers(asio::buffer(w)));
+        }
+
+        // Rejected
+        {
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x02}, {0x01, 0x01}});
+            s.reset_read(r.data(), r.size());
+            error_code ec;
+            connect(s, t, ec);
+            BOOST_TEST_EQ(ec, error::access_denied);
+        }
+
+        // Pipelined
+        {
+            handshake_template p(
+                target(),
+                auth_options::userpass{"user", "pass"},
+                true);
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x02}, {0x01, 0x00}, reply()});
+            s.reset_read(r.data(), r.size());
+            error_code ec;
+            connect(s, p, ec);
+            BOOST_TEST_NOT(ec.failed());
+            BOOST_TEST(s.equal_write_buffers(p.data()));
+
+            // The server can only choose the method offered
+            test::stream s2(ioc);
+            auto r2 = cat({{0x05, 0x00}, reply()});
+            s2.reset_read(r2.data(), r2.size());
+            connect(s2, p, ec);
+            BOOST_TEST_EQ(ec, error::bad_server_choice);
+        }
+    }
+
+    static
+    void
+    testAsyncConnect()
+    {
+        // non-pipelined
+        {
+            asio::io_context ioc;
+            handshake_template t(
+                target(),
+                auth_options::userpass{"user", "pass"});
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x02}, {0x01, 0x00}, reply()});
+            s.reset_read(r.data(), r.size());
+            connect_trace trace;
+            bool invoked = false;
+            async_connect(
+                s, t, timer_wheel::duration::zero(), trace,
+                [&](error_code ec, endpoint ep)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                    BOOST_TEST_EQ(ep.port(), 1080);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST(s.equal_write_buffers(asio::buffer(cat({
+                to_bytes(t.greeting()),
+                userpass_request(),
+                request()}))));
+            BOOST_TEST_EQ(
+                trace[connect_phase::auth].bytes_written,
+                userpass_request().size());
+            BOOST_TEST_EQ(
+                trace[connect_phase::request].bytes_written,
+                request().size());
+        }
+
+        // pipelined, in one write
+        {
+            asio::io_context ioc;
+            handshake_template t(
+                "example.com", 443,
+                std::make_shared<userpass_credentials const>(
+                    "user", "pass"),
+                true);
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x02}, {0x01, 0x00}, reply()});
+            s.reset_read(r.data(), r.size());
+            connect_trace trace;
+            bool invoked = false;
+            async_connect(
+                s, t, timer_wheel::duration::zero(), trace,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+            BOOST_TEST(s.equal_write_buffers(t.data()));
+            auto const& g = trace[connect_phase::greeting];
+            auto const& u = trace[connect_phase::auth];
+            BOOST_TEST_EQ(g.bytes_written, t.data().size());
+            BOOST_TEST(u.started && u.ended);
+            BOOST_TEST_EQ(u.bytes_written, 0u);
+            BOOST_TEST_EQ(u.bytes_read, 2u);
+            BOOST_TEST_NOT(trace[connect_phase::request].started);
+            BOOST_TEST_EQ(trace[connect_phase::reply].bytes_read, 10u);
+        }
+
+        // pipelined, rejected
+        {
+            asio::io_context ioc;
+            handshake_template t(
+                target(),
+                auth_options::userpass{"user", "pass"},
+                true);
+            test::stream s(ioc);
+            auto r = cat({{0x05, 0x02}, {0x01, 0x01}});
+            s.reset_read(r.data(), r.size());
+            bool invoked = false;
+            async_connect(s, t,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_EQ(ec, error::access_denied);
+                });
+            ioc.run();
+            BOOST_TEST(invoked);
+        }
+    }
+
+    void
+    run()
+    {
+        testEncode();
+        testConnect();
+        testAsyncConnect();
+    }
+};
+
+TEST_SUITE(
+    handshake_template_test,
+    "boost.socks.handshake_template");
+
+} // socks
+} // boost
@@ -0,0 +1,300 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "relay.hpp"
+#include <boost/asio/io_context.hpp>
+#include <string>
+#include "stream.hpp"
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class relay_test
+{
+public:
+    using io_context = asio::io_context;
+
+    static
+    void
+    append(test::stream& s, std::string const& str)
+    {
+        s.append_read(str.data(), str.size());
+    }
+
+    static
+    void
+    testHalfClose()
+    {
+        // The client sends a request and shuts
+        // down its side, then reads the response
+        io_context ioc;
+        test::stream client(ioc);
+        test::stream target(ioc);
+        target.wait_for_data(true);
+        append(client, "request");
+
+        relay<test::stream> r(client, target);
+        int activity = 0;
+        r.on_activity(
+            [](void* p)
+            {
+                ++*static_cast<int*>(p);
+            }, &activity);
+        int half_closes = 0;
+        bool done = false;
+        r.start(
+            nullptr,
+            [&](error_code ec)
+            {
+                done = true;
+                BOOST_TEST_NOT(ec.failed());
+            },
+            [&]
+            {
+                ++half_closes;
+            });
+        ioc.run();
+        BOOST_TEST(target.equal_write_buffers(
+            asio::buffer(std::string("request"))));
+        BOOST_TEST(target.send_shutdown());
+        BOOST_TEST_NOT(client.send_shutdown());
+        BOOST_TEST_EQ(half_closes, 1);
+        BOOST_TEST(r.half_closed());
+        BOOST_TEST_NOT(done);
+
+        // The response still reaches the client
+        append(target, "response");
+        ioc.restart();
+        ioc.run();
+        BOOST_TEST(client.equal_write_buffers(
+            asio::buffer(std::string("response"))));
+        BOOST_TEST_NOT(done);
+
+        // The target shuts down its side
+        target.append_eof();
+        ioc.restart();
+        ioc.run();
+        BOOST_TEST(done);
+        BOOST_TEST(client.send_shutdown());
+        BOOST_TEST_EQ(half_closes, 1);
+        BOOST_TEST_NOT(r.half_closed());
+        BOOST_TEST_EQ(activity, 2);
+        BOOST_TEST_EQ(r.bytes_to_target(), 7u);
+        BOOST_TEST_EQ(r.bytes_to_client(), 8u);
+        BOOST_TEST(client.is_open());
+        BOOST_TEST(target.is_open());
+    }
+
+    static
+    void
+    testReadError()
+    {
+        // The target resets the connection
+        // while the client is idle
+        io_context ioc;
+        test::stream client(ioc);
+        test::stream target(
+            ioc, 0, asio::error::connection_reset);
+        client.wait_for_data(true);
+        relay<test::stream> r(client, target);
+        bool done = false;
+        r.start(
+            nullptr,
+            [&](error_code ec)
+            {
+                done = true;
+                BOOST_TEST_EQ(
+                    ec, asio::error::connection_reset);
+            });
+        ioc.run();
+        BOOST_TEST(done);
+        BOOST_TEST_NOT(client.is_open());
+        BOOST_TEST_NOT(target.is_open());
+    }
+
+    static
+    void
+    testWriteError()
+    {
+        // The target does not accept more data
+        io_context ioc;
+        test::stream client(ioc);
+        test::stream target(ioc);
+        client.wait_for_data(true);
+        target.wait_for_data(true);
+        append(client, "data");
+        error_code ec;
+        target.shutdown(
+            asio::socket_base::shutdown_send, ec);
+        relay<test::stream> r(client, target);
+        bool done = false;
+        r.start(
+            nullptr,
+            [&](error_code ec)
+            {
+                done = true;
+                BOOST_TEST_EQ(
+                    ec, asio::error::broken_pipe);
+            });
+        ioc.run();
+        BOOST_TEST(done);
+        BOOST_TEST_NOT(client.is_open());
+        BOOST_TEST_NOT(target.is_open());
+    }
+
+    static
+    void
+    testOwner()
+    {
+        // The owner lives until the relay completes
+        io_context ioc;
+        test::stream client(ioc);
+        test::stream target(ioc);
+        auto owner = std::make_shared<int>(0);
+        std::weak_ptr<int> w = owner;
+        relay<test::stream> r(client, target);
+        r.start(std::move(owner), [](error_code) {});
+        BOOST_TEST_NOT(w.expired());
+        ioc.run();
+        BOOST_TEST(w.expired());
+        BOOST_TEST(client.send_shutdown());
+        BOOST_TEST(target.send_shutdown());
+    }
+
+    static
+    void
+    testTokenBucket()
+    {
+        using clock_type = token_bucket::clock_type;
+        auto t0 = clock_type::now();
+        token_bucket b(1000, 500);
+        BOOST_TEST(b.limited());
+        BOOST_TEST_EQ(b.available(t0), 500u);
+        b.consume(500);
+        BOOST_TEST_EQ(b.available(t0), 0u);
+        BOOST_TEST(
+            b.wait_time(100, t0) >=
+            std::chrono::milliseconds(99));
+        auto t1 = t0 + std::chrono::milliseconds(200);
+        BOOST_TEST(b.available(t1) >= 199u);
+        BOOST_TEST(b.available(t1) <= 200u);
+        // The burst caps the tokens
+        auto t2 = t0 + std::chrono::seconds(10);
+        BOOST_TEST_EQ(b.available(t2), 500u);
+        // A shared bucket can go below zero
+        b.consume(800);
+        BOOST_TEST_EQ(b.available(t2), 0u);
+        BOOST_TEST(
+            b.wait_time(100, t2) >=
+            std::chrono::milliseconds(399));
+
+        // The strictest bucket applies
+        token_bucket a(1000, 100);
+        token_bucket unlimited;
+        rate_limit l;
+        l.add(unlimited);
+        BOOST_TEST_NOT(l.limited());
+        l.add(a);
+        l.add(b);
+        BOOST_TEST(l.limited());
+        BOOST_TEST_EQ(l.burst(), 100u);
+        BOOST_TEST_EQ(l.available(t2), 0u);
+    }
+
+    static
+    void
+    testRateLimit()
+    {
+        // 8 KiB at 64 KiB/s, with 1 KiB bursts,
+        // take at least 7 bursts of waiting
+        io_context ioc;
+        test::stream client(ioc);
+        test::stream target(ioc);
+        target.wait_for_data(true);
+        std::string data(8192, 'x');
+        append(client, data);
+        token_bucket bucket(65536, 1024);
+        rate_limit upload;
+        upload.add(bucket);
+        relay<test::stream> r(client, target);
+        r.limit(&upload, nullptr);
+        bool half_closed = false;
+        r.start(
+            nullptr,
+            [](error_code)
+            {
+            },
+            [&]
+            {
+                half_closed = true;
+            });
+        auto t0 = std::chrono::steady_clock::now();
+        ioc.run();
+        auto dt = std::chrono::steady_clock::now() - t0;
+        BOOST_TEST(half_closed);
+        BOOST_TEST(target.equal_write_buffers(
+            asio::buffer(data)));
+        BOOST_TEST(dt >= std::chrono::milliseconds(100));
+        BOOST_TEST(dt < std::chrono::seconds(2));
+
+    }
+
+    static
+    void
+    testRateLimitAbort()
+    {
+        // A failure cancels a paused read
+        io_context ioc;
+        test::stream client(ioc);
+        test::stream target(
+            ioc, 0, asio::error::connection_reset);
+        append(client, "data");
+        token_bucket bucket(1, 1024);
+        bucket.consume(1024);
+        rate_limit upload;
+        upload.add(bucket);
+        relay<test::stream> r(client, target);
+        r.limit(&upload, nullptr);
+        bool done = false;
+        r.start(
+            nullptr,
+            [&](error_code ec)
+            {
+                done = true;
+                BOOST_TEST_EQ(
+                    ec, asio::error::connection_reset);
+            });
+        ioc.run();
+        BOOST_TEST(done);
+        BOOST_TEST_EQ(r.bytes_to_target(), 0u);
+        BOOST_TEST_EQ(
+            asio::use_service<timer_wheel>(ioc).size(), 0u);
+    }
+
+    void
+    run()
+    {
+        testHalfClose();
+        testReadError();
+        testWriteError();
+        testOwner();
+        testTokenBucket();
+        testRateLimit();
+        testRateLimitAbort();
+    }
+};
+
+TEST_SUITE(
+    relay_test,
+    "boost.socks.relay");
+
+} // socks
+} // boost
@@ -0,0 +1,221 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "server_log.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class server_log_test
+{
+public:
+    // Return the contents of a log file and remove it
+    static
+    std::string
+    read_log(std::string const& path)
+    {
+        std::ifstream f(path);
+        std::stringstream ss;
+        ss << f.rdbuf();
+        std::remove(path.c_str());
+        return ss.str();
+    }
+
+    static
+    std::size_t
+    count(std::string const& s, std::string const& what)
+    {
+        std::size_t n = 0;
+        for (std::size_t p = s.find(what);
+             p != std::string::npos;
+             p = s.find(what, p + 1))
+            ++n;
+        return n;
+    }
+
+    static
+    void
+    testRing()
+    {
+        spsc_ring<int> r(3);
+        BOOST_TEST_EQ(r.capacity(), 4u);
+        int v = 0;
+        BOOST_TEST_NOT(r.try_pop(v));
+        for (int i = 0; i < 4; ++i)
+            BOOST_TEST(r.try_push(i));
+        BOOST_TEST_NOT(r.try_push(4));
+        BOOST_TEST(r.try_pop(v));
+        BOOST_TEST_EQ(v, 0);
+        BOOST_TEST(r.try_push(4));
+
+        // A consumer on another thread sees
+        // every value, in order
+        spsc_ring<int> q(64);
+        int const n = 100000;
+        bool ordered = true;
+        std::thread consumer(
+            [&]
+            {
+                int expected = 0;
+                int got = 0;
+                while (expected < n)
+                {
+                    if (!q.try_pop(got))
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    if (got != expected)
+                        ordered = false;
+                    ++expected;
+                }
+            });
+        for (int i = 0; i < n;)
+        {
+            if (q.try_push(i))
+                ++i;
+            else
+                std::this_thread::yield();
+        }
+        consumer.join();
+        BOOST_TEST(ordered);
+    }
+
+    static
+    void
+    testRecords()
+    {
+        std::string path = "server_log_test_records.log";
+        std::remove(path.c_str());
+        {
+            log_options opt;
+            opt.path = path;
+            server_log log(opt);
+
+            log_record a;
+            a.client = endpoint(
+                asio::ip::make_address("127.0.0.1"), 4000);
+            a.target = endpoint(
+                asio::ip::make_address("10.0.0.1"), 80);
+            a.set_host("example.com");
+            a.version = 5;
+            a.method = 0x02;
+            a.set_user("us\"er");
+            a.reply = 0;
+            a.bytes_to_target = 10;
+            a.bytes_to_client = 20;
+            log.access(a);
+
+            log_record e;
+            e.client = a.client;
+            e.what = "Cannot connect to target";
+            e.ec = asio::error::connection_refused;
+            log.error(e);
+
+            log_record w;
+            w.what = "Relay failed";
+            w.ec = asio::error::eof;
+            log.error(w);
+        }
+        std::string s = read_log(path);
+        BOOST_TEST_EQ(count(s, "\n"), 3u);
+        BOOST_TEST(s.find(
+            "\"type\":\"access\",\"client\":\"127.0.0.1:4000\","
+            "\"target\":\"10.0.0.1:80\",\"host\":\"example.com\","
+            "\"version\":5,\"method\":\"userpass\","
+            "\"user\":\"us\\\"er\",\"reply\":0,\"up\":10,\"down\":20,")
+            != std::string::npos);
+        BOOST_TEST(s.find(
+            "\"type\":\"error\",\"client\":\"127.0.0.1:4000\","
+            "\"what\":\"Cannot connect to target\"")
+            != std::string::npos);
+        BOOST_TEST(s.find(
+            "\"type\":\"warning\"") != std::string::npos);
+    }
+
+    static
+    void
+    testRateLimit()
+    {
+        std::string path = "server_log_test_rate.log";
+        std::remove(path.c_str());
+        {
+            log_options opt;
+            opt.path = path;
+            opt.error_rate = 1;
+            opt.error_burst = 2;
+            opt.access_sample = 3;
+            server_log log(opt);
+            for (int i = 0; i < 10; ++i)
+            {
+                log_record e;
+                e.what = "error";
+                e.ec = asio::error::connection_refused;
+                log.error(e);
+            }
+            std::size_t sampled = 0;
+            for (int i = 0; i < 9; ++i)
+                if (log.sample_access())
+                    ++sampled;
+            BOOST_TEST_EQ(sampled, 3u);
+        }
+        std::string s = read_log(path);
+        BOOST_TEST_EQ(count(s, "\"type\":\"error\""), 2u);
+    }
+
+    static
+    void
+    testDropped()
+    {
+        std::string path = "server_log_test_dropped.log";
+        std::remove(path.c_str());
+        {
+            // The writer is not woken up before
+            // the ring overflows
+            log_options opt;
+            opt.path = path;
+            opt.buffer_size = 4;
+            opt.flush_interval = std::chrono::seconds(10);
+            server_log log(opt);
+            for (int i = 0; i < 10; ++i)
+            {
+                log_record a;
+                log.access(a);
+            }
+            BOOST_TEST_EQ(log.dropped(), 6u);
+        }
+        std::string s = read_log(path);
+        BOOST_TEST_EQ(count(s, "\"type\":\"access\""), 4u);
+        BOOST_TEST(s.find(
+            "{\"type\":\"log\",\"dropped\":6}") != std::string::npos);
+    }
+
+    void
+    run()
+    {
+        testRing();
+        testRecords();
+        testRateLimit();
+        testDropped();
+    }
+};
+
+TEST_SUITE(
+    server_log_test,
+    "boost.socks.server_log");
+
+} // socks
+} // boost
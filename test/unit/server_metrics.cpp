@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "server_metrics.hpp"
+#include <string>
+#include <thread>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class server_metrics_test
+{
+public:
+    static
+    bool
+    contains(std::string const& s, char const* line)
+    {
+        return s.find(std::string(line) + "\n") !=
+            std::string::npos;
+    }
+
+    static
+    void
+    testBuckets()
+    {
+        using h = latency_histogram;
+        BOOST_TEST_EQ(h::index(0), 0u);
+        BOOST_TEST_EQ(h::index(31), 31u);
+        BOOST_TEST_EQ(h::index(32), 32u);
+        BOOST_TEST_EQ(h::index(33), 32u);
+        BOOST_TEST_EQ(h::index(34), 33u);
+        BOOST_TEST_EQ(h::index(63), 47u);
+        BOOST_TEST_EQ(h::index(64), 48u);
+        BOOST_TEST_EQ(h::index(std::uint64_t(-1)), h::size - 1);
+
+        // Every value falls within its bucket,
+        // which is within 1/16 of the value
+        for (std::uint64_t v = 1; v < (std::uint64_t(1) << 35); v = v * 3 + 1)
+        {
+            std::size_t i = h::index(v);
+            BOOST_TEST(h::lower_bound(i) <= v);
+            BOOST_TEST(v < h::upper_bound(i));
+            BOOST_TEST(
+                (h::upper_bound(i) - h::lower_bound(i)) * 16 <=
+                (v < 32 ? 16 : v));
+        }
+    }
+
+    static
+    void
+    testShards()
+    {
+        // Each thread records into its own shard,
+        // and the snapshot sums them
+        server_metrics m;
+        metrics_shard& s = m.local();
+        BOOST_TEST_EQ(&s, &m.local());
+        s.accepted.add();
+        std::thread t(
+            [&m, &s]
+            {
+                metrics_shard& ts = m.local();
+                BOOST_TEST_NE(&ts, &s);
+                ts.accepted.add(2);
+                ts.reply(0x05);
+                ts.reply(0x42);
+                ts.reply_v4(91);
+                ts.bytes_to_client.add(100);
+            });
+        t.join();
+
+        // Another instance has its own shards
+        server_metrics m2;
+        BOOST_TEST_NE(&m2.local(), &s);
+        BOOST_TEST_EQ(&m.local(), &s);
+
+        std::string out;
+        m.write_prometheus(out);
+        BOOST_TEST(contains(out, "socks_accepted_total 3"));
+        BOOST_TEST(contains(out,
+            "socks_replies_total{version=\"5\",code=\"5\"} 1"));
+        BOOST_TEST(contains(out,
+            "socks_replies_total{version=\"5\",code=\"other\"} 1"));
+        BOOST_TEST(contains(out,
+            "socks_replies_total{version=\"4\",code=\"91\"} 1"));
+        BOOST_TEST(contains(out,
+            "socks_relayed_bytes_total{direction=\"download\"} 100"));
+        BOOST_TEST(contains(out,
+            "# TYPE socks_handshake_duration_seconds summary"));
+    }
+
+    static
+    void
+    testQuantiles()
+    {
+        server_metrics m;
+        metrics_shard& s = m.local();
+        for (int i = 0; i < 990; ++i)
+            s.handshake.record(std::chrono::microseconds(10));
+        for (int i = 0; i < 10; ++i)
+            s.handshake.record(std::chrono::milliseconds(2));
+        std::string out;
+        m.write_prometheus(out);
+        BOOST_TEST(contains(out,
+            "socks_handshake_duration_seconds{quantile=\"0.5\"} 0.000011"));
+        BOOST_TEST(contains(out,
+            "socks_handshake_duration_seconds{quantile=\"0.99\"} 0.000011"));
+        BOOST_TEST(contains(out,
+            "socks_handshake_duration_seconds{quantile=\"0.999\"} 0.002048"));
+        BOOST_TEST(contains(out,
+            "socks_handshake_duration_seconds_sum 0.029900"));
+        BOOST_TEST(contains(out,
+            "socks_handshake_duration_seconds_count 1000"));
+        BOOST_TEST(contains(out,
+            "socks_resolve_duration_seconds{quantile=\"0.5\"} 0.000000"));
+    }
+
+    void
+    run()
+    {
+        testBuckets();
+        testShards();
+        testQuantiles();
+    }
+};
+
+TEST_SUITE(
+    server_metrics_test,
+    "boost.socks.server_metrics");
+
+} // socks
+} // boost
@@ -10,6 +10,7 @@
 
 // Test that header file is self-contained.
 #include <boost/socks.hpp>
+#include <algorithm>
 #include "test_suite.hpp"
 #include "stream.hpp"
 
@@ -19,6 +20,61 @@ namespace socks {
 class snippets_test
 {
 public:
+    // A private method sending a token
+    class token_auth
+        : public auth_mechanism
+    {
+    public:
+        explicit
+        token_auth(string_view token)
+            : token_(token)
+        {
+        }
+
+        unsigned char
+        code() const noexcept override
+        {
+            return 0x80;
+        }
+
+        std::size_t
+        prepare(
+            unsigned char* buffer,
+            std::size_t,
+            std::size_t,
+            error_code&) override
+        {
+            buffer[0] = static_cast<unsigned char>(
+                token_.size());
+            std::copy(token_.begin(), token_.end(), buffer + 1);
+            return 1 + token_.size();
+        }
+
+        std::size_t
+        reply_remaining(
+            unsigned char const*,
+            std::size_t n,
+            std::size_t) const noexcept override
+        {
+            return 1 - n;
+        }
+
+        bool
+        on_reply(
+            unsigned char const* buffer,
+            std::size_t,
+            std::size_t,
+            error_code& ec) override
+        {
+            if (buffer[0] != 0x00)
+                ec = error::access_denied;
+            return false;
+        }
+
+    private:
+        string_view token_;
+    };
+
     void
     usingConnect()
     {
@@ -74,6 +130,18 @@ public:
             ignore_unused(bound_ep);
         }
 
+        {
+            //[sync_connect_auth_methods
+            token_auth token("token");
+            auth_options opt(token);
+            opt.add(auth_options::userpass{"user_id", "password"});
+            error_code ec;
+            endpoint bound_ep = connect(
+                socket, target_ep, opt, ec);
+            //]
+            ignore_unused(bound_ep);
+        }
+
     }
 
     void
@@ -0,0 +1,185 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "source_pool.hpp"
+#include "target_connector.hpp"
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class source_pool_test
+{
+public:
+    static
+    endpoint
+    make_endpoint(char const* a, std::uint16_t port = 80)
+    {
+        return endpoint(ip::make_address(a), port);
+    }
+
+    // Return the address `p` binds a socket to
+    static
+    endpoint
+    bound(
+        asio::io_context& ioc,
+        source_pool& p,
+        endpoint const& target)
+    {
+        tcp::socket s(ioc);
+        s.open(target.protocol());
+        error_code ec;
+        p.bind(s, target, {}, ec);
+        BOOST_TEST_NOT(ec.failed());
+        return s.local_endpoint();
+    }
+
+    static
+    void
+    testSelect()
+    {
+        asio::io_context ioc;
+        endpoint t1 = make_endpoint("192.0.2.1");
+        endpoint t2 = make_endpoint("192.0.2.2");
+
+        // No addresses leaves sockets unbound
+        {
+            source_pool p{egress_options()};
+            BOOST_TEST_EQ(p.size(), 0u);
+            endpoint ep = bound(ioc, p, t1);
+            BOOST_TEST(ep.address().is_unspecified());
+            BOOST_TEST_EQ(ep.port(), 0u);
+        }
+
+        egress_options opt;
+        opt.source_addresses = {"127.0.0.2", "bogus", "127.0.0.3"};
+
+        // Addresses are taken in turn
+        {
+            source_pool p(opt);
+            BOOST_TEST_EQ(p.size(), 2u);
+            endpoint a = bound(ioc, p, t1);
+            endpoint b = bound(ioc, p, t1);
+            endpoint c = bound(ioc, p, t1);
+            BOOST_TEST(a.address() != b.address());
+            BOOST_TEST(a.address() == c.address());
+#if defined(__linux__)
+            // The port is picked at connect
+            BOOST_TEST_EQ(a.port(), 0u);
+#endif
+
+            // Targets of another family
+            // are left to the kernel
+            endpoint d = bound(ioc, p, make_endpoint("::1"));
+            BOOST_TEST(d.address().is_unspecified());
+        }
+
+        // A target always gets the same address
+        {
+            opt.hash_target = true;
+            source_pool p(opt);
+            endpoint a = bound(ioc, p, t1);
+            BOOST_TEST(bound(ioc, p, t1).address() == a.address());
+            BOOST_TEST(bound(ioc, p, t1).address() == a.address());
+            endpoint b = bound(ioc, p, t2);
+            BOOST_TEST(bound(ioc, p, t2).address() == b.address());
+        }
+
+        // The port is picked at bind
+        {
+            opt.bind_no_port = false;
+            source_pool p(opt);
+            BOOST_TEST_NE(bound(ioc, p, t1).port(), 0u);
+        }
+    }
+
+    static
+    void
+    testInterface()
+    {
+        asio::io_context ioc;
+        source_pool p{egress_options()};
+        tcp::socket s(ioc);
+        s.open(tcp::v4());
+        error_code ec;
+        p.bind(s, make_endpoint("192.0.2.1"), "nosuchif0", ec);
+        BOOST_TEST(ec.failed());
+    }
+
+    static
+    void
+    testConnector()
+    {
+        asio::io_context ioc;
+        tcp::acceptor acceptor(ioc, tcp::endpoint(
+            asio::ip::address_v4::loopback(), 0));
+        egress_options opt;
+        opt.source_addresses = {"127.0.0.2"};
+        auto sources = std::make_shared<source_pool>(opt);
+
+        // Connections leave from the source address
+        bool invoked = false;
+        target_connector::create(
+            ioc, connect_options(), socket_options(),
+            sources)->start(
+                {acceptor.local_endpoint()},
+                [&](error_code ec, tcp::socket s)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                    BOOST_TEST(s.local_endpoint().address() ==
+                        ip::make_address("127.0.0.2"));
+                });
+        tcp::socket peer(ioc);
+        acceptor.accept(peer);
+        BOOST_TEST(peer.remote_endpoint().address() ==
+            ip::make_address("127.0.0.2"));
+        ioc.run_for(std::chrono::seconds(1));
+        BOOST_TEST(invoked);
+
+        // A source address the host does
+        // not have fails the attempt
+        opt.source_addresses = {"192.0.2.1"};
+        sources = std::make_shared<source_pool>(opt);
+        invoked = false;
+        ioc.restart();
+        target_connector::create(
+            ioc, connect_options(), socket_options(),
+            sources)->start(
+                {acceptor.local_endpoint()},
+                [&](error_code ec, tcp::socket)
+                {
+                    invoked = true;
+                    BOOST_TEST(ec.failed());
+                });
+        ioc.run_for(std::chrono::seconds(1));
+        BOOST_TEST(invoked);
+    }
+
+    void
+    run()
+    {
+        testSelect();
+        testInterface();
+        testConnector();
+    }
+};
+
+TEST_SUITE(
+    source_pool_test,
+    "boost.socks.source_pool");
+
+} // socks
+} // boost
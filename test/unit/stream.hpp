@@ -9,7 +9,11 @@
 #define  BOOST_SOCKS_TEST_UNIT_STREAM_HPP
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/socket_base.hpp>
 #include <boost/socks/error.hpp>
+#include <chrono>
+#include <memory>
 #include <tuple>
 
 namespace boost {
@@ -80,29 +84,16 @@ struct bound_handler {
 private:
     template <std::size_t... I>
     void
-    apply()
+    apply(detail::index_sequence<I...>)
     {
-        return invoke_handler(std::get<I>(args_)...);
-    }
-
-    void
-    invoke_handler(Args&&... args)
-    {
-        std::move(handler_)(
-            static_cast<const Args&>(args)...);
+        std::move(handler_)(std::get<I>(args_)...);
     }
 
     template <std::size_t... I>
     void
-    apply() const
-    {
-        return invoke_handler(std::get<I>(args_)...);
-    }
-
-    void
-    invoke_handler(Args&&... args) const
+    apply(detail::index_sequence<I...>) const
     {
-        handler_(args...);
+        handler_(std::get<I>(args_)...);
     }
 
     Handler handler_;
@@ -170,6 +161,7 @@ public:
         maybe_fail(ec);
         std::size_t n = this->read_some(buffers);
         if (!ec.failed() &&
+            !wait_for_data_ &&
             n != asio::buffer_size(buffers))
             ec = asio::error::eof;
         return n;
@@ -198,6 +190,12 @@ public:
         error_code& ec)
     {
         maybe_fail(ec);
+        if (send_shutdown_)
+        {
+            if (!ec.failed())
+                ec = asio::error::broken_pipe;
+            return 0;
+        }
         return this->write_some(buffers);
     }
 
@@ -208,6 +206,19 @@ public:
         const MutableBufferSequence& buffers,
         Handler&& handler)
     {
+        if (wait_for_data_ &&
+            !closed_ &&
+            n_read_ == out_.size() &&
+            asio::buffer_size(buffers) != 0)
+        {
+            // Complete when more data is
+            // appended or the stream is closed
+            pending_.reset(new pending_read<
+                MutableBufferSequence,
+                typename std::decay<Handler>::type>(
+                    buffers, std::move(handler)));
+            return;
+        }
         error_code ec;
         std::size_t n = read_some(buffers, ec);
         asio::post(
@@ -270,6 +281,12 @@ public:
             out_.resize(n0 + length);
             std::memcpy(out_.data() + n0, data, length);
         }
+        if (pending_ && length != 0)
+        {
+            std::unique_ptr<pending_read_base> p(
+                std::move(pending_));
+            p->complete(*this, {});
+        }
     }
 
     void
@@ -278,6 +295,78 @@ public:
         in_.clear();
     }
 
+    // Make reads fail with eof once the data
+    // is consumed, as when the peer shuts down
+    // its side of the connection
+    void
+    append_eof()
+    {
+        wait_for_data_ = false;
+        if (pending_)
+        {
+            std::unique_ptr<pending_read_base> p(
+                std::move(pending_));
+            p->complete(*this, {});
+        }
+    }
+
+    // Shut down one or both directions
+    //
+    // Later writes fail with broken_pipe
+    // once sending is shut down.
+    void
+    shutdown(
+        asio::socket_base::shutdown_type what,
+        error_code& ec)
+    {
+        ec = {};
+        if (closed_)
+        {
+            ec = asio::error::bad_descriptor;
+            return;
+        }
+        if (what != asio::socket_base::shutdown_receive)
+            send_shutdown_ = true;
+    }
+
+    bool
+    send_shutdown() const noexcept
+    {
+        return send_shutdown_;
+    }
+
+    // Make async reads wait for more data
+    // instead of failing with eof
+    void
+    wait_for_data(bool v) noexcept
+    {
+        wait_for_data_ = v;
+    }
+
+    // Close the stream
+    //
+    // A pending read fails with
+    // operation_aborted and later operations
+    // fail with bad_descriptor.
+    void
+    close(error_code& ec)
+    {
+        ec = {};
+        closed_ = true;
+        if (pending_)
+        {
+            std::unique_ptr<pending_read_base> p(
+                std::move(pending_));
+            p->complete(*this, asio::error::operation_aborted);
+        }
+    }
+
+    bool
+    is_open() const noexcept
+    {
+        return !closed_;
+    }
+
     template <typename Iterator>
     bool
     equal_read_buffers(
@@ -355,10 +444,49 @@ public:
     }
 
 private:
+    struct pending_read_base
+    {
+        virtual
+        ~pending_read_base() = default;
+
+        virtual
+        void
+        complete(stream& s, error_code ec) = 0;
+    };
+
+    template <class MutableBufferSequence, class Handler>
+    struct pending_read
+        : pending_read_base
+    {
+        pending_read(
+            MutableBufferSequence const& b,
+            Handler&& h)
+            : buffers(b)
+            , handler(std::move(h))
+        {
+        }
+
+        void
+        complete(stream& s, error_code ec) override
+        {
+            std::size_t n = 0;
+            if (!ec.failed())
+                n = s.read_some(buffers, ec);
+            asio::post(
+                s.get_executor(),
+                bind_handler(std::move(handler), ec, n));
+        }
+
+        MutableBufferSequence buffers;
+        Handler handler;
+    };
+
     void
     maybe_fail(error_code& ec)
     {
-        if (fail_at_ == 0)
+        if (closed_)
+            ec = asio::error::bad_descriptor;
+        else if (fail_at_ == 0)
             ec = fail_with_;
         else
             --fail_at_;
@@ -411,7 +539,23 @@ private:
     // Failure
     std::size_t fail_at_{0};
     error_code fail_with_{};
+
+    // Waiting reads
+    bool wait_for_data_{false};
+    bool closed_{false};
+    bool send_shutdown_{false};
+    std::unique_ptr<pending_read_base> pending_;
 };
+
+// Run handlers until `f` returns true,
+// giving up after about ten seconds
+template <class F>
+void
+run_until(asio::io_context& ioc, F f)
+{
+    for (int i = 0; i < 1000 && !f(); ++i)
+        ioc.run_one_for(std::chrono::milliseconds(10));
+}
 } // test
 } // socks
 } // boost
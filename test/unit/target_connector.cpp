@@ -0,0 +1,290 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "target_connector.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class target_connector_test
+{
+public:
+    using io_context = asio::io_context;
+
+    // Accepts connections and keeps them open
+    struct listener
+    {
+        explicit
+        listener(io_context& ioc)
+            : acceptor(ioc, tcp::endpoint(
+                asio::ip::address_v4::loopback(), 0))
+        {
+            accept();
+        }
+
+        void
+        accept()
+        {
+            acceptor.async_accept(
+                [this](error_code ec, tcp::socket s)
+                {
+                    if (ec.failed())
+                        return;
+                    peers.push_back(std::move(s));
+                    accept();
+                });
+        }
+
+        endpoint
+        ep() const
+        {
+            return acceptor.local_endpoint();
+        }
+
+        tcp::acceptor acceptor;
+        std::vector<tcp::socket> peers;
+    };
+
+    // The result of a connector
+    struct result
+    {
+        void
+        operator()(error_code ec, tcp::socket s)
+        {
+            ++calls;
+            this->ec = ec;
+            socket = std::make_shared<tcp::socket>(std::move(s));
+        }
+
+        int calls = 0;
+        error_code ec;
+        std::shared_ptr<tcp::socket> socket;
+    };
+
+    // Return an endpoint nothing listens on
+    static
+    endpoint
+    refused(io_context& ioc)
+    {
+        tcp::acceptor a(ioc, tcp::endpoint(
+            asio::ip::address_v4::loopback(), 0));
+        return a.local_endpoint();
+    }
+
+    static
+    endpoint
+    at(char const* s)
+    {
+        return endpoint(asio::ip::make_address(s), 80);
+    }
+
+    static
+    void
+    testInterleave()
+    {
+        // Families alternate, starting with
+        // the first resolved one
+        std::vector<endpoint> eps{
+            at("::1"), at("::2"), at("::3"),
+            at("10.0.0.1"), at("10.0.0.2")};
+        std::vector<endpoint> r =
+            target_connector::interleave(eps);
+        BOOST_TEST_EQ(r.size(), 5u);
+        if (r.size() == 5)
+        {
+            BOOST_TEST(r[0] == at("::1"));
+            BOOST_TEST(r[1] == at("10.0.0.1"));
+            BOOST_TEST(r[2] == at("::2"));
+            BOOST_TEST(r[3] == at("10.0.0.2"));
+            BOOST_TEST(r[4] == at("::3"));
+        }
+
+        eps = {at("10.0.0.1"), at("10.0.0.2"), at("::1")};
+        r = target_connector::interleave(eps);
+        BOOST_TEST_EQ(r.size(), 3u);
+        if (r.size() == 3)
+        {
+            BOOST_TEST(r[0] == at("10.0.0.1"));
+            BOOST_TEST(r[1] == at("::1"));
+            BOOST_TEST(r[2] == at("10.0.0.2"));
+        }
+
+        // A single family keeps its order
+        eps = {at("10.0.0.3"), at("10.0.0.1"), at("10.0.0.2")};
+        BOOST_TEST(target_connector::interleave(eps) == eps);
+        BOOST_TEST(target_connector::interleave({}).empty());
+    }
+
+    static
+    void
+    testRank()
+    {
+        auto rank = &target_connector::rank;
+        BOOST_TEST_GT(
+            rank(asio::error::connection_refused),
+            rank(asio::error::host_unreachable));
+        BOOST_TEST_GT(
+            rank(asio::error::host_unreachable),
+            rank(asio::error::timed_out));
+        BOOST_TEST_GT(
+            rank(asio::error::timed_out),
+            rank(asio::error::network_unreachable));
+        BOOST_TEST_GT(
+            rank(asio::error::network_unreachable),
+            rank(asio::error::access_denied));
+        BOOST_TEST_GT(
+            rank(asio::error::access_denied),
+            rank(asio::error::operation_aborted));
+    }
+
+    static
+    void
+    testConnect()
+    {
+        io_context ioc;
+        listener l(ioc);
+        connect_options opt;
+        opt.attempt_delay = std::chrono::milliseconds(10);
+        result r;
+
+        // A refused address falls back to the next
+        auto c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({refused(ioc), l.ep()}, std::ref(r));
+        BOOST_TEST_EQ(r.calls, 0);
+        ioc.run_for(std::chrono::milliseconds(200));
+        BOOST_TEST_EQ(r.calls, 1);
+        BOOST_TEST_NOT(r.ec.failed());
+        BOOST_TEST(r.socket && r.socket->is_open());
+        error_code ec;
+        BOOST_TEST(
+            r.socket && r.socket->remote_endpoint(ec) == l.ep());
+
+        // Without addresses the handler
+        // gets host_not_found
+        result r2;
+        c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({}, std::ref(r2));
+        ioc.restart();
+        ioc.run_for(std::chrono::milliseconds(20));
+        BOOST_TEST_EQ(r2.calls, 1);
+        BOOST_TEST(r2.ec == asio::error::host_not_found);
+
+        // When every address fails, the handler
+        // gets the error ranked best
+        result r3;
+        c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({refused(ioc), refused(ioc)}, std::ref(r3));
+        ioc.restart();
+        ioc.run_for(std::chrono::milliseconds(200));
+        BOOST_TEST_EQ(r3.calls, 1);
+        BOOST_TEST(r3.ec == asio::error::connection_refused);
+    }
+
+    static
+    void
+    testAttempts()
+    {
+        // Without an attempt delay, attempts start
+        // at once, up to the limit in flight
+        io_context ioc;
+        listener a(ioc);
+        listener b(ioc);
+        connect_options opt;
+        opt.attempt_delay = std::chrono::milliseconds(0);
+        opt.max_attempts = 2;
+        result r;
+        auto c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({a.ep(), b.ep()}, std::ref(r));
+        ioc.run_for(std::chrono::milliseconds(100));
+        BOOST_TEST_EQ(r.calls, 1);
+        BOOST_TEST_NOT(r.ec.failed());
+        BOOST_TEST_EQ(a.peers.size() + b.peers.size(), 2u);
+
+        listener a2(ioc);
+        listener b2(ioc);
+        opt.max_attempts = 1;
+        result r2;
+        c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({a2.ep(), b2.ep()}, std::ref(r2));
+        ioc.restart();
+        ioc.run_for(std::chrono::milliseconds(100));
+        BOOST_TEST_EQ(r2.calls, 1);
+        BOOST_TEST_NOT(r2.ec.failed());
+        BOOST_TEST_EQ(a2.peers.size(), 1u);
+        BOOST_TEST_EQ(b2.peers.size(), 0u);
+
+        // A limit of 0 still makes one attempt
+        listener a3(ioc);
+        opt.max_attempts = 0;
+        result r3;
+        c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({a3.ep()}, std::ref(r3));
+        ioc.restart();
+        ioc.run_for(std::chrono::milliseconds(100));
+        BOOST_TEST_EQ(r3.calls, 1);
+        BOOST_TEST_NOT(r3.ec.failed());
+    }
+
+    static
+    void
+    testCancel()
+    {
+        // Cancelling stops the attempts
+        // waiting for the delay
+        io_context ioc;
+        listener l(ioc);
+        connect_options opt;
+        opt.attempt_delay = std::chrono::seconds(10);
+        result r;
+        auto c = target_connector::create(
+            ioc, opt, socket_options());
+        c->start({refused(ioc), l.ep()}, std::ref(r));
+        c->cancel();
+        ioc.run_for(std::chrono::milliseconds(100));
+        BOOST_TEST_EQ(r.calls, 1);
+        BOOST_TEST(r.ec.failed());
+        BOOST_TEST_EQ(l.peers.size(), 0u);
+
+        // Cancelling once the handler
+        // was called does nothing
+        c->cancel();
+        ioc.restart();
+        ioc.run_for(std::chrono::milliseconds(20));
+        BOOST_TEST_EQ(r.calls, 1);
+    }
+
+    void
+    run()
+    {
+        testInterleave();
+        testRank();
+        testConnect();
+        testAttempts();
+        testCancel();
+    }
+};
+
+TEST_SUITE(
+    target_connector_test,
+    "boost.socks.target_connector");
+
+} // socks
+} // boost
@@ -0,0 +1,362 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "target_pool.hpp"
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stream.hpp"
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class target_pool_test
+{
+public:
+    using io_context = asio::io_context;
+
+    // Accepts connections and keeps them open
+    struct target
+    {
+        explicit
+        target(
+            io_context& ioc,
+            tcp::endpoint ep = tcp::endpoint(
+                asio::ip::address_v4::loopback(), 0))
+            : acceptor(ioc, ep)
+        {
+            accept();
+        }
+
+        void
+        accept()
+        {
+            acceptor.async_accept(
+                [this](error_code ec, tcp::socket s)
+                {
+                    if (ec.failed())
+                        return;
+                    peers.push_back(std::move(s));
+                    accept();
+                });
+        }
+
+        hot_target
+        hot() const
+        {
+            hot_target t;
+            t.host = "127.0.0.1";
+            t.port = std::to_string(
+                acceptor.local_endpoint().port());
+            return t;
+        }
+
+        // Return the accepted end of `s`
+        std::size_t
+        peer(tcp::socket const& s) const
+        {
+            for (std::size_t i = 0; i < peers.size(); ++i)
+                if (peers[i].remote_endpoint() == s.local_endpoint())
+                    return i;
+            return peers.size();
+        }
+
+        std::vector<endpoint>
+        eps() const
+        {
+            return {acceptor.local_endpoint()};
+        }
+
+        tcp::acceptor acceptor;
+        std::vector<tcp::socket> peers;
+    };
+
+    // Accept any address
+    static
+    bool
+    any(endpoint const&)
+    {
+        return true;
+    }
+
+    static
+    std::shared_ptr<target_pool>
+    make(
+        io_context& ioc,
+        hot_target const& t,
+        std::size_t pool_size,
+        std::chrono::milliseconds idle_timeout =
+            std::chrono::seconds(30))
+    {
+        preconnect_options opt;
+        opt.pool_size = pool_size;
+        opt.idle_timeout = idle_timeout;
+        opt.retry_delay = std::chrono::milliseconds(10);
+        return std::make_shared<target_pool>(
+            ioc, t, opt, connect_options(), socket_options());
+    }
+
+    static
+    void
+    testParse()
+    {
+        // Targets are given as <host>:<port>
+        hot_target t;
+        BOOST_TEST(parse_host_port("db.internal:5432", t.host, t.port));
+        BOOST_TEST_EQ(t.host, "db.internal");
+        BOOST_TEST_EQ(t.port, "5432");
+        BOOST_TEST(parse_host_port("[::1]:80", t.host, t.port));
+        BOOST_TEST_EQ(t.host, "::1");
+        BOOST_TEST_EQ(t.port, "80");
+
+        BOOST_TEST_NOT(parse_host_port("host", t.host, t.port));
+        BOOST_TEST_NOT(parse_host_port("host:", t.host, t.port));
+        BOOST_TEST_NOT(parse_host_port(":80", t.host, t.port));
+        BOOST_TEST_NOT(parse_host_port("[]:80", t.host, t.port));
+        BOOST_TEST_NOT(parse_host_port("host:0", t.host, t.port));
+        BOOST_TEST_NOT(parse_host_port("host:65536", t.host, t.port));
+        BOOST_TEST_NOT(parse_host_port("host:80x", t.host, t.port));
+    }
+
+    static
+    void
+    testPool()
+    {
+        io_context ioc;
+        target tgt(ioc);
+        auto pool = make(ioc, tgt.hot(), 2);
+        std::uint16_t port = tgt.acceptor.local_endpoint().port();
+        BOOST_TEST(pool->matches("127.0.0.1", port));
+        BOOST_TEST_NOT(pool->matches("localhost", port));
+        BOOST_TEST_NOT(pool->matches(tgt.eps()));
+        pool->start();
+        test::run_until(ioc, [&]
+        {
+            return
+                pool->idle() == 2 &&
+                tgt.peers.size() == 2;
+        });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+        BOOST_TEST(pool->matches(tgt.eps()));
+
+        // A request takes an open connection
+        tcp::socket s(ioc);
+        BOOST_TEST(pool->take(s, any));
+        BOOST_TEST(s.is_open());
+        BOOST_TEST(s.remote_endpoint() == tgt.acceptor.local_endpoint());
+        BOOST_TEST_EQ(pool->hits(), 1u);
+        BOOST_TEST_EQ(pool->idle(), 1u);
+
+        // The connection works
+        unsigned char b = 'x';
+        asio::write(s, asio::buffer(&b, 1));
+        unsigned char r = 0;
+        std::size_t taken = tgt.peer(s);
+        BOOST_TEST_LT(taken, 2u);
+        asio::read(tgt.peers[taken], asio::buffer(&r, 1));
+        BOOST_TEST_EQ(r, 'x');
+
+        // The pool is filled again
+        test::run_until(ioc, [&]
+        {
+            return
+                pool->idle() == 2 &&
+                tgt.peers.size() == 3;
+        });
+        BOOST_TEST_EQ(tgt.peers.size(), 3u);
+
+        // Connections the target closes are dropped
+        // and only replaced on the next request
+        std::vector<std::size_t> pooled;
+        for (std::size_t i = 0; i < 3; ++i)
+            if (i != taken)
+                pooled.push_back(i);
+        error_code ec;
+        tgt.peers[pooled[0]].close(ec);
+        test::run_until(ioc, [&]{ return pool->dropped() == 1; });
+        BOOST_TEST_EQ(pool->dropped(), 1u);
+        BOOST_TEST_EQ(pool->idle(), 1u);
+
+        // A closed connection the pool did not
+        // see yet is skipped
+        tgt.peers[pooled[1]].close(ec);
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(20));
+        tcp::socket s2(ioc);
+        BOOST_TEST_NOT(pool->take(s2, any));
+        BOOST_TEST_EQ(pool->dropped(), 2u);
+        BOOST_TEST_EQ(pool->misses(), 1u);
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+
+        pool->stop();
+        BOOST_TEST_EQ(pool->idle(), 0u);
+        tcp::socket s3(ioc);
+        BOOST_TEST_NOT(pool->take(s3, any));
+        ioc.run_for(std::chrono::milliseconds(20));
+        BOOST_TEST_EQ(pool->idle(), 0u);
+    }
+
+    static
+    void
+    testAddresses()
+    {
+        // A target listening on every address, so
+        // it has one for each family of localhost
+        io_context ioc;
+        target tgt(ioc, tcp::endpoint(tcp::v6(), 0));
+        std::uint16_t port = tgt.acceptor.local_endpoint().port();
+        hot_target t;
+        t.host = "localhost";
+        t.port = std::to_string(port);
+        std::vector<endpoint> eps;
+        {
+            tcp::resolver r(ioc);
+            error_code ec;
+            for (auto const& e : r.resolve(t.host, t.port, ec))
+                eps.push_back(e.endpoint());
+        }
+        // Without an address per family, the
+        // pool has a single address
+        if (eps.size() < 2)
+            return;
+
+        auto pool = make(ioc, t, 2);
+        pool->start();
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+
+        // The pool connects to the first address,
+        // so a request for the other one takes
+        // no connection
+        std::vector<endpoint> other{eps[1]};
+        BOOST_TEST(pool->matches(other));
+        tcp::socket s(ioc);
+        BOOST_TEST_NOT(pool->take(s,
+            [&](endpoint const& ep)
+            {
+                return ep == eps[1];
+            }));
+        BOOST_TEST_NOT(s.is_open());
+        BOOST_TEST_EQ(pool->misses(), 1u);
+        BOOST_TEST_EQ(pool->idle(), 2u);
+
+        BOOST_TEST(pool->take(s,
+            [&](endpoint const& ep)
+            {
+                return ep == eps[0];
+            }));
+        BOOST_TEST(s.remote_endpoint() == eps[0]);
+        BOOST_TEST_EQ(pool->hits(), 1u);
+        pool->stop();
+    }
+
+    static
+    void
+    testExpiry()
+    {
+        io_context ioc;
+        target tgt(ioc);
+        auto pool = make(
+            ioc, tgt.hot(), 2,
+            std::chrono::milliseconds(50));
+        pool->start();
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+
+        // A target nobody asks for is not
+        // kept connected
+        test::run_until(ioc, [&]{ return pool->expired() == 2; });
+        BOOST_TEST_EQ(pool->expired(), 2u);
+        BOOST_TEST_EQ(pool->idle(), 0u);
+        ioc.run_for(std::chrono::milliseconds(100));
+        BOOST_TEST_EQ(pool->idle(), 0u);
+        BOOST_TEST_EQ(tgt.peers.size(), 2u);
+
+        // A request opens them again
+        tcp::socket s(ioc);
+        BOOST_TEST_NOT(pool->take(s, any));
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+        pool->stop();
+    }
+
+    static
+    void
+    testSet()
+    {
+        io_context ioc;
+        target tgt(ioc);
+        preconnect_options opt;
+        opt.targets.push_back(tgt.hot());
+        opt.pool_size = 1;
+        target_set set(
+            ioc, opt, connect_options(), socket_options());
+        set.start();
+        std::uint16_t port = tgt.acceptor.local_endpoint().port();
+        test::run_until(ioc, [&]{ return tgt.peers.size() == 1; });
+        ioc.run_for(std::chrono::milliseconds(10));
+
+        // Other targets are not pooled
+        tcp::socket s(ioc);
+        BOOST_TEST_NOT(set.take("localhost", port, s, any));
+        BOOST_TEST_NOT(set.take(std::vector<endpoint>{endpoint(
+            asio::ip::make_address("127.0.0.2"), port)}, s, any));
+
+        // A connection to an address the rules
+        // deny stays in the pool
+        auto deny = [](endpoint const&) { return false; };
+        BOOST_TEST_NOT(set.take("127.0.0.1", port, s, deny));
+        BOOST_TEST_NOT(set.take(tgt.eps(), s, deny));
+        BOOST_TEST_NOT(s.is_open());
+        ioc.run_for(std::chrono::milliseconds(10));
+        BOOST_TEST_EQ(tgt.peers.size(), 1u);
+
+        BOOST_TEST(set.take("127.0.0.1", port, s, any));
+        BOOST_TEST(s.is_open());
+        test::run_until(ioc, [&]{ return tgt.peers.size() == 2; });
+        ioc.run_for(std::chrono::milliseconds(10));
+        tcp::socket s2(ioc);
+        BOOST_TEST(set.take(tgt.eps(), s2, any));
+
+        std::string out;
+        set.write_prometheus(out);
+        std::string name = "127.0.0.1:" + std::to_string(port);
+        BOOST_TEST_NE(out.find(
+            "socks_preconnect_requests_total{target=\"" +
+            name + "\",pool=\"hit\"} 2\n"), std::string::npos);
+        BOOST_TEST_NE(out.find(
+            "socks_preconnect_requests_total{target=\"" +
+            name + "\",pool=\"miss\"} 2\n"), std::string::npos);
+        set.stop();
+    }
+
+    void
+    run()
+    {
+        testParse();
+        testPool();
+        testAddresses();
+        testExpiry();
+        testSet();
+    }
+};
+
+TEST_SUITE(
+    target_pool_test,
+    "boost.socks.target_pool");
+
+} // socks
+} // boost
@@ -0,0 +1,252 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include <boost/socks/timer_wheel.hpp>
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class timer_wheel_test
+{
+public:
+    using io_context = asio::io_context;
+    using milliseconds = std::chrono::milliseconds;
+
+    struct counter
+    {
+        static
+        void
+        on_expire(void* p)
+        {
+            ++static_cast<counter*>(p)->n;
+        }
+
+        int n = 0;
+    };
+
+    struct recorder
+    {
+        static
+        void
+        on_expire(void* p)
+        {
+            recorder* r = static_cast<recorder*>(p);
+            r->order->push_back(r->id);
+        }
+
+        std::vector<int>* order;
+        int id;
+    };
+
+    void
+    testTicks()
+    {
+        milliseconds r = timer_wheel::resolution();
+        BOOST_TEST_EQ(timer_wheel::to_ticks(milliseconds(0)), 1u);
+        BOOST_TEST_EQ(timer_wheel::to_ticks(milliseconds(1)), 1u);
+        BOOST_TEST_EQ(timer_wheel::to_ticks(r), 1u);
+        BOOST_TEST_EQ(timer_wheel::to_ticks(r + milliseconds(1)), 2u);
+        BOOST_TEST_EQ(timer_wheel::to_ticks(r * 300), 300u);
+    }
+
+    void
+    testExpire()
+    {
+        io_context ioc;
+        counter c;
+        deadline d(ioc.get_executor());
+        d.on_expire(&counter::on_expire, &c);
+        BOOST_TEST_NOT(d.pending());
+        d.expires_after(milliseconds(20));
+        BOOST_TEST(d.pending());
+        BOOST_TEST_EQ(d.wheel().size(), 1u);
+        auto t0 = timer_wheel::clock_type::now();
+        ioc.run();
+        BOOST_TEST_EQ(c.n, 1);
+        BOOST_TEST(d.expired());
+        BOOST_TEST_NOT(d.pending());
+        BOOST_TEST_EQ(d.wheel().size(), 0u);
+        BOOST_TEST(
+            timer_wheel::clock_type::now() - t0 >=
+            milliseconds(10));
+    }
+
+    void
+    testCancel()
+    {
+        io_context ioc;
+        counter c;
+        {
+            deadline d(ioc.get_executor());
+            d.on_expire(&counter::on_expire, &c);
+            d.expires_after(std::chrono::seconds(5));
+            d.cancel();
+            BOOST_TEST_NOT(d.pending());
+            BOOST_TEST_EQ(d.wheel().size(), 0u);
+            // an idle wheel does not keep the context running
+            auto t0 = timer_wheel::clock_type::now();
+            ioc.run();
+            BOOST_TEST(
+                timer_wheel::clock_type::now() - t0 <
+                std::chrono::seconds(1));
+            BOOST_TEST_EQ(c.n, 0);
+            BOOST_TEST_NOT(d.expired());
+        }
+
+        // destroying a deadline cancels it
+        ioc.restart();
+        {
+            deadline d(ioc.get_executor());
+            d.on_expire(&counter::on_expire, &c);
+            d.expires_after(milliseconds(20));
+        }
+        BOOST_TEST_EQ(
+            asio::use_service<timer_wheel>(ioc).size(), 0u);
+        ioc.run();
+        BOOST_TEST_EQ(c.n, 0);
+    }
+
+    void
+    testOrder()
+    {
+        io_context ioc;
+        std::vector<int> order;
+        recorder r1{&order, 1};
+        recorder r2{&order, 2};
+        recorder r3{&order, 3};
+        deadline d1(ioc.get_executor());
+        deadline d2(ioc.get_executor());
+        deadline d3(ioc.get_executor());
+        d1.on_expire(&recorder::on_expire, &r1);
+        d2.on_expire(&recorder::on_expire, &r2);
+        d3.on_expire(&recorder::on_expire, &r3);
+        d3.expires_after(milliseconds(90));
+        d1.expires_after(milliseconds(10));
+        d2.expires_after(milliseconds(200));
+        // rescheduling replaces the deadline
+        d2.expires_after(milliseconds(50));
+        ioc.run();
+        BOOST_TEST_EQ(order.size(), 3u);
+        if (order.size() == 3)
+        {
+            BOOST_TEST_EQ(order[0], 1);
+            BOOST_TEST_EQ(order[1], 2);
+            BOOST_TEST_EQ(order[2], 3);
+        }
+    }
+
+    struct rescheduler
+    {
+        static
+        void
+        on_expire(void* p)
+        {
+            rescheduler* r = static_cast<rescheduler*>(p);
+            if (++r->n < 3)
+                r->d->expires_after(milliseconds(10));
+        }
+
+        deadline* d;
+        int n = 0;
+    };
+
+    void
+    testReschedule()
+    {
+        // a deadline can be scheduled
+        // from its own callback
+        io_context ioc;
+        deadline d(ioc.get_executor());
+        rescheduler r;
+        r.d = &d;
+        d.on_expire(&rescheduler::on_expire, &r);
+        d.expires_after(milliseconds(10));
+        ioc.run();
+        BOOST_TEST_EQ(r.n, 3);
+        BOOST_TEST_EQ(d.wheel().size(), 0u);
+    }
+
+    struct stamper
+    {
+        static
+        void
+        on_expire(void* p)
+        {
+            static_cast<stamper*>(p)->t =
+                timer_wheel::clock_type::now();
+        }
+
+        timer_wheel::clock_type::time_point t;
+    };
+
+    void
+    testBusyWheel()
+    {
+        // A deadline scheduled on a wheel that did
+        // not move for a while counts from the
+        // time it was scheduled
+        io_context ioc;
+        counter c;
+        deadline d1(ioc.get_executor());
+        d1.on_expire(&counter::on_expire, &c);
+        d1.expires_after(milliseconds(600));
+        std::this_thread::sleep_for(milliseconds(300));
+        stamper s;
+        deadline d2(ioc.get_executor());
+        d2.on_expire(&stamper::on_expire, &s);
+        auto t0 = timer_wheel::clock_type::now();
+        d2.expires_after(milliseconds(200));
+        ioc.run();
+        BOOST_TEST_EQ(c.n, 1);
+        BOOST_TEST(s.t - t0 >= milliseconds(190));
+    }
+
+    void
+    testMany()
+    {
+        io_context ioc;
+        counter c;
+        std::vector<std::unique_ptr<deadline>> ds;
+        for (int i = 0; i < 1000; ++i)
+        {
+            ds.emplace_back(new deadline(ioc.get_executor()));
+            ds.back()->on_expire(&counter::on_expire, &c);
+            ds.back()->expires_after(milliseconds(i % 50));
+        }
+        // cancel every other deadline
+        for (std::size_t i = 0; i < ds.size(); i += 2)
+            ds[i]->cancel();
+        BOOST_TEST_EQ(ds[0]->wheel().size(), 500u);
+        ioc.run();
+        BOOST_TEST_EQ(c.n, 500);
+    }
+
+    void
+    run()
+    {
+        testTicks();
+        testExpire();
+        testCancel();
+        testOrder();
+        testReschedule();
+        testBusyWheel();
+        testMany();
+    }
+};
+
+TEST_SUITE(timer_wheel_test, "boost.socks.timer_wheel");
+
+} // socks
+} // boost
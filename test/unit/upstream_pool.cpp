@@ -0,0 +1,471 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "upstream_pool.hpp"
+#include <boost/asio/read.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stream.hpp"
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class upstream_pool_test
+{
+public:
+    using io_context = asio::io_context;
+    using bytes = std::vector<unsigned char>;
+
+    struct parent;
+
+    // A SOCKS4 or SOCKS5 connection to the parent,
+    // which accepts any username and password
+    struct session
+        : std::enable_shared_from_this<session>
+    {
+        session(tcp::socket s, parent& p)
+            : socket(std::move(s))
+            , owner(p)
+        {
+        }
+
+        void
+        read(std::size_t n, std::function<void()> next)
+        {
+            in.resize(n);
+            auto self = shared_from_this();
+            asio::async_read(
+                socket,
+                asio::buffer(in),
+                [self, next](error_code ec, std::size_t)
+                {
+                    if (!ec.failed())
+                        next();
+                });
+        }
+
+        void
+        write(bytes b, std::function<void()> next)
+        {
+            out = std::move(b);
+            auto self = shared_from_this();
+            asio::async_write(
+                socket,
+                asio::buffer(out),
+                [self, next](error_code ec, std::size_t)
+                {
+                    if (!ec.failed())
+                        next();
+                });
+        }
+
+        void
+        start()
+        {
+            read(1, [this]
+            {
+                if (in[0] == 0x04)
+                    return request_v4();
+                read(1, [this]
+                {
+                    read(in[0], [this]
+                    {
+                        write({0x05, 0x02}, [this]
+                        {
+                            userpass();
+                        });
+                    });
+                });
+            });
+        }
+
+        void
+        userpass()
+        {
+            read(2, [this]
+            {
+                read(in[1] + 1u, [this]
+                {
+                    read(in.back(), [this]
+                    {
+                        ++owner.authenticated;
+                        write({0x01, 0x00}, [this]
+                        {
+                            request();
+                        });
+                    });
+                });
+            });
+        }
+
+        void
+        request()
+        {
+            read(4, [this]
+            {
+                request_ = in;
+                std::size_t n =
+                    in[3] == 0x01 ? 6 :
+                    in[3] == 0x04 ? 18 : 1;
+                read(n, [this]
+                {
+                    request_.insert(
+                        request_.end(), in.begin(), in.end());
+                    if (request_[3] != 0x03)
+                        return reply();
+                    read(in[0] + 2u, [this]
+                    {
+                        request_.insert(
+                            request_.end(), in.begin(), in.end());
+                        reply();
+                    });
+                });
+            });
+        }
+
+        void
+        reply()
+        {
+            owner.requests.push_back(request_);
+            write({
+                0x05, owner.rep, 0x00, 0x01,
+                10, 0, 0, 2, 0x04, 0x38},
+                []{});
+        }
+
+        void
+        request_v4()
+        {
+            request_ = {0x04};
+            read(7, [this]
+            {
+                request_.insert(
+                    request_.end(), in.begin(), in.end());
+                auto self = shared_from_this();
+                asio::async_read_until(
+                    socket,
+                    asio::dynamic_buffer(ident),
+                    '\0',
+                    [self](error_code ec, std::size_t)
+                    {
+                        if (ec.failed())
+                            return;
+                        self->owner.requests.push_back(
+                            self->request_);
+                        self->write({
+                            0x00, 90, 0x04, 0x38,
+                            10, 0, 0, 2},
+                            []{});
+                    });
+            });
+        }
+
+        tcp::socket socket;
+        parent& owner;
+        bytes in;
+        bytes out;
+        bytes request_;
+        std::string ident;
+    };
+
+    struct parent
+    {
+        explicit
+        parent(io_context& ioc)
+            : acceptor(ioc, tcp::endpoint(
+                asio::ip::address_v4::loopback(), 0))
+        {
+            accept();
+        }
+
+        void
+        accept()
+        {
+            acceptor.async_accept(
+                [this](error_code ec, tcp::socket s)
+                {
+                    if (ec.failed())
+                        return;
+                    auto c = std::make_shared<session>(
+                        std::move(s), *this);
+                    sessions.push_back(c);
+                    c->start();
+                    accept();
+                });
+        }
+
+        upstream_proxy
+        proxy(int version = 5) const
+        {
+            upstream_proxy p;
+            p.name = "parent";
+            p.host = "127.0.0.1";
+            p.port = std::to_string(
+                acceptor.local_endpoint().port());
+            p.version = version;
+            p.user = "user";
+            if (version == 5)
+                p.password = "pass";
+            return p;
+        }
+
+        tcp::acceptor acceptor;
+        std::vector<std::shared_ptr<session>> sessions;
+        std::vector<bytes> requests;
+        std::size_t authenticated{0};
+        unsigned char rep{0x00};
+    };
+
+    static
+    std::vector<endpoint>
+    target()
+    {
+        return {endpoint(
+            asio::ip::make_address("10.0.0.1"), 80)};
+    }
+
+    static
+    std::shared_ptr<upstream_pool>
+    make(
+        io_context& ioc,
+        upstream_proxy const& p,
+        std::size_t pool_size)
+    {
+        upstream_options opt;
+        opt.pool_size = pool_size;
+        opt.retry_delay = std::chrono::milliseconds(10);
+        return std::make_shared<upstream_pool>(
+            ioc, p, opt, connect_options(), socket_options());
+    }
+
+    static
+    void
+    testParse()
+    {
+        upstream_proxy p;
+        BOOST_TEST(parse_upstream(
+            "eu=socks5://alice:s3:cr@t@proxy.example.com:1080", p));
+        BOOST_TEST_EQ(p.name, "eu");
+        BOOST_TEST_EQ(p.version, 5);
+        BOOST_TEST_EQ(p.user, "alice");
+        BOOST_TEST_EQ(p.password, "s3:cr@t");
+        BOOST_TEST_EQ(p.host, "proxy.example.com");
+        BOOST_TEST_EQ(p.port, "1080");
+
+        BOOST_TEST(parse_upstream("v6=socks5://[::1]:1080", p));
+        BOOST_TEST_EQ(p.host, "::1");
+        BOOST_TEST(p.user.empty());
+
+        BOOST_TEST(parse_upstream("old=socks4://bob@10.0.0.1:1080", p));
+        BOOST_TEST_EQ(p.version, 4);
+        BOOST_TEST_EQ(p.user, "bob");
+
+        BOOST_TEST_NOT(parse_upstream("socks5://host:1080", p));
+        BOOST_TEST_NOT(parse_upstream("=socks5://host:1080", p));
+        BOOST_TEST_NOT(parse_upstream("a=http://host:1080", p));
+        BOOST_TEST_NOT(parse_upstream("a=socks5://host", p));
+        BOOST_TEST_NOT(parse_upstream("a=socks5://host:70000", p));
+        BOOST_TEST_NOT(parse_upstream("a=socks4://u:p@host:1080", p));
+    }
+
+    static
+    void
+    testPool()
+    {
+        io_context ioc;
+        parent par(ioc);
+        auto pool = make(ioc, par.proxy(), 2);
+        pool->start();
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+        BOOST_TEST_EQ(par.authenticated, 2u);
+
+        // The request only sends the CONNECT
+        bool invoked = false;
+        pool->connect(target(),
+            [&](error_code ec, tcp::socket s)
+            {
+                invoked = true;
+                BOOST_TEST_NOT(ec.failed());
+                BOOST_TEST(s.is_open());
+            });
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+        BOOST_TEST_EQ(pool->hits(), 1u);
+        BOOST_TEST_EQ(pool->misses(), 0u);
+        BOOST_TEST_EQ(par.requests.size(), 1u);
+        BOOST_TEST((par.requests[0] == bytes{
+            0x05, 0x01, 0x00, 0x01, 10, 0, 0, 1, 0x00, 80}));
+
+        // The pool is filled again
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        BOOST_TEST_EQ(par.authenticated, 3u);
+
+        // Names are resolved by the parent
+        invoked = false;
+        pool->connect("example.com", 443,
+            [&](error_code ec, tcp::socket)
+            {
+                invoked = true;
+                BOOST_TEST_NOT(ec.failed());
+            });
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+        BOOST_TEST_EQ(par.requests.back().size(), 7u + 11u);
+        BOOST_TEST_EQ(par.requests.back()[3], 0x03);
+
+        // Connections the parent closes are replaced
+        test::run_until(ioc, [&]{ return pool->idle() == 2; });
+        std::size_t sessions = par.sessions.size();
+        par.sessions.back()->socket.close();
+        test::run_until(ioc, [&]{ return pool->dropped() == 1; });
+        BOOST_TEST_EQ(pool->dropped(), 1u);
+        test::run_until(ioc, [&]
+        {
+            return
+                par.sessions.size() == sessions + 1 &&
+                pool->idle() == 2;
+        });
+        BOOST_TEST_EQ(pool->idle(), 2u);
+
+        pool->stop();
+        BOOST_TEST_EQ(pool->idle(), 0u);
+    }
+
+    static
+    void
+    testMiss()
+    {
+        io_context ioc;
+        parent par(ioc);
+        auto pool = make(ioc, par.proxy(), 0);
+        pool->start();
+
+        // The whole handshake runs
+        // on a new connection
+        bool invoked = false;
+        pool->connect(target(),
+            [&](error_code ec, tcp::socket)
+            {
+                invoked = true;
+                BOOST_TEST_NOT(ec.failed());
+            });
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+        BOOST_TEST_EQ(pool->misses(), 1u);
+        BOOST_TEST_EQ(par.authenticated, 1u);
+        BOOST_TEST_EQ(pool->idle(), 0u);
+
+        // The reply of the parent is passed on
+        par.rep = 0x05;
+        invoked = false;
+        pool->connect(target(),
+            [&](error_code ec, tcp::socket)
+            {
+                invoked = true;
+                BOOST_TEST_EQ(ec, error::connection_refused);
+                BOOST_TEST(to_reply_code(ec) ==
+                    reply_code::connection_refused);
+            });
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+    }
+
+    static
+    void
+    testSocks4()
+    {
+        io_context ioc;
+        parent par(ioc);
+        auto pool = make(ioc, par.proxy(4), 1);
+        BOOST_TEST_NOT(pool->forwards_names());
+        pool->start();
+        test::run_until(ioc, [&]{ return pool->idle() == 1; });
+
+        // IPv6 targets cannot be forwarded
+        bool invoked = false;
+        pool->connect(
+            {endpoint(asio::ip::make_address("::1"), 80)},
+            [&](error_code ec, tcp::socket)
+            {
+                invoked = true;
+                BOOST_TEST_EQ(ec,
+                    asio::error::address_family_not_supported);
+            });
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+
+        invoked = false;
+        pool->connect(target(),
+            [&](error_code ec, tcp::socket)
+            {
+                invoked = true;
+                BOOST_TEST_NOT(ec.failed());
+            });
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+        BOOST_TEST_EQ(pool->hits(), 1u);
+        BOOST_TEST_EQ(par.authenticated, 0u);
+        BOOST_TEST((par.requests.back() == bytes{
+            0x04, 0x01, 0x00, 80, 10, 0, 0, 1}));
+        pool->stop();
+    }
+
+    static
+    void
+    testCancel()
+    {
+        io_context ioc;
+        upstream_proxy p;
+        {
+            // Take a free port and release it
+            parent par(ioc);
+            p = par.proxy();
+        }
+        auto pool = make(ioc, p, 1);
+        pool->start();
+        bool invoked = false;
+        auto r = pool->connect(target(),
+            [&](error_code ec, tcp::socket)
+            {
+                invoked = true;
+                BOOST_TEST_EQ(ec, asio::error::operation_aborted);
+            });
+        r->cancel();
+        test::run_until(ioc, [&]{ return invoked; });
+        BOOST_TEST(invoked);
+        BOOST_TEST_EQ(pool->idle(), 0u);
+        pool->stop();
+        ioc.run();
+    }
+
+    void
+    run()
+    {
+        testParse();
+        testPool();
+        testMiss();
+        testSocks4();
+        testCancel();
+    }
+};
+
+TEST_SUITE(
+    upstream_pool_test,
+    "boost.socks.upstream_pool");
+
+} // socks
+} // boost
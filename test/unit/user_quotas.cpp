@@ -0,0 +1,230 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "user_quotas.hpp"
+#include <thread>
+#include <vector>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class user_quotas_test
+{
+public:
+    static
+    std::shared_ptr<user_quotas>
+    make(
+        asio::io_context& ioc,
+        quota_options const& opt)
+    {
+        return std::make_shared<user_quotas>(ioc, opt);
+    }
+
+    static
+    void
+    testTunnels()
+    {
+        asio::io_context ioc;
+        quota_options opt;
+        opt.max_tunnels = 2;
+        auto q = make(ioc, opt);
+        BOOST_TEST(q->limited());
+
+        quota_ticket a;
+        quota_ticket b;
+        quota_ticket c;
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        BOOST_TEST(static_cast<bool>(a));
+        BOOST_TEST(q->open("alice", b) == quota_limit::none);
+        BOOST_TEST(q->open("alice", c) == quota_limit::tunnels);
+        BOOST_TEST_NOT(static_cast<bool>(c));
+
+        // Users have their own quotas
+        BOOST_TEST(q->open("bob", c) == quota_limit::none);
+        c.close(0);
+
+        // Closed and destroyed tickets
+        // give the tunnel back
+        a.close(0);
+        BOOST_TEST_NOT(static_cast<bool>(a));
+        BOOST_TEST(q->open("alice", c) == quota_limit::none);
+        {
+            quota_ticket moved(std::move(b));
+            BOOST_TEST_NOT(static_cast<bool>(b));
+        }
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        BOOST_TEST(q->open("alice", b) == quota_limit::tunnels);
+
+        // The counts survive a merge
+        q->sync();
+        BOOST_TEST_EQ(q->totals()->users.at("alice").tunnels, 2);
+        BOOST_TEST(q->open("alice", b) == quota_limit::tunnels);
+
+        // Users back to no usage are forgotten
+        a.close(0);
+        c.close(0);
+        q->sync();
+        BOOST_TEST(q->totals()->users.empty());
+    }
+
+    static
+    void
+    testShards()
+    {
+        asio::io_context ioc;
+        quota_options opt;
+        opt.max_tunnels = 2;
+        auto q = make(ioc, opt);
+
+        // Tunnels of another thread are
+        // only seen once they are merged
+        std::vector<quota_ticket> other(2);
+        std::thread t(
+            [&]
+            {
+                for (auto& k : other)
+                    BOOST_TEST(q->open("alice", k) == quota_limit::none);
+            });
+        t.join();
+        quota_ticket a;
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        a.close(0);
+        q->sync();
+        BOOST_TEST(q->open("alice", a) == quota_limit::tunnels);
+
+        // Tunnels can close on another thread
+        other[0].close(0);
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        q->sync();
+        BOOST_TEST_EQ(q->totals()->users.at("alice").tunnels, 2);
+    }
+
+    static
+    void
+    testConnectRate()
+    {
+        asio::io_context ioc;
+        quota_options opt;
+        opt.connect_rate = 1;
+        opt.connect_burst = 2;
+        auto q = make(ioc, opt);
+        quota_ticket a;
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        BOOST_TEST(q->open("alice", a) == quota_limit::connect_rate);
+        BOOST_TEST(q->open("bob", a) == quota_limit::none);
+
+        // Closing does not give the tokens back
+        a.close(0);
+        q->sync();
+        BOOST_TEST(q->open("alice", a) == quota_limit::connect_rate);
+    }
+
+    static
+    void
+    testBytes()
+    {
+        asio::io_context ioc;
+        quota_options opt;
+        opt.max_bytes = 100;
+        opt.window = std::chrono::milliseconds(20);
+        auto q = make(ioc, opt);
+        quota_ticket a;
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        a.close(60);
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        a.close(40);
+        BOOST_TEST(q->open("alice", a) == quota_limit::bytes);
+        q->sync();
+        BOOST_TEST_EQ(q->totals()->users.at("alice").bytes, 100u);
+        BOOST_TEST(q->open("alice", a) == quota_limit::bytes);
+
+        // The next window forgets the bytes
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        q->sync();
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+    }
+
+    static
+    void
+    testTimer()
+    {
+        asio::io_context ioc;
+        quota_options opt;
+        opt.max_tunnels = 1;
+        opt.sync_interval = std::chrono::milliseconds(1);
+        auto q = make(ioc, opt);
+        quota_ticket a;
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        auto t = q->totals();
+        q->start();
+        for (int i = 0; i < 1000 && q->totals() == t; ++i)
+            ioc.run_one_for(std::chrono::milliseconds(10));
+        q->stop();
+        ioc.run();
+        BOOST_TEST_EQ(q->totals()->users.at("alice").tunnels, 1);
+
+        BOOST_TEST_NOT(make(ioc, quota_options())->limited());
+    }
+
+    static
+    void
+    testNoTimer()
+    {
+        // Without the timer, checks merge
+        // the counters themselves
+        asio::io_context ioc;
+        quota_options opt;
+        opt.connect_rate = 100;
+        opt.connect_burst = 1;
+        opt.sync_interval = std::chrono::milliseconds(0);
+        auto q = make(ioc, opt);
+        q->start();
+        BOOST_TEST_EQ(ioc.run_for(
+            std::chrono::milliseconds(1)), 0u);
+
+        // Tokens come back at the rate
+        quota_ticket a;
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        BOOST_TEST(q->open("alice", a) == quota_limit::connect_rate);
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+
+        // The next window forgets the bytes
+        opt.connect_rate = 0;
+        opt.max_bytes = 100;
+        opt.window = std::chrono::milliseconds(100);
+        q = make(ioc, opt);
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+        a.close(100);
+        BOOST_TEST(q->open("alice", a) == quota_limit::bytes);
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        BOOST_TEST(q->open("alice", a) == quota_limit::none);
+    }
+
+    void
+    run()
+    {
+        testTunnels();
+        testShards();
+        testConnectRate();
+        testBytes();
+        testTimer();
+        testNoTimer();
+    }
+};
+
+TEST_SUITE(
+    user_quotas_test,
+    "boost.socks.user_quotas");
+
+} // socks
+} // boost
@@ -0,0 +1,163 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include <boost/socks/userpass_credentials.hpp>
+#include <boost/socks/connect.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "stream.hpp"
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class userpass_credentials_test
+{
+public:
+    using bytes = std::vector<unsigned char>;
+
+    static
+    bytes
+    encoded(userpass_credentials const& c)
+    {
+        return bytes(c.data(), c.data() + c.size());
+    }
+
+    static
+    void
+    testEncode()
+    {
+        userpass_credentials e;
+        BOOST_TEST_EQ(e.user(), "");
+        BOOST_TEST_EQ(e.pass(), "");
+        BOOST_TEST((encoded(e) == bytes{0x01, 0x00, 0x00}));
+
+        userpass_credentials c("username", "pw");
+        BOOST_TEST_EQ(c.user(), "username");
+        BOOST_TEST_EQ(c.pass(), "pw");
+        BOOST_TEST((encoded(c) == bytes{
+            0x01, 8, 'u', 's', 'e', 'r', 'n', 'a', 'm', 'e',
+            2, 'p', 'w'}));
+
+        // The encoding matches the request
+        // written from views
+        auth_options a = auth_options::userpass{"username", "pw"};
+        bytes r(513);
+        r.resize(detail::prepare_userpass_request(
+            r.data(), r.size(), a));
+        BOOST_TEST(encoded(c) == r);
+
+        // Copies own their strings
+        userpass_credentials d(c);
+        c = userpass_credentials("other", "secret");
+        BOOST_TEST_EQ(d.user(), "username");
+        BOOST_TEST_EQ(d.pass(), "pw");
+        BOOST_TEST_EQ(c.user(), "other");
+
+        // The largest credentials are inline
+        std::string u(255, 'u');
+        std::string p(255, 'p');
+        userpass_credentials m(u, p);
+        BOOST_TEST_EQ(m.size(), 513u);
+        BOOST_TEST_EQ(m.user(), u);
+        BOOST_TEST_EQ(m.pass(), p);
+
+        BOOST_TEST_THROWS(
+            userpass_credentials(std::string(256, 'u'), p),
+            std::length_error);
+        BOOST_TEST_THROWS(
+            userpass_credentials(u, std::string(256, 'p')),
+            std::length_error);
+    }
+
+    static
+    void
+    testOptions()
+    {
+        auto c = std::make_shared<
+            userpass_credentials const>("user", "pass");
+        auth_options a(c);
+        BOOST_TEST(a.is_userpass);
+        BOOST_TEST_EQ(a.code(), 0x02);
+        BOOST_TEST_EQ(a.credentials(), c);
+        BOOST_TEST_EQ(a.user, "user");
+        BOOST_TEST_EQ(a.pass, "pass");
+
+        bytes r(513);
+        r.resize(detail::prepare_userpass_request(
+            r.data(), r.size(), a));
+        BOOST_TEST(r == encoded(*c));
+
+        // Views replace the credentials
+        a.add(auth_options::userpass{"u", "p"});
+        BOOST_TEST_NOT(a.credentials());
+        BOOST_TEST_EQ(c.use_count(), 1);
+    }
+
+    static
+    void
+    testAsyncConnect()
+    {
+        // The strings the credentials were made
+        // of do not outlive the initiation
+        asio::io_context ioc;
+        test::stream s(ioc);
+        bytes r1 = {0x05, 0x02};
+        bytes r2 = {0x01, 0x00};
+        bytes r3 = {
+            0x05, 0x00, 0x00, 0x01,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        s.reset_read(r1.data(), r1.size());
+        s.append_read(r2.data(), r2.size());
+        s.append_read(r3.data(), r3.size());
+        bool invoked = false;
+        {
+            std::string user = "user";
+            std::string pass = "pass";
+            auth_options a(
+                std::make_shared<userpass_credentials const>(
+                    user, pass));
+            async_connect(
+                s, endpoint{}, a,
+                [&](error_code ec, endpoint)
+                {
+                    invoked = true;
+                    BOOST_TEST_NOT(ec.failed());
+                });
+            user.assign(4, 'x');
+            pass.assign(4, 'x');
+        }
+        ioc.run();
+        BOOST_TEST(invoked);
+        BOOST_TEST(s.equal_write_buffers(std::vector<asio::const_buffer>{
+            asio::buffer(bytes{0x05, 0x02, 0x00, 0x02}),
+            asio::buffer(bytes{
+                0x01, 4, 'u', 's', 'e', 'r', 4, 'p', 'a', 's', 's'}),
+            asio::buffer(bytes{
+                0x05, 0x01, 0x00, 0x01,
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00})}));
+    }
+
+    void
+    run()
+    {
+        testEncode();
+        testOptions();
+        testAsyncConnect();
+    }
+};
+
+TEST_SUITE(
+    userpass_credentials_test,
+    "boost.socks.userpass_credentials");
+
+} // socks
+} // boost
@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2022 Alan de Freitas (alandefreitas@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/alandefreitas/socks_proto
+//
+
+// Test that header file is self-contained.
+#include "verify_pool.hpp"
+#include <atomic>
+#include <future>
+#include <thread>
+#include "test_suite.hpp"
+
+namespace boost {
+namespace socks {
+
+class verify_pool_test
+{
+public:
+    static
+    void
+    testPost()
+    {
+        // Tasks run on the workers
+        verify_pool p(2, 0);
+        BOOST_TEST_EQ(p.threads(), 2u);
+        std::promise<std::thread::id> id;
+        BOOST_TEST(p.try_post(
+            [&id]
+            {
+                id.set_value(std::this_thread::get_id());
+            }));
+        BOOST_TEST(id.get_future().get() != std::this_thread::get_id());
+
+        std::atomic<int> n{0};
+        std::promise<void> done;
+        for (int i = 0; i < 100; ++i)
+            BOOST_TEST(p.try_post(
+                [&n, &done]
+                {
+                    if (++n == 100)
+                        done.set_value();
+                }));
+        done.get_future().wait();
+        BOOST_TEST_EQ(n.load(), 100);
+        BOOST_TEST_EQ(p.rejected(), 0u);
+    }
+
+    static
+    void
+    testQueueLimit()
+    {
+        std::promise<void> started;
+        std::promise<void> release;
+        std::shared_future<void> released =
+            release.get_future().share();
+        std::atomic<int> ran{0};
+        {
+            verify_pool p(1, 2);
+
+            // Keep the worker busy
+            BOOST_TEST(p.try_post(
+                [&started, released]
+                {
+                    started.set_value();
+                    released.wait();
+                }));
+            started.get_future().wait();
+
+            BOOST_TEST(p.try_post([&ran]{ ++ran; }));
+            BOOST_TEST(p.try_post([&ran]{ ++ran; }));
+            BOOST_TEST_EQ(p.queued(), 2u);
+            BOOST_TEST_NOT(p.try_post([&ran]{ ++ran; }));
+            BOOST_TEST_NOT(p.try_post([&ran]{ ++ran; }));
+            BOOST_TEST_EQ(p.rejected(), 2u);
+
+            // Queued tasks the workers did not
+            // take are dropped by the destructor
+            release.set_value();
+        }
+        BOOST_TEST(ran.load() <= 2);
+    }
+
+    void
+    run()
+    {
+        testPost();
+        testQueueLimit();
+    }
+};
+
+TEST_SUITE(
+    verify_pool_test,
+    "boost.socks.verify_pool");
+
+} // socks
+} // boost